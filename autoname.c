@@ -0,0 +1,815 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "secmap.h"
+#include "elf.h"
+#include "autoname.h"
+
+// Naming imports by hand is tedious, but the headers already say what
+// everything is. The tables are walked in place through a small cache of file
+// pages, so a table with tens of thousands of entries is only a few reads,
+// and the names are collected first so that I can throw away duplicates
+// before making one gate call per name.
+//
+// If two names land on the same offset the export wins, then the import, then
+// the symbol. If two offsets want the same name, the later ones get a _2, _3
+// and so on, the same as signature matches.
+
+#define AUTONAME_PAGE_SIZE      (64 * 1024)
+#define AUTONAME_PAGE_COUNT     16
+
+// Hiew doesn't like very long names, and these are usually C++ noise.
+#define AUTONAME_MAX_NAME       128
+
+// Enough for the NT headers or a name that crosses a page.
+#define AUTONAME_SCRATCH_SIZE   512
+
+// Tables bigger than this are probably garbage.
+#define AUTONAME_MAX_ENTRIES    (1024 * 1024)
+#define AUTONAME_MAX_NAMES      (4 * 1024 * 1024)
+
+// Lower wins when two names are for the same offset.
+#define PRIORITY_EXPORT         0
+#define PRIORITY_IMPORT         1
+#define PRIORITY_DYNSYM         2
+#define PRIORITY_SYMTAB         3
+
+// This is only in newer SDKs, and the old Visual C++ 6 format uses addresses
+// instead of RVAs unless the first bit of Attributes is set.
+typedef struct _DELAY_DESCRIPTOR {
+    DWORD Attributes;
+    DWORD DllName;
+    DWORD ModuleHandle;
+    DWORD ImportAddressTable;
+    DWORD ImportNameTable;
+    DWORD BoundImportAddressTable;
+    DWORD UnloadInformationTable;
+    DWORD TimeDateStamp;
+} DELAY_DESCRIPTOR, *PDELAY_DESCRIPTOR;
+
+#define DELAY_ATTRIBUTE_RVA     1
+
+typedef struct _IMAGE_PAGE {
+    HEM_QWORD Offset;
+    DWORD Length;
+    DWORD LastUsed;
+    BOOL Valid;
+    BYTE Data[AUTONAME_PAGE_SIZE];
+} IMAGE_PAGE, *PIMAGE_PAGE;
+
+typedef struct _AUTONAME {
+    HEM_QWORD Offset;
+    DWORD Name;             // Into the pool
+    DWORD Final;            // The name to use, with a number if it's repeated
+    DWORD Priority;
+    DWORD Order;            // So that sorting is stable
+} AUTONAME, *PAUTONAME;
+
+static struct {
+    PIMAGE_PAGE Pages;
+    DWORD Clock;
+    HEM_QWORD FileLength;
+    BYTE Scratch[AUTONAME_SCRATCH_SIZE];
+    PSECTION_MAP Map;
+    ULONGLONG ImageBase;
+    PJOB Job;
+} Image;
+
+static struct {
+    PAUTONAME Names;
+    DWORD Count;
+    DWORD Max;
+    PCHAR Pool;
+    SIZE_T PoolUsed;
+    SIZE_T PoolSize;
+} Batch;
+
+// Find the page that holds Offset, reading it if it isn't cached.
+static PIMAGE_PAGE GetPage(HEM_QWORD Offset)
+{
+    HEM_QWORD Base = Offset - Offset % AUTONAME_PAGE_SIZE;
+    PIMAGE_PAGE Oldest = &Image.Pages[0];
+
+    for (DWORD i = 0; i < AUTONAME_PAGE_COUNT; i++) {
+        PIMAGE_PAGE Page = &Image.Pages[i];
+
+        if (Page->Valid && Page->Offset == Base) {
+            Page->LastUsed = ++Image.Clock;
+            return Page;
+        }
+
+        if (!Page->Valid || Page->LastUsed < Oldest->LastUsed)
+            Oldest = Page;
+    }
+
+    Oldest->Valid = FALSE;
+    Oldest->Offset = Base;
+    Oldest->Length = (DWORD) min(AUTONAME_PAGE_SIZE, Image.FileLength - Base);
+
+    if (HiewGate_FileRead(Base, Oldest->Length, Oldest->Data) != (int) Oldest->Length)
+        return NULL;
+
+    Oldest->Valid = TRUE;
+    Oldest->LastUsed = ++Image.Clock;
+    return Oldest;
+}
+
+// Returns a pointer to Size bytes at Offset, which is only good until the next
+// read. Usually that's straight into a cached page, the scratch buffer is only
+// needed when the bytes cross into the next one.
+static const VOID *ReadImage(HEM_QWORD Offset, DWORD Size)
+{
+    PIMAGE_PAGE Page;
+    DWORD Done;
+
+    if (Offset >= Image.FileLength || Size > Image.FileLength - Offset || Size > sizeof Image.Scratch)
+        return NULL;
+
+    if ((Page = GetPage(Offset)) == NULL)
+        return NULL;
+
+    if (Offset - Page->Offset + Size <= Page->Length)
+        return Page->Data + (Offset - Page->Offset);
+
+    for (Done = 0; Done < Size; Done += Page->Length - (DWORD) (Offset + Done - Page->Offset)) {
+        DWORD Start;
+
+        if ((Page = GetPage(Offset + Done)) == NULL)
+            return NULL;
+
+        Start = (DWORD) (Offset + Done - Page->Offset);
+
+        CopyMemory(Image.Scratch + Done, Page->Data + Start, min(Size - Done, Page->Length - Start));
+    }
+
+    return Image.Scratch;
+}
+
+// Same thing for a string, it's cut short at AUTONAME_MAX_NAME or the end of
+// the file.
+static LPCSTR ReadImageString(HEM_QWORD Offset)
+{
+    PIMAGE_PAGE Page;
+    DWORD Start;
+    DWORD Length = 0;
+
+    if (Offset >= Image.FileLength || (Page = GetPage(Offset)) == NULL)
+        return NULL;
+
+    Start = (DWORD) (Offset - Page->Offset);
+
+    if (memchr(Page->Data + Start, 0, min(Page->Length - Start, AUTONAME_MAX_NAME)))
+        return (LPCSTR) Page->Data + Start;
+
+    while (Length < AUTONAME_MAX_NAME && Offset + Length < Image.FileLength) {
+        BYTE Byte;
+
+        if ((Page = GetPage(Offset + Length)) == NULL)
+            return NULL;
+
+        Byte = Page->Data[Offset + Length - Page->Offset];
+
+        if (Byte == 0)
+            break;
+
+        Image.Scratch[Length++] = Byte;
+    }
+
+    Image.Scratch[Length] = 0;
+    return (LPCSTR) Image.Scratch;
+}
+
+static BOOL RvaToOffset(DWORD Rva, HEM_QWORD *Offset)
+{
+    return AddressToOffset(Image.Map, Image.ImageBase + Rva, Offset);
+}
+
+// Remember a name for later, returns FALSE if there's no more room or the user
+// wants to stop.
+static BOOL AddName(HEM_QWORD Offset, LPCSTR Prefix, LPCSTR Name, DWORD Priority)
+{
+    CHAR Buffer[AUTONAME_MAX_NAME + 1];
+    SIZE_T Length;
+    PAUTONAME Entry;
+
+    if (!UpdateJob(Image.Job, Batch.Count))
+        return FALSE;
+
+    if (Name == NULL || *Name == 0)
+        return TRUE;
+
+    if (Prefix) {
+        snprintf(Buffer, sizeof Buffer, "%s.%s", Prefix, Name);
+    } else {
+        snprintf(Buffer, sizeof Buffer, "%s", Name);
+    }
+
+    Length = strlen(Buffer) + 1;
+
+    if (Batch.Count == AUTONAME_MAX_NAMES)
+        return FALSE;
+
+    if (Batch.Count == Batch.Max) {
+        DWORD Max = Batch.Max ? Batch.Max * 2 : 4096;
+        PVOID Names = realloc(Batch.Names, Max * sizeof(AUTONAME));
+
+        if (Names == NULL)
+            return FALSE;
+
+        Batch.Names = Names;
+        Batch.Max = Max;
+    }
+
+    if (Batch.PoolUsed + Length > Batch.PoolSize) {
+        SIZE_T Size = max(Batch.PoolSize * 2, 64 * 1024);
+        PVOID Pool = realloc(Batch.Pool, Size);
+
+        if (Pool == NULL)
+            return FALSE;
+
+        Batch.Pool = Pool;
+        Batch.PoolSize = Size;
+    }
+
+    CopyMemory(Batch.Pool + Batch.PoolUsed, Buffer, Length);
+
+    Entry = &Batch.Names[Batch.Count];
+    Entry->Offset = Offset;
+    Entry->Name = (DWORD) Batch.PoolUsed;
+    Entry->Final = Entry->Name;
+    Entry->Priority = Priority;
+    Entry->Order = Batch.Count++;
+
+    Batch.PoolUsed += Length;
+    return TRUE;
+}
+
+// The module name without the extension, like Hiew shows it.
+static VOID GetModuleName(DWORD Rva, PCHAR Module, SIZE_T Size)
+{
+    HEM_QWORD Offset;
+    LPCSTR Name = NULL;
+    PCHAR Dot;
+
+    if (RvaToOffset(Rva, &Offset))
+        Name = ReadImageString(Offset);
+
+    snprintf(Module, Size, "%s", Name && *Name ? Name : "unknown");
+
+    if ((Dot = strrchr(Module, '.')) && Dot != Module)
+        *Dot = 0;
+}
+
+// Name every slot in an import address table, the names come from the lookup
+// table if there is one, because the IAT might be bound.
+static BOOL AddImportTable(LPCSTR Module, DWORD AddressTable, DWORD NameTable)
+{
+    DWORD ThunkSize = Image.Map->Is64 ? sizeof(ULONGLONG) : sizeof(DWORD);
+    CHAR Ordinal[32];
+
+    if (NameTable == 0)
+        NameTable = AddressTable;
+
+    for (DWORD i = 0; i < AUTONAME_MAX_ENTRIES; i++) {
+        HEM_QWORD ThunkOffset;
+        HEM_QWORD SlotOffset;
+        const VOID *Thunk;
+        ULONGLONG Value;
+        LPCSTR Name = NULL;
+
+        if (!RvaToOffset(NameTable + i * ThunkSize, &ThunkOffset))
+            break;
+
+        if ((Thunk = ReadImage(ThunkOffset, ThunkSize)) == NULL)
+            break;
+
+        Value = Image.Map->Is64 ? *(UNALIGNED ULONGLONG *) Thunk : *(UNALIGNED DWORD *) Thunk;
+
+        if (Value == 0)
+            break;
+
+        if (!RvaToOffset(AddressTable + i * ThunkSize, &SlotOffset))
+            continue;
+
+        if (Image.Map->Is64 ? (Value & IMAGE_ORDINAL_FLAG64) : (Value & IMAGE_ORDINAL_FLAG32)) {
+            snprintf(Ordinal, sizeof Ordinal, "Ordinal%u", (DWORD) (Value & 0xFFFF));
+            Name = Ordinal;
+        } else {
+            HEM_QWORD NameOffset;
+
+            // Skip the hint.
+            if (RvaToOffset((DWORD) Value + sizeof(WORD), &NameOffset))
+                Name = ReadImageString(NameOffset);
+        }
+
+        if (!AddName(SlotOffset, Module, Name, PRIORITY_IMPORT))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static BOOL AddImports(PIMAGE_DATA_DIRECTORY Directory)
+{
+    CHAR Module[AUTONAME_MAX_NAME + 1];
+
+    for (DWORD i = 0; i < AUTONAME_MAX_ENTRIES; i++) {
+        IMAGE_IMPORT_DESCRIPTOR Descriptor;
+        const VOID *Data;
+        HEM_QWORD Offset;
+
+        if (!RvaToOffset(Directory->VirtualAddress + i * sizeof Descriptor, &Offset))
+            break;
+
+        if ((Data = ReadImage(Offset, sizeof Descriptor)) == NULL)
+            break;
+
+        CopyMemory(&Descriptor, Data, sizeof Descriptor);
+
+        if (Descriptor.Name == 0 || Descriptor.FirstThunk == 0)
+            break;
+
+        GetModuleName(Descriptor.Name, Module, sizeof Module);
+
+        if (!AddImportTable(Module, Descriptor.FirstThunk, Descriptor.OriginalFirstThunk))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static BOOL AddDelayImports(PIMAGE_DATA_DIRECTORY Directory)
+{
+    CHAR Module[AUTONAME_MAX_NAME + 1];
+
+    for (DWORD i = 0; i < AUTONAME_MAX_ENTRIES; i++) {
+        DELAY_DESCRIPTOR Descriptor;
+        const VOID *Data;
+        HEM_QWORD Offset;
+
+        if (!RvaToOffset(Directory->VirtualAddress + i * sizeof Descriptor, &Offset))
+            break;
+
+        if ((Data = ReadImage(Offset, sizeof Descriptor)) == NULL)
+            break;
+
+        CopyMemory(&Descriptor, Data, sizeof Descriptor);
+
+        if (Descriptor.DllName == 0 || Descriptor.ImportAddressTable == 0)
+            break;
+
+        if (!(Descriptor.Attributes & DELAY_ATTRIBUTE_RVA)) {
+            DWORD Base = (DWORD) Image.ImageBase;
+
+            Descriptor.DllName -= Base;
+            Descriptor.ImportAddressTable -= Base;
+            Descriptor.ImportNameTable -= Descriptor.ImportNameTable ? Base : 0;
+        }
+
+        GetModuleName(Descriptor.DllName, Module, sizeof Module);
+
+        if (!AddImportTable(Module, Descriptor.ImportAddressTable, Descriptor.ImportNameTable))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static BOOL AddExports(PIMAGE_DATA_DIRECTORY Directory)
+{
+    IMAGE_EXPORT_DIRECTORY Exports;
+    const VOID *Data;
+    HEM_QWORD Offset;
+    PBYTE Named;
+    BOOL Result = TRUE;
+    CHAR Ordinal[32];
+
+    if (!RvaToOffset(Directory->VirtualAddress, &Offset))
+        return TRUE;
+
+    if ((Data = ReadImage(Offset, sizeof Exports)) == NULL)
+        return TRUE;
+
+    CopyMemory(&Exports, Data, sizeof Exports);
+
+    if (Exports.NumberOfFunctions > AUTONAME_MAX_ENTRIES || Exports.NumberOfNames > AUTONAME_MAX_ENTRIES)
+        return TRUE;
+
+    // So I know which ones only have an ordinal.
+    if ((Named = calloc(Exports.NumberOfFunctions + 1, sizeof(BYTE))) == NULL)
+        return FALSE;
+
+    for (DWORD i = 0; i < Exports.NumberOfFunctions + Exports.NumberOfNames && Result; i++) {
+        BOOL ByName = i < Exports.NumberOfNames;
+        DWORD Index = i - Exports.NumberOfNames;
+        DWORD NameRva = 0;
+        DWORD Function;
+        LPCSTR Name;
+
+        // The names first, then whatever didn't have one by ordinal.
+        if (ByName) {
+            if (!RvaToOffset(Exports.AddressOfNameOrdinals + i * sizeof(WORD), &Offset)
+             || (Data = ReadImage(Offset, sizeof(WORD))) == NULL)
+                continue;
+
+            Index = *(UNALIGNED WORD *) Data;
+
+            if (!RvaToOffset(Exports.AddressOfNames + i * sizeof(DWORD), &Offset)
+             || (Data = ReadImage(Offset, sizeof(DWORD))) == NULL)
+                continue;
+
+            NameRva = *(UNALIGNED DWORD *) Data;
+        }
+
+        if (Index >= Exports.NumberOfFunctions || (!ByName && Named[Index]))
+            continue;
+
+        Named[Index] = TRUE;
+
+        if (!RvaToOffset(Exports.AddressOfFunctions + Index * sizeof(DWORD), &Offset)
+         || (Data = ReadImage(Offset, sizeof(DWORD))) == NULL)
+            continue;
+
+        Function = *(UNALIGNED DWORD *) Data;
+
+        // Forwarders point at a string in the directory, not code.
+        if (Function == 0 || Function - Directory->VirtualAddress < Directory->Size)
+            continue;
+
+        if (!RvaToOffset(Function, &Offset))
+            continue;
+
+        // The name is read last, it might be in the scratch buffer.
+        if (ByName) {
+            HEM_QWORD NameOffset;
+
+            if (!RvaToOffset(NameRva, &NameOffset))
+                continue;
+
+            Name = ReadImageString(NameOffset);
+        } else {
+            snprintf(Ordinal, sizeof Ordinal, "Ordinal%u", Exports.Base + Index);
+            Name = Ordinal;
+        }
+
+        Result = AddName(Offset, NULL, Name, PRIORITY_EXPORT);
+    }
+
+    free(Named);
+    return Result;
+}
+
+static BOOL AddPeNames(VOID)
+{
+    IMAGE_DATA_DIRECTORY Directories[IMAGE_NUMBEROF_DIRECTORY_ENTRIES] = {0};
+    IMAGE_DOS_HEADER Dos;
+    const VOID *Data;
+    DWORD Count;
+
+    if ((Data = ReadImage(0, sizeof Dos)) == NULL)
+        return TRUE;
+
+    CopyMemory(&Dos, Data, sizeof Dos);
+
+    if ((Data = ReadImage(Dos.e_lfanew, sizeof(IMAGE_NT_HEADERS32))) == NULL)
+        return TRUE;
+
+    if (Image.Map->Is64) {
+        IMAGE_NT_HEADERS64 Headers;
+
+        if ((Data = ReadImage(Dos.e_lfanew, sizeof Headers)) == NULL)
+            return TRUE;
+
+        CopyMemory(&Headers, Data, sizeof Headers);
+
+        Image.ImageBase = Headers.OptionalHeader.ImageBase;
+        Count = min(Headers.OptionalHeader.NumberOfRvaAndSizes, IMAGE_NUMBEROF_DIRECTORY_ENTRIES);
+        CopyMemory(Directories, Headers.OptionalHeader.DataDirectory, Count * sizeof(IMAGE_DATA_DIRECTORY));
+    } else {
+        IMAGE_NT_HEADERS32 Headers;
+
+        CopyMemory(&Headers, Data, sizeof Headers);
+
+        Image.ImageBase = Headers.OptionalHeader.ImageBase;
+        Count = min(Headers.OptionalHeader.NumberOfRvaAndSizes, IMAGE_NUMBEROF_DIRECTORY_ENTRIES);
+        CopyMemory(Directories, Headers.OptionalHeader.DataDirectory, Count * sizeof(IMAGE_DATA_DIRECTORY));
+    }
+
+    if (Directories[IMAGE_DIRECTORY_ENTRY_EXPORT].VirtualAddress
+     && !AddExports(&Directories[IMAGE_DIRECTORY_ENTRY_EXPORT]))
+        return FALSE;
+
+    if (Directories[IMAGE_DIRECTORY_ENTRY_IMPORT].VirtualAddress
+     && !AddImports(&Directories[IMAGE_DIRECTORY_ENTRY_IMPORT]))
+        return FALSE;
+
+    if (Directories[IMAGE_DIRECTORY_ENTRY_DELAY_IMPORT].VirtualAddress
+     && !AddDelayImports(&Directories[IMAGE_DIRECTORY_ENTRY_DELAY_IMPORT]))
+        return FALSE;
+
+    return TRUE;
+}
+
+// Get the file range of section Index, both sizes of header have the fields I
+// need at different places.
+static BOOL GetElfSection(HEM_QWORD Table, DWORD EntrySize, DWORD Index, PELF64_SECTION Section)
+{
+    const VOID *Data;
+
+    if ((Data = ReadImage(Table + (HEM_QWORD) Index * EntrySize, Image.Map->Is64 ? sizeof(ELF64_SECTION) : sizeof(ELF32_SECTION))) == NULL)
+        return FALSE;
+
+    if (Image.Map->Is64) {
+        CopyMemory(Section, Data, sizeof *Section);
+    } else {
+        const ELF32_SECTION *Section32 = Data;
+
+        Section->Type = Section32->Type;
+        Section->Offset = Section32->Offset;
+        Section->Size = Section32->Size;
+        Section->Link = Section32->Link;
+        Section->EntrySize = Section32->EntrySize;
+    }
+
+    return TRUE;
+}
+
+static BOOL AddElfSymbols(PELF64_SECTION Symbols, PELF64_SECTION Strings)
+{
+    DWORD SymbolSize = Image.Map->Is64 ? sizeof(ELF64_SYMBOL) : sizeof(ELF32_SYMBOL);
+    DWORD Priority = Symbols->Type == ELF_SHT_DYNSYM ? PRIORITY_DYNSYM : PRIORITY_SYMTAB;
+    ULONGLONG Count;
+
+    if (Symbols->EntrySize < SymbolSize)
+        return TRUE;
+
+    Count = min(Symbols->Size / Symbols->EntrySize, AUTONAME_MAX_ENTRIES);
+
+    // The first one is always empty.
+    for (DWORD i = 1; i < Count; i++) {
+        const VOID *Data;
+        ELF64_SYMBOL Symbol;
+        HEM_QWORD Offset;
+        BYTE Type;
+
+        if ((Data = ReadImage(Symbols->Offset + i * Symbols->EntrySize, SymbolSize)) == NULL)
+            break;
+
+        if (Image.Map->Is64) {
+            CopyMemory(&Symbol, Data, sizeof Symbol);
+        } else {
+            const ELF32_SYMBOL *Symbol32 = Data;
+
+            Symbol.Name = Symbol32->Name;
+            Symbol.Info = Symbol32->Info;
+            Symbol.Section = Symbol32->Section;
+            Symbol.Value = Symbol32->Value;
+        }
+
+        Type = Symbol.Info & 0xF;
+
+        // Imports have no address, and the reserved sections aren't real.
+        if (Type != ELF_STT_FUNC && Type != ELF_STT_OBJECT)
+            continue;
+
+        if (Symbol.Section == ELF_SHN_UNDEF || Symbol.Section >= ELF_SHN_LORESERVE || Symbol.Name >= Strings->Size)
+            continue;
+
+        if (!AddressToOffset(Image.Map, Symbol.Value, &Offset))
+            continue;
+
+        if (!AddName(Offset, NULL, ReadImageString(Strings->Offset + Symbol.Name), Priority))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static BOOL AddElfNames(VOID)
+{
+    ELF64_HEADER Header;
+    const VOID *Data;
+    HEM_QWORD Table;
+    DWORD EntrySize;
+    DWORD Count;
+
+    if ((Data = ReadImage(0, Image.Map->Is64 ? sizeof(ELF64_HEADER) : sizeof(ELF32_HEADER))) == NULL)
+        return TRUE;
+
+    if (Image.Map->Is64) {
+        CopyMemory(&Header, Data, sizeof Header);
+    } else {
+        const ELF32_HEADER *Header32 = Data;
+
+        CopyMemory(Header.Ident, Header32->Ident, sizeof Header.Ident);
+        Header.SectionOffset = Header32->SectionOffset;
+        Header.SectionEntrySize = Header32->SectionEntrySize;
+        Header.SectionCount = Header32->SectionCount;
+    }
+
+    // The section map only understands little endian too.
+    if (Header.Ident[5] != ELF_DATA_LSB)
+        return TRUE;
+
+    Table = Header.SectionOffset;
+    EntrySize = Header.SectionEntrySize;
+    Count = Header.SectionCount;
+
+    if (EntrySize < (Image.Map->Is64 ? sizeof(ELF64_SECTION) : sizeof(ELF32_SECTION)))
+        return TRUE;
+
+    for (DWORD i = 0; i < Count; i++) {
+        ELF64_SECTION Symbols;
+        ELF64_SECTION Strings;
+
+        if (!GetElfSection(Table, EntrySize, i, &Symbols))
+            break;
+
+        if (Symbols.Type != ELF_SHT_SYMTAB && Symbols.Type != ELF_SHT_DYNSYM)
+            continue;
+
+        if (Symbols.EntrySize == 0 || !GetElfSection(Table, EntrySize, Symbols.Link, &Strings))
+            continue;
+
+        if (!AddElfSymbols(&Symbols, &Strings))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static int __cdecl CompareOffsets(const void *a, const void *b)
+{
+    const AUTONAME *x = a;
+    const AUTONAME *y = b;
+
+    if (x->Offset != y->Offset)
+        return x->Offset < y->Offset ? -1 : 1;
+    if (x->Priority != y->Priority)
+        return x->Priority < y->Priority ? -1 : 1;
+
+    return x->Order < y->Order ? -1 : x->Order > y->Order;
+}
+
+static int __cdecl CompareNames(const void *a, const void *b)
+{
+    const AUTONAME *x = a;
+    const AUTONAME *y = b;
+    int Result = strcmp(Batch.Pool + x->Name, Batch.Pool + y->Name);
+
+    if (Result)
+        return Result;
+
+    return x->Offset < y->Offset ? -1 : x->Offset > y->Offset;
+}
+
+// Keep the best name for each offset, then number any names that are used
+// more than once.
+static VOID RemoveDuplicates(VOID)
+{
+    DWORD Count = 0;
+    DWORD Repeats = 0;
+
+    qsort(Batch.Names, Batch.Count, sizeof(AUTONAME), CompareOffsets);
+
+    for (DWORD i = 0; i < Batch.Count; i++) {
+        if (Count && Batch.Names[Count - 1].Offset == Batch.Names[i].Offset)
+            continue;
+
+        Batch.Names[Count++] = Batch.Names[i];
+    }
+
+    Batch.Count = Count;
+
+    qsort(Batch.Names, Batch.Count, sizeof(AUTONAME), CompareNames);
+
+    for (DWORD i = 1; i < Batch.Count; i++) {
+        PAUTONAME Entry = &Batch.Names[i];
+        CHAR Name[AUTONAME_MAX_NAME + 16];
+        SIZE_T Length;
+        PVOID Pool;
+
+        if (strcmp(Batch.Pool + Entry[-1].Name, Batch.Pool + Entry->Name) != 0) {
+            Repeats = 0;
+            continue;
+        }
+
+        Length = snprintf(Name, sizeof Name, "%s_%u", Batch.Pool + Entry->Name, ++Repeats + 1) + 1;
+
+        if (Batch.PoolUsed + Length > Batch.PoolSize) {
+            if ((Pool = realloc(Batch.Pool, Batch.PoolSize * 2 + Length)) == NULL)
+                break;
+
+            Batch.Pool = Pool;
+            Batch.PoolSize = Batch.PoolSize * 2 + Length;
+        }
+
+        CopyMemory(Batch.Pool + Batch.PoolUsed, Name, Length);
+
+        // Name is left alone for the next comparison.
+        Entry->Final = (DWORD) Batch.PoolUsed;
+        Batch.PoolUsed += Length;
+    }
+}
+
+static VOID FreeBatch(VOID)
+{
+    free(Batch.Names);
+    free(Batch.Pool);
+    free(Image.Pages);
+
+    ZeroMemory(&Batch, sizeof Batch);
+    ZeroMemory(&Image, sizeof Image);
+}
+
+int AutoNameEntryPoint(HEMCALL_TAG *HemCall)
+{
+    HIEWGATE_GETDATA HiewData;
+    DWORD Flags = HemCall->hemFlag & HEM_FLAG_FILEMASK;
+    DWORD Added = 0;
+    DWORD Failed = 0;
+    CHAR Message[256];
+    BOOL Complete;
+    JOB Job;
+
+    if (!(Flags & (HEM_FLAG_PE | HEM_FLAG_PE64 | HEM_FLAG_ELF | HEM_FLAG_ELF64))) {
+        HiewGate_Message("Name Symbols", "This only works on PE and ELF files.");
+        return HEM_OK;
+    }
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return HEM_ERROR;
+
+    if ((Image.Map = GetSectionMap(HemCall)) == NULL || strcmp(Image.Map->Format, "raw") == 0) {
+        HiewGate_Message("Name Symbols", "Hiew failed to read the headers.");
+        return HEM_OK;
+    }
+
+    if ((Image.Pages = calloc(AUTONAME_PAGE_COUNT, sizeof(IMAGE_PAGE))) == NULL) {
+        HiewGate_Message("Name Symbols", "Not enough memory.");
+        return HEM_OK;
+    }
+
+    Image.FileLength = HiewData.filelength;
+    Image.Job = &Job;
+
+    BeginJob(&Job, "Reading symbols", 0);
+
+    if (strcmp(Image.Map->Format, "PE") == 0) {
+        Complete = AddPeNames();
+    } else {
+        Complete = AddElfNames();
+    }
+
+    EndJob(&Job);
+
+    if (!Complete) {
+        HiewGate_Message("Name Symbols", Job.Cancelled ? "Cancelled." : "Not enough memory.");
+        FreeBatch();
+        return HEM_OK;
+    }
+
+    RemoveDuplicates();
+
+    BeginJob(&Job, "Adding names", Batch.Count);
+
+    for (DWORD i = 0; i < Batch.Count; i++) {
+        PAUTONAME Entry = &Batch.Names[i];
+
+        if (!UpdateJob(&Job, i))
+            break;
+
+        // This fails if the offset or name is already used, I don't want to
+        // replace anything the user named.
+        if (HiewGate_Names_AddGlobal(Entry->Offset, Batch.Pool + Entry->Final) == HEM_OK) {
+            Added++;
+        } else {
+            Failed++;
+        }
+    }
+
+    EndJob(&Job);
+
+    snprintf(Message,
+             sizeof Message,
+             "%s %u of %u names from the %s headers in %llu ms%s.",
+             Job.Cancelled ? "Cancelled after adding" : "Added",
+             Added,
+             Batch.Count,
+             Image.Map->Format,
+             Job.Elapsed,
+             Failed ? ", the rest were already named" : "");
+
+    HiewGate_Message("Name Symbols", Message);
+
+    FreeBatch();
+    return HEM_OK;
+}
@@ -0,0 +1,9 @@
+#ifndef __AUTONAME_H
+#define __AUTONAME_H
+
+// Names the exports, import address table slots (including delay loaded
+// ones) and ELF symbols of the current file from its headers, all at once.
+// Names that are already used are left alone.
+int AutoNameEntryPoint(HEMCALL_TAG *HemCall);
+
+#endif
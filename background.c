@@ -0,0 +1,435 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "stream.h"
+#include "vlist.h"
+#include "journal.h"
+#include "background.h"
+
+// Hiew can't redraw until the entry point returns, so a long scan blocks the
+// whole editor. A background job runs the same stream consumers on its own
+// thread instead, and the results are applied the next time I'm invoked.
+//
+// The HiewGate can't be used from another thread, or at all once the entry
+// point has returned, so the job reads the file itself. If that isn't
+// possible, or the file on disk isn't the size Hiew says it is, the range is
+// copied into memory first. That's still much quicker than analysing it.
+
+#define BACKGROUND_CHUNK_SIZE (2 * 1024 * 1024)
+
+// Anything bigger than this has to be read directly.
+#define BACKGROUND_MAX_SNAPSHOT (256 * 1024 * 1024)
+
+// Old jobs are forgotten when there are more than this.
+#define BACKGROUND_MAX_JOBS 32
+
+#define BACKGROUND_MENU_WIDTH 100
+
+enum {
+    BACKGROUND_RUNNING,
+    BACKGROUND_FINISHED,
+    BACKGROUND_FAILED,
+    BACKGROUND_CANCELLED,
+    BACKGROUND_APPLIED,
+};
+
+typedef struct _BACKGROUND_JOB {
+    BACKGROUND_TASK Task;
+    BOOL Released;
+
+    // What's being read.
+    DWORD FilenameHash;
+    HEM_QWORD FileLength;
+    ULONGLONG WriteGeneration;
+    HEM_QWORD Offset;
+    HEM_QWORD Length;
+    CHAR FileName[32];
+    HANDLE File;
+    PBYTE Snapshot;
+
+    // The thread only writes these, and State is set last.
+    HANDLE Thread;
+    volatile LONG State;
+    volatile LONG64 Done;
+    volatile BOOL Cancel;
+    LPCSTR Error;
+    ULONGLONG StartTime;
+    ULONGLONG EndTime;
+} BACKGROUND_JOB, *PBACKGROUND_JOB;
+
+static PCHAR StateNames[] = {
+    "Running",
+    "Finished",
+    "Failed",
+    "Cancelled",
+    "Applied",
+};
+
+// Pointers to every job, oldest first. Only the main thread uses this.
+static VLIST Jobs;
+
+static DWORD WINAPI BackgroundThread(LPVOID Parameter)
+{
+    PBACKGROUND_JOB Job = Parameter;
+    PBACKGROUND_TASK Task = &Job->Task;
+    LARGE_INTEGER Start = { .QuadPart = Job->Offset };
+    LONG State = BACKGROUND_FAILED;
+    LPCSTR Error = NULL;
+    PBYTE Buffer = NULL;
+    BOOL Complete = TRUE;
+    HEM_QWORD Done = 0;
+
+    if (Job->Snapshot == NULL) {
+        Buffer = VirtualAlloc(NULL, BACKGROUND_CHUNK_SIZE, MEM_COMMIT, PAGE_READWRITE);
+
+        if (Buffer == NULL) {
+            Error = "Not enough memory.";
+            goto finished;
+        }
+
+        if (!SetFilePointerEx(Job->File, Start, NULL, FILE_BEGIN)) {
+            Error = "Failed to read the file.";
+            goto finished;
+        }
+    }
+
+    while (Done < Job->Length && Complete) {
+        DWORD Size = min(Job->Length - Done, BACKGROUND_CHUNK_SIZE);
+        const BYTE *Data = Job->Snapshot ? Job->Snapshot + Done : Buffer;
+        DWORD Read;
+
+        if (Job->Cancel) {
+            State = BACKGROUND_CANCELLED;
+            goto finished;
+        }
+
+        if (Job->Snapshot == NULL && (!ReadFile(Job->File, Buffer, Size, &Read, NULL) || Read != Size)) {
+            Error = "Failed to read the file.";
+            goto finished;
+        }
+
+        for (DWORD i = 0; i < Task->Count && Complete; i++) {
+            Complete = Task->Consumers[i].Routine(Task->Consumers[i].Context, Job->Offset + Done, Data, Size);
+        }
+
+        Done += Size;
+
+        InterlockedExchange64(&Job->Done, Done);
+    }
+
+    Error = Task->Finish(Task->Context, Complete);
+    State = Error ? BACKGROUND_FAILED : BACKGROUND_FINISHED;
+
+finished:
+    if (Buffer)
+        VirtualFree(Buffer, 0, MEM_RELEASE);
+
+    Job->Error = Error;
+    Job->EndTime = GetTickCount64();
+
+    InterlockedExchange(&Job->State, State);
+    return 0;
+}
+
+// Copy the range through the HiewGate.
+static BOOL TakeSnapshot(PBACKGROUND_JOB Job, PCHAR Message, SIZE_T MaxLen)
+{
+    HEM_QWORD Done;
+    JOB Progress;
+
+    if (Job->Length > BACKGROUND_MAX_SNAPSHOT) {
+        snprintf(Message, MaxLen, "I can't open the file, and that's too much to copy, try marking a block.");
+        return FALSE;
+    }
+
+    if ((Job->Snapshot = VirtualAlloc(NULL, max(Job->Length, 1), MEM_COMMIT, PAGE_READWRITE)) == NULL) {
+        snprintf(Message, MaxLen, "Not enough memory to copy the file.");
+        return FALSE;
+    }
+
+    BeginJob(&Progress, "Taking a snapshot", Job->Length);
+
+    for (Done = 0; Done < Job->Length; Done += BACKGROUND_CHUNK_SIZE) {
+        DWORD Size = min(Job->Length - Done, BACKGROUND_CHUNK_SIZE);
+
+        if (!UpdateJob(&Progress, Done))
+            break;
+
+        if (HiewGate_FileRead(Job->Offset + Done, Size, Job->Snapshot + Done) != (int) Size)
+            break;
+    }
+
+    EndJob(&Progress);
+
+    if (Done < Job->Length) {
+        snprintf(Message, MaxLen, Progress.Cancelled ? "Cancelled." : "Hiew failed to read the file.");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// Once the thread has finished, the task and the file aren't needed. The job
+// is kept so it can still be shown.
+static VOID ReleaseJob(PBACKGROUND_JOB Job)
+{
+    if (Job->Released)
+        return;
+
+    WaitForSingleObject(Job->Thread, INFINITE);
+    CloseHandle(Job->Thread);
+
+    if (Job->File != INVALID_HANDLE_VALUE)
+        CloseHandle(Job->File);
+    if (Job->Snapshot)
+        VirtualFree(Job->Snapshot, 0, MEM_RELEASE);
+
+    Job->Task.Free(Job->Task.Context);
+    Job->Thread = NULL;
+    Job->File = INVALID_HANDLE_VALUE;
+    Job->Snapshot = NULL;
+    Job->Released = TRUE;
+}
+
+static PBACKGROUND_JOB GetJob(DWORD Index)
+{
+    return *(PBACKGROUND_JOB *) GetVirtualListRecord(&Jobs, Index);
+}
+
+static VOID RemoveJob(DWORD Index)
+{
+    PBACKGROUND_JOB Job = GetJob(Index);
+
+    ReleaseJob(Job);
+    free(Job);
+
+    MoveMemory(GetVirtualListRecord(&Jobs, Index),
+               GetVirtualListRecord(&Jobs, Index + 1),
+               (Jobs.Count - Index - 1) * sizeof(PBACKGROUND_JOB));
+
+    ResizeVirtualList(&Jobs, Jobs.Count - 1);
+}
+
+// Forget the oldest jobs that are over with.
+static VOID TrimJobs(VOID)
+{
+    for (DWORD i = 0; i < Jobs.Count && Jobs.Count >= BACKGROUND_MAX_JOBS;) {
+        LONG State = GetJob(i)->State;
+
+        if (State == BACKGROUND_RUNNING || State == BACKGROUND_FINISHED) {
+            i++;
+            continue;
+        }
+
+        RemoveJob(i);
+    }
+}
+
+static VOID FormatJob(PVOID Context, DWORD Index, const VOID *Record, PCHAR Buffer, SIZE_T Size)
+{
+    PBACKGROUND_JOB Job = *(PBACKGROUND_JOB const *) Record;
+    LONG State = Job->State;
+    ULONGLONG End = State == BACKGROUND_RUNNING ? GetTickCount64() : Job->EndTime;
+    LPCSTR Detail = "";
+
+    if (State == BACKGROUND_FAILED) {
+        Detail = Job->Error;
+    } else if (State == BACKGROUND_FINISHED) {
+        Detail = "Open this file again to apply";
+    }
+
+    snprintf(Buffer,
+             Size,
+             "%-9s %3llu%%  %-12s %-24s %5llus  %s%s",
+             StateNames[State],
+             Job->Done * 100 / max(Job->Length, 1),
+             Job->Task.Name,
+             Job->FileName,
+             (End - Job->StartTime) / 1000,
+             Job->Snapshot ? "(copy) " : "",
+             Detail);
+}
+
+BOOL StartBackgroundJob(PBACKGROUND_TASK Task,
+                        HEMCALL_TAG *HemCall,
+                        HEM_QWORD Offset,
+                        HEM_QWORD Length,
+                        PCHAR Message,
+                        SIZE_T MaxLen)
+{
+    HIEWGATE_GETDATA HiewData;
+    LARGE_INTEGER FileSize;
+    PBACKGROUND_JOB *Slot;
+    PBACKGROUND_JOB Job;
+    PCHAR BaseName;
+
+    if (Jobs.RecordSize == 0)
+        InitVirtualList(&Jobs, sizeof(PBACKGROUND_JOB), FormatJob, NULL);
+
+    if ((Job = calloc(1, sizeof *Job)) == NULL) {
+        snprintf(Message, MaxLen, "Not enough memory.");
+        Task->Free(Task->Context);
+        return FALSE;
+    }
+
+    Job->Task = *Task;
+    Job->File = INVALID_HANDLE_VALUE;
+    Job->FilenameHash = HemCall->filenameHash;
+    Job->Offset = Offset;
+    Job->Length = Length;
+    Job->StartTime = GetTickCount64();
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK) {
+        snprintf(Message, MaxLen, "Hiew didn't say which file is open.");
+        goto error;
+    }
+
+    Job->FileLength = HiewData.filelength;
+    Job->WriteGeneration = GetWriteGeneration();
+
+    BaseName = max(strrchr((PCHAR) HiewData.filename, '\\'), strrchr((PCHAR) HiewData.filename, '/'));
+    BaseName = BaseName ? BaseName + 1 : (PCHAR) HiewData.filename;
+
+    strncpy_s(Job->FileName, sizeof Job->FileName, BaseName, _TRUNCATE);
+
+    Job->File = CreateFile((PCHAR) HiewData.filename,
+                           GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           NULL,
+                           OPEN_EXISTING,
+                           FILE_FLAG_SEQUENTIAL_SCAN,
+                           NULL);
+
+    // If I can't read exactly what Hiew sees, take a copy instead.
+    if (Job->File != INVALID_HANDLE_VALUE
+     && (!GetFileSizeEx(Job->File, &FileSize) || FileSize.QuadPart != HiewData.filelength)) {
+        CloseHandle(Job->File);
+        Job->File = INVALID_HANDLE_VALUE;
+    }
+
+    if (Job->File == INVALID_HANDLE_VALUE && !TakeSnapshot(Job, Message, MaxLen))
+        goto error;
+
+    TrimJobs();
+
+    if ((Slot = AppendVirtualList(&Jobs)) == NULL) {
+        snprintf(Message, MaxLen, "Not enough memory.");
+        goto error;
+    }
+
+    *Slot = Job;
+
+    Job->Thread = CreateThread(NULL, 0, BackgroundThread, Job, 0, NULL);
+
+    if (Job->Thread == NULL) {
+        ResizeVirtualList(&Jobs, Jobs.Count - 1);
+        snprintf(Message, MaxLen, "Failed to start the job.");
+        goto error;
+    }
+
+    return TRUE;
+
+error:
+    if (Job->File != INVALID_HANDLE_VALUE)
+        CloseHandle(Job->File);
+    if (Job->Snapshot)
+        VirtualFree(Job->Snapshot, 0, MEM_RELEASE);
+
+    Task->Free(Task->Context);
+    free(Job);
+    return FALSE;
+}
+
+DWORD CollectBackgroundJobs(HEMCALL_TAG *HemCall)
+{
+    HIEWGATE_GETDATA HiewData;
+    BOOL HaveData = FALSE;
+    DWORD Applied = 0;
+
+    for (DWORD i = 0; i < Jobs.Count; i++) {
+        PBACKGROUND_JOB Job = GetJob(i);
+        LONG State = Job->State;
+
+        if (State == BACKGROUND_RUNNING || Job->Released)
+            continue;
+
+        if (State != BACKGROUND_FINISHED) {
+            ReleaseJob(Job);
+            continue;
+        }
+
+        // These have to wait until the file is open again.
+        if (Job->FilenameHash != HemCall->filenameHash)
+            continue;
+
+        if (!HaveData && HiewGate_GetData(&HiewData) != HEM_OK)
+            break;
+
+        HaveData = TRUE;
+
+        // A patch or transform doesn't change the length, but the results
+        // were made from the old bytes.
+        if (HiewData.filelength != Job->FileLength || GetWriteGeneration() != Job->WriteGeneration) {
+            Job->Error = "The file changed before the results were applied.";
+        } else {
+            Job->Error = Job->Task.Collect(Job->Task.Context, HemCall);
+        }
+
+        Job->State = Job->Error ? BACKGROUND_FAILED : BACKGROUND_APPLIED;
+        Applied += Job->Error == NULL;
+
+        ReleaseJob(Job);
+    }
+
+    return Applied;
+}
+
+int BackgroundEntryPoint(HEMCALL_TAG *HemCall)
+{
+    static PCHAR RunningActions[] = { "Cancel this job" };
+    static PCHAR FinishedActions[] = { "Remove from the list" };
+    PBACKGROUND_JOB Job;
+    LONG Selected;
+
+    if (Jobs.Count == 0) {
+        HiewGate_Message("Background Jobs", "Nothing has been started, Strings and Signatures can run in the background.");
+        return HEM_OK;
+    }
+
+    Selected = ShowVirtualList(&Jobs, "Background Jobs", BACKGROUND_MENU_WIDTH, Jobs.Count - 1);
+
+    if (Selected < 0)
+        return HEM_OK;
+
+    Job = GetJob(Selected);
+
+    if (Job->State == BACKGROUND_RUNNING) {
+        if (HiewGate_Menu((PCHAR) Job->Task.Name, RunningActions, _countof(RunningActions), 24, 1, NULL, NULL, NULL, NULL) == 1)
+            Job->Cancel = TRUE;
+    } else {
+        if (HiewGate_Menu((PCHAR) Job->Task.Name, FinishedActions, _countof(FinishedActions), 24, 1, NULL, NULL, NULL, NULL) == 1)
+            RemoveJob(Selected);
+    }
+
+    return HEM_OK;
+}
+
+VOID StopBackgroundJobs(VOID)
+{
+    for (DWORD i = 0; i < Jobs.Count; i++) {
+        GetJob(i)->Cancel = TRUE;
+    }
+
+    while (Jobs.Count) {
+        RemoveJob(Jobs.Count - 1);
+    }
+
+    FreeVirtualList(&Jobs);
+}
@@ -0,0 +1,48 @@
+#ifndef __BACKGROUND_H
+#define __BACKGROUND_H
+
+typedef struct _BACKGROUND_TASK {
+    LPCSTR Name;
+
+    // Every chunk of the range is passed to these, on the job's thread. They
+    // must not call the HiewGate.
+    STREAM_CONSUMER Consumers[4];
+    DWORD Count;
+
+    // Called on the job's thread after the last chunk, or after a consumer
+    // returned FALSE. Returns NULL on success, or why the job failed.
+    LPCSTR (*Finish)(PVOID Context, BOOL Complete);
+
+    // Called on the next invocation with the same file open, this is where
+    // results are added to Names and ColorMarkers. Returns NULL on success,
+    // or why they couldn't be applied.
+    LPCSTR (*Collect)(PVOID Context, HEMCALL_TAG *HemCall);
+
+    // Called when the job is done with, collected or not.
+    VOID (*Free)(PVOID Context);
+
+    PVOID Context;
+} BACKGROUND_TASK, *PBACKGROUND_TASK;
+
+// Starts streaming Length bytes from Offset of the current file to the task's
+// consumers on a new thread. The file is read directly, or from a snapshot
+// taken now if that isn't possible. If this fails the task is freed, and it
+// returns FALSE with a reason in Message.
+BOOL StartBackgroundJob(PBACKGROUND_TASK Task,
+                        HEMCALL_TAG *HemCall,
+                        HEM_QWORD Offset,
+                        HEM_QWORD Length,
+                        PCHAR Message,
+                        SIZE_T MaxLen);
+
+// Applies the results of any jobs on this file that have finished, this is
+// done every time the hem is invoked. Returns how many were applied.
+DWORD CollectBackgroundJobs(HEMCALL_TAG *HemCall);
+
+// Shows the running, finished and failed jobs.
+int BackgroundEntryPoint(HEMCALL_TAG *HemCall);
+
+// Cancel every job and wait for them to stop.
+VOID StopBackgroundJobs(VOID);
+
+#endif
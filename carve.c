@@ -0,0 +1,935 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <intrin.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "stream.h"
+#include "vlist.h"
+#include "elf.h"
+#include "decode.h"
+#include "carve.h"
+
+// Finds files embedded in the marked block (or the whole file, or disk) and
+// works out how long each one really is, so they can be saved.
+//
+// The scan is one pass through the stream. Every format I look for starts
+// with a distinctive pair of bytes, so each 16 positions are checked for all
+// of them at once with SSE2, and the few matches get a quick look at the
+// rest of the header. Anything that passes is measured afterwards by reading
+// its headers through the gate: a PE ends after its last section or
+// certificate, an ELF after its last segment, section or table, a PNG after
+// IEND, a JPEG after EOI, a gzip stream when it stops inflating, and a CAB
+// says how long it is. A ZIP is found from its end, because the central
+// directory says where it started.
+
+// The most a quick check reads, positions this close to the end of a chunk
+// wait for the next one.
+#define CARVE_HEADER 64
+
+// The vector loop and the quick checks read a little past the end.
+#define CARVE_PADDING (CARVE_HEADER + 32)
+
+#define CARVE_MAX_HITS (1024 * 1024)
+
+#define CARVE_MENU_WIDTH 72
+
+// Headers are read through this, it's big enough for a section table.
+#define CARVE_READ_SIZE (64 * 1024)
+
+// How much to copy at once when saving through the gate.
+#define CARVE_COPY_SIZE (2 * 1024 * 1024)
+
+// How much of the file to map at once when saving from it directly.
+#define CARVE_VIEW_SIZE (64 * 1024 * 1024)
+
+// Anything claiming more than this is probably garbage.
+#define CARVE_MAX_SECTIONS 96
+#define CARVE_MAX_ENTRIES 4096
+
+enum {
+    CARVE_PE,
+    CARVE_ELF,
+    CARVE_ZIP,
+    CARVE_PNG,
+    CARVE_JPEG,
+    CARVE_GZIP,
+    CARVE_CAB,
+    CARVE_NONE,
+};
+
+static PCHAR TypeNames[] = { "PE", "ELF", "ZIP", "PNG", "JPEG", "gzip", "CAB" };
+static PCHAR Extensions[] = { "exe", "elf", "zip", "png", "jpg", "gz", "cab" };
+
+typedef struct _CARVED {
+    HEM_QWORD Offset;
+    HEM_QWORD Length;       // Zero until it's measured
+    DWORD Type;
+} CARVED, *PCARVED;
+
+typedef struct _CARVE_SCAN {
+    HEM_QWORD End;
+    HEM_QWORD Next;         // The first offset that hasn't been checked
+
+    // The current chunk, with the end of the last one in front of it.
+    PBYTE Window;
+    DWORD WindowLength;
+    DWORD WindowCapacity;
+    HEM_QWORD WindowOffset;
+
+    PVLIST Hits;
+    BOOL Full;
+    BOOL NoMemory;
+} CARVE_SCAN, *PCARVE_SCAN;
+
+typedef struct _CARVE_READER {
+    PJOB Job;
+    HEM_QWORD FileLength;
+    HEM_QWORD Offset;       // Where Buffer came from
+    DWORD Length;
+    BYTE Buffer[CARVE_READ_SIZE];
+} CARVE_READER, *PCARVE_READER;
+
+typedef struct _CARVE_SOURCE {
+    HEM_QWORD FileLength;
+
+    // If the file can be mapped, objects are written straight from the view.
+    HANDLE File;
+    HANDLE Mapping;
+    DWORD Granularity;
+
+    // Otherwise they're copied through the gate.
+    PBYTE Buffer;
+} CARVE_SOURCE, *PCARVE_SOURCE;
+
+// The last scan, so the list can be shown again.
+static struct {
+    VLIST List;
+    DWORD FilenameHash;
+    DWORD OffsetWidth;
+    CHAR Title[128];
+} Carved;
+
+static __forceinline WORD ReadBigWord(const BYTE *Data)
+{
+    return Data[0] << 8 | Data[1];
+}
+
+static __forceinline DWORD ReadBigDword(const BYTE *Data)
+{
+    return (DWORD) Data[0] << 24 | Data[1] << 16 | Data[2] << 8 | Data[3];
+}
+
+static VOID AddHit(PCARVE_SCAN Scan, HEM_QWORD Offset, HEM_QWORD Length, DWORD Type)
+{
+    PCARVED Hit;
+
+    if (Scan->Hits->Count >= CARVE_MAX_HITS || (Hit = AppendVirtualList(Scan->Hits)) == NULL) {
+        Scan->Full = TRUE;
+        return;
+    }
+
+    Hit->Offset = Offset;
+    Hit->Length = Length;
+    Hit->Type = Type;
+}
+
+// The first two bytes matched something, see if the rest of the header
+// looks right. The window always has CARVE_HEADER bytes after Index.
+static VOID CheckCandidate(PCARVE_SCAN Scan, DWORD Index)
+{
+    const BYTE *Data = Scan->Window + Index;
+    HEM_QWORD Offset = Scan->WindowOffset + Index;
+    DWORD Value;
+
+    switch (Data[0]) {
+        case 'M':
+            if (Data[1] == 'Z') {
+                // The NT headers have to be somewhere sensible.
+                Value = *(const DWORD UNALIGNED *)(Data + 0x3C);
+
+                if (Value >= 0x40 && Value < 0x10000)
+                    AddHit(Scan, Offset, 0, CARVE_PE);
+            } else if (*(const DWORD UNALIGNED *)(Data + 4) == 0 && *(const DWORD UNALIGNED *)(Data + 12) == 0) {
+                // MSCF, then cbCabinet, then coffFiles, and version 1.3.
+                Value = *(const DWORD UNALIGNED *)(Data + 8);
+
+                if (Data[2] == 'C' && Data[3] == 'F' && Data[24] == 3 && Data[25] == 1
+                 && Value >= 36 && *(const DWORD UNALIGNED *)(Data + 16) < Value) {
+                    AddHit(Scan, Offset, Value, CARVE_CAB);
+                }
+            }
+            break;
+        case 0x7F:
+            // Only little endian, with a valid class and version.
+            if (Data[2] == 'L' && Data[3] == 'F' && (Data[4] == 1 || Data[4] == 2)
+             && Data[5] == ELF_DATA_LSB && Data[6] == 1) {
+                AddHit(Scan, Offset, 0, CARVE_ELF);
+            }
+            break;
+        case 'P':
+            // The end of central directory, for a single disk archive.
+            if (Data[2] == 5 && Data[3] == 6 && *(const DWORD UNALIGNED *)(Data + 4) == 0
+             && *(const WORD UNALIGNED *)(Data + 8) == *(const WORD UNALIGNED *)(Data + 10)) {
+                DWORD Size = *(const DWORD UNALIGNED *)(Data + 12);
+                DWORD Start = *(const DWORD UNALIGNED *)(Data + 16);
+                WORD Comment = *(const WORD UNALIGNED *)(Data + 20);
+
+                if (Start != 0xFFFFFFFF && (HEM_QWORD) Size + Start <= Offset)
+                    AddHit(Scan, Offset - Size - Start, Size + Start + 22 + Comment, CARVE_ZIP);
+            }
+            break;
+        case 0x89:
+            if (memcmp(Data, "\x89PNG\r\n\x1a\n", 8) == 0)
+                AddHit(Scan, Offset, 0, CARVE_PNG);
+            break;
+        case 0xFF:
+            // The second marker should be one that starts a real image.
+            if (Data[2] == 0xFF && ((Data[3] & 0xF0) == 0xE0 || Data[3] == 0xDB || Data[3] == 0xFE
+                                 || (Data[3] >= 0xC0 && Data[3] <= 0xC3))) {
+                AddHit(Scan, Offset, 0, CARVE_JPEG);
+            }
+            break;
+        case 0x1F:
+            // Deflate, and no reserved flags.
+            if (Data[2] == 8 && (Data[3] & 0xE0) == 0)
+                AddHit(Scan, Offset, 0, CARVE_GZIP);
+            break;
+    }
+}
+
+// Check every position from Start to End in the window.
+static VOID ScanRange(PCARVE_SCAN Scan, DWORD Start, DWORD End)
+{
+    unsigned long Bit;
+
+    for (DWORD i = Start; i < End && !Scan->Full; i += 16) {
+        __m128i First = _mm_loadu_si128((const __m128i *)(Scan->Window + i));
+        __m128i Second = _mm_loadu_si128((const __m128i *)(Scan->Window + i + 1));
+        __m128i Match;
+        DWORD Mask;
+
+        #define PAIR(a, b) _mm_and_si128(_mm_cmpeq_epi8(First, _mm_set1_epi8((CHAR)(a))), \
+                                         _mm_cmpeq_epi8(Second, _mm_set1_epi8((CHAR)(b))))
+
+        Match = _mm_or_si128(_mm_or_si128(PAIR('M', 'Z'), PAIR('M', 'S')),
+                             _mm_or_si128(PAIR(0x7F, 'E'), PAIR('P', 'K')));
+        Match = _mm_or_si128(Match, _mm_or_si128(PAIR(0x89, 'P'), PAIR(0xFF, 0xD8)));
+        Match = _mm_or_si128(Match, PAIR(0x1F, 0x8B));
+
+        #undef PAIR
+
+        Mask = _mm_movemask_epi8(Match);
+
+        while (_BitScanForward(&Bit, Mask)) {
+            Mask &= Mask - 1;
+
+            if (i + Bit < End)
+                CheckCandidate(Scan, i + Bit);
+        }
+    }
+}
+
+static BOOL ScanChunk(PVOID Context, HEM_QWORD Offset, const BYTE *Data, DWORD Length)
+{
+    PCARVE_SCAN Scan = Context;
+    DWORD Keep = min(Scan->WindowLength, CARVE_HEADER);
+    HEM_QWORD Limit;
+
+    if (Keep + Length + CARVE_PADDING > Scan->WindowCapacity) {
+        PBYTE Window = realloc(Scan->Window, Keep + Length + CARVE_PADDING);
+
+        if (Window == NULL) {
+            Scan->NoMemory = TRUE;
+            return FALSE;
+        }
+
+        Scan->Window = Window;
+        Scan->WindowCapacity = Keep + Length + CARVE_PADDING;
+    }
+
+    memmove(Scan->Window, Scan->Window + Scan->WindowLength - Keep, Keep);
+    memcpy(Scan->Window + Keep, Data, Length);
+    ZeroMemory(Scan->Window + Keep + Length, CARVE_PADDING);
+
+    Scan->WindowOffset = Offset - Keep;
+    Scan->WindowLength = Keep + Length;
+
+    // Leave the end for next time so headers that cross are seen whole,
+    // unless this is the last chunk.
+    Limit = Offset + Length;
+
+    if (Limit != Scan->End)
+        Limit -= min(Length, CARVE_HEADER);
+
+    if (Scan->Next < Limit) {
+        ScanRange(Scan, (DWORD)(Scan->Next - Scan->WindowOffset), (DWORD)(Limit - Scan->WindowOffset));
+        Scan->Next = Limit;
+    }
+
+    return !Scan->Full;
+}
+
+// Reads a header, small reads near each other share one gate call.
+static BOOL ReadAt(PCARVE_READER Reader, HEM_QWORD Offset, DWORD Size, PVOID Buffer)
+{
+    if (Offset + Size < Offset || Offset + Size > Reader->FileLength || Size > CARVE_READ_SIZE)
+        return FALSE;
+
+    if (Offset < Reader->Offset || Offset + Size > Reader->Offset + Reader->Length) {
+        Reader->Offset = Offset;
+        Reader->Length = (DWORD) min(CARVE_READ_SIZE, Reader->FileLength - Offset);
+
+        if (HiewGate_FileRead(Reader->Offset, Reader->Length, Reader->Buffer) != (int) Reader->Length) {
+            Reader->Length = 0;
+            return FALSE;
+        }
+    }
+
+    CopyMemory(Buffer, Reader->Buffer + (Offset - Reader->Offset), Size);
+    return TRUE;
+}
+
+// Returns the offset of the next Byte at or after Offset, or -1.
+static HEM_QWORD FindByte(PCARVE_READER Reader, HEM_QWORD Offset, BYTE Byte)
+{
+    while (Offset < Reader->FileLength) {
+        BYTE Dummy;
+        const BYTE *Found;
+        DWORD Start;
+
+        if (!ReadAt(Reader, Offset, 1, &Dummy))
+            break;
+
+        Start = (DWORD)(Offset - Reader->Offset);
+        Found = memchr(Reader->Buffer + Start, Byte, Reader->Length - Start);
+
+        if (Found)
+            return Reader->Offset + (Found - Reader->Buffer);
+
+        Offset = Reader->Offset + Reader->Length;
+    }
+
+    return -1;
+}
+
+static HEM_QWORD MeasurePe(PCARVE_READER Reader, HEM_QWORD Offset)
+{
+    IMAGE_DOS_HEADER Dos;
+    IMAGE_NT_HEADERS64 Headers;
+    IMAGE_SECTION_HEADER Section;
+    PIMAGE_NT_HEADERS32 Headers32 = (PVOID) &Headers;
+    PIMAGE_DATA_DIRECTORY Directories;
+    HEM_QWORD SectionOffset;
+    HEM_QWORD End;
+    DWORD Count;
+
+    if (!ReadAt(Reader, Offset, sizeof Dos, &Dos))
+        return 0;
+
+    // The 32 bit headers are smaller, so this is enough for either.
+    if (!ReadAt(Reader, Offset + Dos.e_lfanew, sizeof(IMAGE_NT_HEADERS32), &Headers)
+     || Headers.Signature != IMAGE_NT_SIGNATURE) {
+        return 0;
+    }
+
+    if (Headers.OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC) {
+        End = Headers.OptionalHeader.SizeOfHeaders;
+        Count = Headers.OptionalHeader.NumberOfRvaAndSizes;
+        Directories = Headers.OptionalHeader.DataDirectory;
+    } else if (Headers.OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC) {
+        End = Headers32->OptionalHeader.SizeOfHeaders;
+        Count = Headers32->OptionalHeader.NumberOfRvaAndSizes;
+        Directories = Headers32->OptionalHeader.DataDirectory;
+    } else {
+        return 0;
+    }
+
+    // The certificates aren't loaded, so their address is a file offset.
+    if (Count > IMAGE_DIRECTORY_ENTRY_SECURITY && Directories[IMAGE_DIRECTORY_ENTRY_SECURITY].Size) {
+        End = max(End, (HEM_QWORD) Directories[IMAGE_DIRECTORY_ENTRY_SECURITY].VirtualAddress
+                     + Directories[IMAGE_DIRECTORY_ENTRY_SECURITY].Size);
+    }
+
+    if (Headers.FileHeader.NumberOfSections > CARVE_MAX_SECTIONS)
+        return 0;
+
+    SectionOffset = Offset
+                  + Dos.e_lfanew
+                  + FIELD_OFFSET(IMAGE_NT_HEADERS64, OptionalHeader)
+                  + Headers.FileHeader.SizeOfOptionalHeader;
+
+    for (DWORD i = 0; i < Headers.FileHeader.NumberOfSections; i++) {
+        if (!ReadAt(Reader, SectionOffset + i * sizeof Section, sizeof Section, &Section))
+            return 0;
+
+        if (Section.SizeOfRawData)
+            End = max(End, (HEM_QWORD) Section.PointerToRawData + Section.SizeOfRawData);
+    }
+
+    return End;
+}
+
+static HEM_QWORD MeasureElf(PCARVE_READER Reader, HEM_QWORD Offset)
+{
+    ELF64_HEADER Header;
+    PELF32_HEADER Header32 = (PVOID) &Header;
+    HEM_QWORD End;
+
+    if (!ReadAt(Reader, Offset, sizeof Header, &Header))
+        return 0;
+
+    if (Header.Ident[4] == ELF_CLASS64) {
+        if (Header.ProgramCount > CARVE_MAX_ENTRIES || Header.SectionCount > CARVE_MAX_ENTRIES)
+            return 0;
+
+        End = max(Header.HeaderSize, Header.ProgramOffset + (HEM_QWORD) Header.ProgramCount * Header.ProgramEntrySize);
+        End = max(End, Header.SectionOffset + (HEM_QWORD) Header.SectionCount * Header.SectionEntrySize);
+
+        for (DWORD i = 0; i < Header.ProgramCount; i++) {
+            ELF64_PROGRAM Program;
+
+            if (!ReadAt(Reader, Offset + Header.ProgramOffset + i * Header.ProgramEntrySize, sizeof Program, &Program))
+                return 0;
+
+            End = max(End, Program.Offset + Program.FileSize);
+        }
+
+        for (DWORD i = 0; i < Header.SectionCount; i++) {
+            ELF64_SECTION Section;
+
+            if (!ReadAt(Reader, Offset + Header.SectionOffset + i * Header.SectionEntrySize, sizeof Section, &Section))
+                return 0;
+
+            if (Section.Type != ELF_SHT_NOBITS)
+                End = max(End, Section.Offset + Section.Size);
+        }
+    } else {
+        if (Header32->ProgramCount > CARVE_MAX_ENTRIES || Header32->SectionCount > CARVE_MAX_ENTRIES)
+            return 0;
+
+        End = max(Header32->HeaderSize, Header32->ProgramOffset + (HEM_QWORD) Header32->ProgramCount * Header32->ProgramEntrySize);
+        End = max(End, Header32->SectionOffset + (HEM_QWORD) Header32->SectionCount * Header32->SectionEntrySize);
+
+        for (DWORD i = 0; i < Header32->ProgramCount; i++) {
+            ELF32_PROGRAM Program;
+
+            if (!ReadAt(Reader, Offset + Header32->ProgramOffset + i * Header32->ProgramEntrySize, sizeof Program, &Program))
+                return 0;
+
+            End = max(End, (HEM_QWORD) Program.Offset + Program.FileSize);
+        }
+
+        for (DWORD i = 0; i < Header32->SectionCount; i++) {
+            ELF32_SECTION Section;
+
+            if (!ReadAt(Reader, Offset + Header32->SectionOffset + i * Header32->SectionEntrySize, sizeof Section, &Section))
+                return 0;
+
+            if (Section.Type != ELF_SHT_NOBITS)
+                End = max(End, (HEM_QWORD) Section.Offset + Section.Size);
+        }
+    }
+
+    return End;
+}
+
+// A PNG is a list of chunks ending with IEND.
+static HEM_QWORD MeasurePng(PCARVE_READER Reader, HEM_QWORD Offset)
+{
+    HEM_QWORD Position = Offset + 8;
+    BYTE Chunk[8];
+
+    while (ReadAt(Reader, Position, sizeof Chunk, Chunk)) {
+        DWORD Length = ReadBigDword(Chunk);
+
+        // Chunk types are always letters.
+        for (DWORD i = 4; i < 8; i++) {
+            if (!isalpha(Chunk[i]))
+                return 0;
+        }
+
+        if (Length > 0x7FFFFFFF)
+            return 0;
+
+        Position += 12 + Length;
+
+        if (memcmp(Chunk + 4, "IEND", 4) == 0)
+            return Position - Offset;
+    }
+
+    return 0;
+}
+
+// A JPEG is a list of segments, and after each scan there's entropy coded
+// data where a 0xFF is followed by zero or a restart marker.
+static HEM_QWORD MeasureJpeg(PCARVE_READER Reader, HEM_QWORD Offset)
+{
+    HEM_QWORD Position = Offset + 2;
+    BYTE Marker[4];
+
+    while (ReadAt(Reader, Position, sizeof Marker, Marker)) {
+        if (Marker[0] != 0xFF)
+            return 0;
+
+        switch (Marker[1]) {
+            case 0xFF:
+                // Padding.
+                Position++;
+                continue;
+            case 0xD9:
+                return Position + 2 - Offset;
+            case 0x00:
+                return 0;
+            case 0x01: case 0xD0: case 0xD1: case 0xD2: case 0xD3:
+            case 0xD4: case 0xD5: case 0xD6: case 0xD7:
+                Position += 2;
+                continue;
+        }
+
+        if (ReadBigWord(Marker + 2) < 2)
+            return 0;
+
+        Position += 2 + ReadBigWord(Marker + 2);
+
+        if (Marker[1] != 0xDA)
+            continue;
+
+        // Find the marker after the scan.
+        while ((Position = FindByte(Reader, Position, 0xFF)) != -1) {
+            if (!ReadAt(Reader, Position, 2, Marker))
+                return 0;
+
+            if (Marker[1] != 0x00 && Marker[1] != 0xFF && (Marker[1] < 0xD0 || Marker[1] > 0xD7))
+                break;
+
+            Position += Marker[1] == 0xFF ? 1 : 2;
+        }
+
+        if (Position == -1)
+            return 0;
+    }
+
+    return 0;
+}
+
+// Work out how long the hit really is, returns FALSE if it isn't valid.
+static BOOL MeasureHit(PCARVE_READER Reader, PCARVED Hit)
+{
+    BYTE Magic[4];
+    HEM_QWORD Length = Hit->Length;
+
+    switch (Hit->Type) {
+        case CARVE_PE:
+            Length = MeasurePe(Reader, Hit->Offset);
+            break;
+        case CARVE_ELF:
+            Length = MeasureElf(Reader, Hit->Offset);
+            break;
+        case CARVE_PNG:
+            Length = MeasurePng(Reader, Hit->Offset);
+            break;
+        case CARVE_JPEG:
+            Length = MeasureJpeg(Reader, Hit->Offset);
+            break;
+        case CARVE_GZIP:
+            if (!MeasureCompressed(Reader->Job, Hit->Offset, Reader->FileLength - Hit->Offset, &Length))
+                return FALSE;
+            break;
+        case CARVE_ZIP:
+            // An empty archive is just the end record, otherwise it should
+            // start with a local header.
+            if (!ReadAt(Reader, Hit->Offset, sizeof Magic, Magic))
+                return FALSE;
+            if (memcmp(Magic, "PK\x03\x04", 4) != 0 && memcmp(Magic, "PK\x05\x06", 4) != 0)
+                return FALSE;
+            break;
+    }
+
+    if (Length == 0 || Length > Reader->FileLength - Hit->Offset)
+        return FALSE;
+
+    Hit->Length = Length;
+    return TRUE;
+}
+
+static int __cdecl CompareHits(const void *a, const void *b)
+{
+    const CARVED *x = a;
+    const CARVED *y = b;
+
+    if (x->Offset != y->Offset)
+        return x->Offset < y->Offset ? -1 : 1;
+
+    return x->Type < y->Type ? -1 : x->Type > y->Type;
+}
+
+// Measure everything that was found, and throw away the ones that aren't
+// real. Returns NULL, or why they weren't all measured.
+static LPCSTR MeasureHits(PJOB Job, HEM_QWORD FileLength)
+{
+    PCARVE_READER Reader;
+    PCARVED Hits = GetVirtualListRecord(&Carved.List, 0);
+    DWORD Kept = 0;
+    LPCSTR Error = NULL;
+
+    if ((Reader = malloc(sizeof *Reader)) == NULL)
+        return "Not enough memory.";
+
+    // A big gzip stream takes a while, so Esc works during that too.
+    Reader->Job = Job;
+    Reader->FileLength = FileLength;
+    Reader->Offset = 0;
+    Reader->Length = 0;
+
+    qsort(Hits, Carved.List.Count, sizeof(CARVED), CompareHits);
+
+    for (DWORD i = 0; i < Carved.List.Count; i++) {
+        if (!UpdateJob(Job, i)) {
+            Error = "Cancelled.";
+            break;
+        }
+
+        if (Kept && CompareHits(&Hits[Kept - 1], &Hits[i]) == 0)
+            continue;
+
+        if (MeasureHit(Reader, &Hits[i]))
+            Hits[Kept++] = Hits[i];
+    }
+
+    ResizeVirtualList(&Carved.List, Kept);
+
+    free(Reader);
+    return Error;
+}
+
+static VOID FormatHit(PVOID Context, DWORD Index, const VOID *Record, PCHAR Buffer, SIZE_T Size)
+{
+    const CARVED *Hit = Record;
+
+    snprintf(Buffer,
+             Size,
+             "%0*llX  %0*llX  %s",
+             Carved.OffsetWidth,
+             Hit->Offset,
+             Carved.OffsetWidth,
+             Hit->Length,
+             TypeNames[Hit->Type]);
+}
+
+// Map the file if I can read exactly what Hiew sees, a disk can't be mapped.
+static BOOL OpenSource(HEMCALL_TAG *HemCall, HIEWGATE_GETDATA *HiewData, PCARVE_SOURCE Source)
+{
+    SYSTEM_INFO SystemInfo;
+    LARGE_INTEGER FileSize;
+
+    ZeroMemory(Source, sizeof *Source);
+
+    GetSystemInfo(&SystemInfo);
+
+    Source->FileLength = HiewData->filelength;
+    Source->Granularity = SystemInfo.dwAllocationGranularity;
+    Source->File = INVALID_HANDLE_VALUE;
+
+    if (!(HemCall->hemFlag & HEM_FLAG_DISK)) {
+        Source->File = CreateFile((PCHAR) HiewData->filename,
+                                  GENERIC_READ,
+                                  FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                  NULL,
+                                  OPEN_EXISTING,
+                                  FILE_FLAG_SEQUENTIAL_SCAN,
+                                  NULL);
+    }
+
+    if (Source->File != INVALID_HANDLE_VALUE
+     && GetFileSizeEx(Source->File, &FileSize)
+     && FileSize.QuadPart == HiewData->filelength) {
+        Source->Mapping = CreateFileMapping(Source->File, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+
+    if (Source->Mapping == NULL && (Source->Buffer = malloc(CARVE_COPY_SIZE)) == NULL)
+        return FALSE;
+
+    return TRUE;
+}
+
+static VOID CloseSource(PCARVE_SOURCE Source)
+{
+    if (Source->Mapping)
+        CloseHandle(Source->Mapping);
+    if (Source->File != INVALID_HANDLE_VALUE)
+        CloseHandle(Source->File);
+
+    free(Source->Buffer);
+}
+
+// Writes the object to FileName, from a view of the file if it's mapped so
+// nothing is copied, or through the gate otherwise.
+static LPCSTR SaveHit(PCARVE_SOURCE Source, PJOB Job, HEM_QWORD *Done, const CARVED *Hit, PCHAR FileName)
+{
+    LPCSTR Error = NULL;
+    HANDLE File;
+
+    File = CreateFile(FileName,
+                      GENERIC_WRITE,
+                      0,
+                      NULL,
+                      CREATE_ALWAYS,
+                      FILE_FLAG_SEQUENTIAL_SCAN,
+                      NULL);
+
+    if (File == INVALID_HANDLE_VALUE)
+        return "Failed to create the file.";
+
+    for (HEM_QWORD Saved = 0; Saved < Hit->Length && Error == NULL; ) {
+        HEM_QWORD Offset = Hit->Offset + Saved;
+        HEM_QWORD ViewOffset = Offset;
+        PBYTE View = Source->Buffer;
+        DWORD Length;
+        DWORD Written;
+
+        if (!UpdateJob(Job, *Done))
+            break;
+
+        if (Source->Mapping) {
+            ViewOffset = Offset & ~(HEM_QWORD)(Source->Granularity - 1);
+            Length = (DWORD) min(CARVE_VIEW_SIZE - (Offset - ViewOffset), Hit->Length - Saved);
+            View = MapViewOfFile(Source->Mapping,
+                                 FILE_MAP_READ,
+                                 ViewOffset >> 32,
+                                 ViewOffset & 0xFFFFFFFF,
+                                 (SIZE_T)(Offset - ViewOffset) + Length);
+
+            if (View == NULL) {
+                Error = "Failed to map the file.";
+                break;
+            }
+        } else {
+            Length = (DWORD) min(CARVE_COPY_SIZE, Hit->Length - Saved);
+
+            if (HiewGate_FileRead(Offset, Length, View) != (int) Length) {
+                Error = "Hiew failed to read the file.";
+                break;
+            }
+        }
+
+        if (!WriteFile(File, View + (Offset - ViewOffset), Length, &Written, NULL) || Written != Length)
+            Error = "Failed to write the file.";
+
+        if (Source->Mapping)
+            UnmapViewOfFile(View);
+
+        Saved += Length;
+        *Done += Length;
+    }
+
+    CloseHandle(File);
+    return Error;
+}
+
+static VOID SaveHits(HEMCALL_TAG *HemCall, DWORD Selected, BOOL All)
+{
+    const CARVED *Hit = GetVirtualListRecord(&Carved.List, Selected);
+    CHAR FileName[HEM_FILENAME_MAXLEN] = {0};
+    CHAR Name[HEM_FILENAME_MAXLEN];
+    HIEWGATE_GETDATA HiewData;
+    CARVE_SOURCE Source;
+    LPCSTR Error = NULL;
+    HEM_QWORD Total = 0;
+    HEM_QWORD Done = 0;
+    DWORD First = All ? 0 : Selected;
+    DWORD Last = All ? Carved.List.Count : Selected + 1;
+    DWORD Saved = 0;
+    CHAR Message[256];
+    SIZE_T Used;
+    JOB Job;
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return;
+
+    if (All) {
+        snprintf(FileName, sizeof FileName, "carved");
+    } else {
+        snprintf(FileName, sizeof FileName, "carved_%llX.%s", Hit->Offset, Extensions[Hit->Type]);
+    }
+
+    if (HiewGate_GetFilename(All ? "Save Objects With Prefix" : "Save Object As", FileName) != HEM_INPUT_CR)
+        return;
+
+    if (!OpenSource(HemCall, &HiewData, &Source)) {
+        HiewGate_Message("Carve", "Not enough memory.");
+        return;
+    }
+
+    for (DWORD i = First; i < Last; i++) {
+        Total += ((PCARVED) GetVirtualListRecord(&Carved.List, i))->Length;
+    }
+
+    BeginJob(&Job, "Saving", Total);
+
+    for (DWORD i = First; i < Last && Error == NULL && !Job.Cancelled; i++) {
+        Hit = GetVirtualListRecord(&Carved.List, i);
+
+        if (All) {
+            snprintf(Name, sizeof Name, "%s_%llX.%s", FileName, Hit->Offset, Extensions[Hit->Type]);
+        } else {
+            strcpy_s(Name, sizeof Name, FileName);
+        }
+
+        if ((Error = SaveHit(&Source, &Job, &Done, Hit, Name)) == NULL && !Job.Cancelled)
+            Saved++;
+    }
+
+    EndJob(&Job);
+    CloseSource(&Source);
+
+    if (Error || Job.Cancelled) {
+        snprintf(Message, sizeof Message, "%s Saved %u of %u.", Error ? Error : "Cancelled.", Saved, Last - First);
+    } else {
+        Used = snprintf(Message, sizeof Message, "Saved %u, %s, ", Saved, Source.Mapping ? "mapped" : "copied");
+
+        FormatJobStats(&Job, Message + Used, sizeof Message - Used);
+    }
+
+    HiewGate_Message("Carve", Message);
+}
+
+static BOOL FindObjects(HEMCALL_TAG *HemCall, HIEWGATE_GETDATA *HiewData)
+{
+    CARVE_SCAN Scan = {0};
+    STREAM_CONSUMER Consumer;
+    JOB Job;
+    JOB MeasureJob;
+    HEM_QWORD Offset;
+    HEM_QWORD Length;
+    CHAR Stats[64];
+    LPCSTR Error;
+    int Result;
+
+    GetMarkedRange(HiewData, &Offset, &Length);
+
+    FreeVirtualList(&Carved.List);
+    InitVirtualList(&Carved.List, sizeof(CARVED), FormatHit, NULL);
+
+    Carved.FilenameHash = HemCall->filenameHash;
+    Carved.OffsetWidth = HiewData->filelength > 0xFFFFFFFF ? 16 : 8;
+
+    Scan.End = Offset + Length;
+    Scan.Next = Offset;
+    Scan.Hits = &Carved.List;
+
+    Consumer.Routine = ScanChunk;
+    Consumer.Context = &Scan;
+
+    BeginJob(&Job, "Carving", Length);
+
+    Result = StreamFileRange(&Job, Offset, Length, &Consumer, 1);
+
+    EndJob(&Job);
+
+    free(Scan.Window);
+
+    // If there were too many, I can still measure some.
+    if (Result == HEM_ERROR && Scan.Full)
+        Result = HEM_OK;
+
+    if (Scan.NoMemory) {
+        Error = "Not enough memory.";
+    } else if (Result != HEM_OK) {
+        Error = Result == HEM_KEYBREAK ? "Cancelled." : "Hiew failed to read the file.";
+    } else {
+        BeginJob(&MeasureJob, "Measuring", Carved.List.Count);
+        Error = MeasureHits(&MeasureJob, HiewData->filelength);
+        EndJob(&MeasureJob);
+    }
+
+    if (Error) {
+        FreeVirtualList(&Carved.List);
+        HiewGate_Message("Carve", (PCHAR) Error);
+        return FALSE;
+    }
+
+    if (Carved.List.Count == 0) {
+        HiewGate_Message("Carve", "Nothing was found.");
+        return FALSE;
+    }
+
+    FormatJobStats(&Job, Stats, sizeof Stats);
+
+    snprintf(Carved.Title,
+             sizeof Carved.Title,
+             "%u objects%s, %s",
+             Carved.List.Count,
+             Scan.Full ? " (some are missing)" : "",
+             Stats);
+
+    return TRUE;
+}
+
+int CarveEntryPoint(HEMCALL_TAG *HemCall)
+{
+    static PCHAR Actions[] = {
+        "Carve again",
+        "Show the last results",
+    };
+    HIEWGATE_GETDATA HiewData;
+    CHAR Lines[3][128];
+    PCHAR Menu[3];
+    DWORD Width = 0;
+    LONG Selected;
+    PCARVED Hit;
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return HEM_ERROR;
+
+    // A disk takes a while, so maybe I want the same results again.
+    if (Carved.List.Count && Carved.FilenameHash == HemCall->filenameHash) {
+        switch (HiewGate_Menu("Carve", Actions, _countof(Actions), 24, 2, NULL, NULL, NULL, NULL)) {
+            case 1:
+                if (!FindObjects(HemCall, &HiewData))
+                    return HEM_OK;
+                break;
+            case 2:
+                break;
+            default:
+                return HEM_OK;
+        }
+    } else if (!FindObjects(HemCall, &HiewData)) {
+        return HEM_OK;
+    }
+
+    if ((Selected = ShowVirtualList(&Carved.List, Carved.Title, CARVE_MENU_WIDTH, 0)) < 0)
+        return HEM_OK;
+
+    Hit = GetVirtualListRecord(&Carved.List, Selected);
+
+    snprintf(Lines[0], sizeof Lines[0], "Go to %llX", Hit->Offset);
+    snprintf(Lines[1], sizeof Lines[0], "Save this %s (%#llx bytes) to a file", TypeNames[Hit->Type], Hit->Length);
+    snprintf(Lines[2], sizeof Lines[0], "Save all %u objects to files", Carved.List.Count);
+
+    for (DWORD i = 0; i < _countof(Menu); i++) {
+        Menu[i] = Lines[i];
+        Width = max(Width, strlen(Lines[i]));
+    }
+
+    switch (HiewGate_Menu("Carve", Menu, _countof(Menu), Width, 1, NULL, NULL, NULL, NULL)) {
+        case 1:
+            HemCall->returnOffset = Hit->Offset;
+            HemCall->returnActionFlag |= HEM_RETURN_SETOFFSET;
+            break;
+        case 2:
+            SaveHits(HemCall, Selected, FALSE);
+            break;
+        case 3:
+            SaveHits(HemCall, Selected, TRUE);
+            break;
+    }
+
+    return HEM_OK;
+}
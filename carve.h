@@ -0,0 +1,8 @@
+#ifndef __CARVE_H
+#define __CARVE_H
+
+// Finds PE, ELF, ZIP, PNG, JPEG, gzip and CAB files embedded in the block,
+// measures them from their headers and saves them to disk.
+int CarveEntryPoint(HEMCALL_TAG *HemCall);
+
+#endif
@@ -0,0 +1,931 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <intrin.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "stream.h"
+#include "util.h"
+#include "decode.h"
+
+// Decodes the marked block as base64, hex text or deflate and writes the
+// result to a file. Embedded blobs can be hundreds of megabytes, so nothing
+// is ever held in memory: the block is read a chunk at a time and the output
+// goes through a fixed buffer, deflate only needs the last 32K.
+//
+// Base64 and hex are decoded 16 characters at a time with SSE while the text
+// is clean, and one character at a time around line breaks, padding and
+// anything else. The inflater is the usual canonical Huffman decoder, with a
+// lookup table for the short codes that make up most of the data.
+
+#define DECODE_CHUNK_SIZE       (1024 * 1024)
+#define DECODE_FIRST_CHUNK      (16 * 1024)
+#define DECODE_OUTPUT_SIZE      (1024 * 1024)
+
+#define INFLATE_WINDOW_SIZE     32768
+#define INFLATE_MAX_BITS        15
+#define INFLATE_FAST_BITS       9
+#define INFLATE_LITERALS        288
+#define INFLATE_DISTANCES       30
+
+typedef enum _DECODE_FORMAT {
+    DECODE_BASE64,
+    DECODE_HEX,
+    DECODE_DEFLATE,
+    DECODE_FORMATS,
+} DECODE_FORMAT;
+
+static LPCSTR FormatNames[] = { "Base64", "Hex text", "Deflate, zlib or gzip" };
+
+typedef struct _HUFFMAN {
+    WORD Count[INFLATE_MAX_BITS + 1];   // How many codes of each length
+    WORD Symbol[INFLATE_LITERALS];      // Ordered by code
+    WORD Fast[1 << INFLATE_FAST_BITS];  // Length << 9 | Symbol, or zero
+} HUFFMAN, *PHUFFMAN;
+
+typedef struct _DECODER {
+    // The block being read.
+    BYTE Input[DECODE_CHUNK_SIZE];
+    DWORD Position;
+    DWORD Length;
+    HEM_QWORD Offset;       // Where Input came from
+    HEM_QWORD Start;
+    HEM_QWORD End;
+    DWORD ChunkSize;        // Doubles up to DECODE_CHUNK_SIZE
+    PJOB Job;               // Optional
+    BOOL PollOnly;          // The job is counting something else
+
+    // Where it's going, or NULL to just count it.
+    HANDLE File;
+    BYTE Output[DECODE_OUTPUT_SIZE];
+    DWORD Used;
+    ULONGLONG Written;
+
+    LPCSTR Error;
+    BOOL Finished;          // Padding or the last deflate block was seen.
+
+    // Text decoders, the bits that don't make a whole byte yet.
+    DWORD Bits;
+    DWORD BitCount;
+
+    // The inflater.
+    ULONGLONG BitBuffer;
+    DWORD Available;
+    BYTE Window[INFLATE_WINDOW_SIZE];
+    ULONGLONG Total;
+    DWORD Trailer;          // The checksum after a zlib or gzip stream
+    HUFFMAN Literals;
+    HUFFMAN Distances;
+} DECODER, *PDECODER;
+
+static DECODE_FORMAT DecodeFormat;
+
+// Sextets for base64 characters, or 0xFF. The URL safe ones are accepted too.
+static BYTE Base64Values[256];
+
+static const WORD LengthBase[] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const BYTE LengthExtra[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const WORD DistanceBase[] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+
+static const BYTE DistanceExtra[] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static const BYTE CodeLengthOrder[] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static BOOL HasSsse3(VOID)
+{
+    int CpuInfo[4];
+
+    __cpuid(CpuInfo, 1);
+
+    return !!(CpuInfo[2] & (1 << 9));
+}
+
+static VOID InitializeBase64(VOID)
+{
+    static LPCSTR Alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    FillMemory(Base64Values, sizeof Base64Values, 0xFF);
+
+    for (DWORD i = 0; i < 64; i++) {
+        Base64Values[(BYTE) Alphabet[i]] = (BYTE) i;
+    }
+
+    Base64Values['-'] = 62;
+    Base64Values['_'] = 63;
+}
+
+static BOOL FlushOutput(PDECODER Decoder)
+{
+    DWORD Written;
+
+    if (Decoder->Used == 0)
+        return TRUE;
+
+    if (Decoder->File && (!WriteFile(Decoder->File, Decoder->Output, Decoder->Used, &Written, NULL) || Written != Decoder->Used)) {
+        Decoder->Error = "Failed to write the output file.";
+        return FALSE;
+    }
+
+    Decoder->Written += Decoder->Used;
+    Decoder->Used = 0;
+    return TRUE;
+}
+
+// The vector decoders store a whole register, so there's always room for one.
+static BOOL ReserveOutput(PDECODER Decoder)
+{
+    if (Decoder->Used + sizeof(__m128i) > sizeof Decoder->Output)
+        return FlushOutput(Decoder);
+
+    return TRUE;
+}
+
+static __forceinline BOOL EmitByte(PDECODER Decoder, BYTE Byte)
+{
+    Decoder->Output[Decoder->Used++] = Byte;
+
+    if (Decoder->Used == sizeof Decoder->Output)
+        return FlushOutput(Decoder);
+
+    return TRUE;
+}
+
+// Read the next chunk of the block, returns FALSE at the end or if the user
+// wants to stop.
+static BOOL ReadChunk(PDECODER Decoder)
+{
+    HEM_QWORD Next = Decoder->Offset + Decoder->Length;
+
+    if (Next >= Decoder->End || Decoder->Error)
+        return FALSE;
+
+    if (Decoder->Job && !UpdateJob(Decoder->Job, Decoder->PollOnly ? Decoder->Job->Done : Next - Decoder->Start))
+        return FALSE;
+
+    Decoder->Offset = Next;
+    Decoder->Length = (DWORD) min(Decoder->ChunkSize, Decoder->End - Next);
+    Decoder->Position = 0;
+
+    // Start small in case the data is only short.
+    Decoder->ChunkSize = min(Decoder->ChunkSize * 2, DECODE_CHUNK_SIZE);
+
+    if (HiewGate_FileRead(Decoder->Offset, Decoder->Length, Decoder->Input) != (int) Decoder->Length) {
+        Decoder->Error = "Hiew failed to read the file.";
+        Decoder->Length = 0;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// Muła's method, the high nibble picks which ranges a character could be in
+// and the low nibble which it is in, so both lookups only agree for valid
+// characters. Returns FALSE if any of the 16 aren't plain base64.
+static BOOL DecodeBase64Vector(const BYTE *Text, PBYTE Output)
+{
+    const __m128i LowTable = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i HighTable = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i RollTable = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                            0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i Input = _mm_loadu_si128((const __m128i *) Text);
+    __m128i High = _mm_and_si128(_mm_srli_epi32(Input, 4), _mm_set1_epi8(0x0F));
+    __m128i Low = _mm_and_si128(Input, _mm_set1_epi8(0x0F));
+    __m128i Invalid = _mm_and_si128(_mm_shuffle_epi8(LowTable, Low), _mm_shuffle_epi8(HighTable, High));
+    __m128i Slash;
+    __m128i Values;
+
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(Invalid, _mm_setzero_si128())))
+        return FALSE;
+
+    // The slash is the only character that shares a high nibble with others
+    // but needs a different offset.
+    Slash = _mm_cmpeq_epi8(Input, _mm_set1_epi8('/'));
+    Values = _mm_add_epi8(Input, _mm_shuffle_epi8(RollTable, _mm_add_epi8(Slash, High)));
+
+    // Join pairs of sextets, then pairs of those, then pick out the bytes.
+    Values = _mm_maddubs_epi16(Values, _mm_set1_epi32(0x01400140));
+    Values = _mm_madd_epi16(Values, _mm_set1_epi32(0x00011000));
+    Values = _mm_shuffle_epi8(Values, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+    _mm_storeu_si128((__m128i *) Output, Values);
+    return TRUE;
+}
+
+static VOID DecodeBase64(PDECODER Decoder, BOOL Vector)
+{
+    const BYTE *Text = Decoder->Input;
+    DWORD Length = Decoder->Length;
+
+    for (DWORD i = 0; i < Length && !Decoder->Finished; ) {
+        BYTE Value;
+
+        if (!ReserveOutput(Decoder))
+            return;
+
+        // Only when there's nothing left over.
+        if (Vector && Decoder->BitCount == 0 && i + sizeof(__m128i) <= Length) {
+            if (DecodeBase64Vector(Text + i, Decoder->Output + Decoder->Used)) {
+                Decoder->Used += 12;
+                i += sizeof(__m128i);
+                continue;
+            }
+        }
+
+        switch (Text[i]) {
+            case ' ': case '\t': case '\r': case '\n':
+                i++;
+                continue;
+            case '=':
+                Decoder->Finished = TRUE;
+                continue;
+        }
+
+        if ((Value = Base64Values[Text[i]]) == 0xFF) {
+            Decoder->Error = "That isn't base64.";
+            Decoder->Position = i;
+            return;
+        }
+
+        Decoder->Bits = Decoder->Bits << 6 | Value;
+        Decoder->BitCount += 6;
+
+        if (Decoder->BitCount >= 8) {
+            Decoder->BitCount -= 8;
+
+            if (!EmitByte(Decoder, (BYTE) (Decoder->Bits >> Decoder->BitCount)))
+                return;
+        }
+
+        i++;
+    }
+}
+
+// 16 hex digits to 8 bytes, returns FALSE if they aren't all digits.
+static BOOL DecodeHexVector(const BYTE *Text, PBYTE Output)
+{
+    __m128i Input = _mm_loadu_si128((const __m128i *) Text);
+    __m128i Lower = _mm_or_si128(Input, _mm_set1_epi8(0x20));
+    __m128i Digit = _mm_and_si128(_mm_cmpgt_epi8(Input, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(Input, _mm_set1_epi8('9' + 1)));
+    __m128i Letter = _mm_and_si128(_mm_cmpgt_epi8(Lower, _mm_set1_epi8('a' - 1)),
+                                   _mm_cmplt_epi8(Lower, _mm_set1_epi8('f' + 1)));
+    __m128i Values;
+
+    if (_mm_movemask_epi8(_mm_or_si128(Digit, Letter)) != 0xFFFF)
+        return FALSE;
+
+    Values = _mm_or_si128(_mm_and_si128(Digit, _mm_sub_epi8(Input, _mm_set1_epi8('0'))),
+                          _mm_andnot_si128(Digit, _mm_sub_epi8(Lower, _mm_set1_epi8('a' - 10))));
+
+    // The first digit of each pair is the high nibble.
+    Values = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(Values, _mm_set1_epi16(0x00FF)), 4),
+                          _mm_srli_epi16(Values, 8));
+
+    _mm_storel_epi64((__m128i *) Output, _mm_packus_epi16(Values, Values));
+    return TRUE;
+}
+
+// Whitespace and the usual separators are skipped, so "4D 5A 90" works.
+static VOID DecodeHex(PDECODER Decoder)
+{
+    const BYTE *Text = Decoder->Input;
+    DWORD Length = Decoder->Length;
+
+    for (DWORD i = 0; i < Length; ) {
+        int Value;
+
+        if (!ReserveOutput(Decoder))
+            return;
+
+        if (Decoder->BitCount == 0 && i + sizeof(__m128i) <= Length) {
+            if (DecodeHexVector(Text + i, Decoder->Output + Decoder->Used)) {
+                Decoder->Used += 8;
+                i += sizeof(__m128i);
+                continue;
+            }
+        }
+
+        switch (Text[i]) {
+            case ' ': case '\t': case '\r': case '\n': case ',': case ':': case '-':
+                i++;
+                continue;
+        }
+
+        if ((Value = HexDigit(Text[i])) < 0) {
+            Decoder->Error = "That isn't hex text.";
+            Decoder->Position = i;
+            return;
+        }
+
+        Decoder->Bits = Decoder->Bits << 4 | Value;
+        Decoder->BitCount += 4;
+
+        if (Decoder->BitCount == 8) {
+            Decoder->BitCount = 0;
+
+            if (!EmitByte(Decoder, (BYTE) Decoder->Bits))
+                return;
+        }
+
+        i++;
+    }
+}
+
+static __forceinline int ReadByte(PDECODER Decoder)
+{
+    if (Decoder->Position == Decoder->Length && !ReadChunk(Decoder))
+        return -1;
+
+    return Decoder->Input[Decoder->Position++];
+}
+
+// Make sure there are at least Count bits buffered, returns FALSE if the
+// block ends first.
+static __forceinline BOOL NeedBits(PDECODER Decoder, DWORD Count)
+{
+    while (Decoder->Available < Count) {
+        int Byte = ReadByte(Decoder);
+
+        if (Byte < 0)
+            return FALSE;
+
+        Decoder->BitBuffer |= (ULONGLONG) Byte << Decoder->Available;
+        Decoder->Available += 8;
+    }
+
+    return TRUE;
+}
+
+// Deflate packs bits from the least significant end. If the data runs out,
+// this sets Error and returns zero, the callers check before using much.
+static __forceinline DWORD GetBits(PDECODER Decoder, DWORD Count)
+{
+    DWORD Value;
+
+    if (!NeedBits(Decoder, Count)) {
+        if (Decoder->Error == NULL)
+            Decoder->Error = Decoder->Job && Decoder->Job->Cancelled ? "Cancelled." : "The compressed data ends too soon.";
+        return 0;
+    }
+
+    Value = (DWORD) (Decoder->BitBuffer & ((1ULL << Count) - 1));
+
+    Decoder->BitBuffer >>= Count;
+    Decoder->Available -= Count;
+    return Value;
+}
+
+static __forceinline BOOL EmitInflated(PDECODER Decoder, BYTE Byte)
+{
+    Decoder->Window[Decoder->Total++ % INFLATE_WINDOW_SIZE] = Byte;
+
+    return EmitByte(Decoder, Byte);
+}
+
+// Returns FALSE if the lengths don't make a valid code. Incomplete codes are
+// allowed, a block with one distance code has one.
+static BOOL BuildHuffman(PHUFFMAN Huffman, const BYTE *Lengths, DWORD Count)
+{
+    WORD Offsets[INFLATE_MAX_BITS + 1];
+    WORD Next[INFLATE_MAX_BITS + 1];
+    LONG Left = 1;
+    WORD Code = 0;
+
+    ZeroMemory(Huffman, sizeof *Huffman);
+
+    for (DWORD i = 0; i < Count; i++) {
+        Huffman->Count[Lengths[i]]++;
+    }
+
+    Huffman->Count[0] = 0;
+
+    for (DWORD Length = 1; Length <= INFLATE_MAX_BITS; Length++) {
+        Left = Left * 2 - Huffman->Count[Length];
+
+        if (Left < 0)
+            return FALSE;
+    }
+
+    Offsets[1] = 0;
+
+    for (DWORD Length = 1; Length < INFLATE_MAX_BITS; Length++) {
+        Offsets[Length + 1] = Offsets[Length] + Huffman->Count[Length];
+    }
+
+    // The first code of each length, as in RFC 1951.
+    for (DWORD Length = 1; Length <= INFLATE_MAX_BITS; Length++) {
+        Code = (Code + Huffman->Count[Length - 1]) << 1;
+        Next[Length] = Code;
+    }
+
+    for (DWORD Symbol = 0; Symbol < Count; Symbol++) {
+        DWORD Length = Lengths[Symbol];
+        DWORD Reversed = 0;
+
+        if (Length == 0)
+            continue;
+
+        Huffman->Symbol[Offsets[Length]++] = (WORD) Symbol;
+
+        if (Length > INFLATE_FAST_BITS) {
+            Next[Length]++;
+            continue;
+        }
+
+        // The table is indexed by the next bits in the stream, which are the
+        // code backwards.
+        for (DWORD b = 0, c = Next[Length]++; b < Length; b++, c >>= 1) {
+            Reversed = Reversed << 1 | (c & 1);
+        }
+
+        for (DWORD i = Reversed; i < _countof(Huffman->Fast); i += 1 << Length) {
+            Huffman->Fast[i] = (WORD) (Length << 9 | Symbol);
+        }
+    }
+
+    return TRUE;
+}
+
+// Returns the next symbol, or -1 if the code isn't in the table.
+static int DecodeSymbol(PDECODER Decoder, PHUFFMAN Huffman)
+{
+    DWORD First = 0;
+    DWORD Index = 0;
+    DWORD Code = 0;
+    WORD Entry;
+
+    // Near the end there might not be enough bits to fill the table index,
+    // but the code might still be short enough.
+    NeedBits(Decoder, INFLATE_FAST_BITS);
+
+    Entry = Huffman->Fast[Decoder->BitBuffer & ((1 << INFLATE_FAST_BITS) - 1)];
+
+    if (Entry && (DWORD) (Entry >> 9) <= Decoder->Available) {
+        Decoder->BitBuffer >>= Entry >> 9;
+        Decoder->Available -= Entry >> 9;
+        return Entry & 0x1FF;
+    }
+
+    // A long code, go a bit at a time.
+    for (DWORD Length = 1; Length <= INFLATE_MAX_BITS; Length++) {
+        DWORD Count = Huffman->Count[Length];
+
+        Code |= GetBits(Decoder, 1);
+
+        if (Decoder->Error)
+            return -1;
+
+        if (Code - First < Count)
+            return Huffman->Symbol[Index + Code - First];
+
+        Index += Count;
+        First = (First + Count) << 1;
+        Code <<= 1;
+    }
+
+    return -1;
+}
+
+static BOOL InflateCodes(PDECODER Decoder)
+{
+    while (TRUE) {
+        int Symbol = DecodeSymbol(Decoder, &Decoder->Literals);
+        DWORD Length;
+        DWORD Distance;
+
+        if (Symbol < 0)
+            break;
+
+        if (Symbol < 256) {
+            if (!EmitInflated(Decoder, (BYTE) Symbol))
+                return FALSE;
+            continue;
+        }
+
+        if (Symbol == 256)
+            return TRUE;
+
+        if ((Symbol -= 257) >= _countof(LengthBase))
+            break;
+
+        Length = LengthBase[Symbol] + GetBits(Decoder, LengthExtra[Symbol]);
+
+        if ((Symbol = DecodeSymbol(Decoder, &Decoder->Distances)) < 0 || Symbol >= _countof(DistanceBase))
+            break;
+
+        Distance = DistanceBase[Symbol] + GetBits(Decoder, DistanceExtra[Symbol]);
+
+        if (Decoder->Error)
+            return FALSE;
+
+        if (Distance > Decoder->Total || Distance > INFLATE_WINDOW_SIZE) {
+            Decoder->Error = "The compressed data refers back too far.";
+            return FALSE;
+        }
+
+        // This can overlap what it's writing, that's how runs are encoded.
+        while (Length--) {
+            if (!EmitInflated(Decoder, Decoder->Window[(Decoder->Total - Distance) % INFLATE_WINDOW_SIZE]))
+                return FALSE;
+        }
+    }
+
+    if (Decoder->Error == NULL)
+        Decoder->Error = "The compressed data is damaged.";
+
+    return FALSE;
+}
+
+static BOOL InflateStored(PDECODER Decoder)
+{
+    DWORD Length;
+
+    // Stored blocks start on a byte boundary.
+    GetBits(Decoder, Decoder->Available % 8);
+
+    Length = GetBits(Decoder, 16);
+
+    if ((GetBits(Decoder, 16) ^ 0xFFFF) != Length && Decoder->Error == NULL)
+        Decoder->Error = "The compressed data is damaged.";
+
+    while (Length-- && Decoder->Error == NULL) {
+        if (!EmitInflated(Decoder, (BYTE) GetBits(Decoder, 8)))
+            return FALSE;
+    }
+
+    return Decoder->Error == NULL;
+}
+
+static BOOL InflateFixed(PDECODER Decoder)
+{
+    BYTE Lengths[INFLATE_LITERALS];
+    DWORD i;
+
+    for (i = 0; i < 144; i++) Lengths[i] = 8;
+    for (; i < 256; i++) Lengths[i] = 9;
+    for (; i < 280; i++) Lengths[i] = 7;
+    for (; i < INFLATE_LITERALS; i++) Lengths[i] = 8;
+
+    BuildHuffman(&Decoder->Literals, Lengths, INFLATE_LITERALS);
+
+    for (i = 0; i < INFLATE_DISTANCES; i++) Lengths[i] = 5;
+
+    BuildHuffman(&Decoder->Distances, Lengths, INFLATE_DISTANCES);
+
+    return InflateCodes(Decoder);
+}
+
+static BOOL InflateDynamic(PDECODER Decoder)
+{
+    BYTE Lengths[INFLATE_LITERALS + INFLATE_DISTANCES + 2] = {0};
+    DWORD LiteralCount = GetBits(Decoder, 5) + 257;
+    DWORD DistanceCount = GetBits(Decoder, 5) + 1;
+    DWORD CodeCount = GetBits(Decoder, 4) + 4;
+    DWORD i;
+
+    if (Decoder->Error)
+        return FALSE;
+
+    if (LiteralCount > INFLATE_LITERALS || DistanceCount > INFLATE_DISTANCES + 2)
+        goto damaged;
+
+    // First the code that the code lengths are written with.
+    for (i = 0; i < CodeCount; i++) {
+        Lengths[CodeLengthOrder[i]] = (BYTE) GetBits(Decoder, 3);
+    }
+
+    if (!BuildHuffman(&Decoder->Literals, Lengths, _countof(CodeLengthOrder)))
+        goto damaged;
+
+    ZeroMemory(Lengths, sizeof Lengths);
+
+    for (i = 0; i < LiteralCount + DistanceCount; ) {
+        int Symbol = DecodeSymbol(Decoder, &Decoder->Literals);
+        DWORD Repeat;
+        BYTE Length = 0;
+
+        if (Symbol < 0)
+            goto damaged;
+
+        if (Symbol < 16) {
+            Lengths[i++] = (BYTE) Symbol;
+            continue;
+        }
+
+        if (Symbol == 16) {
+            if (i == 0)
+                goto damaged;
+
+            Length = Lengths[i - 1];
+            Repeat = 3 + GetBits(Decoder, 2);
+        } else if (Symbol == 17) {
+            Repeat = 3 + GetBits(Decoder, 3);
+        } else {
+            Repeat = 11 + GetBits(Decoder, 7);
+        }
+
+        if (Decoder->Error || i + Repeat > LiteralCount + DistanceCount)
+            goto damaged;
+
+        while (Repeat--) {
+            Lengths[i++] = Length;
+        }
+    }
+
+    // There has to be an end of block code.
+    if (Lengths[256] == 0)
+        goto damaged;
+
+    if (!BuildHuffman(&Decoder->Literals, Lengths, LiteralCount)
+     || !BuildHuffman(&Decoder->Distances, Lengths + LiteralCount, DistanceCount)) {
+        goto damaged;
+    }
+
+    return InflateCodes(Decoder);
+
+damaged:
+    if (Decoder->Error == NULL)
+        Decoder->Error = "The compressed data is damaged.";
+
+    return FALSE;
+}
+
+// Skip a zlib or gzip header if there is one, otherwise it's raw deflate.
+static BOOL SkipHeader(PDECODER Decoder)
+{
+    const BYTE *Data = Decoder->Input;
+    DWORD Flags;
+
+    if (Decoder->Length >= 2 && Data[0] == 0x1F && Data[1] == 0x8B) {
+        if (GetBits(Decoder, 16) != 0x8B1F || GetBits(Decoder, 8) != 8)
+            goto damaged;
+
+        Flags = GetBits(Decoder, 8);
+
+        // Time, extra flags and OS.
+        for (DWORD i = 0; i < 6; i++) {
+            GetBits(Decoder, 8);
+        }
+
+        if (Flags & 4) {
+            for (DWORD Extra = GetBits(Decoder, 16); Extra && !Decoder->Error; Extra--) {
+                GetBits(Decoder, 8);
+            }
+        }
+
+        // The name and comment are zero terminated.
+        for (DWORD Bit = 8; Bit <= 16; Bit *= 2) {
+            if (Flags & Bit) {
+                while (GetBits(Decoder, 8) && !Decoder->Error)
+                    ;
+            }
+        }
+
+        if (Flags & 2)
+            GetBits(Decoder, 16);
+
+        // The crc and length.
+        Decoder->Trailer = 8;
+    } else if (Decoder->Length >= 2 && (Data[0] & 0x0F) == 8 && (Data[0] << 8 | Data[1]) % 31 == 0) {
+        if (Data[1] & 0x20) {
+            Decoder->Error = "That zlib stream needs a preset dictionary.";
+            return FALSE;
+        }
+
+        GetBits(Decoder, 16);
+
+        // The adler32.
+        Decoder->Trailer = 4;
+    }
+
+    return Decoder->Error == NULL;
+
+damaged:
+    Decoder->Error = "The gzip header is damaged.";
+    return FALSE;
+}
+
+static VOID Inflate(PDECODER Decoder)
+{
+    if (!SkipHeader(Decoder))
+        return;
+
+    while (!Decoder->Finished) {
+        DWORD Type;
+        BOOL Result;
+
+        Decoder->Finished = GetBits(Decoder, 1);
+        Type = GetBits(Decoder, 2);
+
+        if (Decoder->Error)
+            return;
+
+        switch (Type) {
+            case 0:
+                Result = InflateStored(Decoder);
+                break;
+            case 1:
+                Result = InflateFixed(Decoder);
+                break;
+            case 2:
+                Result = InflateDynamic(Decoder);
+                break;
+            default:
+                Decoder->Error = "The compressed data is damaged.";
+                return;
+        }
+
+        if (!Result)
+            return;
+    }
+}
+
+BOOL MeasureCompressed(PJOB Job, HEM_QWORD Offset, HEM_QWORD Limit, HEM_QWORD *Length)
+{
+    PDECODER Decoder;
+    BOOL Result = FALSE;
+
+    if ((Decoder = calloc(1, sizeof *Decoder)) == NULL)
+        return FALSE;
+
+    Decoder->Offset = Offset;
+    Decoder->Start = Offset;
+    Decoder->End = Offset + Limit;
+    Decoder->ChunkSize = DECODE_FIRST_CHUNK;
+    Decoder->Job = Job;
+    Decoder->PollOnly = TRUE;
+
+    if (ReadChunk(Decoder)) {
+        Inflate(Decoder);
+
+        // Whatever is still in the bit buffer wasn't needed.
+        if (Decoder->Error == NULL && Decoder->Finished) {
+            *Length = Decoder->Offset + Decoder->Position - Decoder->Available / 8 - Offset + Decoder->Trailer;
+            Result = *Length <= Limit;
+        }
+    }
+
+    free(Decoder);
+    return Result;
+}
+
+static BOOL SelectDecodeOptions(HEM_QWORD Offset, HEM_QWORD Length)
+{
+    CHAR Lines[2][128];
+    PCHAR Menu[2];
+    DWORD Width = 0;
+    int Choice = 1;
+
+    while (TRUE) {
+        snprintf(Lines[0], sizeof Lines[0], "Decode %#llx bytes from %#llx to a file", Length, Offset);
+        snprintf(Lines[1], sizeof Lines[0], "Format %s", FormatNames[DecodeFormat]);
+
+        for (DWORD i = 0; i < _countof(Menu); i++) {
+            Menu[i] = Lines[i];
+            Width = max(Width, strlen(Lines[i]));
+        }
+
+        Choice = HiewGate_Menu("Decode", Menu, _countof(Menu), Width, Choice, NULL, NULL, NULL, NULL);
+
+        switch (Choice) {
+            case 1:
+                return TRUE;
+            case 2:
+                DecodeFormat = (DecodeFormat + 1) % DECODE_FORMATS;
+                break;
+            default:
+                return FALSE;
+        }
+    }
+}
+
+int DecodeEntryPoint(HEMCALL_TAG *HemCall)
+{
+    CHAR FileName[HEM_FILENAME_MAXLEN] = {0};
+    HIEWGATE_GETDATA HiewData;
+    PDECODER Decoder;
+    JOB Job;
+    HEM_QWORD Offset;
+    HEM_QWORD Length;
+    CHAR Message[256];
+    SIZE_T Used;
+    BOOL Vector;
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return HEM_ERROR;
+
+    GetMarkedRange(&HiewData, &Offset, &Length);
+
+    if (!SelectDecodeOptions(Offset, Length))
+        return HEM_OK;
+
+    if (HiewGate_GetFilename("Save Decoded As", FileName) != HEM_INPUT_CR)
+        return HEM_OK;
+
+    if ((Decoder = calloc(1, sizeof *Decoder)) == NULL) {
+        HiewGate_Message("Decode", "Not enough memory.");
+        return HEM_OK;
+    }
+
+    Decoder->File = CreateFile(FileName,
+                               GENERIC_WRITE,
+                               0,
+                               NULL,
+                               CREATE_ALWAYS,
+                               FILE_FLAG_SEQUENTIAL_SCAN,
+                               NULL);
+
+    if (Decoder->File == INVALID_HANDLE_VALUE) {
+        HiewGate_Message("Decode", "Failed to create that file.");
+        free(Decoder);
+        return HEM_OK;
+    }
+
+    InitializeBase64();
+
+    Vector = HasSsse3();
+
+    Decoder->Job = &Job;
+    Decoder->Offset = Offset;
+    Decoder->Start = Offset;
+    Decoder->End = Offset + Length;
+    Decoder->ChunkSize = DECODE_CHUNK_SIZE;
+
+    BeginJob(&Job, "Decoding", Length);
+
+    if (ReadChunk(Decoder)) {
+        switch (DecodeFormat) {
+            case DECODE_BASE64:
+                do {
+                    DecodeBase64(Decoder, Vector);
+                } while (!Decoder->Error && !Decoder->Finished && ReadChunk(Decoder));
+
+                // Unpadded base64 can end with a partial group.
+                Decoder->BitCount = 0;
+                break;
+            case DECODE_HEX:
+                do {
+                    DecodeHex(Decoder);
+                } while (!Decoder->Error && ReadChunk(Decoder));
+                break;
+            case DECODE_DEFLATE:
+                Inflate(Decoder);
+                break;
+        }
+    }
+
+    if (Decoder->Error == NULL && DecodeFormat == DECODE_HEX && Decoder->BitCount)
+        Decoder->Error = "There's an odd number of hex digits.";
+
+    if (Decoder->Error == NULL && DecodeFormat == DECODE_DEFLATE && !Decoder->Finished)
+        Decoder->Error = "The compressed data ends too soon.";
+
+    FlushOutput(Decoder);
+    EndJob(&Job);
+
+    CloseHandle(Decoder->File);
+
+    if (Job.Cancelled) {
+        snprintf(Message, sizeof Message, "Cancelled after writing %llu bytes.", Decoder->Written);
+    } else if (Decoder->Error) {
+        snprintf(Message,
+                 sizeof Message,
+                 "%s Stopped at %#llx after writing %llu bytes.",
+                 Decoder->Error,
+                 Decoder->Offset + Decoder->Position,
+                 Decoder->Written);
+    } else {
+        Used = snprintf(Message, sizeof Message, "Wrote %llu bytes, read ", Decoder->Written);
+
+        FormatJobStats(&Job, Message + Used, sizeof Message - Used);
+    }
+
+    HiewGate_Message("Decode", Message);
+
+    free(Decoder);
+    return HEM_OK;
+}
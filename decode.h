@@ -0,0 +1,13 @@
+#ifndef __DECODE_H
+#define __DECODE_H
+
+// Decodes the marked block as base64, hex text or deflate into a file.
+int DecodeEntryPoint(HEMCALL_TAG *HemCall);
+
+// Inflates the deflate, zlib or gzip stream at Offset without keeping the
+// output, to find out how many bytes of the file it uses. Returns FALSE if it
+// isn't valid, doesn't end within Limit bytes, or Job was cancelled. Job is
+// only polled for Esc, its progress is left alone.
+BOOL MeasureCompressed(PJOB Job, HEM_QWORD Offset, HEM_QWORD Limit, HEM_QWORD *Length);
+
+#endif
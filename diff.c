@@ -0,0 +1,624 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <intrin.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "stream.h"
+#include "vlist.h"
+#include "diff.h"
+
+// This compares the marked block (or the whole file) with another file. The
+// current file is read through the HiewGate, the other file is mapped a view
+// at a time, and equal runs are skipped with SSE2 compares.
+//
+// When the files differ, I look for the next place they agree again. That's
+// usually at the same alignment (something was changed), but if something
+// was inserted or deleted the rest of the file is shifted, so I also index a
+// window of the other file by a rolling hash and look for where this file
+// lines up with it. The window grows until something is found, so small
+// changes stay cheap.
+//
+// Differences are highlighted with ColorMarker and collected in a list.
+
+// How much to read from this file at once.
+#define DIFF_CHUNK_SIZE (2 * 1024 * 1024)
+
+// This many equal bytes means the files are back in sync.
+#define DIFF_SYNC_LENGTH 32
+
+// How far to look for the files to sync again, this is the biggest insertion
+// or deletion I can find.
+#define DIFF_MIN_RADIUS 256
+#define DIFF_MAX_RADIUS (64 * 1024)
+
+// I always want this much of both files available after a difference.
+#define DIFF_LOOKAHEAD (DIFF_MAX_RADIUS + DIFF_SYNC_LENGTH)
+
+// How much of the other file to map at once, must be much bigger than a chunk.
+#define DIFF_VIEW_SIZE (32 * 1024 * 1024)
+
+// Differences closer than this are shown as one.
+#define DIFF_COALESCE_GAP 16
+
+// Slots in the rolling hash index.
+#define DIFF_TABLE_BITS 17
+
+// The rolling hash multiplier.
+#define DIFF_HASH_PRIME 0x01000193
+
+// ColorMarker can't mark more than this at once.
+#define DIFF_MAX_MARKER 0xFFFFFF
+
+// White on red.
+#define DIFF_COLOR 0x4F
+
+typedef struct _DIFF_RECORD {
+    HEM_QWORD Offset;
+    HEM_QWORD Length;
+    HEM_QWORD OtherOffset;
+    HEM_QWORD OtherLength;
+} DIFF_RECORD, *PDIFF_RECORD;
+
+typedef struct _DIFF_SLOT {
+    DWORD Stamp;
+    DWORD Position;
+} DIFF_SLOT, *PDIFF_SLOT;
+
+typedef struct _DIFF_CONTEXT {
+    // The range of this file being compared.
+    HEM_QWORD Start;
+    HEM_QWORD End;
+    HEM_QWORD FileLength;
+
+    // The file position, and how far ahead the other file is.
+    HEM_QWORD Position;
+    LONGLONG Delta;
+
+    // What has been read of this file.
+    PBYTE Buffer;
+    HEM_QWORD BufferOffset;
+    DWORD BufferLength;
+
+    // The other file, and what's mapped of it.
+    HANDLE File;
+    HANDLE Mapping;
+    HEM_QWORD OtherSize;
+    const BYTE *View;
+    HEM_QWORD ViewOffset;
+    DWORD ViewLength;
+    DWORD Granularity;
+
+    // The index used to find where the files sync.
+    PDIFF_SLOT Table;
+    DWORD Stamp;
+    DWORD HashPower;
+
+    JOB Job;
+    PCHAR Error;
+} DIFF_CONTEXT, *PDIFF_CONTEXT;
+
+// The last comparison is kept so the list can be shown again and the markers
+// removed.
+static struct {
+    VLIST List;
+    DWORD OffsetWidth;
+    HEM_QWORD FileLength;
+    HEM_QWORD Bytes;
+    CHAR Name[64];
+} Differences;
+
+// Returns how many bytes are equal from the start.
+static DWORD FindDifference(const BYTE *Data, const BYTE *Other, DWORD Length)
+{
+    unsigned long Bit;
+    DWORD i = 0;
+
+    // Four vectors at a time, the exact byte only matters once they differ.
+    for (; i + 64 <= Length; i += 64) {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(Data + i)),
+                                   _mm_loadu_si128((const __m128i *)(Other + i)));
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(Data + i + 16)),
+                                   _mm_loadu_si128((const __m128i *)(Other + i + 16)));
+        __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(Data + i + 32)),
+                                   _mm_loadu_si128((const __m128i *)(Other + i + 32)));
+        __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(Data + i + 48)),
+                                   _mm_loadu_si128((const __m128i *)(Other + i + 48)));
+
+        if (_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d))) != 0xFFFF)
+            break;
+    }
+
+    for (; i + 16 <= Length; i += 16) {
+        DWORD Mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(Data + i)),
+                                                      _mm_loadu_si128((const __m128i *)(Other + i))));
+
+        if (_BitScanForward(&Bit, ~Mask & 0xFFFF))
+            return i + Bit;
+    }
+
+    for (; i < Length; i++) {
+        if (Data[i] != Other[i])
+            return i;
+    }
+
+    return Length;
+}
+
+static DWORD HashBlock(const BYTE *Data)
+{
+    DWORD Hash = 0;
+
+    for (DWORD i = 0; i < DIFF_SYNC_LENGTH; i++) {
+        Hash = Hash * DIFF_HASH_PRIME + Data[i];
+    }
+
+    return Hash;
+}
+
+// Remove the first byte of the block and add the one after it.
+static DWORD RollHash(PDIFF_CONTEXT Diff, DWORD Hash, const BYTE *Data)
+{
+    return (Hash - Data[0] * Diff->HashPower) * DIFF_HASH_PRIME + Data[DIFF_SYNC_LENGTH];
+}
+
+static PDIFF_SLOT LookupHash(PDIFF_CONTEXT Diff, DWORD Hash)
+{
+    return &Diff->Table[(Hash * 0x9E3779B1) >> (32 - DIFF_TABLE_BITS)];
+}
+
+// Find the first block of Data that also appears in Other. The same
+// alignment wins if there's a choice, because that means nothing moved.
+static BOOL FindSync(PDIFF_CONTEXT Diff,
+                     const BYTE *Data,
+                     DWORD Length,
+                     const BYTE *Other,
+                     DWORD OtherLength,
+                     PDWORD Position,
+                     PDWORD OtherPosition)
+{
+    PDIFF_SLOT Slot;
+    DWORD Hash;
+
+    if (Length < DIFF_SYNC_LENGTH || OtherLength < DIFF_SYNC_LENGTH)
+        return FALSE;
+
+    // Stamps save clearing the table every time.
+    if (++Diff->Stamp == 0) {
+        ZeroMemory(Diff->Table, sizeof(DIFF_SLOT) << DIFF_TABLE_BITS);
+        Diff->Stamp = 1;
+    }
+
+    // Index the other side, the earliest position wins.
+    Hash = HashBlock(Other);
+
+    for (DWORD i = 0; i + DIFF_SYNC_LENGTH <= OtherLength; i++) {
+        Slot = LookupHash(Diff, Hash);
+
+        if (Slot->Stamp != Diff->Stamp) {
+            Slot->Stamp = Diff->Stamp;
+            Slot->Position = i;
+        }
+
+        if (i + DIFF_SYNC_LENGTH < OtherLength)
+            Hash = RollHash(Diff, Hash, Other + i);
+    }
+
+    Hash = HashBlock(Data);
+
+    for (DWORD i = 0; i + DIFF_SYNC_LENGTH <= Length; i++) {
+        if (i + DIFF_SYNC_LENGTH <= OtherLength && memcmp(Data + i, Other + i, DIFF_SYNC_LENGTH) == 0) {
+            *Position = *OtherPosition = i;
+            return TRUE;
+        }
+
+        Slot = LookupHash(Diff, Hash);
+
+        if (Slot->Stamp == Diff->Stamp && memcmp(Data + i, Other + Slot->Position, DIFF_SYNC_LENGTH) == 0) {
+            *Position = i;
+            *OtherPosition = Slot->Position;
+            return TRUE;
+        }
+
+        if (i + DIFF_SYNC_LENGTH < Length)
+            Hash = RollHash(Diff, Hash, Data + i);
+    }
+
+    return FALSE;
+}
+
+static VOID MarkDifference(PDIFF_RECORD Record, BOOL Remove)
+{
+    HEM_QWORD Offset = Record->Offset;
+    HEM_QWORD Length = Record->Length;
+
+    // Something was deleted here, just mark where.
+    if (Length == 0)
+        Length = 1;
+
+    while (Length) {
+        DWORD Size = min(Length, DIFF_MAX_MARKER);
+
+        HiewGate_ColorMarker(Offset, Remove ? 0 : Size, DIFF_COLOR);
+
+        Offset += Size;
+        Length -= Size;
+    }
+}
+
+static VOID ClearDifferences(VOID)
+{
+    for (DWORD i = 0; i < Differences.List.Count; i++) {
+        PDIFF_RECORD Record = GetVirtualListRecord(&Differences.List, i);
+
+        if (Record->Offset < Differences.FileLength)
+            MarkDifference(Record, TRUE);
+    }
+
+    FreeVirtualList(&Differences.List);
+
+    Differences.Bytes = 0;
+}
+
+static BOOL AddDifference(PDIFF_CONTEXT Diff,
+                          HEM_QWORD Length,
+                          HEM_QWORD OtherLength)
+{
+    HEM_QWORD Offset = Diff->Position;
+    HEM_QWORD OtherOffset = Diff->Position + Diff->Delta;
+    PDIFF_RECORD Record = NULL;
+
+    Differences.Bytes += max(Length, OtherLength);
+
+    if (Differences.List.Count) {
+        Record = GetVirtualListRecord(&Differences.List, Differences.List.Count - 1);
+
+        // The bytes between are equal, so the gap is the same in both files.
+        if (Offset - (Record->Offset + Record->Length) <= DIFF_COALESCE_GAP) {
+            Record->Length = Offset + Length - Record->Offset;
+            Record->OtherLength = OtherOffset + OtherLength - Record->OtherOffset;
+            return TRUE;
+        }
+
+        // That one is finished, it can be shown now.
+        if (Record->Offset < Differences.FileLength)
+            MarkDifference(Record, FALSE);
+    }
+
+    if ((Record = AppendVirtualList(&Differences.List)) == NULL) {
+        Diff->Error = "Not enough memory for that many differences.";
+        return FALSE;
+    }
+
+    Record->Offset = Offset;
+    Record->Length = Length;
+    Record->OtherOffset = OtherOffset;
+    Record->OtherLength = OtherLength;
+    return TRUE;
+}
+
+// Gets Length bytes of the other file, mapping a new view if necessary.
+static const BYTE *MapOtherFile(PDIFF_CONTEXT Diff, HEM_QWORD Offset, DWORD Length)
+{
+    if (Diff->View
+        && Offset >= Diff->ViewOffset
+        && Offset + Length <= Diff->ViewOffset + Diff->ViewLength) {
+        return Diff->View + (Offset - Diff->ViewOffset);
+    }
+
+    if (Diff->View)
+        UnmapViewOfFile(Diff->View);
+
+    Diff->ViewOffset = Offset & ~(HEM_QWORD)(Diff->Granularity - 1);
+    Diff->ViewLength = min(DIFF_VIEW_SIZE, Diff->OtherSize - Diff->ViewOffset);
+    Diff->View = MapViewOfFile(Diff->Mapping,
+                               FILE_MAP_READ,
+                               Diff->ViewOffset >> 32,
+                               Diff->ViewOffset & 0xFFFFFFFF,
+                               Diff->ViewLength);
+
+    if (Diff->View == NULL) {
+        Diff->Error = "Failed to map the other file.";
+        return NULL;
+    }
+
+    return Diff->View + (Offset - Diff->ViewOffset);
+}
+
+// Make sure there's at least a lookahead of this file after Position.
+static int FillBuffer(PDIFF_CONTEXT Diff)
+{
+    HEM_QWORD BufferEnd = Diff->BufferOffset + Diff->BufferLength;
+    DWORD Keep = BufferEnd - Diff->Position;
+    DWORD ReadSize;
+
+    if (Keep >= DIFF_LOOKAHEAD || BufferEnd == Diff->End)
+        return HEM_OK;
+
+    if (!UpdateJob(&Diff->Job, Diff->Position - Diff->Start))
+        return HEM_KEYBREAK;
+
+    memmove(Diff->Buffer, Diff->Buffer + (Diff->Position - Diff->BufferOffset), Keep);
+
+    ReadSize = min(DIFF_CHUNK_SIZE, Diff->End - BufferEnd);
+
+    if (HiewGate_FileRead(BufferEnd, ReadSize, Diff->Buffer + Keep) != (int) ReadSize) {
+        Diff->Error = "Hiew failed to read the file.";
+        return HEM_ERROR;
+    }
+
+    Diff->BufferOffset = Diff->Position;
+    Diff->BufferLength = Keep + ReadSize;
+    return HEM_OK;
+}
+
+static int CompareFiles(PDIFF_CONTEXT Diff)
+{
+    int Result;
+
+    Diff->Position = Diff->Start;
+    Diff->BufferOffset = Diff->Start;
+
+    while (Diff->Position < Diff->End) {
+        HEM_QWORD OtherOffset = Diff->Position + Diff->Delta;
+        DWORD Length, OtherLength, Same, Radius;
+        DWORD Position, OtherPosition;
+        const BYTE *Data, *Other;
+        BOOL Found = FALSE;
+
+        if ((Result = FillBuffer(Diff)) != HEM_OK)
+            return Result;
+
+        // Everything left was added to this file.
+        if (OtherOffset >= Diff->OtherSize) {
+            if (!AddDifference(Diff, Diff->End - Diff->Position, 0))
+                return HEM_ERROR;
+            break;
+        }
+
+        Data = Diff->Buffer + (Diff->Position - Diff->BufferOffset);
+        Length = Diff->BufferOffset + Diff->BufferLength - Diff->Position;
+        OtherLength = min(max(Length, DIFF_LOOKAHEAD), Diff->OtherSize - OtherOffset);
+
+        if ((Other = MapOtherFile(Diff, OtherOffset, OtherLength)) == NULL)
+            return HEM_ERROR;
+
+        // Skip whatever is the same, I'll come back with a full buffer.
+        if ((Same = FindDifference(Data, Other, min(Length, OtherLength))) != 0) {
+            Diff->Position += Same;
+            continue;
+        }
+
+        Length = min(Length, DIFF_LOOKAHEAD);
+        OtherLength = min(OtherLength, DIFF_LOOKAHEAD);
+
+        for (Radius = DIFF_MIN_RADIUS; Radius <= DIFF_MAX_RADIUS; Radius *= 4) {
+            Found = FindSync(Diff,
+                             Data,
+                             min(Length, Radius + DIFF_SYNC_LENGTH),
+                             Other,
+                             min(OtherLength, Radius + DIFF_SYNC_LENGTH),
+                             &Position,
+                             &OtherPosition);
+
+            if (Found || (Length <= Radius + DIFF_SYNC_LENGTH && OtherLength <= Radius + DIFF_SYNC_LENGTH))
+                break;
+        }
+
+        // Nothing lines up nearby, call it changed and keep going.
+        if (!Found) {
+            Position = min(Length, DIFF_MAX_RADIUS);
+            OtherPosition = min(Position, OtherLength);
+        }
+
+        if (!AddDifference(Diff, Position, OtherPosition))
+            return HEM_ERROR;
+
+        Diff->Delta += (LONGLONG) OtherPosition - Position;
+        Diff->Position += Position;
+    }
+
+    // Anything left in the other file was deleted from this one.
+    if (Diff->End == Diff->FileLength && Diff->End + Diff->Delta < Diff->OtherSize) {
+        Diff->Position = Diff->End;
+
+        if (!AddDifference(Diff, 0, Diff->OtherSize - (Diff->End + Diff->Delta)))
+            return HEM_ERROR;
+    }
+
+    // Show the last one.
+    if (Differences.List.Count) {
+        PDIFF_RECORD Record = GetVirtualListRecord(&Differences.List, Differences.List.Count - 1);
+
+        if (Record->Offset < Differences.FileLength)
+            MarkDifference(Record, FALSE);
+    }
+
+    return HEM_OK;
+}
+
+static VOID FormatDifference(PVOID Context, DWORD Index, const VOID *Record, PCHAR Buffer, SIZE_T Size)
+{
+    const DIFF_RECORD *Difference = Record;
+    int Length;
+
+    Length = snprintf(Buffer,
+                      Size,
+                      "%0*llX %0*llX  ",
+                      Differences.OffsetWidth,
+                      Difference->Offset,
+                      Differences.OffsetWidth,
+                      Difference->OtherOffset);
+
+    if (Difference->OtherLength == 0) {
+        snprintf(Buffer + Length, Size - Length, "%llu bytes only in this file", Difference->Length);
+    } else if (Difference->Length == 0) {
+        snprintf(Buffer + Length, Size - Length, "%llu bytes only in %s", Difference->OtherLength, Differences.Name);
+    } else if (Difference->Length == Difference->OtherLength) {
+        snprintf(Buffer + Length, Size - Length, "%llu bytes changed", Difference->Length);
+    } else {
+        snprintf(Buffer + Length, Size - Length, "%llu bytes changed to %llu", Difference->Length, Difference->OtherLength);
+    }
+}
+
+static VOID ShowDifferences(HEMCALL_TAG *HemCall, PCHAR Title)
+{
+    PDIFF_RECORD Record;
+    LONG Selected;
+
+    Selected = ShowVirtualList(&Differences.List,
+                               Title,
+                               Differences.OffsetWidth * 2 + 3 + 48,
+                               0);
+
+    if (Selected >= 0) {
+        Record = GetVirtualListRecord(&Differences.List, Selected);
+
+        HemCall->returnOffset = Record->Offset;
+        HemCall->returnActionFlag |= HEM_RETURN_SETOFFSET;
+    }
+}
+
+int DiffEntryPoint(HEMCALL_TAG *HemCall)
+{
+    static PCHAR Actions[] = {
+        "Compare with file",
+        "Show differences",
+        "Clear highlighting",
+    };
+    CHAR FileName[HEM_FILENAME_MAXLEN] = {0};
+    HIEWGATE_GETDATA HiewData;
+    LARGE_INTEGER OtherSize;
+    SYSTEM_INFO SystemInfo;
+    DIFF_CONTEXT Diff = {0};
+    HEM_QWORD Length;
+    CHAR Title[128];
+    PCHAR BaseName;
+    int Result;
+
+    // If there's already a comparison, maybe I want to look at it again.
+    if (Differences.List.Count) {
+        switch (HiewGate_Menu("Compare", Actions, _countof(Actions), 20, 1, NULL, NULL, NULL, NULL)) {
+            case 1:
+                break;
+            case 2:
+                snprintf(Title, sizeof Title, "%u differences from %s", Differences.List.Count, Differences.Name);
+                ShowDifferences(HemCall, Title);
+                return HEM_OK;
+            case 3:
+                ClearDifferences();
+                return HEM_OK;
+            default:
+                return HEM_OK;
+        }
+    }
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return HEM_ERROR;
+
+    if (HiewGate_GetFilename("Compare With", FileName) != HEM_INPUT_CR)
+        return HEM_OK;
+
+    Diff.File = CreateFile(FileName,
+                           GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE,
+                           NULL,
+                           OPEN_EXISTING,
+                           FILE_FLAG_SEQUENTIAL_SCAN,
+                           NULL);
+
+    if (Diff.File == INVALID_HANDLE_VALUE) {
+        HiewGate_Message("Error", "Failed to open that file.");
+        return HEM_OK;
+    }
+
+    if (!GetFileSizeEx(Diff.File, &OtherSize)) {
+        HiewGate_Message("Error", "Failed to read that file.");
+        goto finished;
+    }
+
+    // An empty file can't be mapped, but there's nothing to read anyway.
+    if (OtherSize.QuadPart) {
+        Diff.Mapping = CreateFileMapping(Diff.File, NULL, PAGE_READONLY, 0, 0, NULL);
+
+        if (Diff.Mapping == NULL) {
+            HiewGate_Message("Error", "Failed to map that file.");
+            goto finished;
+        }
+    }
+
+    GetSystemInfo(&SystemInfo);
+    GetMarkedRange(&HiewData, &Diff.Start, &Length);
+
+    Diff.End = Diff.Start + Length;
+    Diff.FileLength = HiewData.filelength;
+    Diff.OtherSize = OtherSize.QuadPart;
+    Diff.Granularity = SystemInfo.dwAllocationGranularity;
+    Diff.Buffer = malloc(DIFF_CHUNK_SIZE + DIFF_LOOKAHEAD);
+    Diff.Table = calloc(1, sizeof(DIFF_SLOT) << DIFF_TABLE_BITS);
+    Diff.HashPower = 1;
+
+    for (DWORD i = 1; i < DIFF_SYNC_LENGTH; i++) {
+        Diff.HashPower *= DIFF_HASH_PRIME;
+    }
+
+    if (Diff.Buffer == NULL || Diff.Table == NULL) {
+        HiewGate_Message("Error", "Not enough memory to compare.");
+        goto finished;
+    }
+
+    // Remove the highlighting from last time.
+    ClearDifferences();
+
+    BaseName = max(strrchr(FileName, '\\'), strrchr(FileName, '/'));
+    BaseName = BaseName ? BaseName + 1 : FileName;
+
+    strncpy_s(Differences.Name, sizeof Differences.Name, BaseName, _TRUNCATE);
+
+    Differences.FileLength = Diff.FileLength;
+    Differences.OffsetWidth = max(Diff.FileLength, Diff.OtherSize) > 0xFFFFFFFF ? 16 : 8;
+
+    InitVirtualList(&Differences.List, sizeof(DIFF_RECORD), FormatDifference, NULL);
+
+    BeginJob(&Diff.Job, "Comparing", Length);
+
+    Result = CompareFiles(&Diff);
+
+    EndJob(&Diff.Job);
+
+    if (Result != HEM_OK) {
+        HiewGate_Message("Compare", Result == HEM_KEYBREAK ? "Cancelled." : Diff.Error);
+        ClearDifferences();
+        goto finished;
+    }
+
+    if (Differences.List.Count == 0) {
+        HiewGate_Message("Compare", "The files are identical.");
+        goto finished;
+    }
+
+    snprintf(Title,
+             sizeof Title,
+             "%u differences from %s, %llu bytes (%llu ms)",
+             Differences.List.Count,
+             Differences.Name,
+             Differences.Bytes,
+             Diff.Job.Elapsed);
+
+    ShowDifferences(HemCall, Title);
+
+finished:
+    if (Diff.View)
+        UnmapViewOfFile(Diff.View);
+    if (Diff.Mapping)
+        CloseHandle(Diff.Mapping);
+    CloseHandle(Diff.File);
+    free(Diff.Buffer);
+    free(Diff.Table);
+    return HEM_OK;
+}
@@ -0,0 +1,8 @@
+#ifndef __DIFF_H
+#define __DIFF_H
+
+// Compares the marked block (or the whole file) with another file, the
+// differences are highlighted and can be browsed.
+int DiffEntryPoint(HEMCALL_TAG *HemCall);
+
+#endif
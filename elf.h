@@ -0,0 +1,122 @@
+#ifndef __ELF_H
+#define __ELF_H
+
+// Just the parts of the ELF format I need, all little endian.
+
+typedef struct _ELF32_HEADER {
+    BYTE Ident[16];
+    WORD Type;
+    WORD Machine;
+    DWORD Version;
+    DWORD Entry;
+    DWORD ProgramOffset;
+    DWORD SectionOffset;
+    DWORD Flags;
+    WORD HeaderSize;
+    WORD ProgramEntrySize;
+    WORD ProgramCount;
+    WORD SectionEntrySize;
+    WORD SectionCount;
+    WORD SectionNames;
+} ELF32_HEADER, *PELF32_HEADER;
+
+typedef struct _ELF64_HEADER {
+    BYTE Ident[16];
+    WORD Type;
+    WORD Machine;
+    DWORD Version;
+    ULONGLONG Entry;
+    ULONGLONG ProgramOffset;
+    ULONGLONG SectionOffset;
+    DWORD Flags;
+    WORD HeaderSize;
+    WORD ProgramEntrySize;
+    WORD ProgramCount;
+    WORD SectionEntrySize;
+    WORD SectionCount;
+    WORD SectionNames;
+} ELF64_HEADER, *PELF64_HEADER;
+
+typedef struct _ELF32_PROGRAM {
+    DWORD Type;
+    DWORD Offset;
+    DWORD Address;
+    DWORD PhysicalAddress;
+    DWORD FileSize;
+    DWORD MemorySize;
+    DWORD Flags;
+    DWORD Align;
+} ELF32_PROGRAM, *PELF32_PROGRAM;
+
+typedef struct _ELF64_PROGRAM {
+    DWORD Type;
+    DWORD Flags;
+    ULONGLONG Offset;
+    ULONGLONG Address;
+    ULONGLONG PhysicalAddress;
+    ULONGLONG FileSize;
+    ULONGLONG MemorySize;
+    ULONGLONG Align;
+} ELF64_PROGRAM, *PELF64_PROGRAM;
+
+typedef struct _ELF32_SECTION {
+    DWORD Name;
+    DWORD Type;
+    DWORD Flags;
+    DWORD Address;
+    DWORD Offset;
+    DWORD Size;
+    DWORD Link;
+    DWORD Info;
+    DWORD Align;
+    DWORD EntrySize;
+} ELF32_SECTION, *PELF32_SECTION;
+
+typedef struct _ELF64_SECTION {
+    DWORD Name;
+    DWORD Type;
+    ULONGLONG Flags;
+    ULONGLONG Address;
+    ULONGLONG Offset;
+    ULONGLONG Size;
+    DWORD Link;
+    DWORD Info;
+    ULONGLONG Align;
+    ULONGLONG EntrySize;
+} ELF64_SECTION, *PELF64_SECTION;
+
+typedef struct _ELF32_SYMBOL {
+    DWORD Name;
+    DWORD Value;
+    DWORD Size;
+    BYTE Info;
+    BYTE Other;
+    WORD Section;
+} ELF32_SYMBOL, *PELF32_SYMBOL;
+
+typedef struct _ELF64_SYMBOL {
+    DWORD Name;
+    BYTE Info;
+    BYTE Other;
+    WORD Section;
+    ULONGLONG Value;
+    ULONGLONG Size;
+} ELF64_SYMBOL, *PELF64_SYMBOL;
+
+#define ELF_CLASS64     2
+#define ELF_DATA_LSB    1
+
+#define ELF_PT_LOAD     1
+#define ELF_PF_X        1
+
+#define ELF_SHT_SYMTAB  2
+#define ELF_SHT_NOBITS  8
+#define ELF_SHT_DYNSYM  11
+
+#define ELF_SHN_UNDEF       0
+#define ELF_SHN_LORESERVE   0xFF00
+
+#define ELF_STT_OBJECT  1
+#define ELF_STT_FUNC    2
+
+#endif
@@ -0,0 +1,298 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "stream.h"
+#include "vlist.h"
+#include "rcache.h"
+#include "entropy.h"
+
+// This splits a range into fixed size windows and calculates the entropy and
+// a byte histogram of each one, which makes compressed or encrypted regions
+// easy to spot.
+//
+// Each chunk from the stream is split into windows that are counted in
+// parallel. Only a small summary of each window is kept in a virtual list, so
+// huge maps open instantly.
+
+// Rows are kept below this, the window size is chosen to fit.
+#define ENTROPY_MAX_ROWS (1024 * 1024)
+
+// Windows are a power of two between these, so they never cross a chunk.
+#define ENTROPY_MIN_WINDOW 256
+#define ENTROPY_MAX_WINDOW (1024 * 1024)
+
+// Entropy is kept in millibits per byte.
+#define ENTROPY_MAX 8000
+
+// Anything above this is probably compressed or encrypted.
+#define ENTROPY_HIGH 7200
+
+#define ENTROPY_BAR_WIDTH 32
+
+// Counts up to this have a precalculated n*log2(n).
+#define ENTROPY_LOG_TABLE_SIZE (64 * 1024)
+
+typedef struct _ENTROPY_ROW {
+    WORD Entropy;
+    WORD Distinct;
+    BYTE Top;
+    BYTE TopPercent;
+} ENTROPY_ROW, *PENTROPY_ROW;
+
+typedef struct _ENTROPY_MAP {
+    HEM_QWORD Offset;
+    HEM_QWORD Length;
+    DWORD WindowSize;
+    DWORD OffsetWidth;
+    VLIST Rows;
+
+    // The chunk currently being counted.
+    HEM_QWORD ChunkOffset;
+    const BYTE *Data;
+    DWORD ChunkLength;
+} ENTROPY_MAP, *PENTROPY_MAP;
+
+static float NLogN[ENTROPY_LOG_TABLE_SIZE + 1];
+static INIT_ONCE EntropyInit = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK InitializeEntropy(PINIT_ONCE InitOnce,
+                                       PVOID Parameter,
+                                       PVOID *Context)
+{
+    for (DWORD i = 1; i <= ENTROPY_LOG_TABLE_SIZE; i++) {
+        NLogN[i] = i * log2(i);
+    }
+    return TRUE;
+}
+
+// Counting into one table means consecutive equal bytes wait on each other,
+// which is common (think runs of zeros). Four tables, one per byte lane,
+// keeps the increments independent.
+static VOID CountBytes(const BYTE *Data, DWORD Length, PDWORD Counts)
+{
+    DWORD Lanes[4][256] = {0};
+    DWORD i = 0;
+
+    for (; i + 8 <= Length; i += 8) {
+        DWORD One = *(const DWORD *)(Data + i);
+        DWORD Two = *(const DWORD *)(Data + i + 4);
+
+        Lanes[0][One & 0xFF]++;
+        Lanes[1][(One >> 8) & 0xFF]++;
+        Lanes[2][(One >> 16) & 0xFF]++;
+        Lanes[3][One >> 24]++;
+        Lanes[0][Two & 0xFF]++;
+        Lanes[1][(Two >> 8) & 0xFF]++;
+        Lanes[2][(Two >> 16) & 0xFF]++;
+        Lanes[3][Two >> 24]++;
+    }
+
+    for (; i < Length; i++) {
+        Lanes[0][Data[i]]++;
+    }
+
+    for (DWORD c = 0; c < 256; c++) {
+        Counts[c] = Lanes[0][c] + Lanes[1][c] + Lanes[2][c] + Lanes[3][c];
+    }
+}
+
+static VOID CountWindow(PVOID Context, DWORD Index)
+{
+    PENTROPY_MAP Map = Context;
+    DWORD Offset = Index * Map->WindowSize;
+    DWORD Length = min(Map->WindowSize, Map->ChunkLength - Offset);
+    PENTROPY_ROW Row = GetVirtualListRecord(&Map->Rows, (Map->ChunkOffset - Map->Offset) / Map->WindowSize + Index);
+    DWORD Counts[256];
+    double Sum = 0;
+    DWORD Top = 0;
+
+    CountBytes(Map->Data + Offset, Length, Counts);
+
+    Row->Distinct = 0;
+
+    // H = log2(n) - sum(c * log2(c)) / n
+    for (DWORD c = 0; c < 256; c++) {
+        if (Counts[c] == 0)
+            continue;
+
+        Row->Distinct++;
+
+        Sum += Counts[c] <= ENTROPY_LOG_TABLE_SIZE ? NLogN[Counts[c]] : Counts[c] * log2(Counts[c]);
+
+        if (Counts[c] > Counts[Top])
+            Top = c;
+    }
+
+    Row->Entropy = max(0, (log2(Length) - Sum / Length) * 1000 + 0.5);
+    Row->Top = Top;
+    Row->TopPercent = Counts[Top] * 100ULL / Length;
+}
+
+static BOOL CountChunk(PVOID Context, HEM_QWORD Offset, const BYTE *Data, DWORD Length)
+{
+    PENTROPY_MAP Map = Context;
+
+    Map->ChunkOffset = Offset;
+    Map->Data = Data;
+    Map->ChunkLength = Length;
+
+    ParallelFor((Length + Map->WindowSize - 1) / Map->WindowSize, CountWindow, Map);
+    return TRUE;
+}
+
+static VOID FormatEntropyRow(PVOID Context, DWORD Index, const VOID *Record, PCHAR Buffer, SIZE_T Size)
+{
+    PENTROPY_MAP Map = Context;
+    const ENTROPY_ROW *Row = Record;
+    DWORD Fill = Row->Entropy * ENTROPY_BAR_WIDTH / ENTROPY_MAX;
+    CHAR Bar[ENTROPY_BAR_WIDTH + 1];
+
+    memset(Bar, '#', Fill);
+    memset(Bar + Fill, '.', ENTROPY_BAR_WIDTH - Fill);
+
+    Bar[ENTROPY_BAR_WIDTH] = '\0';
+
+    snprintf(Buffer,
+             Size,
+             "%0*llX %c%u.%03u %s %3u  %02X %3u%%",
+             Map->OffsetWidth,
+             Map->Offset + (HEM_QWORD) Index * Map->WindowSize,
+             Row->Entropy >= ENTROPY_HIGH ? '*' : ' ',
+             Row->Entropy / 1000,
+             Row->Entropy % 1000,
+             Bar,
+             Row->Distinct,
+             Row->Top,
+             Row->TopPercent);
+}
+
+// The smallest power of two window that keeps the map a reasonable size.
+static DWORD ChooseWindowSize(HEM_QWORD Length)
+{
+    DWORD WindowSize = ENTROPY_MIN_WINDOW;
+
+    while (WindowSize < ENTROPY_MAX_WINDOW && Length / WindowSize >= ENTROPY_MAX_ROWS) {
+        WindowSize *= 2;
+    }
+
+    return WindowSize;
+}
+
+int EntropyEntryPoint(HEMCALL_TAG *HemCall)
+{
+    static PCHAR Sizes[] = {
+        "Automatic",
+        "256 bytes",
+        "1K",
+        "4K",
+        "16K",
+        "64K",
+        "256K",
+        "1M",
+    };
+    HIEWGATE_GETDATA HiewData;
+    STREAM_CONSUMER Consumer;
+    JOB Job;
+    ENTROPY_MAP Map = {0};
+    RESULT_KEY Key = { RESULT_ENTROPY };
+    RESULT_PART Part;
+    const VOID *Saved;
+    SIZE_T Size;
+    CHAR Title[128];
+    LONG Selected;
+    int Choice;
+    int Result;
+
+    InitOnceExecuteOnce(&EntropyInit, InitializeEntropy, NULL, NULL);
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return HEM_ERROR;
+
+    GetMarkedRange(&HiewData, &Map.Offset, &Map.Length);
+
+    if (Map.Length == 0) {
+        HiewGate_Message("Entropy", "There's nothing to measure.");
+        return HEM_OK;
+    }
+
+    Choice = HiewGate_Menu("Window Size", Sizes, _countof(Sizes), 16, 1, NULL, NULL, NULL, NULL);
+
+    if (Choice <= 0)
+        return HEM_OK;
+
+    // 256 bytes, then each one is four times bigger.
+    Map.WindowSize = Choice == 1 ? ChooseWindowSize(Map.Length)
+                                 : ENTROPY_MIN_WINDOW << ((Choice - 2) * 2);
+
+    if (Map.Length / Map.WindowSize >= ENTROPY_MAX_ROWS) {
+        HiewGate_Message("Entropy", "That window size is too small for this much data.");
+        return HEM_OK;
+    }
+
+    Map.OffsetWidth = HiewData.filelength > 0xFFFFFFFF ? 16 : 8;
+
+    InitVirtualList(&Map.Rows, sizeof(ENTROPY_ROW), FormatEntropyRow, &Map);
+
+    if (!ResizeVirtualList(&Map.Rows, (Map.Length + Map.WindowSize - 1) / Map.WindowSize)) {
+        HiewGate_Message("Error", "Not enough memory for the map.");
+        return HEM_OK;
+    }
+
+    Key.Offset = Map.Offset;
+    Key.Length = Map.Length;
+    Key.Parameter = Map.WindowSize;
+
+    Part.Data = GetVirtualListRecord(&Map.Rows, 0);
+    Part.Size = Map.Rows.Count * sizeof(ENTROPY_ROW);
+
+    // I might have measured this before.
+    if ((Saved = FindCachedResult(&Key, &Size)) != NULL && Size == Part.Size) {
+        CopyMemory(GetVirtualListRecord(&Map.Rows, 0), Saved, Size);
+        goto show;
+    }
+
+    Consumer.Routine = CountChunk;
+    Consumer.Context = &Map;
+
+    BeginJob(&Job, "Measuring entropy", Map.Length);
+
+    Result = StreamFileRange(&Job, Map.Offset, Map.Length, &Consumer, 1);
+
+    EndJob(&Job);
+
+    if (Result != HEM_OK) {
+        HiewGate_Message("Entropy", Result == HEM_KEYBREAK ? "Cancelled." : "Hiew failed to read the file.");
+        goto finished;
+    }
+
+    SaveCachedResult(&Key, &Part, 1);
+
+show:
+
+    snprintf(Title,
+             sizeof Title,
+             "Entropy of %u byte windows (* = likely packed), distinct, top byte",
+             Map.WindowSize);
+
+    Selected = ShowVirtualList(&Map.Rows,
+                               Title,
+                               Map.OffsetWidth + 2 + 5 + 1 + ENTROPY_BAR_WIDTH + 14,
+                               0);
+
+    if (Selected >= 0) {
+        HemCall->returnOffset = Map.Offset + (HEM_QWORD) Selected * Map.WindowSize;
+        HemCall->returnActionFlag |= HEM_RETURN_SETOFFSET;
+    }
+
+finished:
+    FreeVirtualList(&Map.Rows);
+    return HEM_OK;
+}
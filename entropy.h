@@ -0,0 +1,8 @@
+#ifndef __ENTROPY_H
+#define __ENTROPY_H
+
+// Shows the entropy of every window of the marked block (or file), choosing
+// a window jumps to it.
+int EntropyEntryPoint(HEMCALL_TAG *HemCall);
+
+#endif
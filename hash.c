@@ -0,0 +1,888 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <intrin.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "stream.h"
+#include "rcache.h"
+#include "hash.h"
+
+// This hashes a range of the file with several digests in one pass. The range
+// is streamed through the HiewGate (see stream.c), and every digest runs on
+// its own thread, so the time taken is roughly the slowest digest or the gate,
+// whichever is worse.
+//
+// The SSE4.2 crc32 instruction and the SHA extensions are used if the cpu has
+// them, otherwise I use table driven or plain C versions.
+
+typedef struct _SHA_STATE {
+    DWORD State[8];
+    ULONGLONG Length;
+    BYTE Buffer[64];
+} SHA_STATE, *PSHA_STATE;
+
+typedef struct _XXH64_STATE {
+    ULONGLONG Length;
+    ULONGLONG Seed;
+    ULONGLONG Acc[4];
+    BYTE Buffer[32];
+} XXH64_STATE, *PXXH64_STATE;
+
+typedef struct _HASH_DIGEST HASH_DIGEST, *PHASH_DIGEST;
+
+typedef struct _HASH_CONTEXT {
+    PHASH_DIGEST Digest;
+    union {
+        DWORD Crc;
+        SHA_STATE Sha;
+        XXH64_STATE Xxh;
+    };
+    BYTE Result[32];
+} HASH_CONTEXT, *PHASH_CONTEXT;
+
+struct _HASH_DIGEST {
+    PCHAR Name;
+    DWORD Size;
+    VOID (*Init)(PHASH_CONTEXT Hash);
+    VOID (*Update)(PHASH_CONTEXT Hash, const BYTE *Data, SIZE_T Length);
+    VOID (*Final)(PHASH_CONTEXT Hash);
+};
+
+typedef VOID (*PSHA_BLOCKS)(PDWORD State, const BYTE *Data, SIZE_T Blocks);
+
+static DWORD Crc32Table[8][256];
+static DWORD Crc32cTable[256];
+static BOOL HasSse42;
+static BOOL HasShaNi;
+static INIT_ONCE HashInit = INIT_ONCE_STATIC_INIT;
+
+static const DWORD Sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static BOOL CALLBACK InitializeHash(PINIT_ONCE InitOnce,
+                                    PVOID Parameter,
+                                    PVOID *Context)
+{
+    int CpuInfo[4];
+    int MaxLeaf;
+
+    __cpuid(CpuInfo, 0);
+
+    MaxLeaf = CpuInfo[0];
+
+    __cpuid(CpuInfo, 1);
+
+    HasSse42 = !!(CpuInfo[2] & (1 << 20));
+
+    // The SHA code also needs SSSE3 and SSE4.1.
+    if (MaxLeaf >= 7 && (CpuInfo[2] & (1 << 9)) && (CpuInfo[2] & (1 << 19))) {
+        __cpuidex(CpuInfo, 7, 0);
+        HasShaNi = !!(CpuInfo[1] & (1 << 29));
+    }
+
+    // Slicing-by-8 tables, Crc32Table[n] advances a byte through n more zeros.
+    for (DWORD i = 0; i < 256; i++) {
+        DWORD Crc = i;
+        DWORD Crcc = i;
+
+        for (DWORD j = 0; j < 8; j++) {
+            Crc = (Crc >> 1) ^ (Crc & 1 ? 0xEDB88320 : 0);
+            Crcc = (Crcc >> 1) ^ (Crcc & 1 ? 0x82F63B78 : 0);
+        }
+
+        Crc32Table[0][i] = Crc;
+        Crc32cTable[i] = Crcc;
+    }
+
+    for (DWORD i = 0; i < 256; i++) {
+        for (DWORD j = 1; j < 8; j++) {
+            DWORD Crc = Crc32Table[j - 1][i];
+            Crc32Table[j][i] = (Crc >> 8) ^ Crc32Table[0][Crc & 0xFF];
+        }
+    }
+
+    return TRUE;
+}
+
+static DWORD LoadBigEndian32(const BYTE *Data)
+{
+    return Data[0] << 24 | Data[1] << 16 | Data[2] << 8 | Data[3];
+}
+
+static VOID StoreBigEndian32(PBYTE Data, DWORD Value)
+{
+    Data[0] = Value >> 24;
+    Data[1] = Value >> 16;
+    Data[2] = Value >> 8;
+    Data[3] = Value;
+}
+
+DWORD UpdateCrc32(DWORD Crc, const VOID *Buffer, SIZE_T Length)
+{
+    const BYTE *Data = Buffer;
+
+    InitOnceExecuteOnce(&HashInit, InitializeHash, NULL, NULL);
+
+    Crc = ~Crc;
+
+    while (Length && ((ULONG_PTR) Data & 3)) {
+        Crc = Crc32Table[0][(Crc ^ *Data++) & 0xFF] ^ (Crc >> 8);
+        Length--;
+    }
+
+    // Eight bytes at a time, the lookups are independent.
+    while (Length >= 8) {
+        DWORD One = *(const DWORD *)(Data + 0) ^ Crc;
+        DWORD Two = *(const DWORD *)(Data + 4);
+
+        Crc = Crc32Table[7][One & 0xFF]
+            ^ Crc32Table[6][(One >> 8) & 0xFF]
+            ^ Crc32Table[5][(One >> 16) & 0xFF]
+            ^ Crc32Table[4][One >> 24]
+            ^ Crc32Table[3][Two & 0xFF]
+            ^ Crc32Table[2][(Two >> 8) & 0xFF]
+            ^ Crc32Table[1][(Two >> 16) & 0xFF]
+            ^ Crc32Table[0][Two >> 24];
+
+        Data += 8;
+        Length -= 8;
+    }
+
+    while (Length--) {
+        Crc = Crc32Table[0][(Crc ^ *Data++) & 0xFF] ^ (Crc >> 8);
+    }
+
+    return ~Crc;
+}
+
+DWORD UpdateCrc32c(DWORD Crc, const VOID *Buffer, SIZE_T Length)
+{
+    const BYTE *Data = Buffer;
+
+    InitOnceExecuteOnce(&HashInit, InitializeHash, NULL, NULL);
+
+    Crc = ~Crc;
+
+    if (HasSse42) {
+        while (Length && ((ULONG_PTR) Data & 3)) {
+            Crc = _mm_crc32_u8(Crc, *Data++);
+            Length--;
+        }
+
+        while (Length >= 4) {
+            Crc = _mm_crc32_u32(Crc, *(const DWORD *) Data);
+            Data += 4;
+            Length -= 4;
+        }
+
+        while (Length--) {
+            Crc = _mm_crc32_u8(Crc, *Data++);
+        }
+    } else {
+        while (Length--) {
+            Crc = Crc32cTable[(Crc ^ *Data++) & 0xFF] ^ (Crc >> 8);
+        }
+    }
+
+    return ~Crc;
+}
+
+static VOID Sha1BlocksGeneric(PDWORD State, const BYTE *Data, SIZE_T Blocks)
+{
+    DWORD W[80];
+
+    while (Blocks--) {
+        DWORD a = State[0];
+        DWORD b = State[1];
+        DWORD c = State[2];
+        DWORD d = State[3];
+        DWORD e = State[4];
+
+        for (DWORD t = 0; t < 16; t++) {
+            W[t] = LoadBigEndian32(Data + t * 4);
+        }
+
+        for (DWORD t = 16; t < 80; t++) {
+            W[t] = _rotl(W[t - 3] ^ W[t - 8] ^ W[t - 14] ^ W[t - 16], 1);
+        }
+
+        for (DWORD t = 0; t < 80; t++) {
+            DWORD f;
+            DWORD k;
+            DWORD Temp;
+
+            if (t < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (t < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (t < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+
+            Temp = _rotl(a, 5) + f + e + k + W[t];
+            e = d;
+            d = c;
+            c = _rotl(b, 30);
+            b = a;
+            a = Temp;
+        }
+
+        State[0] += a;
+        State[1] += b;
+        State[2] += c;
+        State[3] += d;
+        State[4] += e;
+
+        Data += 64;
+    }
+}
+
+// Four rounds of SHA-1 with the SHA extensions, see the Intel SHA extensions
+// paper. The message schedule for later rounds is computed as I go.
+#define SHA1_ROUNDS(g, Cur, Other)                                                      \
+    do {                                                                                \
+        if ((g) == 0) {                                                                 \
+            Cur = _mm_add_epi32(Cur, M[0]);                                             \
+        } else {                                                                        \
+            Cur = _mm_sha1nexte_epu32(Cur, M[(g) & 3]);                                 \
+        }                                                                               \
+        Other = Abcd;                                                                   \
+        if ((g) >= 3 && (g) <= 18) {                                                    \
+            M[((g) + 1) & 3] = _mm_sha1msg2_epu32(M[((g) + 1) & 3], M[(g) & 3]);        \
+        }                                                                               \
+        Abcd = _mm_sha1rnds4_epu32(Abcd, Cur, (g) / 5);                                 \
+        if ((g) >= 1 && (g) <= 16) {                                                    \
+            M[((g) - 1) & 3] = _mm_sha1msg1_epu32(M[((g) - 1) & 3], M[(g) & 3]);        \
+        }                                                                               \
+        if ((g) >= 2 && (g) <= 17) {                                                    \
+            M[((g) - 2) & 3] = _mm_xor_si128(M[((g) - 2) & 3], M[(g) & 3]);             \
+        }                                                                               \
+    } while (FALSE)
+
+static VOID Sha1BlocksNi(PDWORD State, const BYTE *Data, SIZE_T Blocks)
+{
+    const __m128i Mask = _mm_set_epi32(0x00010203, 0x04050607, 0x08090a0b, 0x0c0d0e0f);
+    __m128i Abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) State), 0x1B);
+    __m128i E0 = _mm_set_epi32(State[4], 0, 0, 0);
+    __m128i E1;
+    __m128i M[4];
+
+    while (Blocks--) {
+        __m128i AbcdSave = Abcd;
+        __m128i E0Save = E0;
+
+        for (DWORD i = 0; i < 4; i++) {
+            M[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(Data + i * 16)), Mask);
+        }
+
+        SHA1_ROUNDS(0, E0, E1);
+        SHA1_ROUNDS(1, E1, E0);
+        SHA1_ROUNDS(2, E0, E1);
+        SHA1_ROUNDS(3, E1, E0);
+        SHA1_ROUNDS(4, E0, E1);
+        SHA1_ROUNDS(5, E1, E0);
+        SHA1_ROUNDS(6, E0, E1);
+        SHA1_ROUNDS(7, E1, E0);
+        SHA1_ROUNDS(8, E0, E1);
+        SHA1_ROUNDS(9, E1, E0);
+        SHA1_ROUNDS(10, E0, E1);
+        SHA1_ROUNDS(11, E1, E0);
+        SHA1_ROUNDS(12, E0, E1);
+        SHA1_ROUNDS(13, E1, E0);
+        SHA1_ROUNDS(14, E0, E1);
+        SHA1_ROUNDS(15, E1, E0);
+        SHA1_ROUNDS(16, E0, E1);
+        SHA1_ROUNDS(17, E1, E0);
+        SHA1_ROUNDS(18, E0, E1);
+        SHA1_ROUNDS(19, E1, E0);
+
+        E0 = _mm_sha1nexte_epu32(E0, E0Save);
+        Abcd = _mm_add_epi32(Abcd, AbcdSave);
+
+        Data += 64;
+    }
+
+    _mm_storeu_si128((__m128i *) State, _mm_shuffle_epi32(Abcd, 0x1B));
+
+    State[4] = _mm_extract_epi32(E0, 3);
+}
+
+static VOID Sha256BlocksGeneric(PDWORD State, const BYTE *Data, SIZE_T Blocks)
+{
+    DWORD W[64];
+
+    while (Blocks--) {
+        DWORD s[8];
+
+        for (DWORD t = 0; t < 16; t++) {
+            W[t] = LoadBigEndian32(Data + t * 4);
+        }
+
+        for (DWORD t = 16; t < 64; t++) {
+            DWORD s0 = _rotr(W[t - 15], 7) ^ _rotr(W[t - 15], 18) ^ (W[t - 15] >> 3);
+            DWORD s1 = _rotr(W[t - 2], 17) ^ _rotr(W[t - 2], 19) ^ (W[t - 2] >> 10);
+            W[t] = W[t - 16] + s0 + W[t - 7] + s1;
+        }
+
+        CopyMemory(s, State, sizeof s);
+
+        for (DWORD t = 0; t < 64; t++) {
+            DWORD S1 = _rotr(s[4], 6) ^ _rotr(s[4], 11) ^ _rotr(s[4], 25);
+            DWORD Ch = (s[4] & s[5]) ^ (~s[4] & s[6]);
+            DWORD Temp1 = s[7] + S1 + Ch + Sha256K[t] + W[t];
+            DWORD S0 = _rotr(s[0], 2) ^ _rotr(s[0], 13) ^ _rotr(s[0], 22);
+            DWORD Maj = (s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]);
+
+            s[7] = s[6];
+            s[6] = s[5];
+            s[5] = s[4];
+            s[4] = s[3] + Temp1;
+            s[3] = s[2];
+            s[2] = s[1];
+            s[1] = s[0];
+            s[0] = Temp1 + S0 + Maj;
+        }
+
+        for (DWORD i = 0; i < 8; i++) {
+            State[i] += s[i];
+        }
+
+        Data += 64;
+    }
+}
+
+// Four rounds of SHA-256 with the SHA extensions.
+#define SHA256_ROUNDS(g)                                                                \
+    do {                                                                                \
+        Msg = _mm_add_epi32(M[(g) & 3], _mm_loadu_si128((const __m128i *) &Sha256K[(g) * 4])); \
+        State1 = _mm_sha256rnds2_epu32(State1, State0, Msg);                            \
+        if ((g) >= 3 && (g) <= 14) {                                                    \
+            Temp = _mm_alignr_epi8(M[(g) & 3], M[((g) - 1) & 3], 4);                    \
+            M[((g) + 1) & 3] = _mm_add_epi32(M[((g) + 1) & 3], Temp);                   \
+            M[((g) + 1) & 3] = _mm_sha256msg2_epu32(M[((g) + 1) & 3], M[(g) & 3]);      \
+        }                                                                               \
+        Msg = _mm_shuffle_epi32(Msg, 0x0E);                                             \
+        State0 = _mm_sha256rnds2_epu32(State0, State1, Msg);                            \
+        if ((g) >= 1 && (g) <= 12) {                                                    \
+            M[((g) - 1) & 3] = _mm_sha256msg1_epu32(M[((g) - 1) & 3], M[(g) & 3]);      \
+        }                                                                               \
+    } while (FALSE)
+
+static VOID Sha256BlocksNi(PDWORD State, const BYTE *Data, SIZE_T Blocks)
+{
+    const __m128i Mask = _mm_set_epi32(0x0c0d0e0f, 0x08090a0b, 0x04050607, 0x00010203);
+    __m128i State0;
+    __m128i State1;
+    __m128i Temp;
+    __m128i Msg;
+    __m128i M[4];
+
+    // The instructions want the state as ABEF and CDGH.
+    Temp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &State[0]), 0xB1);
+    State1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &State[4]), 0x1B);
+    State0 = _mm_alignr_epi8(Temp, State1, 8);
+    State1 = _mm_blend_epi16(State1, Temp, 0xF0);
+
+    while (Blocks--) {
+        __m128i State0Save = State0;
+        __m128i State1Save = State1;
+
+        for (DWORD i = 0; i < 4; i++) {
+            M[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(Data + i * 16)), Mask);
+        }
+
+        SHA256_ROUNDS(0);
+        SHA256_ROUNDS(1);
+        SHA256_ROUNDS(2);
+        SHA256_ROUNDS(3);
+        SHA256_ROUNDS(4);
+        SHA256_ROUNDS(5);
+        SHA256_ROUNDS(6);
+        SHA256_ROUNDS(7);
+        SHA256_ROUNDS(8);
+        SHA256_ROUNDS(9);
+        SHA256_ROUNDS(10);
+        SHA256_ROUNDS(11);
+        SHA256_ROUNDS(12);
+        SHA256_ROUNDS(13);
+        SHA256_ROUNDS(14);
+        SHA256_ROUNDS(15);
+
+        State0 = _mm_add_epi32(State0, State0Save);
+        State1 = _mm_add_epi32(State1, State1Save);
+
+        Data += 64;
+    }
+
+    Temp = _mm_shuffle_epi32(State0, 0x1B);
+    State1 = _mm_shuffle_epi32(State1, 0xB1);
+    State0 = _mm_blend_epi16(Temp, State1, 0xF0);
+    State1 = _mm_alignr_epi8(State1, Temp, 8);
+
+    _mm_storeu_si128((__m128i *) &State[0], State0);
+    _mm_storeu_si128((__m128i *) &State[4], State1);
+}
+
+static VOID UpdateSha(PSHA_STATE Sha, PSHA_BLOCKS ShaBlocks, const BYTE *Data, SIZE_T Length)
+{
+    DWORD Used = Sha->Length % 64;
+
+    Sha->Length += Length;
+
+    // Finish any partial block first.
+    if (Used) {
+        DWORD Count = min(Length, 64 - Used);
+
+        CopyMemory(&Sha->Buffer[Used], Data, Count);
+
+        Data += Count;
+        Length -= Count;
+
+        if (Used + Count < 64)
+            return;
+
+        ShaBlocks(Sha->State, Sha->Buffer, 1);
+    }
+
+    if (Length >= 64) {
+        ShaBlocks(Sha->State, Data, Length / 64);
+        Data += Length & ~63;
+        Length %= 64;
+    }
+
+    CopyMemory(Sha->Buffer, Data, Length);
+}
+
+static VOID FinalSha(PSHA_STATE Sha, PSHA_BLOCKS ShaBlocks, PBYTE Digest, DWORD Words)
+{
+    ULONGLONG Bits = Sha->Length * 8;
+    DWORD Used = Sha->Length % 64;
+
+    Sha->Buffer[Used++] = 0x80;
+
+    if (Used > 56) {
+        ZeroMemory(&Sha->Buffer[Used], 64 - Used);
+        ShaBlocks(Sha->State, Sha->Buffer, 1);
+        Used = 0;
+    }
+
+    ZeroMemory(&Sha->Buffer[Used], 56 - Used);
+
+    StoreBigEndian32(&Sha->Buffer[56], Bits >> 32);
+    StoreBigEndian32(&Sha->Buffer[60], Bits);
+
+    ShaBlocks(Sha->State, Sha->Buffer, 1);
+
+    for (DWORD i = 0; i < Words; i++) {
+        StoreBigEndian32(&Digest[i * 4], Sha->State[i]);
+    }
+}
+
+static ULONGLONG Xxh64Round(ULONGLONG Acc, ULONGLONG Input)
+{
+    Acc += Input * XXH_PRIME64_2;
+    Acc = _rotl64(Acc, 31);
+    return Acc * XXH_PRIME64_1;
+}
+
+static ULONGLONG Xxh64Merge(ULONGLONG Acc, ULONGLONG Value)
+{
+    Acc ^= Xxh64Round(0, Value);
+    return Acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static VOID InitXxh64(PXXH64_STATE Xxh, ULONGLONG Seed)
+{
+    Xxh->Length = 0;
+    Xxh->Seed = Seed;
+    Xxh->Acc[0] = Seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+    Xxh->Acc[1] = Seed + XXH_PRIME64_2;
+    Xxh->Acc[2] = Seed;
+    Xxh->Acc[3] = Seed - XXH_PRIME64_1;
+}
+
+static VOID Xxh64Stripes(PXXH64_STATE Xxh, const BYTE *Data, SIZE_T Stripes)
+{
+    ULONGLONG Acc0 = Xxh->Acc[0];
+    ULONGLONG Acc1 = Xxh->Acc[1];
+    ULONGLONG Acc2 = Xxh->Acc[2];
+    ULONGLONG Acc3 = Xxh->Acc[3];
+
+    while (Stripes--) {
+        Acc0 = Xxh64Round(Acc0, *(const ULONGLONG *)(Data + 0));
+        Acc1 = Xxh64Round(Acc1, *(const ULONGLONG *)(Data + 8));
+        Acc2 = Xxh64Round(Acc2, *(const ULONGLONG *)(Data + 16));
+        Acc3 = Xxh64Round(Acc3, *(const ULONGLONG *)(Data + 24));
+        Data += 32;
+    }
+
+    Xxh->Acc[0] = Acc0;
+    Xxh->Acc[1] = Acc1;
+    Xxh->Acc[2] = Acc2;
+    Xxh->Acc[3] = Acc3;
+}
+
+static VOID UpdateXxh64(PXXH64_STATE Xxh, const BYTE *Data, SIZE_T Length)
+{
+    DWORD Used = Xxh->Length % 32;
+
+    Xxh->Length += Length;
+
+    if (Used) {
+        DWORD Count = min(Length, 32 - Used);
+
+        CopyMemory(&Xxh->Buffer[Used], Data, Count);
+
+        Data += Count;
+        Length -= Count;
+
+        if (Used + Count < 32)
+            return;
+
+        Xxh64Stripes(Xxh, Xxh->Buffer, 1);
+    }
+
+    if (Length >= 32) {
+        Xxh64Stripes(Xxh, Data, Length / 32);
+        Data += Length & ~31;
+        Length %= 32;
+    }
+
+    CopyMemory(Xxh->Buffer, Data, Length);
+}
+
+static ULONGLONG FinalXxh64(PXXH64_STATE Xxh)
+{
+    const BYTE *Data = Xxh->Buffer;
+    DWORD Length = Xxh->Length % 32;
+    ULONGLONG Hash;
+
+    if (Xxh->Length >= 32) {
+        Hash = _rotl64(Xxh->Acc[0], 1)
+             + _rotl64(Xxh->Acc[1], 7)
+             + _rotl64(Xxh->Acc[2], 12)
+             + _rotl64(Xxh->Acc[3], 18);
+
+        for (DWORD i = 0; i < 4; i++) {
+            Hash = Xxh64Merge(Hash, Xxh->Acc[i]);
+        }
+    } else {
+        Hash = Xxh->Seed + XXH_PRIME64_5;
+    }
+
+    Hash += Xxh->Length;
+
+    for (; Length >= 8; Data += 8, Length -= 8) {
+        Hash ^= Xxh64Round(0, *(const ULONGLONG *) Data);
+        Hash = _rotl64(Hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+
+    if (Length >= 4) {
+        Hash ^= (ULONGLONG)(*(const DWORD *) Data) * XXH_PRIME64_1;
+        Hash = _rotl64(Hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        Data += 4;
+        Length -= 4;
+    }
+
+    while (Length--) {
+        Hash ^= *Data++ * XXH_PRIME64_5;
+        Hash = _rotl64(Hash, 11) * XXH_PRIME64_1;
+    }
+
+    Hash ^= Hash >> 33;
+    Hash *= XXH_PRIME64_2;
+    Hash ^= Hash >> 29;
+    Hash *= XXH_PRIME64_3;
+    Hash ^= Hash >> 32;
+
+    return Hash;
+}
+
+ULONGLONG Xxh64(const VOID *Data, SIZE_T Length, ULONGLONG Seed)
+{
+    XXH64_STATE Xxh;
+
+    InitXxh64(&Xxh, Seed);
+    UpdateXxh64(&Xxh, Data, Length);
+
+    return FinalXxh64(&Xxh);
+}
+
+static VOID InitCrc(PHASH_CONTEXT Hash)
+{
+    Hash->Crc = 0;
+}
+
+static VOID UpdateCrc32Digest(PHASH_CONTEXT Hash, const BYTE *Data, SIZE_T Length)
+{
+    Hash->Crc = UpdateCrc32(Hash->Crc, Data, Length);
+}
+
+static VOID UpdateCrc32cDigest(PHASH_CONTEXT Hash, const BYTE *Data, SIZE_T Length)
+{
+    Hash->Crc = UpdateCrc32c(Hash->Crc, Data, Length);
+}
+
+static VOID FinalCrc(PHASH_CONTEXT Hash)
+{
+    StoreBigEndian32(Hash->Result, Hash->Crc);
+}
+
+static VOID InitSha1(PHASH_CONTEXT Hash)
+{
+    static const DWORD Initial[] = {
+        0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0,
+    };
+
+    ZeroMemory(&Hash->Sha, sizeof Hash->Sha);
+    CopyMemory(Hash->Sha.State, Initial, sizeof Initial);
+}
+
+static VOID UpdateSha1(PHASH_CONTEXT Hash, const BYTE *Data, SIZE_T Length)
+{
+    UpdateSha(&Hash->Sha, HasShaNi ? Sha1BlocksNi : Sha1BlocksGeneric, Data, Length);
+}
+
+static VOID FinalSha1(PHASH_CONTEXT Hash)
+{
+    FinalSha(&Hash->Sha, HasShaNi ? Sha1BlocksNi : Sha1BlocksGeneric, Hash->Result, 5);
+}
+
+static VOID InitSha256(PHASH_CONTEXT Hash)
+{
+    static const DWORD Initial[] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    ZeroMemory(&Hash->Sha, sizeof Hash->Sha);
+    CopyMemory(Hash->Sha.State, Initial, sizeof Initial);
+}
+
+static VOID UpdateSha256(PHASH_CONTEXT Hash, const BYTE *Data, SIZE_T Length)
+{
+    UpdateSha(&Hash->Sha, HasShaNi ? Sha256BlocksNi : Sha256BlocksGeneric, Data, Length);
+}
+
+static VOID FinalSha256(PHASH_CONTEXT Hash)
+{
+    FinalSha(&Hash->Sha, HasShaNi ? Sha256BlocksNi : Sha256BlocksGeneric, Hash->Result, 8);
+}
+
+static VOID InitXxh64Digest(PHASH_CONTEXT Hash)
+{
+    InitXxh64(&Hash->Xxh, 0);
+}
+
+static VOID UpdateXxh64Digest(PHASH_CONTEXT Hash, const BYTE *Data, SIZE_T Length)
+{
+    UpdateXxh64(&Hash->Xxh, Data, Length);
+}
+
+static VOID FinalXxh64Digest(PHASH_CONTEXT Hash)
+{
+    ULONGLONG Result = FinalXxh64(&Hash->Xxh);
+
+    StoreBigEndian32(&Hash->Result[0], Result >> 32);
+    StoreBigEndian32(&Hash->Result[4], Result);
+}
+
+static HASH_DIGEST HashDigests[] = {
+    { "CRC32",   4,  InitCrc,         UpdateCrc32Digest,  FinalCrc },
+    { "CRC32C",  4,  InitCrc,         UpdateCrc32cDigest, FinalCrc },
+    { "SHA-1",   20, InitSha1,        UpdateSha1,         FinalSha1 },
+    { "SHA-256", 32, InitSha256,      UpdateSha256,       FinalSha256 },
+    { "XXH64",   8,  InitXxh64Digest, UpdateXxh64Digest,  FinalXxh64Digest },
+};
+
+// Remember what was selected last time.
+static BOOL HashSelected[_countof(HashDigests)] = { TRUE, FALSE, TRUE, TRUE, TRUE };
+
+static BOOL HashChunk(PVOID Context, HEM_QWORD Offset, const BYTE *Data, DWORD Length)
+{
+    PHASH_CONTEXT Hash = Context;
+
+    Hash->Digest->Update(Hash, Data, Length);
+    return TRUE;
+}
+
+// Let the user toggle digests until they choose to start.
+static BOOL SelectDigests(HEM_QWORD Offset, HEM_QWORD Length)
+{
+    CHAR Lines[_countof(HashDigests) + 1][64];
+    PCHAR Menu[_countof(HashDigests) + 1];
+    DWORD Width = 0;
+    int Choice = 1;
+
+    while (TRUE) {
+        snprintf(Lines[0], sizeof Lines[0], "Hash %#llx bytes from %#llx", Length, Offset);
+
+        for (DWORD i = 0; i < _countof(HashDigests); i++) {
+            snprintf(Lines[i + 1],
+                     sizeof Lines[i + 1],
+                     "[%c] %s",
+                     HashSelected[i] ? 'x' : ' ',
+                     HashDigests[i].Name);
+        }
+
+        for (DWORD i = 0; i < _countof(Menu); i++) {
+            Menu[i] = Lines[i];
+            Width = max(Width, strlen(Lines[i]));
+        }
+
+        Choice = HiewGate_Menu("Hash", Menu, _countof(Menu), Width, Choice, NULL, NULL, NULL, NULL);
+
+        if (Choice <= 0)
+            return FALSE;
+
+        if (Choice == 1)
+            break;
+
+        HashSelected[Choice - 2] = !HashSelected[Choice - 2];
+    }
+
+    for (DWORD i = 0; i < _countof(HashDigests); i++) {
+        if (HashSelected[i])
+            return TRUE;
+    }
+
+    HiewGate_Message("Hash", "No digests were selected.");
+    return FALSE;
+}
+
+int HashEntryPoint(HEMCALL_TAG *HemCall)
+{
+    HASH_CONTEXT Hashes[_countof(HashDigests)];
+    STREAM_CONSUMER Consumers[_countof(HashDigests)];
+    CHAR Lines[_countof(HashDigests) + 1][128];
+    PCHAR Window[_countof(HashDigests) + 1];
+    HIEWGATE_GETDATA HiewData;
+    JOB Job;
+    RESULT_KEY Key = { RESULT_HASH };
+    HEM_QWORD Offset;
+    HEM_QWORD Length;
+    DWORD Count = 0;
+    DWORD Streamed = 0;
+    DWORD Width = 0;
+    int Result;
+
+    InitOnceExecuteOnce(&HashInit, InitializeHash, NULL, NULL);
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return HEM_ERROR;
+
+    GetMarkedRange(&HiewData, &Offset, &Length);
+
+    if (!SelectDigests(Offset, Length))
+        return HEM_OK;
+
+    Key.Offset = Offset;
+    Key.Length = Length;
+
+    for (DWORD i = 0; i < _countof(HashDigests); i++) {
+        const VOID *Saved;
+        SIZE_T Size;
+
+        if (HashSelected[i] == FALSE)
+            continue;
+
+        Hashes[Count].Digest = &HashDigests[i];
+
+        Key.Parameter = i;
+
+        // If I hashed this range before, there's no need to read it again.
+        if ((Saved = FindCachedResult(&Key, &Size)) != NULL && Size == HashDigests[i].Size) {
+            CopyMemory(Hashes[Count++].Result, Saved, Size);
+            continue;
+        }
+
+        Hashes[Count].Digest->Init(&Hashes[Count]);
+
+        Consumers[Streamed].Routine = HashChunk;
+        Consumers[Streamed].Context = &Hashes[Count];
+
+        Streamed++;
+        Count++;
+    }
+
+    if (Streamed) {
+        BeginJob(&Job, "Hashing", Length);
+
+        Result = StreamFileRange(&Job, Offset, Length, Consumers, Streamed);
+
+        EndJob(&Job);
+
+        if (Result == HEM_KEYBREAK) {
+            HiewGate_Message("Hash", "Cancelled.");
+            return HEM_OK;
+        }
+
+        if (Result != HEM_OK) {
+            HiewGate_Message("Error", "Hiew failed to read the file.");
+            return HEM_OK;
+        }
+    }
+
+    for (DWORD i = 0; i < Streamed; i++) {
+        PHASH_CONTEXT Hash = Consumers[i].Context;
+        RESULT_PART Part = { Hash->Result, Hash->Digest->Size };
+
+        Hash->Digest->Final(Hash);
+
+        Key.Parameter = Hash->Digest - HashDigests;
+
+        SaveCachedResult(&Key, &Part, 1);
+    }
+
+    for (DWORD i = 0; i < Count; i++) {
+        PCHAR Line = Lines[i];
+        SIZE_T Used;
+
+        Used = snprintf(Line, sizeof Lines[i], "%-8s ", Hashes[i].Digest->Name);
+
+        for (DWORD j = 0; j < Hashes[i].Digest->Size; j++) {
+            Used += snprintf(Line + Used, sizeof Lines[i] - Used, "%02x", Hashes[i].Result[j]);
+        }
+    }
+
+    if (Streamed == 0) {
+        snprintf(Lines[Count], sizeof Lines[Count], "%llu bytes, saved from last time", Length);
+    } else {
+        FormatJobStats(&Job, Lines[Count], sizeof Lines[Count]);
+    }
+
+    for (DWORD i = 0; i <= Count; i++) {
+        Window[i] = Lines[i];
+        Width = max(Width, strlen(Lines[i]));
+    }
+
+    HiewGate_Window("Hash", Window, Count + 1, Width, NULL, NULL);
+
+    return HEM_OK;
+}
@@ -0,0 +1,16 @@
+#ifndef __HASH_H
+#define __HASH_H
+
+// Continue a crc32 (as used by zip, png, etc), start with 0.
+DWORD UpdateCrc32(DWORD Crc, const VOID *Data, SIZE_T Length);
+
+// Continue a crc32c (Castagnoli, as used by iSCSI, ext4, etc), start with 0.
+DWORD UpdateCrc32c(DWORD Crc, const VOID *Data, SIZE_T Length);
+
+// The xxHash64 of a buffer.
+ULONGLONG Xxh64(const VOID *Data, SIZE_T Length, ULONGLONG Seed);
+
+// Hashes the marked block (or the whole file) with the selected digests.
+int HashEntryPoint(HEMCALL_TAG *HemCall);
+
+#endif
@@ -0,0 +1,200 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "history.h"
+
+// This file records how often each key was sent, so that the menu can put
+// the keys you actually use at the top. Over a slow link, every arrow key
+// press you save is noticeable.
+//
+// The file is mapped, so updating a counter is just a memory write, and
+// several Hiew instances can share it.
+
+#define HISTORY_MAGIC       'TSHK'
+#define HISTORY_VERSION     1
+#define HISTORY_EXTENSION   ".hst"
+#define MAX_HISTORY_KEYS    128
+#define MAX_HISTORY_KEYLEN  32
+
+// FILETIME units.
+#define HISTORY_DAY         (24ULL * 60 * 60 * 1000 * 1000 * 10)
+
+typedef struct _KEY_USAGE {
+    CHAR Key[MAX_HISTORY_KEYLEN];
+    LONG Count;
+    DWORD Reserved;
+    ULONGLONG LastUsed;
+} KEY_USAGE, *PKEY_USAGE;
+
+typedef struct _KEY_HISTORY {
+    DWORD Magic;
+    DWORD Version;
+    KEY_USAGE Keys[MAX_HISTORY_KEYS];
+} KEY_HISTORY, *PKEY_HISTORY;
+
+static HANDLE HistoryFile = INVALID_HANDLE_VALUE;
+static HANDLE HistoryMapping;
+static PKEY_HISTORY History;
+
+BOOL OpenKeyHistory(LPCSTR HemFile)
+{
+    CHAR FileName[MAX_PATH];
+    PCHAR Extension;
+
+    if (History)
+        return TRUE;
+
+    // Replace the .hem with our extension.
+    if (strcpy_s(FileName, sizeof FileName, HemFile) != 0)
+        return FALSE;
+
+    if ((Extension = strrchr(FileName, '.')) != NULL)
+        *Extension = '\0';
+
+    if (strncat_s(FileName, sizeof FileName, HISTORY_EXTENSION, _TRUNCATE) != 0)
+        return FALSE;
+
+    HistoryFile = CreateFile(FileName,
+                             GENERIC_READ | GENERIC_WRITE,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE,
+                             NULL,
+                             OPEN_ALWAYS,
+                             FILE_ATTRIBUTE_NORMAL,
+                             NULL);
+
+    // This is fine, the hem might be somewhere read-only. The menu just won't
+    // be sorted.
+    if (HistoryFile == INVALID_HANDLE_VALUE)
+        goto error;
+
+    HistoryMapping = CreateFileMapping(HistoryFile,
+                                       NULL,
+                                       PAGE_READWRITE,
+                                       0,
+                                       sizeof(KEY_HISTORY),
+                                       NULL);
+
+    if (HistoryMapping == NULL)
+        goto error;
+
+    History = MapViewOfFile(HistoryMapping,
+                            FILE_MAP_WRITE,
+                            0,
+                            0,
+                            sizeof(KEY_HISTORY));
+
+    if (History == NULL)
+        goto error;
+
+    // A new file is zero filled, anything else we don't understand is just
+    // discarded.
+    if (History->Magic != HISTORY_MAGIC || History->Version != HISTORY_VERSION) {
+        ZeroMemory(History, sizeof *History);
+        History->Magic = HISTORY_MAGIC;
+        History->Version = HISTORY_VERSION;
+    }
+
+    return TRUE;
+
+error:
+    CloseKeyHistory();
+    return FALSE;
+}
+
+VOID CloseKeyHistory(VOID)
+{
+    if (History)
+        UnmapViewOfFile(History);
+    if (HistoryMapping)
+        CloseHandle(HistoryMapping);
+    if (HistoryFile != INVALID_HANDLE_VALUE)
+        CloseHandle(HistoryFile);
+
+    History = NULL;
+    HistoryMapping = NULL;
+    HistoryFile = INVALID_HANDLE_VALUE;
+}
+
+static PKEY_USAGE FindKeyUsage(LPCSTR Key)
+{
+    for (DWORD i = 0; i < MAX_HISTORY_KEYS; i++) {
+        if (strncmp(History->Keys[i].Key, Key, MAX_HISTORY_KEYLEN) == 0)
+            return &History->Keys[i];
+    }
+    return NULL;
+}
+
+static ULONGLONG GetCurrentFileTime(VOID)
+{
+    ULARGE_INTEGER Now;
+    FILETIME Time;
+
+    GetSystemTimeAsFileTime(&Time);
+
+    Now.LowPart = Time.dwLowDateTime;
+    Now.HighPart = Time.dwHighDateTime;
+
+    return Now.QuadPart;
+}
+
+// This is the same idea as browser "frecency", a key used a lot last week
+// should beat a key used a lot last year.
+DWORD GetKeyScore(LPCSTR Key)
+{
+    PKEY_USAGE Usage;
+    ULONGLONG Age;
+    DWORD Weight;
+
+    if (History == NULL || (Usage = FindKeyUsage(Key)) == NULL)
+        return 0;
+
+    Age = (GetCurrentFileTime() - Usage->LastUsed) / HISTORY_DAY;
+
+    if (Age < 4) {
+        Weight = 100;
+    } else if (Age < 14) {
+        Weight = 70;
+    } else if (Age < 31) {
+        Weight = 50;
+    } else if (Age < 90) {
+        Weight = 30;
+    } else {
+        Weight = 10;
+    }
+
+    return Usage->Count * Weight;
+}
+
+VOID RecordKeyUsage(LPCSTR Key)
+{
+    PKEY_USAGE Usage;
+
+    if (History == NULL)
+        return;
+
+    // Don't bother tracking anything too long to store.
+    if (strlen(Key) >= MAX_HISTORY_KEYLEN)
+        return;
+
+    if ((Usage = FindKeyUsage(Key)) == NULL) {
+        // Claim an empty slot, or evict the least recently used key.
+        Usage = &History->Keys[0];
+
+        for (DWORD i = 0; i < MAX_HISTORY_KEYS; i++) {
+            if (History->Keys[i].LastUsed < Usage->LastUsed)
+                Usage = &History->Keys[i];
+        }
+
+        ZeroMemory(Usage, sizeof *Usage);
+        strcpy_s(Usage->Key, sizeof Usage->Key, Key);
+    }
+
+    InterlockedIncrement(&Usage->Count);
+
+    Usage->LastUsed = GetCurrentFileTime();
+}
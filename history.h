@@ -0,0 +1,16 @@
+#ifndef __HISTORY_H
+#define __HISTORY_H
+
+// Opens (or creates) the usage history file that lives next to the hem.
+BOOL OpenKeyHistory(LPCSTR HemFile);
+
+// Unmaps the usage history, it's safe to call this if it was never opened.
+VOID CloseKeyHistory(VOID);
+
+// Returns a score for how likely Key is to be chosen, higher is more likely.
+DWORD GetKeyScore(LPCSTR Key);
+
+// Remember that Key was just chosen.
+VOID RecordKeyUsage(LPCSTR Key);
+
+#endif
@@ -0,0 +1,234 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "input.h"
+#include "inject.h"
+
+// Hiew doesn't read the console while a hem is running, so key events are
+// queued here and written by a worker thread once the entry point returns.
+
+// How long to wait between simulated input events.
+#define KEY_SEND_DELAY 64
+
+// How many events to write to the console at once, I also wait for the
+// console input buffer to drain below this before writing more.
+#define MAX_INJECT_BATCH 128
+
+// How long to wait for the console to consume events.
+#define INJECT_POLL_DELAY 4
+
+// Nobody needs more keys than this queued, and it keeps the sizes small
+// enough that nothing can overflow.
+#define MAX_QUEUED_EVENTS (4 * 1024 * 1024)
+
+static SRWLOCK QueueLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE QueueReady = CONDITION_VARIABLE_INIT;
+static PINPUT_RECORD Queue;
+static DWORD QueueHead;
+static DWORD QueueCount;
+static DWORD QueueSize;
+static HANDLE InjectThread;
+static BOOL Stopping;
+static volatile LONG64 DeliveredCount;
+
+// Wait for whoever is reading the console to catch up, writing faster than
+// Hiew can read just makes the input buffer grow and terminals drop input.
+static VOID WaitForConsoleInput(HANDLE Console)
+{
+    DWORD Pending;
+
+    while (!Stopping && GetNumberOfConsoleInputEvents(Console, &Pending)) {
+        if (Pending < MAX_INJECT_BATCH)
+            break;
+
+        Sleep(INJECT_POLL_DELAY);
+    }
+}
+
+static DWORD WINAPI InjectKeysThread(LPVOID lpvThreadParam)
+{
+    HANDLE Console = GetStdHandle(STD_INPUT_HANDLE);
+    INPUT_RECORD Batch[MAX_INJECT_BATCH];
+    DWORD BatchCount;
+    DWORD EventCount;
+
+    while (TRUE) {
+        AcquireSRWLockExclusive(&QueueLock);
+
+        while (QueueCount == 0 && !Stopping)
+            SleepConditionVariableSRW(&QueueReady, &QueueLock, INFINITE, 0);
+
+        ReleaseSRWLockExclusive(&QueueLock);
+
+        if (Stopping)
+            break;
+
+        // Wait for dialogs to clean up.
+        Sleep(KEY_SEND_DELAY);
+
+        // Now drain the queue.
+        while (TRUE) {
+            AcquireSRWLockExclusive(&QueueLock);
+
+            BatchCount = min(QueueCount, _countof(Batch));
+
+            CopyMemory(Batch, &Queue[QueueHead], BatchCount * sizeof *Batch);
+
+            QueueHead += BatchCount;
+            QueueCount -= BatchCount;
+
+            ReleaseSRWLockExclusive(&QueueLock);
+
+            if (BatchCount == 0 || Stopping)
+                break;
+
+            WaitForConsoleInput(Console);
+
+            if (WriteConsoleInput(Console, Batch, BatchCount, &EventCount)) {
+                InterlockedExchangeAdd64(&DeliveredCount, EventCount);
+            }
+        }
+    }
+
+    return 0;
+}
+
+BOOL QueueKeyRecords(const KEY_EVENT_RECORD *Records, DWORD Count, BOOL Coalesce)
+{
+    BOOL Result = FALSE;
+    ULONGLONG Total = 0;
+
+    AcquireSRWLockExclusive(&QueueLock);
+
+    if (Stopping)
+        goto finished;
+
+    // Unless the reader honours wRepeatCount, repeated keys have to be
+    // expanded into separate events. They still get written in batches.
+    for (DWORD i = 0; i < Count; i++) {
+        Total += Coalesce ? 1 : max(Records[i].wRepeatCount, 1);
+    }
+
+    if (Total > MAX_QUEUED_EVENTS - QueueCount)
+        goto finished;
+
+    // Move anything still pending to the start, then make room.
+    MoveMemory(Queue, &Queue[QueueHead], QueueCount * sizeof *Queue);
+
+    QueueHead = 0;
+
+    if (QueueCount + Total > QueueSize) {
+        PINPUT_RECORD NewQueue;
+        DWORD NewSize = (DWORD) min(max(QueueSize * 2ULL, QueueCount + Total), MAX_QUEUED_EVENTS);
+
+        if ((NewQueue = realloc(Queue, NewSize * sizeof *Queue)) == NULL)
+            goto finished;
+
+        Queue = NewQueue;
+        QueueSize = NewSize;
+    }
+
+    for (DWORD i = 0; i < Count; i++) {
+        DWORD Repeat = Coalesce ? 1 : max(Records[i].wRepeatCount, 1);
+
+        while (Repeat--) {
+            Queue[QueueCount].EventType = KEY_EVENT;
+            Queue[QueueCount].Event.KeyEvent = Records[i];
+
+            if (!Coalesce)
+                Queue[QueueCount].Event.KeyEvent.wRepeatCount = 1;
+
+            QueueCount++;
+        }
+    }
+
+    // Start the thread the first time it's needed.
+    if (InjectThread == NULL) {
+        InjectThread = CreateThread(NULL, 0, InjectKeysThread, NULL, 0, NULL);
+
+        if (InjectThread == NULL) {
+            QueueCount -= (DWORD) Total;
+            goto finished;
+        }
+    }
+
+    WakeConditionVariable(&QueueReady);
+
+    Result = TRUE;
+
+finished:
+    ReleaseSRWLockExclusive(&QueueLock);
+    return Result;
+}
+
+BOOL QueueKeyStrings(LPCSTR *Keys, DWORD Count, BOOL Coalesce)
+{
+    PKEY_EVENT_RECORD Records;
+    BOOL Result = FALSE;
+
+    if ((Records = calloc(Count, sizeof *Records)) == NULL)
+        return FALSE;
+
+    for (DWORD i = 0; i < Count; i++) {
+        if (Keys[i] == NULL || !DecodeKeyString(Keys[i], &Records[i]))
+            goto finished;
+    }
+
+    Result = QueueKeyRecords(Records, Count, Coalesce);
+
+finished:
+    free(Records);
+    return Result;
+}
+
+DWORD GetPendingKeyCount(VOID)
+{
+    DWORD Count;
+
+    AcquireSRWLockShared(&QueueLock);
+    Count = QueueCount;
+    ReleaseSRWLockShared(&QueueLock);
+
+    return Count;
+}
+
+ULONGLONG GetDeliveredKeyCount(VOID)
+{
+    return InterlockedExchangeAdd64(&DeliveredCount, 0);
+}
+
+VOID DiscardKeyRecords(VOID)
+{
+    AcquireSRWLockExclusive(&QueueLock);
+    QueueHead = 0;
+    QueueCount = 0;
+    ReleaseSRWLockExclusive(&QueueLock);
+}
+
+VOID StopKeyInjector(VOID)
+{
+    AcquireSRWLockExclusive(&QueueLock);
+
+    Stopping = TRUE;
+    QueueCount = 0;
+
+    WakeAllConditionVariable(&QueueReady);
+
+    ReleaseSRWLockExclusive(&QueueLock);
+
+    if (InjectThread) {
+        WaitForSingleObject(InjectThread, INFINITE);
+        CloseHandle(InjectThread);
+    }
+
+    free(Queue);
+
+    Queue = NULL;
+    QueueSize = 0;
+    InjectThread = NULL;
+}
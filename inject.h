@@ -0,0 +1,25 @@
+#ifndef __INJECT_H
+#define __INJECT_H
+
+// Queue key events to be written to the console input buffer. If Coalesce is
+// set, events with a wRepeatCount are written as a single event, otherwise
+// they're expanded into separate events.
+BOOL QueueKeyRecords(const KEY_EVENT_RECORD *Records, DWORD Count, BOOL Coalesce);
+
+// Decodes strings of the form "Ctrl+Shift+A" and queues them, nothing is
+// queued unless every string can be decoded.
+BOOL QueueKeyStrings(LPCSTR *Keys, DWORD Count, BOOL Coalesce);
+
+// How many queued events haven't been written yet.
+DWORD GetPendingKeyCount(VOID);
+
+// How many events have been written to the console in total.
+ULONGLONG GetDeliveredKeyCount(VOID);
+
+// Throw away anything that hasn't been written yet.
+VOID DiscardKeyRecords(VOID);
+
+// Discard anything pending and stop the injector thread.
+VOID StopKeyInjector(VOID);
+
+#endif
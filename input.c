@@ -31,12 +31,205 @@ static BOOL CALLBACK InitializeKeyTables(PINIT_ONCE InitOnce,
     return TRUE;
 }
 
+// The character a key produces depends on the keyboard layout, so rather than
+// guessing I ask ToUnicodeEx() once for every key in every modifier state and
+// remember the answers. These bits index the precomputed tables.
+#define LAYOUT_SHIFT    (1 << 0)
+#define LAYOUT_CTRL     (1 << 1)
+#define LAYOUT_ALT      (1 << 2)
+#define LAYOUT_CAPS     (1 << 3)
+#define LAYOUT_STATES   (1 << 4)
+
+// Most people only switch between one or two layouts, this is plenty.
+#define MAX_KEY_LAYOUTS 8
+
+// Don't let ToUnicodeEx() change the keyboard state (Windows 10 1607+).
+#define TOUNICODE_NOSTATE (1 << 2)
+
+// The reverse mapping, which key produces a character.
+typedef struct _KEY_SOURCE {
+    BYTE KeyCode;
+    BYTE State;
+    WORD ScanCode;
+} KEY_SOURCE, *PKEY_SOURCE;
+
+typedef struct _KEY_LAYOUT {
+    HKL Layout;
+    UINT CodePage;
+    BOOL Ready;
+    CHAR Chars[LAYOUT_STATES][UCHAR_MAX + 1];
+    KEY_SOURCE Sources[UCHAR_MAX + 1];
+} KEY_LAYOUT, *PKEY_LAYOUT;
+
+static SRWLOCK KeyLayoutLock = SRWLOCK_INIT;
+static KEY_LAYOUT KeyLayouts[MAX_KEY_LAYOUTS];
+static DWORD NextKeyLayout;
+static HKL SelectedLayout;
+
+static DWORD KeyLayoutState(DWORD CtrlState)
+{
+    DWORD State = 0;
+
+    if (CtrlState & SHIFT_PRESSED)
+        State |= LAYOUT_SHIFT;
+    if (CtrlState & (LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED))
+        State |= LAYOUT_CTRL;
+    if (CtrlState & (LEFT_ALT_PRESSED | RIGHT_ALT_PRESSED))
+        State |= LAYOUT_ALT;
+    if (CtrlState & CAPSLOCK_ON)
+        State |= LAYOUT_CAPS;
+
+    return State;
+}
+
+static VOID BuildKeyLayout(PKEY_LAYOUT Table)
+{
+    BYTE KeyState[UCHAR_MAX + 1];
+
+    ZeroMemory(Table->Sources, sizeof Table->Sources);
+
+    for (DWORD State = 0; State < LAYOUT_STATES; State++) {
+        ZeroMemory(KeyState, sizeof KeyState);
+
+        if (State & LAYOUT_SHIFT)
+            KeyState[VK_SHIFT] = KeyState[VK_LSHIFT] = 0x80;
+        if (State & LAYOUT_CTRL)
+            KeyState[VK_CONTROL] = KeyState[VK_LCONTROL] = 0x80;
+        if (State & LAYOUT_ALT)
+            KeyState[VK_MENU] = KeyState[VK_LMENU] = 0x80;
+        if (State & LAYOUT_CAPS)
+            KeyState[VK_CAPITAL] = 0x01;
+
+        for (DWORD Key = 0; Key <= UCHAR_MAX; Key++) {
+            UINT ScanCode = MapVirtualKeyEx(Key, MAPVK_VK_TO_VSC, Table->Layout);
+            WCHAR Buffer[4];
+            BOOL Unmapped = FALSE;
+
+            Table->Chars[State][Key] = 0;
+
+            // Dead keys return -1, and ligatures return more than one
+            // character. Neither can be represented in a single event.
+            if (ToUnicodeEx(Key,
+                            ScanCode,
+                            KeyState,
+                            Buffer,
+                            _countof(Buffer),
+                            TOUNICODE_NOSTATE,
+                            Table->Layout) != 1) {
+                continue;
+            }
+
+            // Console input events are in the console codepage.
+            if (WideCharToMultiByte(Table->CodePage,
+                                    WC_NO_BEST_FIT_CHARS,
+                                    Buffer,
+                                    1,
+                                    &Table->Chars[State][Key],
+                                    1,
+                                    NULL,
+                                    &Unmapped) != 1 || Unmapped) {
+                Table->Chars[State][Key] = 0;
+                continue;
+            }
+
+            // States are visited in order of complexity, so the first key
+            // found that produces a character is the simplest way to type it.
+            if (Table->Sources[(BYTE) Table->Chars[State][Key]].KeyCode == 0) {
+                Table->Sources[(BYTE) Table->Chars[State][Key]].KeyCode = Key;
+                Table->Sources[(BYTE) Table->Chars[State][Key]].State = State;
+                Table->Sources[(BYTE) Table->Chars[State][Key]].ScanCode = ScanCode;
+            }
+        }
+    }
+}
+
+static PKEY_LAYOUT FindKeyLayout(HKL Layout, UINT CodePage)
+{
+    for (DWORD i = 0; i < MAX_KEY_LAYOUTS; i++) {
+        if (KeyLayouts[i].Ready
+         && KeyLayouts[i].Layout == Layout
+         && KeyLayouts[i].CodePage == CodePage) {
+            return &KeyLayouts[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Find the translation table for Layout, building it if necessary. This
+// returns with the lock held shared so the slot can't be recycled while
+// you're reading it, call ReleaseKeyLayout() when you're done.
+static PKEY_LAYOUT AcquireKeyLayout(HKL Layout)
+{
+    UINT CodePage = GetConsoleCP();
+    PKEY_LAYOUT Table;
+
+    while (TRUE) {
+        AcquireSRWLockShared(&KeyLayoutLock);
+
+        if ((Table = FindKeyLayout(Layout, CodePage)))
+            return Table;
+
+        ReleaseSRWLockShared(&KeyLayoutLock);
+
+        AcquireSRWLockExclusive(&KeyLayoutLock);
+
+        // Someone else might have built it while I was waiting, if not then
+        // recycle the oldest slot.
+        if (FindKeyLayout(Layout, CodePage) == NULL) {
+            Table = &KeyLayouts[NextKeyLayout++ % MAX_KEY_LAYOUTS];
+            Table->Ready = FALSE;
+            Table->Layout = Layout;
+            Table->CodePage = CodePage;
+
+            BuildKeyLayout(Table);
+
+            Table->Ready = TRUE;
+        }
+
+        // SRW locks can't be downgraded, so go around again. It's only
+        // possible to miss if other layouts used every slot in between.
+        ReleaseSRWLockExclusive(&KeyLayoutLock);
+    }
+}
+
+static VOID ReleaseKeyLayout(PKEY_LAYOUT Table)
+{
+    ReleaseSRWLockShared(&KeyLayoutLock);
+}
+
+static VOID CALLBACK KeyLayoutCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context)
+{
+    ReleaseKeyLayout(AcquireKeyLayout(Context));
+}
+
+// Use Layout for future decoding, the tables are built in the background if
+// they're not already cached.
+VOID SelectKeyLayout(HKL Layout)
+{
+    InterlockedExchangePointer((PVOID *) &SelectedLayout, Layout);
+
+    // If this fails it doesn't matter, it will be built when it's needed.
+    TrySubmitThreadpoolCallback(KeyLayoutCallback, Layout, NULL);
+}
+
 // I think you cannot possibly encode more than 9 keys into a key event, thats
 // 8 modifiers and at most 1 non-modifier
 // e.g.
 // Caps Lock+Left Alt+Right Alt+Left Ctrl+Right Ctrl+Num Lock+Scroll Lock+Shift+X
 #define MAX_KEY_COMBINATION 9
 
+// Some common abbreviations people use that GetKeyNameText() doesn't.
+static const struct {
+    LPCSTR Alias;
+    LPCSTR KeyName;
+} KeyAliases[] = {
+    { "PgUp", "Page Up" },
+    { "PgDn", "Page Down" },
+    { "Del", "Delete" },
+    { "Ins", "Insert" },
+};
+
 // Takes a PKEY_EVENT_RECORD, and translates it into a string.
 BOOL EncodeKeyString(PKEY_EVENT_RECORD Record, PCHAR HotKey, SIZE_T MaxLen)
 {
@@ -142,6 +335,15 @@ success:
         }
     }
 
+    // Repeated keys are written like "Page Down x500".
+    if (Record->wRepeatCount > 1) {
+        CHAR Repeat[16];
+
+        snprintf(Repeat, sizeof Repeat, " x%u", Record->wRepeatCount);
+
+        strncat_s(HotKey, MaxLen, Repeat, _TRUNCATE);
+    }
+
     return NumKeys > 0;
 }
 
@@ -150,10 +352,30 @@ BOOL DecodeKeyString(LPCSTR HotKey, PKEY_EVENT_RECORD Record)
 {
     PCHAR KeyCombination = strdupa(HotKey);
     PCHAR CurKey;
+    PCHAR Repeat;
     DWORD CtrlState = 0;
+    DWORD RepeatCount = 1;
+    PKEY_LAYOUT Layout;
 
     ZeroMemory(Record, sizeof *Record);
 
+    // Check for a repeat count, e.g. "Page Down x500".
+    if ((Repeat = strrchr(KeyCombination, ' ')) && tolower(Repeat[1]) == 'x') {
+        PCHAR End;
+
+        RepeatCount = strtoul(Repeat + 2, &End, 10);
+
+        // If it's not a number, then it must be part of a key name.
+        if (End != Repeat + 2 && *End == '\0') {
+            if (RepeatCount == 0 || RepeatCount > USHRT_MAX)
+                return FALSE;
+
+            *Repeat = '\0';
+        } else {
+            RepeatCount = 1;
+        }
+    }
+
     InitOnceExecuteOnce(&KeyTablesInit, InitializeKeyTables, NULL, NULL);
 
     for (CurKey = strtok(KeyCombination, "+");
@@ -164,6 +386,13 @@ BOOL DecodeKeyString(LPCSTR HotKey, PKEY_EVENT_RECORD Record)
         UINT KeyCode;
         PCHAR Result;
 
+        for (DWORD i = 0; i < _countof(KeyAliases); i++) {
+            if (stricmp(CurKey, KeyAliases[i].Alias) == 0) {
+                CurKey = (PCHAR) KeyAliases[i].KeyName;
+                break;
+            }
+        }
+
         Result   = _lfind(CurKey, RegKeyNames, &NumElems, MAX_KEY_LEN, stricmp);
         ScanCode = (DWORD)(Result - (PCHAR) RegKeyNames) / MAX_KEY_LEN;
 
@@ -233,81 +462,58 @@ BOOL DecodeKeyString(LPCSTR HotKey, PKEY_EVENT_RECORD Record)
         // We've decoded the modifiers, but what if user just wants Ctrl+Alt?
         // Whatver the last key is, that is the scancode.
         Record->bKeyDown = TRUE;
-        Record->wRepeatCount = 1;
+        Record->wRepeatCount = RepeatCount;
         Record->wVirtualScanCode = ScanCode;
         Record->wVirtualKeyCode = KeyCode;
-        Record->uChar.AsciiChar = MapVirtualKey(KeyCode, MAPVK_VK_TO_CHAR);
         Record->dwControlKeyState = CtrlState;
+    }
 
-        // I dunno what the rules are for setting this field, I've tried
-        // to guess them from observation.
-        if (CtrlState & LEFT_CTRL_PRESSED) {
-            if (CtrlState & (LEFT_ALT_PRESSED | RIGHT_ALT_PRESSED)) {
-                Record->uChar.AsciiChar = 0;
-            }
-        }
-
-        if (KeyCode == Record->uChar.AsciiChar && isalpha(KeyCode)) {
+    // Now that all the modifiers are known, the character is just a lookup
+    // in the table for the current layout.
+    Layout = AcquireKeyLayout(SelectedLayout ? SelectedLayout : GetKeyboardLayout(0));
 
-            // In general, for ascii chars the lowercase form seems to be used.
-            Record->uChar.AsciiChar = tolower(KeyCode);
+    Record->uChar.AsciiChar = Layout->Chars[KeyLayoutState(CtrlState)][Record->wVirtualKeyCode & UCHAR_MAX];
 
-            // If you hold ctrl, you get the ctrl characters, in alphabetic
-            // order.
-            if (CtrlState & (LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED)) {
-                // Is this right??????????????
-                Record->uChar.AsciiChar -= 'a' - 1;
-            }
-        }
+    ReleaseKeyLayout(Layout);
 
-        if (KeyCode == Record->uChar.AsciiChar && isdigit(KeyCode)) {
-            if (CtrlState & SHIFT_PRESSED) {
-                // I don't think there's any way to figure out what this should be
-                // without localization, so I'll just simulate it.
-                Record->uChar.AsciiChar = ")!@#$%^&*("[KeyCode - '0'];
-            }
-            // fallthrough intentional.
-            // If CTRL is pressed with a digit, AsciiChar is always 0.
-            if (CtrlState & (LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED)) {
-                Record->uChar.AsciiChar = 0;
-            }
-        }
+    return TRUE;
+}
 
-        // https://www.codeproject.com/Questions/511401/apluslittleplusaboutplusMSGplusHandingplusaboutplu
-        if (KeyCode == VK_BACK) {
-            if (CtrlState & (LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED)) {
-                if ((CtrlState & ~(LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED)) == 0) {
-                    Record->uChar.AsciiChar = 0x7f;
-                }
-            }
-        }
+// Generates the key event that would type Char on the current layout.
+BOOL DecodeKeyChar(CHAR Char, PKEY_EVENT_RECORD Record)
+{
+    PKEY_LAYOUT Layout;
+    KEY_SOURCE Source;
 
-        // This needs some work to understand.
-        if (CtrlState & (LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED)) {
-            switch (KeyCode) {
-                case VK_RETURN:
-                    Record->uChar.AsciiChar = '\n';
-                    break;
-                case VK_OEM_7:  // '#'
-                    Record->uChar.AsciiChar = 28;
-                    break;
-                case VK_OEM_4:  // '['
-                case VK_OEM_6:  // ']'
-                case VK_OEM_5:  // '\\'
-                    Record->uChar.AsciiChar -= 'A' - 1;
-                    break;
-                case VK_OEM_1:  // ';'
-                case VK_OEM_3:  // '~'
-                case VK_OEM_PERIOD:
-                case VK_OEM_MINUS:
-                case VK_OEM_PLUS:
-                case VK_TAB:
-                    Record->uChar.AsciiChar = 0;
-                    break;
-            }
-        }
+    ZeroMemory(Record, sizeof *Record);
 
-    }
+    // Copy it out, the table can be rebuilt for another layout later.
+    Layout = AcquireKeyLayout(SelectedLayout ? SelectedLayout : GetKeyboardLayout(0));
+    Source = Layout->Sources[(BYTE) Char];
+    ReleaseKeyLayout(Layout);
+
+    Record->bKeyDown = TRUE;
+    Record->wRepeatCount = 1;
+    Record->uChar.AsciiChar = Char;
+
+    // If no key produces this character, the console will still accept an
+    // event with just the character set.
+    if (Source.KeyCode == 0)
+        return FALSE;
+
+    Record->wVirtualKeyCode = Source.KeyCode;
+    Record->wVirtualScanCode = Source.ScanCode;
+
+    if (Source.State & LAYOUT_SHIFT)
+        Record->dwControlKeyState |= SHIFT_PRESSED;
+    if (Source.State & LAYOUT_CTRL)
+        Record->dwControlKeyState |= LEFT_CTRL_PRESSED;
+    if (Source.State & LAYOUT_ALT)
+        Record->dwControlKeyState |= (Source.State & LAYOUT_CTRL)
+                                   ? RIGHT_ALT_PRESSED
+                                   : LEFT_ALT_PRESSED;
+    if (Source.State & LAYOUT_CAPS)
+        Record->dwControlKeyState |= CAPSLOCK_ON;
 
     return TRUE;
 }
@@ -4,9 +4,17 @@
 // Takes a PKEY_EVENT_RECORD, and translates it into a string.
 BOOL EncodeKeyString(PKEY_EVENT_RECORD Record, PCHAR HotKey, SIZE_T MaxLen);
 
-// Decodes a string of the form "Ctrl+Shift+A" into a PKEY_EVENT_RECORD
+// Decodes a string of the form "Ctrl+Shift+A" into a PKEY_EVENT_RECORD, a
+// repeat count can be added like "Page Down x500".
 BOOL DecodeKeyString(LPCSTR HotKey, PKEY_EVENT_RECORD Record);
 
+// Generates the key event that would type Char, returns FALSE if no key on
+// the current layout produces it (the event is still usable).
+BOOL DecodeKeyChar(CHAR Char, PKEY_EVENT_RECORD Record);
+
+// Use the specified keyboard layout to translate keys into characters.
+VOID SelectKeyLayout(HKL Layout);
+
 VOID PrintKeyEvent(PKEY_EVENT_RECORD Key);
 
 #endif
@@ -0,0 +1,127 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+
+// Long loops have to check HiewGate_IsKeyBreak() so the user can cancel, but
+// every check is a round trip through Hiew. Checking on every iteration can
+// easily cost more than the work, and checking every N iterations is either
+// too often or too slow depending on how long an iteration takes.
+//
+// Instead, a job just remembers how far it got, and only asks Hiew when a
+// time slice has passed on the performance counter. The progress message is
+// redrawn the same way, and the time spent doing both is recorded, so I can
+// see if it's getting in the way.
+
+// Milliseconds between checking for Esc.
+#define JOB_POLL_INTERVAL 50
+
+// Milliseconds between redrawing the progress message.
+#define JOB_DRAW_INTERVAL 500
+
+static LONGLONG ReadCounter(VOID)
+{
+    LARGE_INTEGER Counter;
+
+    QueryPerformanceCounter(&Counter);
+    return Counter.QuadPart;
+}
+
+static VOID DrawJob(PJOB Job)
+{
+    CHAR Message[128];
+
+    if (Job->Total) {
+        snprintf(Message,
+                 sizeof Message,
+                 "%s, %llu%% done, press Esc to cancel...",
+                 Job->Name,
+                 min(Job->Done, Job->Total) * 100 / Job->Total);
+    } else {
+        snprintf(Message, sizeof Message, "%s, press Esc to cancel...", Job->Name);
+    }
+
+    HiewGate_MessageWaitOpen(Message);
+}
+
+VOID BeginJob(PJOB Job, LPCSTR Name, ULONGLONG Total)
+{
+    LARGE_INTEGER Frequency;
+
+    QueryPerformanceFrequency(&Frequency);
+
+    ZeroMemory(Job, sizeof *Job);
+
+    Job->Name = Name;
+    Job->Total = Total;
+    Job->Frequency = Frequency.QuadPart;
+    Job->Start = ReadCounter();
+    Job->NextPoll = Job->Start + Job->Frequency * JOB_POLL_INTERVAL / 1000;
+    Job->NextDraw = Job->Start + Job->Frequency * JOB_DRAW_INTERVAL / 1000;
+
+    DrawJob(Job);
+
+    Job->Waiting += ReadCounter() - Job->Start;
+}
+
+BOOL UpdateJob(PJOB Job, ULONGLONG Done)
+{
+    LONGLONG Now;
+
+    Job->Done = Done;
+
+    if (Job->Cancelled)
+        return FALSE;
+
+    if ((Now = ReadCounter()) < Job->NextPoll)
+        return TRUE;
+
+    Job->Polls++;
+
+    if (HiewGate_IsKeyBreak() == HEM_KEYBREAK)
+        Job->Cancelled = TRUE;
+
+    // Only worth redrawing if there's a percentage to show.
+    if (Job->Total && Now >= Job->NextDraw && !Job->Cancelled) {
+        HiewGate_MessageWaitClose();
+        DrawJob(Job);
+
+        Job->NextDraw = Now + Job->Frequency * JOB_DRAW_INTERVAL / 1000;
+    }
+
+    // The next slice starts after the gate calls, so a slow gate can't use
+    // up all of the time.
+    Job->NextPoll = ReadCounter();
+    Job->Waiting += Job->NextPoll - Now;
+    Job->NextPoll += Job->Frequency * JOB_POLL_INTERVAL / 1000;
+
+    return !Job->Cancelled;
+}
+
+VOID EndJob(PJOB Job)
+{
+    LONGLONG Now = ReadCounter();
+
+    HiewGate_MessageWaitClose();
+
+    Job->Waiting += ReadCounter() - Now;
+    Job->Elapsed = (Now - Job->Start) * 1000 / Job->Frequency;
+    Job->PollTime = Job->Waiting * 1000 / Job->Frequency;
+}
+
+VOID FormatJobStats(PJOB Job, PCHAR Buffer, SIZE_T Size)
+{
+    snprintf(Buffer,
+             Size,
+             "%llu bytes in %llu ms (%llu MB/s, %llu ms polling)",
+             Job->Done,
+             Job->Elapsed,
+             Job->Done / 1024 * 1000 / 1024 / max(Job->Elapsed, 1),
+             Job->PollTime);
+}
@@ -0,0 +1,39 @@
+#ifndef __JOB_H
+#define __JOB_H
+
+typedef struct _JOB {
+    LPCSTR Name;
+    ULONGLONG Total;        // Units of work, usually bytes, zero if unknown.
+    ULONGLONG Done;
+    BOOL Cancelled;
+    DWORD Polls;
+
+    // Filled in by EndJob(), in milliseconds.
+    ULONGLONG Elapsed;
+    ULONGLONG PollTime;     // Spent in the gate checking keys and drawing.
+
+    // Performance counter ticks.
+    LONGLONG Frequency;
+    LONGLONG Start;
+    LONGLONG NextPoll;
+    LONGLONG NextDraw;
+    LONGLONG Waiting;
+} JOB, *PJOB;
+
+// Shows a progress message and starts the clock. Total is how much work there
+// is, or zero if you don't know.
+VOID BeginJob(PJOB Job, LPCSTR Name, ULONGLONG Total);
+
+// Records that Done units are finished. The break key is only checked, and
+// the message redrawn, when enough time has passed, so this is cheap enough
+// to call on every iteration. Returns FALSE once the user has pressed Esc.
+BOOL UpdateJob(PJOB Job, ULONGLONG Done);
+
+// Removes the message and stops the clock.
+VOID EndJob(PJOB Job);
+
+// Describes how long a finished job took, e.g. "1048576 bytes in 20 ms
+// (50 MB/s, 1 ms polling)". The units are assumed to be bytes.
+VOID FormatJobStats(PJOB Job, PCHAR Buffer, SIZE_T Size);
+
+#endif
@@ -0,0 +1,746 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "rcache.h"
+#include "secmap.h"
+#include "journal.h"
+
+// Hiew's own undo doesn't know about writes made through the HiewGate, so
+// every write I make is recorded here first. The journal is an append-only
+// log in a mapped file, so recording a write is just a FileRead straight into
+// the mapping.
+//
+// Writes are grouped into transactions, e.g. applying a patch, and each
+// record stores both the old and new bytes so a transaction can be undone
+// and redone. The journal is bounded, the oldest transactions are discarded
+// to make room for new ones.
+
+#define JOURNAL_MAGIC           'LNJK'
+#define JOURNAL_VERSION         1
+#define JOURNAL_EXTENSION       ".jnl"
+#define JOURNAL_INITIAL_SIZE    (1024 * 1024)
+#define JOURNAL_MAX_SIZE        (64 * 1024 * 1024)
+#define JOURNAL_MAX_WRITE       (1024 * 1024)
+#define JOURNAL_MAX_DESCRIPTION 64
+#define JOURNAL_NO_TRANSACTION  ((ULONGLONG) -1)
+
+#define JOURNAL_ALIGN(x) (((x) + 7) & ~7)
+
+enum {
+    JOURNAL_BEGIN = 1,
+    JOURNAL_WRITE,
+    JOURNAL_END,
+};
+
+typedef struct _JOURNAL_HEADER {
+    DWORD Magic;
+    DWORD Version;
+    DWORD FilenameHash;
+    DWORD Reserved;
+    ULONGLONG Capacity;
+    ULONGLONG Used;
+    ULONGLONG Applied;
+} JOURNAL_HEADER, *PJOURNAL_HEADER;
+
+// A WRITE has the old bytes followed by the new bytes in Data, a BEGIN has a
+// description, and an END has the offset of its BEGIN.
+typedef struct _JOURNAL_RECORD {
+    DWORD Type;
+    DWORD Size;
+    ULONGLONG Offset;
+    DWORD Length;
+    DWORD Reserved;
+    BYTE Data[];
+} JOURNAL_RECORD, *PJOURNAL_RECORD;
+
+// A range of the file, used to check that nothing changed before undo.
+typedef struct _JOURNAL_RANGE {
+    ULONGLONG Start;
+    ULONGLONG End;
+} JOURNAL_RANGE, *PJOURNAL_RANGE;
+
+static HANDLE JournalFile = INVALID_HANDLE_VALUE;
+static HANDLE JournalMapping;
+static PJOURNAL_HEADER Journal;
+static DWORD JournalHash;
+static ULONGLONG OpenTransaction = JOURNAL_NO_TRANSACTION;
+static BOOL JournalBroken;
+static DWORD TransactionDepth;
+static ULONGLONG WriteGeneration;
+
+static PJOURNAL_RECORD JournalRecord(ULONGLONG Offset)
+{
+    return (PJOURNAL_RECORD)((PBYTE)(Journal + 1) + Offset);
+}
+
+static BOOL MapJournal(ULONGLONG Capacity)
+{
+    ULARGE_INTEGER Size = { .QuadPart = sizeof(JOURNAL_HEADER) + Capacity };
+
+    if (Journal)
+        UnmapViewOfFile(Journal);
+    if (JournalMapping)
+        CloseHandle(JournalMapping);
+
+    Journal = NULL;
+
+    // This will extend the file if necessary.
+    JournalMapping = CreateFileMapping(JournalFile,
+                                       NULL,
+                                       PAGE_READWRITE,
+                                       Size.HighPart,
+                                       Size.LowPart,
+                                       NULL);
+
+    if (JournalMapping == NULL)
+        return FALSE;
+
+    Journal = MapViewOfFile(JournalMapping, FILE_MAP_WRITE, 0, 0, Size.QuadPart);
+
+    if (Journal == NULL)
+        return FALSE;
+
+    Journal->Capacity = Capacity;
+    return TRUE;
+}
+
+static PJOURNAL_RECORD AppendJournalRecord(DWORD Type, ULONGLONG Offset, DWORD DataSize);
+
+// Check the records make sense, anything after the first bad record is
+// thrown away. If Hiew crashed during a transaction, close it so that it can
+// still be undone.
+static VOID RepairJournal(VOID)
+{
+    ULONGLONG Begin = JOURNAL_NO_TRANSACTION;
+    ULONGLONG Offset = 0;
+
+    while (Offset + sizeof(JOURNAL_RECORD) <= Journal->Used) {
+        PJOURNAL_RECORD Record = JournalRecord(Offset);
+
+        if (Record->Size < sizeof(JOURNAL_RECORD) || Offset + Record->Size > Journal->Used)
+            break;
+
+        if (Record->Type == JOURNAL_BEGIN)
+            Begin = Offset;
+        if (Record->Type == JOURNAL_END)
+            Begin = JOURNAL_NO_TRANSACTION;
+
+        Offset += Record->Size;
+    }
+
+    Journal->Used = Offset;
+    Journal->Applied = min(Journal->Applied, Journal->Used);
+
+    if (Begin != JOURNAL_NO_TRANSACTION) {
+        Journal->Applied = Journal->Used;
+
+        if (AppendJournalRecord(JOURNAL_END, Begin, 0) == NULL) {
+            Journal->Used = Journal->Applied = 0;
+        }
+    }
+}
+
+BOOL OpenJournal(LPCSTR HemFile, DWORD FilenameHash)
+{
+    CHAR FileName[MAX_PATH];
+    CHAR Suffix[32];
+    LARGE_INTEGER FileSize;
+    ULONGLONG Capacity;
+    PCHAR Extension;
+
+    if (Journal && JournalHash == FilenameHash)
+        return TRUE;
+
+    CloseJournal();
+
+    // The journal is named after the hem and the file, e.g. keyhelp-1234ABCD.jnl
+    if (strcpy_s(FileName, sizeof FileName, HemFile) != 0)
+        return FALSE;
+
+    if ((Extension = strrchr(FileName, '.')) != NULL)
+        *Extension = '\0';
+
+    snprintf(Suffix, sizeof Suffix, "-%08X%s", FilenameHash, JOURNAL_EXTENSION);
+
+    if (strncat_s(FileName, sizeof FileName, Suffix, _TRUNCATE) != 0)
+        return FALSE;
+
+    JournalFile = CreateFile(FileName,
+                             GENERIC_READ | GENERIC_WRITE,
+                             FILE_SHARE_READ,
+                             NULL,
+                             OPEN_ALWAYS,
+                             FILE_ATTRIBUTE_NORMAL,
+                             NULL);
+
+    if (JournalFile == INVALID_HANDLE_VALUE)
+        goto error;
+
+    if (!GetFileSizeEx(JournalFile, &FileSize))
+        goto error;
+
+    Capacity = JOURNAL_INITIAL_SIZE;
+
+    if (FileSize.QuadPart > sizeof(JOURNAL_HEADER) + JOURNAL_INITIAL_SIZE) {
+        Capacity = min(FileSize.QuadPart - sizeof(JOURNAL_HEADER), JOURNAL_MAX_SIZE);
+    }
+
+    if (!MapJournal(Capacity))
+        goto error;
+
+    if (Journal->Magic != JOURNAL_MAGIC
+     || Journal->Version != JOURNAL_VERSION
+     || Journal->FilenameHash != FilenameHash
+     || Journal->Used > Journal->Capacity) {
+        ZeroMemory(Journal, sizeof *Journal);
+        Journal->Magic = JOURNAL_MAGIC;
+        Journal->Version = JOURNAL_VERSION;
+        Journal->FilenameHash = FilenameHash;
+        Journal->Capacity = Capacity;
+    }
+
+    JournalHash = FilenameHash;
+
+    RepairJournal();
+
+    return TRUE;
+
+error:
+    CloseJournal();
+    return FALSE;
+}
+
+VOID CloseJournal(VOID)
+{
+    if (Journal)
+        UnmapViewOfFile(Journal);
+    if (JournalMapping)
+        CloseHandle(JournalMapping);
+    if (JournalFile != INVALID_HANDLE_VALUE)
+        CloseHandle(JournalFile);
+
+    Journal = NULL;
+    JournalMapping = NULL;
+    JournalFile = INVALID_HANDLE_VALUE;
+    OpenTransaction = JOURNAL_NO_TRANSACTION;
+    JournalBroken = FALSE;
+    TransactionDepth = 0;
+}
+
+// Throw away old transactions until there's room for Size more bytes.
+static BOOL CompactJournal(ULONGLONG Size)
+{
+    ULONGLONG Offset = 0;
+    ULONGLONG Cut = 0;
+
+    while (Offset < Journal->Used && Journal->Used - Cut + Size > Journal->Capacity) {
+        PJOURNAL_RECORD Record = JournalRecord(Offset);
+
+        // Never discard the transaction that's being written.
+        if (Offset >= OpenTransaction)
+            break;
+
+        Offset += Record->Size;
+
+        if (Record->Type == JOURNAL_END)
+            Cut = Offset;
+    }
+
+    if (Journal->Used - Cut + Size > Journal->Capacity)
+        return FALSE;
+
+    MoveMemory(JournalRecord(0), JournalRecord(Cut), Journal->Used - Cut);
+
+    Journal->Used -= Cut;
+    Journal->Applied -= min(Journal->Applied, Cut);
+
+    if (OpenTransaction != JOURNAL_NO_TRANSACTION)
+        OpenTransaction -= Cut;
+
+    // Fix the links from each END to its BEGIN.
+    for (Offset = 0; Offset < Journal->Used; Offset += JournalRecord(Offset)->Size) {
+        if (JournalRecord(Offset)->Type == JOURNAL_END) {
+            JournalRecord(Offset)->Offset -= Cut;
+        }
+    }
+
+    return TRUE;
+}
+
+static PJOURNAL_RECORD AppendJournalRecord(DWORD Type, ULONGLONG Offset, DWORD DataSize)
+{
+    DWORD Size = JOURNAL_ALIGN(sizeof(JOURNAL_RECORD) + DataSize);
+    PJOURNAL_RECORD Record;
+
+    // Anything that was undone can't be redone after a new write.
+    Journal->Used = Journal->Applied;
+
+    if (Journal->Used + Size > Journal->Capacity) {
+        ULONGLONG Current = Journal->Capacity;
+        ULONGLONG Capacity = max(Current * 2, Journal->Used + Size);
+
+        // Grow if I can, otherwise make room.
+        if (Capacity > JOURNAL_MAX_SIZE || !MapJournal(Capacity)) {
+            if (Journal == NULL && !MapJournal(Current))
+                return NULL;
+            if (!CompactJournal(Size))
+                return NULL;
+        }
+    }
+
+    Record = JournalRecord(Journal->Used);
+    Record->Type = Type;
+    Record->Size = Size;
+    Record->Offset = Offset;
+    Record->Length = 0;
+    Record->Reserved = 0;
+
+    Journal->Used += Size;
+    Journal->Applied = Journal->Used;
+
+    return Record;
+}
+
+// This transaction can't be journalled, e.g. it's bigger than the journal.
+// Rather than leave a partial transaction that can't really be undone, the
+// history is discarded and the rest of it isn't recorded.
+static VOID DiscardJournal(VOID)
+{
+    Journal->Used = Journal->Applied = 0;
+    JournalBroken = OpenTransaction != JOURNAL_NO_TRANSACTION;
+    OpenTransaction = JOURNAL_NO_TRANSACTION;
+}
+
+// Transactions can nest, e.g. the write cache flushing during a patch, only
+// the outermost one is recorded.
+VOID BeginJournalTransaction(LPCSTR Description)
+{
+    PJOURNAL_RECORD Record;
+
+    if (TransactionDepth++ != 0)
+        return;
+
+    if (Journal == NULL || OpenTransaction != JOURNAL_NO_TRANSACTION)
+        return;
+
+    JournalBroken = FALSE;
+
+    if ((Record = AppendJournalRecord(JOURNAL_BEGIN, 0, JOURNAL_MAX_DESCRIPTION)) == NULL) {
+        DiscardJournal();
+        JournalBroken = TRUE;
+        return;
+    }
+
+    strncpy_s((PCHAR) Record->Data, JOURNAL_MAX_DESCRIPTION, Description, _TRUNCATE);
+
+    OpenTransaction = (PBYTE) Record - (PBYTE) JournalRecord(0);
+}
+
+BOOL EndJournalTransaction(VOID)
+{
+    BOOL Recorded = Journal != NULL && OpenTransaction != JOURNAL_NO_TRANSACTION;
+
+    if (TransactionDepth == 0 || --TransactionDepth != 0)
+        return Recorded;
+
+    JournalBroken = FALSE;
+
+    if (!Recorded)
+        return FALSE;
+
+    if (AppendJournalRecord(JOURNAL_END, OpenTransaction, 0) == NULL) {
+        DiscardJournal();
+        Recorded = FALSE;
+    }
+
+    OpenTransaction = JOURNAL_NO_TRANSACTION;
+    JournalBroken = FALSE;
+    return Recorded;
+}
+
+// Every byte is stored twice, plus a record header for each write.
+BOOL CanJournalWrite(HEM_QWORD Bytes)
+{
+    ULONGLONG Records = Bytes / JOURNAL_MAX_WRITE + 3;
+
+    if (Journal == NULL)
+        return FALSE;
+
+    return Bytes <= JOURNAL_MAX_SIZE
+        && Bytes * 2 + Records * JOURNAL_ALIGN(sizeof(JOURNAL_RECORD) + JOURNAL_MAX_DESCRIPTION) <= JOURNAL_MAX_SIZE;
+}
+
+BOOL ConfirmWithoutUndo(LPCSTR Action)
+{
+    CHAR Anyway[128];
+    PCHAR Menu[] = {
+        Anyway,
+        "Cancel",
+    };
+
+    snprintf(Anyway, sizeof Anyway, "%s anyway, this can't be undone", Action);
+
+    return HiewGate_Menu("Too big to undo", Menu, _countof(Menu), strlen(Menu[0]), 2, NULL, NULL, NULL, NULL) == 1;
+}
+
+int JournalFileWrite(HEM_QWORD Offset, HEM_UINT Bytes, HEM_BYTE *Buffer)
+{
+    BOOL Implicit = FALSE;
+
+    // Any saved results are about to be wrong, and so might the headers.
+    InvalidateResultCache();
+    InvalidateSectionMap();
+
+    WriteGeneration++;
+
+    if (Journal == NULL || JournalBroken)
+        goto write;
+
+    // A write outside a transaction is a transaction by itself.
+    if (TransactionDepth == 0) {
+        BeginJournalTransaction("Write");
+        Implicit = TRUE;
+    }
+
+    for (HEM_UINT Done = 0; Done < Bytes && !JournalBroken;) {
+        DWORD Count = min(Bytes - Done, JOURNAL_MAX_WRITE);
+        PJOURNAL_RECORD Record;
+
+        if ((Record = AppendJournalRecord(JOURNAL_WRITE, Offset + Done, Count * 2)) == NULL) {
+            DiscardJournal();
+            break;
+        }
+
+        Record->Length = Count;
+
+        // Read the old contents straight into the journal.
+        if (HiewGate_FileRead(Offset + Done, Count, Record->Data) != (int) Count) {
+            DiscardJournal();
+            break;
+        }
+
+        CopyMemory(Record->Data + Count, Buffer + Done, Count);
+
+        Done += Count;
+    }
+
+    if (Implicit)
+        EndJournalTransaction();
+
+write:
+    return HiewGate_FileWrite(Offset, Bytes, Buffer);
+}
+
+ULONGLONG GetWriteGeneration(VOID)
+{
+    return WriteGeneration;
+}
+
+// Find the END of the transaction starting at Begin, which has to be a BEGIN.
+// The journal is just a file, so every record on the way is checked before I
+// trust its Size or Length.
+static BOOL FindTransactionEnd(ULONGLONG Begin, PULONGLONG End)
+{
+    ULONGLONG Offset = Begin;
+
+    while (Offset + sizeof(JOURNAL_RECORD) <= Journal->Used) {
+        PJOURNAL_RECORD Record = JournalRecord(Offset);
+
+        if (Record->Size < sizeof(JOURNAL_RECORD) || Record->Size > Journal->Used - Offset)
+            return FALSE;
+
+        if (Offset == Begin && Record->Type != JOURNAL_BEGIN)
+            return FALSE;
+
+        // Writes are never split bigger than JOURNAL_MAX_WRITE, and that's
+        // all VerifyTransaction() has room for.
+        if (Record->Type == JOURNAL_WRITE) {
+            if (Record->Length == 0 || Record->Length > JOURNAL_MAX_WRITE)
+                return FALSE;
+
+            if (sizeof(JOURNAL_RECORD) + Record->Length * 2ULL > Record->Size)
+                return FALSE;
+        }
+
+        if (Record->Type == JOURNAL_END) {
+            *End = Offset;
+            return TRUE;
+        }
+
+        Offset += Record->Size;
+    }
+
+    return FALSE;
+}
+
+// Find the WRITE records between Begin and End, which FindTransactionEnd()
+// has already checked.
+static DWORD GetTransactionWrites(ULONGLONG Begin, ULONGLONG End, PULONGLONG *Writes)
+{
+    ULONGLONG Offset;
+    DWORD Count = 0;
+
+    *Writes = NULL;
+
+    for (Offset = Begin; Offset < End; Offset += JournalRecord(Offset)->Size) {
+        if (JournalRecord(Offset)->Type == JOURNAL_WRITE) {
+            Count++;
+        }
+    }
+
+    if (Count == 0 || (*Writes = calloc(Count, sizeof(ULONGLONG))) == NULL)
+        return 0;
+
+    Count = 0;
+
+    for (Offset = Begin; Offset < End; Offset += JournalRecord(Offset)->Size) {
+        if (JournalRecord(Offset)->Type == JOURNAL_WRITE) {
+            (*Writes)[Count++] = Offset;
+        }
+    }
+
+    return Count;
+}
+
+// The first range that ends at or after Position, the ranges are sorted and
+// don't touch.
+static DWORD FindRange(PJOURNAL_RANGE Ranges, DWORD Count, ULONGLONG Position)
+{
+    DWORD Low = 0;
+    DWORD High = Count;
+
+    while (Low < High) {
+        DWORD Middle = Low + (High - Low) / 2;
+
+        if (Ranges[Middle].End < Position) {
+            Low = Middle + 1;
+        } else {
+            High = Middle;
+        }
+    }
+
+    return Low;
+}
+
+// Before undoing (or redoing) a transaction, make sure the file still
+// contains what it wrote (or overwrote). Otherwise the file must have been
+// changed some other way, and putting the old bytes back would corrupt it.
+//
+// When writes in a transaction overlap, only the last (or first) one to touch
+// a byte matters, so I keep a sorted list of what has already been checked
+// and only compare the gaps in it.
+static BOOL VerifyTransaction(PULONGLONG Writes, DWORD Count, BOOL Undo)
+{
+    PJOURNAL_RANGE Checked;
+    DWORD NumChecked = 0;
+    PBYTE Current;
+    BOOL Result = FALSE;
+
+    Checked = calloc(Count, sizeof *Checked);
+    Current = malloc(JOURNAL_MAX_WRITE);
+
+    if (Checked == NULL || Current == NULL)
+        goto finished;
+
+    for (DWORD i = 0; i < Count; i++) {
+        PJOURNAL_RECORD Record = JournalRecord(Writes[Undo ? Count - i - 1 : i]);
+        PBYTE Expected = Undo ? Record->Data + Record->Length : Record->Data;
+        ULONGLONG Start = Record->Offset;
+        ULONGLONG End = Record->Offset + Record->Length;
+        ULONGLONG Position = Start;
+        DWORD First = FindRange(Checked, NumChecked, Start);
+        DWORD Last;
+
+        if (HiewGate_FileRead(Start, Record->Length, Current) != (int) Record->Length)
+            goto finished;
+
+        // Compare everything that wasn't covered by a record already checked.
+        for (DWORD j = First; Position < End;) {
+            ULONGLONG Gap;
+
+            if (j < NumChecked && Checked[j].Start <= Position) {
+                Position = max(Position, Checked[j].End);
+                j++;
+                continue;
+            }
+
+            Gap = j < NumChecked ? min(Checked[j].Start, End) : End;
+
+            if (memcmp(Current + (Position - Start), Expected + (Position - Start), (SIZE_T)(Gap - Position)) != 0)
+                goto finished;
+
+            Position = Gap;
+        }
+
+        // Add this range, merging it with any it touches.
+        for (Last = First; Last < NumChecked && Checked[Last].Start <= End; Last++)
+            ;
+
+        if (Last == First) {
+            MoveMemory(&Checked[First + 1], &Checked[First], (NumChecked - First) * sizeof *Checked);
+            Checked[First].Start = Start;
+            Checked[First].End = End;
+            NumChecked++;
+        } else {
+            Checked[First].Start = min(Checked[First].Start, Start);
+            Checked[First].End = max(Checked[Last - 1].End, End);
+            MoveMemory(&Checked[First + 1], &Checked[Last], (NumChecked - Last) * sizeof *Checked);
+            NumChecked -= Last - First - 1;
+        }
+    }
+
+    Result = TRUE;
+
+finished:
+    free(Checked);
+    free(Current);
+    return Result;
+}
+
+static int ReplayTransaction(ULONGLONG Begin, ULONGLONG End, BOOL Undo, PCHAR Message, SIZE_T MaxLen)
+{
+    PJOURNAL_RECORD Description = JournalRecord(Begin);
+    PULONGLONG Writes;
+    ULONGLONG Bytes = 0;
+    DWORD Count;
+
+    if ((Count = GetTransactionWrites(Begin, End, &Writes)) == 0) {
+        snprintf(Message, MaxLen, "That transaction didn't write anything.");
+        return HEM_ERROR;
+    }
+
+    HiewGate_MessageWaitOpen(Undo ? "Undoing..." : "Redoing...");
+
+    if (!VerifyTransaction(Writes, Count, Undo)) {
+        HiewGate_MessageWaitClose();
+        snprintf(Message, MaxLen, "The file has changed since \"%s\", not touching it.", (PCHAR) Description->Data);
+        free(Writes);
+        return HEM_ERROR;
+    }
+
+    if (HiewGate_FileOpenForWrite() != HEM_OK) {
+        HiewGate_MessageWaitClose();
+        snprintf(Message, MaxLen, "The file is read only.");
+        free(Writes);
+        return HEM_ERROR;
+    }
+
+    InvalidateResultCache();
+    InvalidateSectionMap();
+
+    WriteGeneration++;
+
+    // Undo happens in reverse order, in case writes overlapped.
+    for (DWORD i = 0; i < Count; i++) {
+        PJOURNAL_RECORD Record = JournalRecord(Writes[Undo ? Count - i - 1 : i]);
+
+        // Applied isn't moved, because this transaction wasn't really
+        // undone, the user has to know how much of it was.
+        if (HiewGate_FileWrite(Record->Offset,
+                               Record->Length,
+                               Undo ? Record->Data : Record->Data + Record->Length) != HEM_OK) {
+            HiewGate_MessageWaitClose();
+            snprintf(Message,
+                     MaxLen,
+                     "Hiew failed to write at %#llx, only %u of %u writes (%llu bytes) of \"%s\" were %s.",
+                     Record->Offset,
+                     i,
+                     Count,
+                     Bytes,
+                     (PCHAR) Description->Data,
+                     Undo ? "undone" : "redone");
+            free(Writes);
+            return HEM_ERROR;
+        }
+
+        Bytes += Record->Length;
+    }
+
+    HiewGate_MessageWaitClose();
+
+    snprintf(Message,
+             MaxLen,
+             "%s \"%s\", %llu bytes in %u writes.",
+             Undo ? "Undid" : "Redid",
+             (PCHAR) Description->Data,
+             Bytes,
+             Count);
+
+    free(Writes);
+    return HEM_OK;
+}
+
+int UndoJournalTransaction(PCHAR Message, SIZE_T MaxLen)
+{
+    PJOURNAL_RECORD Record;
+    ULONGLONG Begin;
+    ULONGLONG End;
+
+    if (Journal == NULL) {
+        snprintf(Message, MaxLen, "There is no undo journal for this file.");
+        return HEM_ERROR;
+    }
+
+    if (Journal->Applied == 0) {
+        snprintf(Message, MaxLen, "There is nothing to undo.");
+        return HEM_ERROR;
+    }
+
+    if (Journal->Applied < sizeof(JOURNAL_RECORD)) {
+        snprintf(Message, MaxLen, "The undo journal is corrupt.");
+        return HEM_ERROR;
+    }
+
+    Record = JournalRecord(Journal->Applied - sizeof(JOURNAL_RECORD));
+    Begin = Record->Offset;
+
+    // The walk from its BEGIN has to arrive at this END.
+    if (Record->Type != JOURNAL_END
+     || Begin >= Journal->Applied
+     || !FindTransactionEnd(Begin, &End)
+     || End != Journal->Applied - sizeof(JOURNAL_RECORD)) {
+        snprintf(Message, MaxLen, "The undo journal is corrupt.");
+        return HEM_ERROR;
+    }
+
+    if (ReplayTransaction(Begin, End, TRUE, Message, MaxLen) != HEM_OK)
+        return HEM_ERROR;
+
+    Journal->Applied = Begin;
+    return HEM_OK;
+}
+
+int RedoJournalTransaction(PCHAR Message, SIZE_T MaxLen)
+{
+    ULONGLONG Begin;
+    ULONGLONG End;
+
+    if (Journal == NULL) {
+        snprintf(Message, MaxLen, "There is no undo journal for this file.");
+        return HEM_ERROR;
+    }
+
+    if (Journal->Applied == Journal->Used) {
+        snprintf(Message, MaxLen, "There is nothing to redo.");
+        return HEM_ERROR;
+    }
+
+    Begin = Journal->Applied;
+
+    if (!FindTransactionEnd(Begin, &End)) {
+        snprintf(Message, MaxLen, "The undo journal is corrupt.");
+        return HEM_ERROR;
+    }
+
+    if (ReplayTransaction(Begin, End, FALSE, Message, MaxLen) != HEM_OK)
+        return HEM_ERROR;
+
+    Journal->Applied = End + JournalRecord(End)->Size;
+    return HEM_OK;
+}
@@ -0,0 +1,38 @@
+#ifndef __JOURNAL_H
+#define __JOURNAL_H
+
+// Opens the undo journal for the file identified by FilenameHash, the journal
+// is kept next to the hem. Nothing happens if it's already open.
+BOOL OpenJournal(LPCSTR HemFile, DWORD FilenameHash);
+
+// Unmaps the journal, it's safe to call this if it was never opened.
+VOID CloseJournal(VOID);
+
+// All writes between these calls are undone together, they can be nested.
+// EndJournalTransaction() returns FALSE if the transaction couldn't be
+// recorded, so it can't be undone.
+VOID BeginJournalTransaction(LPCSTR Description);
+BOOL EndJournalTransaction(VOID);
+
+// Roughly whether a transaction that writes this many bytes fits in the
+// journal. If it doesn't, the whole history is discarded to make room.
+BOOL CanJournalWrite(HEM_QWORD Bytes);
+
+// Asks whether to go ahead when CanJournalWrite() says no, Action is what
+// would happen, e.g. "Transform it".
+BOOL ConfirmWithoutUndo(LPCSTR Action);
+
+// Just like HiewGate_FileWrite(), but records what was overwritten first. If
+// there's no journal open, the write still happens.
+int JournalFileWrite(HEM_QWORD Offset, HEM_UINT Bytes, HEM_BYTE *Buffer);
+
+// Counts the writes made through the HiewGate, including undo and redo, so
+// anything that read the file earlier can tell if it might have changed.
+ULONGLONG GetWriteGeneration(VOID);
+
+// Undo or redo the most recent transaction. Returns HEM_OK, or HEM_ERROR
+// with a reason in Message.
+int UndoJournalTransaction(PCHAR Message, SIZE_T MaxLen);
+int RedoJournalTransaction(PCHAR Message, SIZE_T MaxLen);
+
+#endif
@@ -8,9 +8,38 @@
 
 #include "hem.h"
 #include "input.h"
+#include "history.h"
+#include "inject.h"
+#include "keyhelp.h"
+#include "paste.h"
+#include "patch.h"
+#include "journal.h"
+#include "wcache.h"
+#include "hash.h"
+#include "entropy.h"
+#include "vlist.h"
+#include "diff.h"
+#include "textscan.h"
+#include "signature.h"
+#include "rcache.h"
+#include "job.h"
+#include "stream.h"
+#include "background.h"
+#include "xref.h"
+#include "valscan.h"
+#include "autoname.h"
+#include "template.h"
+#include "transform.h"
+#include "decode.h"
+#include "carve.h"
+#include "regex.h"
 
 static HEM_API Hem_EntryPoint(HEMCALL_TAG *);
 static HEM_API Hem_Unload(void);
+static HEM_API Hem2HemGate(void *);
+static int SendKeyEntryPoint(HEMCALL_TAG *);
+static int UndoEntryPoint(HEMCALL_TAG *);
+static int RedoEntryPoint(HEMCALL_TAG *);
 
 HEMINFO_TAG KeyboardHelper = {
     .cbSize         = sizeof(KeyboardHelper),
@@ -20,6 +49,7 @@ HEMINFO_TAG KeyboardHelper = {
     .hemFlag        = HEM_FLAG_MODEMASK | HEM_FLAG_FILEMASK,
     .EntryPoint     = Hem_EntryPoint,
     .Unload         = Hem_Unload,
+    .Hem2HemGate    = Hem2HemGate,
     .shortName      = "Keyboard Helper",
     .name           = "Hiew Keyboard Helper",
     .about1         = "This plugin can send key combinations that",
@@ -27,14 +57,18 @@ HEMINFO_TAG KeyboardHelper = {
     .about3         = "",
 };
 
-// How long to wait between simulated input events.
-#define KEY_SEND_DELAY 64
-
+// If an entry has a Handler, it's called instead of sending the key.
 typedef struct _HIEW_KEYS {
     PCHAR Key;
     PCHAR Description;
+    int (*Handler)(HEMCALL_TAG *HemCall);
 } HIEW_KEYS, *PHIEW_KEYS;
 
+typedef struct _KEY_RANK {
+    DWORD Index;
+    DWORD Score;
+} KEY_RANK, *PKEY_RANK;
+
 static HIEW_KEYS HiewKeys[] = {
     { "Ctrl+Alt", "information" },
     { "Ctrl+Backspace", "file history" },
@@ -42,108 +76,245 @@ static HIEW_KEYS HiewKeys[] = {
     { "Ctrl+-", "Macro manager" },
     { "Ctrl+NumMult", "mark all" },
     { "Alt+NumMult", "resize block to current offset" },
+    { "Paste", "type text or hex from clipboard or file", PasteEntryPoint },
+    { "Send Key", "type any key, e.g. Page Down x500", SendKeyEntryPoint },
+    { "Apply Patch", "apply an IPS, BPS or hex script patch", PatchEntryPoint },
+    { "Undo Write", "undo the last change made by this plugin", UndoEntryPoint },
+    { "Redo Write", "redo the last change that was undone", RedoEntryPoint },
+    { "Hash", "crc32, sha1, sha256 or xxhash of the block", HashEntryPoint },
+    { "Entropy", "find packed or encrypted regions", EntropyEntryPoint },
+    { "Compare", "highlight differences with another file", DiffEntryPoint },
+    { "Strings", "find ascii and utf-16 strings", StringsEntryPoint },
+    { "Signatures", "find crypto constants, packers and more", SignatureEntryPoint },
+    { "Cross References", "find calls, jumps and pointers to the cursor", XrefEntryPoint },
+    { "Values", "find numbers, floats or pointers in the block", ValuesEntryPoint },
+    { "Name Symbols", "name imports, exports and symbols from the headers", AutoNameEntryPoint },
+    { "Templates", "decode structs at the cursor", TemplateEntryPoint },
+    { "Transform", "xor, add, rotate, swap or fill the marked block", TransformEntryPoint },
+    { "Decode", "base64, hex or deflate from the block to a file", DecodeEntryPoint },
+    { "Carve", "find embedded files and save them to disk", CarveEntryPoint },
+    { "Regex", "find all matches of a byte regex", RegexEntryPoint },
+    { "Background Jobs", "show running and finished analysis", BackgroundEntryPoint },
 };
 
-DWORD WINAPI SendInputThread(LPVOID lpvThreadParam);
+// The journal lives next to the hem, so I need to remember where that is.
+static CHAR HemFile[MAX_PATH];
 
 int HEM_EXPORT Hem_Load(HIEWINFO_TAG *HiewInfo)
 {
     HiewGate_Set(HiewInfo);
     HiewInfo->hemInfo = &KeyboardHelper;
+
+    // It doesn't matter if this fails, the menu just won't be sorted.
+    OpenKeyHistory(HiewInfo->hemFile);
+
+    // Signatures are only compiled when first used, this just finds them.
+    OpenSignatures(HiewInfo->hemFile);
+    OpenTemplates(HiewInfo->hemFile);
+
+    strncpy_s(HemFile, sizeof HemFile, (PCHAR) HiewInfo->hemFile, _TRUNCATE);
+
     return HEM_OK;
 }
 
 int HEM_API Hem_Unload()
 {
+    StopBackgroundJobs();
+    StopPaste();
+    StopKeyInjector();
+    DiscardFileWrites();
+    CloseKeyHistory();
+    CloseJournal();
+    CloseSignatures();
+    CloseTemplates();
+    CloseResultCache();
+    return HEM_OK;
+}
+
+// Most likely keys first, ties stay in the order of HiewKeys.
+static int __cdecl CompareKeyRank(const void *a, const void *b)
+{
+    const KEY_RANK *x = a;
+    const KEY_RANK *y = b;
+
+    if (x->Score != y->Score)
+        return x->Score > y->Score ? -1 : 1;
+
+    return x->Index < y->Index ? -1 : x->Index > y->Index;
+}
+
+static VOID FormatKeyEntry(PVOID Context, DWORD Index, const VOID *Record, PCHAR Buffer, SIZE_T Size)
+{
+    const KEY_RANK *Rank = Record;
+    PHIEW_KEYS Entry = &HiewKeys[Rank->Index];
+
+    snprintf(Buffer, Size, "%-16s - %s", Entry->Key, Entry->Description);
+}
+
+// Let the user type any key combination.
+int SendKeyEntryPoint(HEMCALL_TAG *HemCall)
+{
+    static CHAR HotKey[64];
+    LPCSTR Keys[] = { HotKey };
+
+    if (HiewGate_GetString("Key (e.g. Ctrl+Shift+A, Page Down x500)",
+                           HotKey,
+                           sizeof HotKey) != HEM_INPUT_CR) {
+        return HEM_OK;
+    }
+
+    if (!QueueKeyStrings(Keys, _countof(Keys), FALSE)) {
+        HiewGate_Message("Error", "I don't know how to type that key.");
+    }
+
+    return HEM_OK;
+}
+
+int UndoEntryPoint(HEMCALL_TAG *HemCall)
+{
+    CHAR Message[256];
+
+    UndoJournalTransaction(Message, sizeof Message);
+    HiewGate_Message("Undo", Message);
+    return HEM_OK;
+}
+
+int RedoEntryPoint(HEMCALL_TAG *HemCall)
+{
+    CHAR Message[256];
+
+    RedoJournalTransaction(Message, sizeof Message);
+    HiewGate_Message("Redo", Message);
     return HEM_OK;
 }
 
-static PCHAR HiewGate_StringDup(LPCSTR String)
+// Other hems can ask me to send keys, see keyhelp.h
+int HEM_API Hem2HemGate(void *Parameters)
 {
-    PCHAR Result;
-    Result = HiewGate_GetMemory(strlen(String) + 1);
-    return strcpy(Result, String);
+    KEYHELP_GETVERSION *Request = Parameters;
+
+    if (Request == NULL)
+        return HEM_ERR_POINTER_IS_NULL;
+
+    // Every request starts like KEYHELP_GETVERSION.
+    if (Request->cbSize < sizeof(KEYHELP_GETVERSION))
+        return HEM_ERR_HIEWDATA_SIZE_MISMATCH;
+
+    if (Request->version > KEYHELP_VERSION)
+        return HEM_ERR_HIEW_VERSION_INVALID;
+
+    switch (Request->callId) {
+        case KEYHELP_ID_GETVERSION: {
+            Request->version = KEYHELP_VERSION;
+            return HEM_OK;
+        }
+        case KEYHELP_ID_SENDKEYS: {
+            KEYHELP_SENDKEYS *Send = Parameters;
+            int Flags;
+
+            // Version 1 didn't have flags.
+            if (Send->cbSize < RTL_SIZEOF_THROUGH_FIELD(KEYHELP_SENDKEYS, count))
+                return HEM_ERR_HIEWDATA_SIZE_MISMATCH;
+            if (Send->keys == NULL || Send->count < 0)
+                return HEM_ERR_POINTER_IS_NULL;
+
+            Flags = Send->cbSize >= sizeof(KEYHELP_SENDKEYS) ? Send->flags : 0;
+
+            return QueueKeyStrings((LPCSTR *) Send->keys, Send->count, Flags & KEYHELP_FLAG_COALESCE)
+                ? HEM_OK
+                : HEM_ERR_INVALID_ARGUMENT;
+        }
+        case KEYHELP_ID_SENDRECORDS: {
+            KEYHELP_SENDRECORDS *Send = Parameters;
+            int Flags;
+
+            if (Send->cbSize < RTL_SIZEOF_THROUGH_FIELD(KEYHELP_SENDRECORDS, count))
+                return HEM_ERR_HIEWDATA_SIZE_MISMATCH;
+            if (Send->records == NULL || Send->count < 0)
+                return HEM_ERR_POINTER_IS_NULL;
+
+            Flags = Send->cbSize >= sizeof(KEYHELP_SENDRECORDS) ? Send->flags : 0;
+
+            return QueueKeyRecords(Send->records, Send->count, Flags & KEYHELP_FLAG_COALESCE)
+                ? HEM_OK
+                : HEM_ERROR;
+        }
+    }
+
+    return HEM_ERR_HIEWGATE_ID_INVALID;
 }
 
 int HEM_API Hem_EntryPoint(HEMCALL_TAG *HemCall)
 {
-    static HANDLE InputThread;
-    PCHAR KeyList[_countof(HiewKeys)];
+    static VLIST KeyList;
+    PKEY_RANK KeyOrder;
     DWORD KeyWidth = 0;
-    DWORD KeyNum;
+    LONG KeyNum;
 
     if (HemCall->cbSize < sizeof(HEMCALL_TAG))
         return HEM_ERROR;
 
-    // Generate the menu
-    for (DWORD Key = 0; Key < _countof(HiewKeys); Key++) {
-        CHAR MenuEntry[256];
+    // The user might have switched layouts since last time, get the tables
+    // ready while they're choosing.
+    SelectKeyLayout(GetKeyboardLayout(0));
 
-        // Format entry..
-        snprintf(MenuEntry,
-                 sizeof MenuEntry, "%-16s - %s",
-                 HiewKeys[Key].Key,
-                 HiewKeys[Key].Description);
+    // Every file has its own journal, if it can't be opened writes still
+    // work but can't be undone.
+    OpenJournal(HemFile, HemCall->filenameHash);
 
-        KeyList[Key] = HiewGate_StringDup(MenuEntry);
+    // Results from last time can be reused if the file hasn't changed.
+    OpenResultCache(HemFile, HemCall->filenameHash);
 
-        if (strlen(KeyList[Key]) > KeyWidth)
-            KeyWidth = strlen(KeyList[Key]);
+    // Anything that finished in the background since last time is applied
+    // now, while the file is open.
+    if (CollectBackgroundJobs(HemCall))
+        HiewGate_Message("Background Jobs", "Background jobs finished, their results have been applied.");
+
+    InitVirtualList(&KeyList, sizeof(KEY_RANK), FormatKeyEntry, NULL);
+
+    if (!ResizeVirtualList(&KeyList, _countof(HiewKeys))) {
+        HiewGate_Message("Error", "Not enough memory for the menu.");
+        return HEM_OK;
     }
 
-    KeyNum = HiewGate_Menu("Choose Key",
-                           KeyList,
-                           _countof(HiewKeys),
-                           KeyWidth,
-                           0,
-                           NULL,
-                           NULL,
-                           NULL,
-                           NULL);
-
-    // Clean up.
+    KeyOrder = GetVirtualListRecord(&KeyList, 0);
+
+    // Put the keys I'm most likely to want first.
     for (DWORD Key = 0; Key < _countof(HiewKeys); Key++) {
-        HiewGate_FreeMemory(KeyList[Key]);
-    }
+        KeyOrder[Key].Index = Key;
+        KeyOrder[Key].Score = GetKeyScore(HiewKeys[Key].Key);
 
-    if (KeyNum-- <= 0) {
-        HiewGate_Message("Error", "Action was cancelled.");
-        return HEM_OK;
+        KeyWidth = max(KeyWidth, 16 + 3 + strlen(HiewKeys[Key].Description));
     }
 
-    InputThread = CreateThread(NULL, 0, SendInputThread, &HiewKeys[KeyNum], 0, 0);
+    qsort(KeyOrder, _countof(HiewKeys), sizeof *KeyOrder, CompareKeyRank);
 
-    // I don't need to monitor the result
-    CloseHandle(InputThread);
+    KeyNum = ShowVirtualList(&KeyList, "Choose Key", KeyWidth, 0);
 
-    return HEM_OK;
-}
+    // Translate back to the real index.
+    if (KeyNum >= 0)
+        KeyNum = KeyOrder[KeyNum].Index;
 
-DWORD WINAPI SendInputThread(LPVOID lpvThreadParam)
-{
-    PHIEW_KEYS InputKeys;
-    DWORD EventCount;
-    WORD ScanCode;
-    WORD ScanCodeEx;
-    WORD KeyCode;
-    CHAR AsciiChar;
-    INT Event;
+    FreeVirtualList(&KeyList);
 
-    INPUT_RECORD InputRecord = {
-        .EventType = KEY_EVENT,
-    };
+    if (KeyNum < 0) {
+        HiewGate_Message("Error", "Action was cancelled.");
+        return HEM_OK;
+    }
 
-    // Wait for dialogs to clean up.
-    Sleep(KEY_SEND_DELAY);
+    RecordKeyUsage(HiewKeys[KeyNum].Key);
 
-    InputKeys = lpvThreadParam;
+    if (HiewKeys[KeyNum].Handler) {
+        int Result = HiewKeys[KeyNum].Handler(HemCall);
 
-    DecodeKeyString(InputKeys->Key, &InputRecord.Event.KeyEvent);
+        // Make sure the file is up to date before Hiew looks at it again.
+        FlushFileWrites();
+        return Result;
+    }
 
-    WriteConsoleInput(GetStdHandle(STD_INPUT_HANDLE),
-                      &InputRecord,
-                      1,
-                      &EventCount);
+    if (!QueueKeyStrings((LPCSTR *) &HiewKeys[KeyNum].Key, 1, FALSE)) {
+        HiewGate_Message("Error", "Failed to send that key.");
+    }
 
-    return 0;
+    return HEM_OK;
 }
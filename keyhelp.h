@@ -0,0 +1,84 @@
+//
+//    Keyboard Helper Hem2Hem interface
+//
+//    Other hems can send keystrokes to Hiew through this plugin, e.g.
+//
+//      HIEWGATE_GETHEM2HEMGATE gate;
+//      KEYHELP_SENDKEYS        send = { sizeof( send ), KEYHELP_ID_SENDKEYS, KEYHELP_VERSION };
+//
+//      if( HiewGate_GetHem2HemGate( &gate, KEYHELP_SHORTNAME ) == HEM_OK ){
+//        send.keys = keys;
+//        send.count = 2;
+//        gate.Hem2HemGate( &send );
+//      }
+//
+//    The keys are queued, and are delivered after your entry point returns.
+//
+
+#ifndef _KEYHELP_H_
+#define _KEYHELP_H_
+
+#include <pshpack1.h>
+
+////////////////////////////////////////////////////////////
+// Version of this interface, only ever extended
+
+#define KEYHELP_VERSION               2
+#define KEYHELP_SHORTNAME             "Keyboard Helper"
+
+////////////////////////////////////////////////////////////
+// Identificators of the hem2hem calls
+
+enum KEYHELPID_T{
+        KEYHELP_ID_GETVERSION               = 0,
+        KEYHELP_ID_SENDKEYS,
+        KEYHELP_ID_SENDRECORDS,
+        KEYHELP_ID_MAX };
+
+////////////////////////////////////////////////////////////
+// Flags for sending keys, added in version 2
+//
+// Hiew reads each event separately, so by default a repeated key is sent as
+// that many events (in a few large writes). If the reader honours
+// wRepeatCount, set KEYHELP_FLAG_COALESCE to send a single event instead.
+
+#define KEYHELP_FLAG_COALESCE         0x00000001
+
+////////////////////////////////////////////////////////////
+// Structures of the hem2hem calls
+//
+// returns:
+//    HEM_ERR_POINTER_IS_NULL
+//    HEM_ERR_HIEWDATA_SIZE_MISMATCH
+//    HEM_ERR_HIEW_VERSION_INVALID, if version is newer than this plugin
+//    HEM_ERR_HIEWGATE_ID_INVALID
+//    HEM_ERR_INVALID_ARGUMENT, if a key couldn't be decoded
+//    HEM_OK
+
+typedef struct{
+  int                     cbSize;
+  int                     callId;           // KEYHELP_ID_GETVERSION
+  int                     version;          // KEYHELP_VERSION, returns plugin version
+  }KEYHELP_GETVERSION;
+
+typedef struct{
+  int                     cbSize;
+  int                     callId;           // KEYHELP_ID_SENDKEYS
+  int                     version;          // KEYHELP_VERSION
+  HEM_BYTE              **keys;             // e.g. "Ctrl+Shift+A", "Page Down x500"
+  int                     count;
+  int                     flags;            // KEYHELP_FLAG_*, version 2
+  }KEYHELP_SENDKEYS;
+
+typedef struct{
+  int                     cbSize;
+  int                     callId;           // KEYHELP_ID_SENDRECORDS
+  int                     version;          // KEYHELP_VERSION
+  struct _KEY_EVENT_RECORD *records;        // pre-decoded key events
+  int                     count;
+  int                     flags;            // KEYHELP_FLAG_*, version 2
+  }KEYHELP_SENDRECORDS;
+
+#include <poppack.h>
+
+#endif /* _KEYHELP_H_ */
@@ -0,0 +1,332 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "input.h"
+#include "inject.h"
+#include "paste.h"
+
+// Typing a long hex string into Hiew over ssh is painful, this lets you paste
+// it instead. The payload is converted to key events a batch at a time by a
+// background thread, so that it never gets too far ahead of Hiew.
+//
+// Hiew can't read input until the entry point returns, so the paste has to
+// keep running afterwards. To check on it (or cancel it), just choose Paste
+// again.
+
+// How many characters to convert and queue at once.
+#define PASTE_BATCH 256
+
+// How long to wait for the injector to catch up.
+#define PASTE_POLL_DELAY 8
+
+// Anything bigger than this is probably a mistake.
+#define PASTE_MAX_FILE (64 * 1024 * 1024)
+
+// How much of a file to read between checking for Esc.
+#define PASTE_READ_CHUNK (1024 * 1024)
+
+enum {
+    PASTE_TEXT_CLIPBOARD = 1,
+    PASTE_HEX_CLIPBOARD,
+    PASTE_TEXT_FILE,
+    PASTE_HEX_FILE,
+};
+
+static PCHAR PasteSources[] = {
+    "Text from clipboard",
+    "Hex digits from clipboard",
+    "Text from file",
+    "Bytes from file as hex",
+};
+
+typedef struct _PASTE_STATE {
+    PBYTE Payload;
+    SIZE_T Length;
+    SIZE_T Position;
+    BOOL HexBytes;
+    ULONGLONG Characters;
+    ULONGLONG FirstEvent;
+    ULONGLONG StartTime;
+    ULONGLONG FinishTime;
+    volatile BOOL Cancel;
+} PASTE_STATE, *PPASTE_STATE;
+
+static PASTE_STATE Paste;
+static HANDLE PasteThread;
+
+static DWORD WINAPI PasteKeysThread(LPVOID lpvThreadParam)
+{
+    static const CHAR HexDigits[] = "0123456789ABCDEF";
+    KEY_EVENT_RECORD Batch[PASTE_BATCH];
+    DWORD Count;
+
+    while (Paste.Position < Paste.Length && !Paste.Cancel) {
+
+        // Don't get too far ahead of the injector, it's waiting for Hiew.
+        if (GetPendingKeyCount() >= PASTE_BATCH) {
+            Sleep(PASTE_POLL_DELAY);
+            continue;
+        }
+
+        for (Count = 0; Count + 2 <= PASTE_BATCH && Paste.Position < Paste.Length;) {
+            BYTE Byte = Paste.Payload[Paste.Position++];
+
+            if (Paste.HexBytes) {
+                DecodeKeyChar(HexDigits[Byte >> 4], &Batch[Count++]);
+                DecodeKeyChar(HexDigits[Byte & 15], &Batch[Count++]);
+                continue;
+            }
+
+            // A newline is just Enter.
+            if (Byte == '\r' && Paste.Position < Paste.Length) {
+                if (Paste.Payload[Paste.Position] == '\n') {
+                    continue;
+                }
+            }
+
+            if (Byte == '\n')
+                Byte = '\r';
+
+            DecodeKeyChar(Byte, &Batch[Count++]);
+        }
+
+        if (!QueueKeyRecords(Batch, Count, FALSE))
+            break;
+
+        Paste.Characters += Count;
+    }
+
+    // Wait for it all to be delivered, so that the rate is accurate.
+    while (!Paste.Cancel && GetPendingKeyCount())
+        Sleep(PASTE_POLL_DELAY);
+
+    if (Paste.Cancel)
+        DiscardKeyRecords();
+
+    Paste.FinishTime = GetTickCount64();
+
+    return 0;
+}
+
+static BOOL IsPasteRunning(VOID)
+{
+    return PasteThread && WaitForSingleObject(PasteThread, 0) == WAIT_TIMEOUT;
+}
+
+static VOID FormatPasteStatus(PCHAR Status, SIZE_T MaxLen)
+{
+    ULONGLONG Delivered = GetDeliveredKeyCount() - Paste.FirstEvent;
+    ULONGLONG Elapsed;
+
+    Elapsed = (Paste.FinishTime ? Paste.FinishTime : GetTickCount64()) - Paste.StartTime;
+
+    // Other keys might have been sent at the same time.
+    Delivered = min(Delivered, Paste.Characters);
+
+    snprintf(Status,
+             MaxLen,
+             "%llu characters %s, %llu characters/sec.",
+             Delivered,
+             Paste.Cancel ? "sent before cancel" : "sent",
+             Delivered * 1000 / max(Elapsed, 1));
+}
+
+static VOID FreePaste(VOID)
+{
+    if (PasteThread)
+        CloseHandle(PasteThread);
+
+    free(Paste.Payload);
+
+    ZeroMemory(&Paste, sizeof Paste);
+
+    PasteThread = NULL;
+}
+
+static PBYTE ReadClipboardText(PSIZE_T Length)
+{
+    HANDLE Clipboard;
+    PBYTE Result = NULL;
+    PCHAR Text;
+
+    if (!OpenClipboard(NULL))
+        return NULL;
+
+    // The console expects the OEM codepage, Windows will convert for me.
+    if ((Clipboard = GetClipboardData(CF_OEMTEXT)) == NULL)
+        goto finished;
+
+    if ((Text = GlobalLock(Clipboard)) == NULL)
+        goto finished;
+
+    *Length = strlen(Text);
+
+    if ((Result = malloc(*Length + 1)) != NULL)
+        CopyMemory(Result, Text, *Length + 1);
+
+    GlobalUnlock(Clipboard);
+
+finished:
+    CloseClipboard();
+    return Result;
+}
+
+static PBYTE ReadPasteFile(LPCSTR FileName, PSIZE_T Length)
+{
+    LARGE_INTEGER FileSize;
+    PBYTE Result = NULL;
+    HANDLE File;
+    DWORD Read;
+    JOB Job;
+
+    File = CreateFile(FileName,
+                      GENERIC_READ,
+                      FILE_SHARE_READ | FILE_SHARE_WRITE,
+                      NULL,
+                      OPEN_EXISTING,
+                      FILE_FLAG_SEQUENTIAL_SCAN,
+                      NULL);
+
+    if (File == INVALID_HANDLE_VALUE) {
+        HiewGate_Message("Error", "Failed to open that file.");
+        return NULL;
+    }
+
+    if (!GetFileSizeEx(File, &FileSize) || FileSize.QuadPart > PASTE_MAX_FILE) {
+        HiewGate_Message("Error", "That file is too big to paste.");
+        goto finished;
+    }
+
+    if ((Result = malloc(FileSize.QuadPart + 1)) == NULL)
+        goto finished;
+
+    BeginJob(&Job, "Reading file", FileSize.QuadPart);
+
+    for (*Length = 0; *Length < FileSize.QuadPart; *Length += Read) {
+        DWORD Chunk = min(FileSize.QuadPart - *Length, PASTE_READ_CHUNK);
+
+        if (!UpdateJob(&Job, *Length)
+         || !ReadFile(File, Result + *Length, Chunk, &Read, NULL)
+         || Read == 0) {
+            free(Result);
+            Result = NULL;
+            break;
+        }
+    }
+
+    EndJob(&Job);
+
+finished:
+    CloseHandle(File);
+    return Result;
+}
+
+int PasteEntryPoint(HEMCALL_TAG *HemCall)
+{
+    CHAR FileName[HEM_FILENAME_MAXLEN] = {0};
+    CHAR Status[256];
+    DWORD Width = 0;
+    INT Source;
+
+    // If there's already a paste running, show how it's doing.
+    if (IsPasteRunning()) {
+        FormatPasteStatus(Status, sizeof Status - 32);
+
+        strncat_s(Status, sizeof Status, " Press C to cancel.", _TRUNCATE);
+
+        if (toupper(HiewGate_Message("Paste", Status)) == 'C') {
+            Paste.Cancel = TRUE;
+            DiscardKeyRecords();
+        }
+
+        return HEM_OK;
+    }
+
+    // If the last paste finished, tell them how it went.
+    if (PasteThread) {
+        FormatPasteStatus(Status, sizeof Status);
+        HiewGate_Message("Paste Finished", Status);
+        FreePaste();
+    }
+
+    for (DWORD i = 0; i < _countof(PasteSources); i++) {
+        Width = max(Width, strlen(PasteSources[i]));
+    }
+
+    Source = HiewGate_Menu("Paste",
+                           PasteSources,
+                           _countof(PasteSources),
+                           Width,
+                           1,
+                           NULL,
+                           NULL,
+                           NULL,
+                           NULL);
+
+    switch (Source) {
+        case PASTE_TEXT_CLIPBOARD:
+        case PASTE_HEX_CLIPBOARD:
+            Paste.Payload = ReadClipboardText(&Paste.Length);
+
+            if (Paste.Payload == NULL) {
+                HiewGate_Message("Error", "There is no text on the clipboard.");
+                return HEM_OK;
+            }
+            break;
+        case PASTE_TEXT_FILE:
+        case PASTE_HEX_FILE:
+            if (HiewGate_GetFilename("Paste File", FileName) != HEM_INPUT_CR)
+                return HEM_OK;
+
+            if ((Paste.Payload = ReadPasteFile(FileName, &Paste.Length)) == NULL)
+                return HEM_OK;
+
+            Paste.HexBytes = Source == PASTE_HEX_FILE;
+            break;
+        default:
+            return HEM_OK;
+    }
+
+    // Only keep the hex digits, so you can paste "90 90 C3" or a hexdump.
+    if (Source == PASTE_HEX_CLIPBOARD) {
+        SIZE_T Digits = 0;
+
+        for (SIZE_T i = 0; i < Paste.Length; i++) {
+            if (isxdigit(Paste.Payload[i])) {
+                Paste.Payload[Digits++] = Paste.Payload[i];
+            }
+        }
+
+        Paste.Length = Digits;
+    }
+
+    Paste.FirstEvent = GetDeliveredKeyCount();
+    Paste.StartTime = GetTickCount64();
+
+    PasteThread = CreateThread(NULL, 0, PasteKeysThread, NULL, 0, NULL);
+
+    if (PasteThread == NULL) {
+        HiewGate_Message("Error", "Failed to start paste.");
+        FreePaste();
+    }
+
+    return HEM_OK;
+}
+
+VOID StopPaste(VOID)
+{
+    if (PasteThread) {
+        Paste.Cancel = TRUE;
+        WaitForSingleObject(PasteThread, INFINITE);
+    }
+
+    FreePaste();
+}
@@ -0,0 +1,11 @@
+#ifndef __PASTE_H
+#define __PASTE_H
+
+// Types text or hex from the clipboard or a file into Hiew, or shows the
+// progress of a paste already running.
+int PasteEntryPoint(HEMCALL_TAG *HemCall);
+
+// Cancel any paste in progress and wait for it to finish.
+VOID StopPaste(VOID);
+
+#endif
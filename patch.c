@@ -0,0 +1,741 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "patch.h"
+#include "journal.h"
+#include "wcache.h"
+#include "hash.h"
+#include "util.h"
+
+// This applies patches to the current file through the HiewGate. Every gate
+// call is slow, so the patch is streamed through a buffer and writes are
+// coalesced into large contiguous chunks.
+//
+// Supported formats are:
+//
+//  IPS         "PATCH", records of 24-bit offset and data (or RLE), "EOF".
+//  BPS         "BPS1", beat patches. The target must be the same size as the
+//              source, because the HiewGate can't resize files.
+//  Hex script  Lines of the form "1A2B: 90 90 C3", with # or ; comments.
+
+// How much of the patch file to read at once.
+#define PATCH_READ_SIZE (64 * 1024)
+
+// How much recent BPS output is kept in memory.
+#define PATCH_TARGET_SIZE (1024 * 1024)
+
+// Differences closer than this are written together when applying BPS.
+#define PATCH_MERGE_GAP 16
+
+// Longest line allowed in a hex script.
+#define PATCH_MAX_LINE 4096
+
+typedef struct _PATCH_READER {
+    HANDLE File;
+    ULONGLONG Size;
+    ULONGLONG Offset;
+    DWORD Crc;
+    DWORD Head;
+    DWORD Tail;
+    BYTE Buffer[PATCH_READ_SIZE];
+} PATCH_READER, *PPATCH_READER;
+
+typedef struct _PATCH_CONTEXT {
+    PATCH_READER Reader;
+    WCACHE_STATS Stats;
+    HEM_QWORD FileLength;
+    JOB Job;
+    DWORD Records;
+    LPCSTR Error;
+} PATCH_CONTEXT, *PPATCH_CONTEXT;
+
+static BOOL ReadPatch(PPATCH_CONTEXT Context, PVOID Data, DWORD Length)
+{
+    PPATCH_READER Reader = &Context->Reader;
+    PBYTE Output = Data;
+
+    while (Length) {
+        DWORD Count;
+
+        if (Reader->Head == Reader->Tail) {
+            DWORD Read;
+
+            if (!ReadFile(Reader->File, Reader->Buffer, sizeof Reader->Buffer, &Read, NULL) || Read == 0) {
+                Context->Error = "The patch file is truncated.";
+                return FALSE;
+            }
+
+            Reader->Head = 0;
+            Reader->Tail = Read;
+        }
+
+        Count = min(Length, Reader->Tail - Reader->Head);
+
+        CopyMemory(Output, &Reader->Buffer[Reader->Head], Count);
+
+        Reader->Crc = UpdateCrc32(Reader->Crc, Output, Count);
+        Reader->Head += Count;
+        Reader->Offset += Count;
+
+        Output += Count;
+        Length -= Count;
+    }
+
+    return TRUE;
+}
+
+// Returns FALSE if the user wants to stop, progress is how much of the patch
+// has been read.
+static BOOL CheckPatchBreak(PPATCH_CONTEXT Context)
+{
+    return UpdateJob(&Context->Job, Context->Reader.Offset);
+}
+
+// Records are often small and close together, the write cache turns them
+// into a few large writes.
+static BOOL WritePatch(PPATCH_CONTEXT Context, HEM_QWORD Offset, const BYTE *Data, DWORD Length)
+{
+    // The HiewGate can't grow files.
+    if (Offset + Length > Context->FileLength) {
+        Context->Error = "The patch writes past the end of the file.";
+        return FALSE;
+    }
+
+    if (CachedFileWrite(Offset, Length, (HEM_BYTE *) Data) != HEM_OK) {
+        Context->Error = "Hiew failed to write to the file.";
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static BOOL ApplyIpsPatch(PPATCH_CONTEXT Context)
+{
+    BYTE Data[USHRT_MAX];
+    BYTE Header[3];
+
+    while (CheckPatchBreak(Context)) {
+        DWORD Offset;
+        DWORD Length;
+
+        if (!ReadPatch(Context, Header, 3))
+            return FALSE;
+
+        // There might be a truncation length after this, but the HiewGate
+        // can't truncate files so I just ignore it.
+        if (memcmp(Header, "EOF", 3) == 0)
+            return TRUE;
+
+        Offset = Header[0] << 16 | Header[1] << 8 | Header[2];
+
+        if (!ReadPatch(Context, Header, 2))
+            return FALSE;
+
+        Length = Header[0] << 8 | Header[1];
+
+        if (Length == 0) {
+            // An RLE record, a 16-bit count and a byte.
+            if (!ReadPatch(Context, Header, 3))
+                return FALSE;
+
+            Length = Header[0] << 8 | Header[1];
+
+            FillMemory(Data, Length, Header[2]);
+        } else if (!ReadPatch(Context, Data, Length)) {
+            return FALSE;
+        }
+
+        if (!WritePatch(Context, Offset, Data, Length))
+            return FALSE;
+
+        Context->Records++;
+    }
+
+    return FALSE;
+}
+
+static BOOL ReadBpsNumber(PPATCH_CONTEXT Context, PULONGLONG Number)
+{
+    ULONGLONG Shift = 1;
+    BYTE Byte;
+
+    *Number = 0;
+
+    do {
+        if (!ReadPatch(Context, &Byte, 1))
+            return FALSE;
+
+        *Number += (Byte & 0x7F) * Shift;
+
+        if (Byte & 0x80)
+            break;
+
+        Shift <<= 7;
+        *Number += Shift;
+    } while (Shift < (1ULL << 56));
+
+    return TRUE;
+}
+
+// The target of a BPS patch is built in a temporary file, because commands
+// can copy from both the source and the target. Recent output is kept in a
+// buffer, because copies from just behind the output are common.
+typedef struct _BPS_TARGET {
+    HANDLE File;
+    ULONGLONG Length;
+    ULONGLONG Flushed;
+    DWORD Crc;
+    BYTE Buffer[PATCH_TARGET_SIZE];
+} BPS_TARGET, *PBPS_TARGET;
+
+static BOOL WriteBpsTarget(PBPS_TARGET Target, const BYTE *Data, DWORD Length)
+{
+    Target->Crc = UpdateCrc32(Target->Crc, Data, Length);
+
+    while (Length) {
+        DWORD Used = Target->Length - Target->Flushed;
+        DWORD Count = min(Length, sizeof Target->Buffer - Used);
+        DWORD Written;
+
+        CopyMemory(&Target->Buffer[Used], Data, Count);
+
+        Target->Length += Count;
+        Data += Count;
+        Length -= Count;
+
+        if (Used + Count == sizeof Target->Buffer) {
+            if (!WriteFile(Target->File, Target->Buffer, sizeof Target->Buffer, &Written, NULL))
+                return FALSE;
+
+            Target->Flushed = Target->Length;
+        }
+    }
+
+    return TRUE;
+}
+
+static BOOL ReadBpsTarget(PBPS_TARGET Target, ULONGLONG Offset, PBYTE Data, DWORD Length)
+{
+    // Is it all still in the buffer?
+    if (Offset >= Target->Flushed) {
+        CopyMemory(Data, &Target->Buffer[Offset - Target->Flushed], Length);
+        return TRUE;
+    }
+
+    // Read whatever has already been flushed from the file.
+    if (Offset < Target->Flushed) {
+        LARGE_INTEGER Position = { .QuadPart = Offset };
+        LARGE_INTEGER End = { .QuadPart = Target->Flushed };
+        DWORD Count = min(Length, Target->Flushed - Offset);
+        DWORD Read;
+
+        if (!SetFilePointerEx(Target->File, Position, NULL, FILE_BEGIN))
+            return FALSE;
+        if (!ReadFile(Target->File, Data, Count, &Read, NULL) || Read != Count)
+            return FALSE;
+
+        // Put the file pointer back for the next flush.
+        if (!SetFilePointerEx(Target->File, End, NULL, FILE_BEGIN))
+            return FALSE;
+
+        Offset += Count;
+        Data += Count;
+        Length -= Count;
+    }
+
+    // The rest must be in the buffer.
+    CopyMemory(Data, &Target->Buffer[Offset - Target->Flushed], Length);
+
+    return TRUE;
+}
+
+static BOOL FlushBpsTarget(PBPS_TARGET Target)
+{
+    DWORD Used = Target->Length - Target->Flushed;
+    DWORD Written;
+
+    if (Used && !WriteFile(Target->File, Target->Buffer, Used, &Written, NULL))
+        return FALSE;
+
+    Target->Flushed = Target->Length;
+    return TRUE;
+}
+
+// Decode the BPS commands into Target.
+static BOOL DecodeBpsPatch(PPATCH_CONTEXT Context, PBPS_TARGET Target, ULONGLONG TargetSize)
+{
+    static BYTE Data[PATCH_READ_SIZE];
+    ULONGLONG SourceRelative = 0;
+    ULONGLONG TargetRelative = 0;
+    ULONGLONG Footer = Context->Reader.Size - 12;
+
+    while (Context->Reader.Offset < Footer) {
+        ULONGLONG Command;
+        ULONGLONG Length;
+        ULONGLONG Delta;
+
+        if (!CheckPatchBreak(Context))
+            return FALSE;
+
+        if (!ReadBpsNumber(Context, &Command))
+            return FALSE;
+
+        Length = (Command >> 2) + 1;
+
+        if (Target->Length + Length > TargetSize) {
+            Context->Error = "The BPS patch is corrupt.";
+            return FALSE;
+        }
+
+        switch (Command & 3) {
+            case 0: // SourceRead
+                for (ULONGLONG Offset = Target->Length; Length;) {
+                    DWORD Count = min(Length, sizeof Data);
+
+                    if (HiewGate_FileRead(Offset, Count, Data) != (int) Count) {
+                        Context->Error = "Hiew failed to read the file.";
+                        return FALSE;
+                    }
+
+                    if (!WriteBpsTarget(Target, Data, Count))
+                        return FALSE;
+
+                    Offset += Count;
+                    Length -= Count;
+                }
+                break;
+            case 1: // TargetRead
+                while (Length) {
+                    DWORD Count = min(Length, sizeof Data);
+
+                    if (!ReadPatch(Context, Data, Count))
+                        return FALSE;
+                    if (!WriteBpsTarget(Target, Data, Count))
+                        return FALSE;
+
+                    Length -= Count;
+                }
+                break;
+            case 2: // SourceCopy
+                if (!ReadBpsNumber(Context, &Delta))
+                    return FALSE;
+
+                SourceRelative += (Delta & 1 ? -1 : 1) * (LONGLONG)(Delta >> 1);
+
+                if (SourceRelative + Length > Context->FileLength) {
+                    Context->Error = "The BPS patch is corrupt.";
+                    return FALSE;
+                }
+
+                while (Length) {
+                    DWORD Count = min(Length, sizeof Data);
+
+                    if (HiewGate_FileRead(SourceRelative, Count, Data) != (int) Count) {
+                        Context->Error = "Hiew failed to read the file.";
+                        return FALSE;
+                    }
+
+                    if (!WriteBpsTarget(Target, Data, Count))
+                        return FALSE;
+
+                    SourceRelative += Count;
+                    Length -= Count;
+                }
+                break;
+            case 3: // TargetCopy
+                if (!ReadBpsNumber(Context, &Delta))
+                    return FALSE;
+
+                TargetRelative += (Delta & 1 ? -1 : 1) * (LONGLONG)(Delta >> 1);
+
+                if (TargetRelative >= Target->Length) {
+                    Context->Error = "The BPS patch is corrupt.";
+                    return FALSE;
+                }
+
+                // The copy can overlap the output, e.g. to repeat a pattern,
+                // so only copy what already exists each time.
+                while (Length) {
+                    DWORD Count = min(Length, sizeof Data);
+
+                    Count = min(Count, Target->Length - TargetRelative);
+
+                    if (!ReadBpsTarget(Target, TargetRelative, Data, Count))
+                        return FALSE;
+                    if (!WriteBpsTarget(Target, Data, Count))
+                        return FALSE;
+
+                    TargetRelative += Count;
+                    Length -= Count;
+                }
+                break;
+        }
+
+        Context->Records++;
+    }
+
+    return FlushBpsTarget(Target);
+}
+
+// Now write only the parts that changed.
+static BOOL WriteBpsChanges(PPATCH_CONTEXT Context, PBPS_TARGET Target)
+{
+    static BYTE Source[PATCH_READ_SIZE];
+    static BYTE Output[PATCH_READ_SIZE];
+    LARGE_INTEGER Start = {0};
+
+    if (!SetFilePointerEx(Target->File, Start, NULL, FILE_BEGIN))
+        return FALSE;
+
+    for (ULONGLONG Offset = 0; Offset < Target->Length;) {
+        DWORD Count = min(Target->Length - Offset, sizeof Output);
+        DWORD Read;
+
+        if (!CheckPatchBreak(Context))
+            return FALSE;
+
+        if (!ReadFile(Target->File, Output, Count, &Read, NULL) || Read != Count)
+            return FALSE;
+
+        if (CachedFileRead(Offset, Count, Source) != (int) Count) {
+            Context->Error = "Hiew failed to read the file.";
+            return FALSE;
+        }
+
+        for (DWORD i = 0; i < Count;) {
+            DWORD Run;
+            DWORD Gap;
+
+            if (Source[i] == Output[i]) {
+                i++;
+                continue;
+            }
+
+            // Extend the run over small gaps, it's cheaper to rewrite a few
+            // unchanged bytes than make another call.
+            for (Run = i + 1, Gap = 0; Run < Count && Gap < PATCH_MERGE_GAP; Run++) {
+                Gap = Source[Run] == Output[Run] ? Gap + 1 : 0;
+            }
+
+            Run -= Gap;
+
+            if (!WritePatch(Context, Offset + i, &Output[i], Run - i))
+                return FALSE;
+
+            i = Run;
+        }
+
+        Offset += Count;
+    }
+
+    return TRUE;
+}
+
+static BOOL ApplyBpsPatch(PPATCH_CONTEXT Context)
+{
+    CHAR TempPath[MAX_PATH];
+    CHAR TempName[MAX_PATH];
+    ULONGLONG SourceSize;
+    ULONGLONG TargetSize;
+    ULONGLONG MetadataSize;
+    PBPS_TARGET Target;
+    DWORD PatchCrc;
+    DWORD Footer[3];
+    BOOL Result = FALSE;
+
+    if (Context->Reader.Size < 4 + 12) {
+        Context->Error = "The BPS patch is truncated.";
+        return FALSE;
+    }
+
+    if (!ReadBpsNumber(Context, &SourceSize)
+     || !ReadBpsNumber(Context, &TargetSize)
+     || !ReadBpsNumber(Context, &MetadataSize)) {
+        return FALSE;
+    }
+
+    if (SourceSize != Context->FileLength) {
+        Context->Error = "This BPS patch is for a different file.";
+        return FALSE;
+    }
+
+    if (TargetSize != SourceSize) {
+        Context->Error = "BPS patches that change the file size are not supported.";
+        return FALSE;
+    }
+
+    // I don't need the metadata.
+    while (MetadataSize) {
+        BYTE Metadata[256];
+        DWORD Count = min(MetadataSize, sizeof Metadata);
+
+        if (!ReadPatch(Context, Metadata, Count))
+            return FALSE;
+
+        MetadataSize -= Count;
+    }
+
+    if ((Target = calloc(1, sizeof *Target)) == NULL)
+        return FALSE;
+
+    GetTempPath(sizeof TempPath, TempPath);
+    GetTempFileName(TempPath, "bps", 0, TempName);
+
+    Target->File = CreateFile(TempName,
+                              GENERIC_READ | GENERIC_WRITE,
+                              0,
+                              NULL,
+                              CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+                              NULL);
+
+    if (Target->File == INVALID_HANDLE_VALUE) {
+        Context->Error = "Failed to create a temporary file.";
+        goto finished;
+    }
+
+    if (!DecodeBpsPatch(Context, Target, TargetSize))
+        goto finished;
+
+    if (Target->Length != TargetSize) {
+        Context->Error = "The BPS patch is corrupt.";
+        goto finished;
+    }
+
+    // The patch crc covers everything except itself.
+    if (!ReadPatch(Context, Footer, sizeof(DWORD) * 2))
+        goto finished;
+
+    PatchCrc = Context->Reader.Crc;
+
+    if (!ReadPatch(Context, &Footer[2], sizeof(DWORD)))
+        goto finished;
+
+    // If the target matches, then the source must have been right too.
+    if (Footer[1] != Target->Crc || Footer[2] != PatchCrc) {
+        Context->Error = "The BPS checksum doesn't match, the file was not changed.";
+        goto finished;
+    }
+
+    Result = WriteBpsChanges(Context, Target);
+
+finished:
+    if (Target->File != INVALID_HANDLE_VALUE)
+        CloseHandle(Target->File);
+    free(Target);
+    return Result;
+}
+
+static BOOL ReadPatchLine(PPATCH_CONTEXT Context, PCHAR Line, DWORD MaxLen)
+{
+    DWORD Length = 0;
+    CHAR Char;
+
+    while (Context->Reader.Offset < Context->Reader.Size) {
+        if (!ReadPatch(Context, &Char, 1))
+            return FALSE;
+
+        if (Char == '\n')
+            break;
+
+        if (Length + 1 >= MaxLen) {
+            Context->Error = "A line in the hex script is too long.";
+            return FALSE;
+        }
+
+        Line[Length++] = Char;
+    }
+
+    Line[Length] = '\0';
+    return TRUE;
+}
+
+static BOOL ApplyHexScript(PPATCH_CONTEXT Context)
+{
+    static CHAR Line[PATCH_MAX_LINE];
+    static BYTE Data[PATCH_MAX_LINE / 2];
+
+    while (Context->Reader.Offset < Context->Reader.Size) {
+        ULONGLONG Offset;
+        PCHAR Position;
+        DWORD Length = 0;
+
+        if (!CheckPatchBreak(Context))
+            return FALSE;
+
+        if (!ReadPatchLine(Context, Line, sizeof Line))
+            return FALSE;
+
+        for (Position = Line; isspace(*Position); Position++)
+            ;
+
+        // Blank lines and comments.
+        if (*Position == '\0' || *Position == '#' || *Position == ';')
+            continue;
+
+        Offset = _strtoui64(Position, &Position, 16);
+
+        if (*Position++ != ':') {
+            Context->Error = "Expected \"offset: hex bytes\" in hex script.";
+            return FALSE;
+        }
+
+        while (*Position) {
+            if (isspace(*Position)) {
+                Position++;
+                continue;
+            }
+
+            // Allow comments at the end of a line.
+            if (*Position == '#' || *Position == ';')
+                break;
+
+            if (HexDigit(Position[0]) < 0 || HexDigit(Position[1]) < 0) {
+                Context->Error = "Invalid hex bytes in hex script.";
+                return FALSE;
+            }
+
+            Data[Length++] = HexDigit(Position[0]) << 4 | HexDigit(Position[1]);
+            Position += 2;
+        }
+
+        if (!WritePatch(Context, Offset, Data, Length))
+            return FALSE;
+
+        Context->Records++;
+    }
+
+    return TRUE;
+}
+
+int PatchEntryPoint(HEMCALL_TAG *HemCall)
+{
+    CHAR FileName[HEM_FILENAME_MAXLEN] = {0};
+    HIEWGATE_GETDATA HiewData;
+    LARGE_INTEGER PatchSize;
+    PPATCH_CONTEXT Context;
+    WCACHE_STATS Stats;
+    CHAR Message[256];
+    BYTE Magic[5] = {0};
+    BOOL Recorded;
+    BOOL Result;
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return HEM_ERROR;
+
+    if (HiewGate_GetFilename("Patch File", FileName) != HEM_INPUT_CR)
+        return HEM_OK;
+
+    if ((Context = calloc(1, sizeof *Context)) == NULL)
+        return HEM_ERROR;
+
+    Context->FileLength = HiewData.filelength;
+    Context->Reader.File = CreateFile(FileName,
+                                      GENERIC_READ,
+                                      FILE_SHARE_READ,
+                                      NULL,
+                                      OPEN_EXISTING,
+                                      FILE_FLAG_SEQUENTIAL_SCAN,
+                                      NULL);
+
+    if (Context->Reader.File == INVALID_HANDLE_VALUE) {
+        HiewGate_Message("Error", "Failed to open the patch file.");
+        goto finished;
+    }
+
+    if (!GetFileSizeEx(Context->Reader.File, &PatchSize)) {
+        HiewGate_Message("Error", "Failed to read the patch file.");
+        goto finished;
+    }
+
+    Context->Reader.Size = PatchSize.QuadPart;
+
+    // I don't know how much a patch writes until it's applied, but it's
+    // usually about the size of the patch. If that's too big for the journal,
+    // it would throw away all the undo history and still not be undoable.
+    if (!CanJournalWrite(PatchSize.QuadPart) && !ConfirmWithoutUndo("Apply it"))
+        goto finished;
+
+    if (HiewGate_FileOpenForWrite() != HEM_OK) {
+        HiewGate_Message("Error", "The file is read only.");
+        goto finished;
+    }
+
+    BeginJob(&Context->Job, "Applying patch", PatchSize.QuadPart);
+
+    // The whole patch can be undone in one go.
+    BeginJournalTransaction("Apply Patch");
+
+    GetWriteCacheStats(&Context->Stats);
+
+    // Figure out what kind of patch this is.
+    if (PatchSize.QuadPart >= 4 && ReadPatch(Context, Magic, 4) && memcmp(Magic, "BPS1", 4) == 0) {
+        Result = ApplyBpsPatch(Context);
+    } else if (PatchSize.QuadPart >= 5 && ReadPatch(Context, &Magic[4], 1) && memcmp(Magic, "PATCH", 5) == 0) {
+        Result = ApplyIpsPatch(Context);
+    } else {
+        LARGE_INTEGER Start = {0};
+
+        // Start again, it must be a script.
+        SetFilePointerEx(Context->Reader.File, Start, NULL, FILE_BEGIN);
+
+        Context->Reader.Head = Context->Reader.Tail = 0;
+        Context->Reader.Offset = 0;
+        Context->Error = NULL;
+
+        Result = ApplyHexScript(Context);
+    }
+
+    // Write whatever is left, even after an error, so that the file matches
+    // what I say was applied.
+    if (!FlushFileWrites() && Result) {
+        Context->Error = "Hiew failed to write to the file.";
+        Result = FALSE;
+    }
+
+    Recorded = EndJournalTransaction();
+
+    // Work out how many writes were mine.
+    GetWriteCacheStats(&Stats);
+
+    Stats.Writes -= Context->Stats.Writes;
+    Stats.GateCalls -= Context->Stats.GateCalls;
+    Stats.Bytes -= Context->Stats.Bytes;
+
+    EndJob(&Context->Job);
+
+    if (Result) {
+        snprintf(Message,
+                 sizeof Message,
+                 "Applied %u records, %llu bytes in %u writes, %u saved (%llu ms)%s.",
+                 Context->Records,
+                 Stats.Bytes,
+                 Stats.GateCalls,
+                 Stats.Writes - Stats.GateCalls,
+                 Context->Job.Elapsed,
+                 Recorded ? "" : " (can't be undone)");
+        HiewGate_Message("Patch", Message);
+    } else {
+        snprintf(Message,
+                 sizeof Message,
+                 "%s %llu bytes were written%s.",
+                 Context->Job.Cancelled ? "Cancelled." : Context->Error ? Context->Error : "Failed.",
+                 Stats.Bytes,
+                 Recorded || Stats.Bytes == 0 ? "" : " (can't be undone)");
+        HiewGate_Message("Error", Message);
+    }
+
+finished:
+    if (Context->Reader.File != INVALID_HANDLE_VALUE)
+        CloseHandle(Context->Reader.File);
+    free(Context);
+    return HEM_OK;
+}
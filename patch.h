@@ -0,0 +1,8 @@
+#ifndef __PATCH_H
+#define __PATCH_H
+
+// Applies an IPS, BPS or hex script ("offset: hex bytes") patch file to the
+// current file.
+int PatchEntryPoint(HEMCALL_TAG *HemCall);
+
+#endif
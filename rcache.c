@@ -0,0 +1,409 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "hash.h"
+#include "rcache.h"
+
+// Scanning a big file takes a while, and I often reopen the same file to look
+// at the results again. This keeps the results of each analysis in a mapped
+// file next to the hem, one per file like the undo journal, so they can be
+// reused instead of scanning again.
+//
+// The cache is only trusted if the file still has the same length, the same
+// modification time, and a fingerprint made from samples spread across the
+// file still matches. This is checked the first time the cache is used each
+// time the hem is invoked. Anything I write myself throws the cache away, so
+// the fingerprint only has to catch changes made outside the hem.
+
+#define RESULT_MAGIC            'SRHK'
+#define RESULT_VERSION          1
+#define RESULT_EXTENSION        ".rch"
+#define RESULT_INITIAL_SIZE     (1024 * 1024)
+#define RESULT_MAX_SIZE         (256 * 1024 * 1024)
+
+// Files with fewer blocks than this are hashed completely.
+#define RESULT_SAMPLES          64
+#define RESULT_SAMPLE_SIZE      4096
+
+#define RESULT_ALIGN(x) (((x) + 7) & ~7ULL)
+
+typedef struct _RESULT_HEADER {
+    DWORD Magic;
+    DWORD Version;
+    DWORD FilenameHash;
+    DWORD Reserved;
+    ULONGLONG FileLength;
+    ULONGLONG WriteTime;
+    ULONGLONG Fingerprint;
+    ULONGLONG Capacity;
+    ULONGLONG Used;
+} RESULT_HEADER, *PRESULT_HEADER;
+
+typedef struct _RESULT_RECORD {
+    DWORD Type;             // Zero if it was replaced.
+    DWORD Reserved;
+    ULONGLONG Size;         // The whole record, including this header.
+    ULONGLONG Offset;
+    ULONGLONG Length;
+    ULONGLONG Parameter;
+    ULONGLONG DataSize;
+    BYTE Data[];
+} RESULT_RECORD, *PRESULT_RECORD;
+
+static HANDLE ResultFile = INVALID_HANDLE_VALUE;
+static HANDLE ResultMapping;
+static PRESULT_HEADER Results;
+static DWORD ResultHash;
+static BOOL Verified;
+
+static PRESULT_RECORD ResultRecord(ULONGLONG Offset)
+{
+    return (PRESULT_RECORD)((PBYTE)(Results + 1) + Offset);
+}
+
+static BOOL MapResults(ULONGLONG Capacity)
+{
+    ULARGE_INTEGER Size = { .QuadPart = sizeof(RESULT_HEADER) + Capacity };
+
+    if (Results)
+        UnmapViewOfFile(Results);
+    if (ResultMapping)
+        CloseHandle(ResultMapping);
+
+    Results = NULL;
+
+    // This will extend the file if necessary.
+    ResultMapping = CreateFileMapping(ResultFile,
+                                      NULL,
+                                      PAGE_READWRITE,
+                                      Size.HighPart,
+                                      Size.LowPart,
+                                      NULL);
+
+    if (ResultMapping == NULL)
+        return FALSE;
+
+    Results = MapViewOfFile(ResultMapping, FILE_MAP_WRITE, 0, 0, Size.QuadPart);
+
+    if (Results == NULL)
+        return FALSE;
+
+    Results->Capacity = Capacity;
+    return TRUE;
+}
+
+// Anything after the first record that doesn't make sense is thrown away.
+static VOID RepairResults(VOID)
+{
+    ULONGLONG Offset = 0;
+
+    while (Offset + sizeof(RESULT_RECORD) <= Results->Used) {
+        PRESULT_RECORD Record = ResultRecord(Offset);
+
+        if (Record->Size < sizeof(RESULT_RECORD)
+         || Record->Size > Results->Used - Offset
+         || Record->DataSize > Record->Size - sizeof(RESULT_RECORD))
+            break;
+
+        Offset += Record->Size;
+    }
+
+    Results->Used = Offset;
+}
+
+BOOL OpenResultCache(LPCSTR HemFile, DWORD FilenameHash)
+{
+    CHAR FileName[MAX_PATH];
+    CHAR Suffix[32];
+    LARGE_INTEGER FileSize;
+    ULONGLONG Capacity;
+    PCHAR Extension;
+
+    // The file might have changed since last time.
+    Verified = FALSE;
+
+    if (Results && ResultHash == FilenameHash)
+        return TRUE;
+
+    CloseResultCache();
+
+    // The cache is named after the hem and the file, e.g. keyhelp-1234ABCD.rch
+    if (strcpy_s(FileName, sizeof FileName, HemFile) != 0)
+        return FALSE;
+
+    if ((Extension = strrchr(FileName, '.')) != NULL)
+        *Extension = '\0';
+
+    snprintf(Suffix, sizeof Suffix, "-%08X%s", FilenameHash, RESULT_EXTENSION);
+
+    if (strncat_s(FileName, sizeof FileName, Suffix, _TRUNCATE) != 0)
+        return FALSE;
+
+    // If another Hiew has this open, it just won't be cached.
+    ResultFile = CreateFile(FileName,
+                            GENERIC_READ | GENERIC_WRITE,
+                            FILE_SHARE_READ,
+                            NULL,
+                            OPEN_ALWAYS,
+                            FILE_ATTRIBUTE_NORMAL,
+                            NULL);
+
+    if (ResultFile == INVALID_HANDLE_VALUE)
+        goto error;
+
+    if (!GetFileSizeEx(ResultFile, &FileSize))
+        goto error;
+
+    Capacity = RESULT_INITIAL_SIZE;
+
+    if (FileSize.QuadPart > sizeof(RESULT_HEADER) + RESULT_INITIAL_SIZE) {
+        Capacity = min(FileSize.QuadPart - sizeof(RESULT_HEADER), RESULT_MAX_SIZE);
+    }
+
+    if (!MapResults(Capacity))
+        goto error;
+
+    if (Results->Magic != RESULT_MAGIC
+     || Results->Version != RESULT_VERSION
+     || Results->FilenameHash != FilenameHash
+     || Results->Used > Results->Capacity) {
+        ZeroMemory(Results, sizeof *Results);
+        Results->Magic = RESULT_MAGIC;
+        Results->Version = RESULT_VERSION;
+        Results->FilenameHash = FilenameHash;
+        Results->Capacity = Capacity;
+    }
+
+    ResultHash = FilenameHash;
+
+    RepairResults();
+
+    return TRUE;
+
+error:
+    CloseResultCache();
+    return FALSE;
+}
+
+VOID CloseResultCache(VOID)
+{
+    if (Results)
+        UnmapViewOfFile(Results);
+    if (ResultMapping)
+        CloseHandle(ResultMapping);
+    if (ResultFile != INVALID_HANDLE_VALUE)
+        CloseHandle(ResultFile);
+
+    Results = NULL;
+    ResultMapping = NULL;
+    ResultFile = INVALID_HANDLE_VALUE;
+    Verified = FALSE;
+}
+
+// Hash a few blocks spread evenly across the file, always including the
+// first and last. Small files are hashed completely.
+static BOOL GetFingerprint(HEM_QWORD FileLength, PULONGLONG Fingerprint)
+{
+    HEM_QWORD Blocks = (FileLength + RESULT_SAMPLE_SIZE - 1) / RESULT_SAMPLE_SIZE;
+    BYTE Sample[RESULT_SAMPLE_SIZE];
+    ULONGLONG Hash = FileLength;
+
+    for (DWORD i = 0; i < RESULT_SAMPLES && i < Blocks; i++) {
+        HEM_QWORD Block = Blocks <= RESULT_SAMPLES ? i : i * (Blocks - 1) / (RESULT_SAMPLES - 1);
+        HEM_QWORD Offset = Block * RESULT_SAMPLE_SIZE;
+        DWORD Length = min(RESULT_SAMPLE_SIZE, FileLength - Offset);
+
+        if (HiewGate_FileRead(Offset, Length, Sample) != (int) Length)
+            return FALSE;
+
+        Hash = Xxh64(Sample, Length, Hash);
+    }
+
+    *Fingerprint = Hash;
+    return TRUE;
+}
+
+// Make sure the results still belong to this file, or throw them away.
+static BOOL VerifyResultCache(VOID)
+{
+    WIN32_FILE_ATTRIBUTE_DATA Attributes;
+    HIEWGATE_GETDATA HiewData;
+    ULONGLONG WriteTime = 0;
+    ULONGLONG Fingerprint;
+
+    if (Results == NULL)
+        return FALSE;
+
+    if (Verified)
+        return TRUE;
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return FALSE;
+
+    // This isn't essential, the fingerprint still works without it.
+    if (GetFileAttributesEx((PCHAR) HiewData.filename, GetFileExInfoStandard, &Attributes)) {
+        WriteTime = (ULONGLONG) Attributes.ftLastWriteTime.dwHighDateTime << 32
+                  | Attributes.ftLastWriteTime.dwLowDateTime;
+    }
+
+    if (!GetFingerprint(HiewData.filelength, &Fingerprint))
+        return FALSE;
+
+    if (Results->FileLength != HiewData.filelength
+     || Results->WriteTime != WriteTime
+     || Results->Fingerprint != Fingerprint) {
+        Results->Used = 0;
+        Results->FileLength = HiewData.filelength;
+        Results->WriteTime = WriteTime;
+        Results->Fingerprint = Fingerprint;
+    }
+
+    Verified = TRUE;
+    return TRUE;
+}
+
+static PRESULT_RECORD FindRecord(PRESULT_KEY Key)
+{
+    for (ULONGLONG Offset = 0; Offset < Results->Used; Offset += ResultRecord(Offset)->Size) {
+        PRESULT_RECORD Record = ResultRecord(Offset);
+
+        if (Record->Type == Key->Type
+         && Record->Offset == Key->Offset
+         && Record->Length == Key->Length
+         && Record->Parameter == Key->Parameter)
+            return Record;
+    }
+
+    return NULL;
+}
+
+const VOID *FindCachedResult(PRESULT_KEY Key, PSIZE_T Size)
+{
+    PRESULT_RECORD Record;
+
+    if (!VerifyResultCache())
+        return NULL;
+
+    if ((Record = FindRecord(Key)) == NULL)
+        return NULL;
+
+    *Size = Record->DataSize;
+    return Record->Data;
+}
+
+// Make room for Size more bytes. The file grows if it can, otherwise the
+// oldest results are thrown away. Replaced records are always removed.
+static BOOL MakeRoom(ULONGLONG Size)
+{
+    ULONGLONG Capacity = Results->Capacity;
+    ULONGLONG Used = Results->Used;
+    ULONGLONG Written = 0;
+    ULONGLONG Live = 0;
+    ULONGLONG RecordSize;
+
+    if (Used + Size <= Capacity)
+        return TRUE;
+
+    for (ULONGLONG Offset = 0; Offset < Used; Offset += ResultRecord(Offset)->Size) {
+        if (ResultRecord(Offset)->Type)
+            Live += ResultRecord(Offset)->Size;
+    }
+
+    while (Capacity < Live + Size && Capacity < RESULT_MAX_SIZE) {
+        Capacity = min(Capacity * 2, RESULT_MAX_SIZE);
+    }
+
+    if (Capacity != Results->Capacity && !MapResults(Capacity)) {
+        CloseResultCache();
+        return FALSE;
+    }
+
+    // If I'm interrupted, it's better to lose everything than keep a mess.
+    Results->Used = 0;
+
+    for (ULONGLONG Offset = 0; Offset < Used; Offset += RecordSize) {
+        PRESULT_RECORD Record = ResultRecord(Offset);
+
+        RecordSize = Record->Size;
+
+        if (Record->Type == 0)
+            continue;
+
+        if (Live + Size > Results->Capacity) {
+            Live -= RecordSize;
+            continue;
+        }
+
+        MoveMemory(ResultRecord(Written), Record, RecordSize);
+
+        Written += RecordSize;
+    }
+
+    Results->Used = Written;
+
+    return Written + Size <= Results->Capacity;
+}
+
+BOOL SaveCachedResult(PRESULT_KEY Key, const RESULT_PART *Parts, DWORD Count)
+{
+    PRESULT_RECORD Record;
+    ULONGLONG DataSize = 0;
+    ULONGLONG Size;
+    PBYTE Data;
+
+    if (!VerifyResultCache())
+        return FALSE;
+
+    for (DWORD i = 0; i < Count; i++) {
+        DataSize += Parts[i].Size;
+    }
+
+    Size = RESULT_ALIGN(sizeof(RESULT_RECORD) + DataSize);
+
+    // Not worth throwing everything else away for.
+    if (Size > RESULT_MAX_SIZE / 2)
+        return FALSE;
+
+    if ((Record = FindRecord(Key)) != NULL)
+        Record->Type = 0;
+
+    if (!MakeRoom(Size))
+        return FALSE;
+
+    Record = ResultRecord(Results->Used);
+    Record->Type = Key->Type;
+    Record->Reserved = 0;
+    Record->Size = Size;
+    Record->Offset = Key->Offset;
+    Record->Length = Key->Length;
+    Record->Parameter = Key->Parameter;
+    Record->DataSize = DataSize;
+
+    Data = Record->Data;
+
+    for (DWORD i = 0; i < Count; i++) {
+        CopyMemory(Data, Parts[i].Data, Parts[i].Size);
+        Data += Parts[i].Size;
+    }
+
+    // It only becomes visible once it's complete.
+    Results->Used += Size;
+    return TRUE;
+}
+
+VOID InvalidateResultCache(VOID)
+{
+    if (Results == NULL)
+        return;
+
+    Results->Used = 0;
+    Results->Fingerprint = 0;
+
+    Verified = FALSE;
+}
@@ -0,0 +1,45 @@
+#ifndef __RCACHE_H
+#define __RCACHE_H
+
+// The kinds of results that can be saved.
+enum {
+    RESULT_HASH = 1,
+    RESULT_ENTROPY,
+    RESULT_STRINGS,
+    RESULT_SIGNATURES,
+};
+
+// Results are for a range of the file, and Parameter is whatever settings
+// changes them, e.g. the window size.
+typedef struct _RESULT_KEY {
+    DWORD Type;
+    HEM_QWORD Offset;
+    HEM_QWORD Length;
+    ULONGLONG Parameter;
+} RESULT_KEY, *PRESULT_KEY;
+
+typedef struct _RESULT_PART {
+    const VOID *Data;
+    SIZE_T Size;
+} RESULT_PART, *PRESULT_PART;
+
+// Opens the result cache for the file identified by FilenameHash, the cache
+// is kept next to the hem. Call this every time the hem is invoked, so the
+// file is checked again before anything is found.
+BOOL OpenResultCache(LPCSTR HemFile, DWORD FilenameHash);
+
+// Unmaps the cache, it's safe to call this if it was never opened.
+VOID CloseResultCache(VOID);
+
+// Returns the results saved for Key, or NULL. The pointer is only valid until
+// the next call to SaveCachedResult().
+const VOID *FindCachedResult(PRESULT_KEY Key, PSIZE_T Size);
+
+// Saves results for Key, replacing any that were saved before. The data is
+// gathered from Count parts.
+BOOL SaveCachedResult(PRESULT_KEY Key, const RESULT_PART *Parts, DWORD Count);
+
+// Forget everything saved for this file, it's about to be written.
+VOID InvalidateResultCache(VOID);
+
+#endif
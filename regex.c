@@ -0,0 +1,1235 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <intrin.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "stream.h"
+#include "vlist.h"
+#include "util.h"
+#include "regex.h"
+
+// A byte regex search, for the things a masked search can't say, like
+// "MZ.{58}[\x80-\xff]" or "(https?|ftp)://[\x21-\x7e]+".
+//
+// The pattern is compiled to an NFA the usual way, and the NFA is turned
+// into a DFA lazily, one state and transition at a time as the data needs
+// them. The DFA states live in a fixed size cache, and if that fills up it's
+// just thrown away and rebuilt from wherever the search is. Almost all the
+// time the search is a table lookup per byte.
+//
+// Matches are leftmost-longest and don't overlap. The DFA only says where
+// the first match ends, not where it started, and a later attempt can end
+// first. So once something ends, I go back to the last place nothing was in
+// progress and try an anchored DFA from each byte after that, the first one
+// that matches is the leftmost, and it runs until it dies for the longest.
+// None of that needs more than REGEX_MAX_MATCH bytes either side of the end,
+// so keeping twice that from the last chunk handles matches across chunks.
+//
+// Whenever nothing is in progress, the search skips to the next byte that
+// could start a match, with SSE2 if there are only a few of those.
+
+#define REGEX_MAX_PATTERN 256
+
+// Matches longer than this are cut short.
+#define REGEX_MAX_MATCH 4096
+
+// Enough of the last chunk to look back from a match that ends just after it.
+#define REGEX_KEEP (REGEX_MAX_MATCH * 2)
+
+// The SSE2 prefilter reads a little past the end of the window.
+#define REGEX_PADDING 16
+
+#define REGEX_MAX_HITS (1024 * 1024)
+
+// Limits on what a pattern compiles to.
+#define REGEX_MAX_NODES 1024
+#define REGEX_MAX_CLASSES 512
+#define REGEX_MAX_STATES 8192
+#define REGEX_MAX_REPEAT 1000
+
+// The DFA cache, each state is 1K of transitions.
+#define REGEX_CACHE_STATES 2048
+#define REGEX_CACHE_POOL (256 * 1024)
+
+// The SSE2 prefilter is only used if this few bytes can start a match.
+#define REGEX_PREFILTER_BYTES 4
+
+#define REGEX_PREVIEW 24
+
+#define REGEX_MENU_WIDTH 90
+
+// A transition is the next state index with these flags, or unknown.
+#define REGEX_MATCH     0x80000000
+#define REGEX_DEAD      0x40000000
+#define REGEX_SPECIAL   (REGEX_MATCH | REGEX_DEAD)
+#define REGEX_UNKNOWN   0xFFFFFFFF
+#define REGEX_INDEX     0x3FFFFFFF
+
+#define REGEX_NONE      0xFFFFFFFF
+#define REGEX_INFINITE  0xFFFF
+
+enum {
+    NODE_EMPTY,
+    NODE_CLASS,
+    NODE_CONCAT,
+    NODE_ALTERNATE,
+    NODE_REPEAT,
+};
+
+enum {
+    NFA_CLASS,
+    NFA_SPLIT,
+    NFA_MATCH,
+};
+
+typedef struct _REGEX_CLASS {
+    DWORD Bits[8];
+} REGEX_CLASS, *PREGEX_CLASS;
+
+typedef struct _REGEX_NODE {
+    DWORD Type;
+    DWORD Left;             // Or the class
+    DWORD Right;
+    WORD Min;
+    WORD Max;
+} REGEX_NODE, *PREGEX_NODE;
+
+typedef struct _NFA_STATE {
+    DWORD Type;
+    DWORD Out;
+    DWORD Out1;             // Or the class
+} NFA_STATE, *PNFA_STATE;
+
+typedef struct _REGEX_NFA {
+    NFA_STATE States[REGEX_MAX_STATES];
+    DWORD Count;
+    DWORD Start;
+} REGEX_NFA, *PREGEX_NFA;
+
+typedef struct _DFA_STATE {
+    DWORD Set;              // Offset into the pool
+    DWORD Length;
+    DWORD Hash;
+    BOOL Match;
+} DFA_STATE, *PDFA_STATE;
+
+typedef struct _REGEX_DFA {
+    PREGEX_NFA Nfa;
+    const REGEX_CLASS *Classes;
+    BOOL Unanchored;        // Starts a new attempt after every byte
+
+    DWORD Table[REGEX_CACHE_STATES * 256];
+    DFA_STATE States[REGEX_CACHE_STATES];
+    DWORD Count;
+    DWORD Buckets[REGEX_CACHE_STATES * 2];
+    DWORD Pool[REGEX_CACHE_POOL];
+    DWORD PoolUsed;
+    DWORD Start;
+    DWORD Flushes;
+
+    // Scratch space for building sets.
+    DWORD Set[REGEX_MAX_STATES];
+    DWORD Copy[REGEX_MAX_STATES];
+    DWORD Stack[REGEX_MAX_STATES * 2 + 1];
+    DWORD Marks[REGEX_MAX_STATES];
+    DWORD Generation;
+} REGEX_DFA, *PREGEX_DFA;
+
+typedef struct _REGEX {
+    REGEX_NODE Nodes[REGEX_MAX_NODES];
+    DWORD NodeCount;
+    REGEX_CLASS Classes[REGEX_MAX_CLASSES];
+    DWORD ClassCount;
+    BOOL Caseless;
+
+    // The pattern being parsed.
+    const BYTE *Pattern;
+    LPCSTR Error;
+
+    REGEX_NFA Nfa;
+    REGEX_DFA SearchDfa;
+    REGEX_DFA AnchoredDfa;
+
+    // The bytes that can start a match, for the prefilter.
+    REGEX_CLASS FirstSet;
+    BYTE First[REGEX_PREFILTER_BYTES];
+    DWORD FirstCount;
+} REGEX, *PREGEX;
+
+typedef struct _REGEX_HIT {
+    HEM_QWORD Offset;
+    DWORD Length;
+    BYTE PreviewLength;
+    BYTE Preview[REGEX_PREVIEW];
+} REGEX_HIT, *PREGEX_HIT;
+
+typedef struct _REGEX_SCAN {
+    PREGEX Regex;
+    HEM_QWORD End;
+
+    // The current chunk, with the end of the last one in front of it.
+    PBYTE Window;
+    DWORD WindowLength;
+    DWORD WindowCapacity;
+    HEM_QWORD WindowOffset;
+
+    // The search DFA is at the end of the window between chunks, unless
+    // it's waiting for enough data after a match to finish it.
+    DWORD State;
+    BOOL Pending;
+    HEM_QWORD MatchEnd;     // Where the first thing to match ended
+    HEM_QWORD Idle;         // Nothing before here is still in progress
+
+    PVLIST Hits;
+    BOOL Full;
+} REGEX_SCAN, *PREGEX_SCAN;
+
+// Remember the settings from last time.
+static CHAR RegexText[REGEX_MAX_PATTERN];
+static BOOL RegexCaseless;
+
+// The last search, so the list can be shown again.
+static struct {
+    VLIST List;
+    DWORD OffsetWidth;
+    CHAR Pattern[REGEX_MAX_PATTERN];
+} Matches;
+
+static __forceinline VOID AddByte(PREGEX_CLASS Class, BYTE Byte)
+{
+    Class->Bits[Byte >> 5] |= 1 << (Byte & 31);
+}
+
+static __forceinline BOOL HasByte(const REGEX_CLASS *Class, BYTE Byte)
+{
+    return !!(Class->Bits[Byte >> 5] & (1 << (Byte & 31)));
+}
+
+static VOID AddRange(PREGEX_CLASS Class, DWORD Low, DWORD High)
+{
+    for (DWORD i = Low; i <= High; i++) {
+        AddByte(Class, (BYTE) i);
+    }
+}
+
+// Adds the other case of every letter, before a class is negated.
+static VOID FoldClass(PREGEX Regex, PREGEX_CLASS Class)
+{
+    if (!Regex->Caseless)
+        return;
+
+    for (DWORD c = 'A'; c <= 'Z'; c++) {
+        if (HasByte(Class, (BYTE) c) || HasByte(Class, (BYTE)(c | 0x20))) {
+            AddByte(Class, (BYTE) c);
+            AddByte(Class, (BYTE)(c | 0x20));
+        }
+    }
+}
+
+static DWORD NewNode(PREGEX Regex, DWORD Type, DWORD Left, DWORD Right)
+{
+    PREGEX_NODE Node;
+
+    if (Regex->NodeCount == REGEX_MAX_NODES) {
+        Regex->Error = "The pattern is too complicated.";
+        return REGEX_NONE;
+    }
+
+    Node = &Regex->Nodes[Regex->NodeCount];
+    Node->Type = Type;
+    Node->Left = Left;
+    Node->Right = Right;
+    Node->Min = 1;
+    Node->Max = 1;
+    return Regex->NodeCount++;
+}
+
+static PREGEX_CLASS NewClass(PREGEX Regex, DWORD *Node)
+{
+    if (Regex->ClassCount == REGEX_MAX_CLASSES) {
+        Regex->Error = "The pattern is too complicated.";
+        return NULL;
+    }
+
+    if ((*Node = NewNode(Regex, NODE_CLASS, Regex->ClassCount, 0)) == REGEX_NONE)
+        return NULL;
+
+    ZeroMemory(&Regex->Classes[Regex->ClassCount], sizeof(REGEX_CLASS));
+    return &Regex->Classes[Regex->ClassCount++];
+}
+
+// Parses the escape after a backslash, either adding a shorthand class to
+// Class or returning a single byte. Returns -1 if it was a class.
+static int ParseEscape(PREGEX Regex, PREGEX_CLASS Class)
+{
+    BYTE c = *Regex->Pattern++;
+    REGEX_CLASS Shorthand = {0};
+    BOOL Negate = FALSE;
+    int High;
+    int Low;
+
+    switch (c) {
+        case 'x':
+            if ((High = HexDigit(Regex->Pattern[0])) < 0 || (Low = HexDigit(Regex->Pattern[1])) < 0) {
+                Regex->Error = "\\x needs two hex digits.";
+                return 0;
+            }
+            Regex->Pattern += 2;
+            return High << 4 | Low;
+        case 'n':
+            return '\n';
+        case 'r':
+            return '\r';
+        case 't':
+            return '\t';
+        case '0':
+            return 0;
+        case 'D':
+            Negate = TRUE;
+            // Fallthrough.
+        case 'd':
+            AddRange(&Shorthand, '0', '9');
+            break;
+        case 'W':
+            Negate = TRUE;
+            // Fallthrough.
+        case 'w':
+            AddRange(&Shorthand, '0', '9');
+            AddRange(&Shorthand, 'A', 'Z');
+            AddRange(&Shorthand, 'a', 'z');
+            AddByte(&Shorthand, '_');
+            break;
+        case 'S':
+            Negate = TRUE;
+            // Fallthrough.
+        case 's':
+            AddRange(&Shorthand, '\t', '\r');
+            AddByte(&Shorthand, ' ');
+            break;
+        case 0:
+            Regex->Pattern--;
+            Regex->Error = "The pattern ends with a backslash.";
+            return 0;
+        default:
+            if (isalnum(c)) {
+                Regex->Error = "That escape isn't supported.";
+                return 0;
+            }
+            return c;
+    }
+
+    for (DWORD i = 0; i < _countof(Class->Bits); i++) {
+        Class->Bits[i] |= Negate ? ~Shorthand.Bits[i] : Shorthand.Bits[i];
+    }
+
+    return -1;
+}
+
+// The pattern is just after the [.
+static DWORD ParseClass(PREGEX Regex)
+{
+    PREGEX_CLASS Class;
+    BOOL Negate = FALSE;
+    DWORD Node;
+
+    if ((Class = NewClass(Regex, &Node)) == NULL)
+        return REGEX_NONE;
+
+    if (*Regex->Pattern == '^') {
+        Negate = TRUE;
+        Regex->Pattern++;
+    }
+
+    // A ] first is just a ].
+    for (BOOL First = TRUE; First || *Regex->Pattern != ']'; First = FALSE) {
+        int Low = *Regex->Pattern++;
+        int High;
+
+        if (Low == 0) {
+            Regex->Error = "The [ doesn't have a ].";
+            return REGEX_NONE;
+        }
+
+        if (Low == '\\' && (Low = ParseEscape(Regex, Class)) < 0)
+            continue;
+
+        if (Regex->Error)
+            return REGEX_NONE;
+
+        High = Low;
+
+        if (Regex->Pattern[0] == '-' && Regex->Pattern[1] != ']' && Regex->Pattern[1] != 0) {
+            Regex->Pattern++;
+            High = *Regex->Pattern++;
+
+            if (High == '\\' && (High = ParseEscape(Regex, Class)) < 0) {
+                Regex->Error = "A range can't end with a class.";
+                return REGEX_NONE;
+            }
+
+            if (Regex->Error)
+                return REGEX_NONE;
+
+            if (High < Low) {
+                Regex->Error = "A range is backwards.";
+                return REGEX_NONE;
+            }
+        }
+
+        AddRange(Class, Low, High);
+    }
+
+    Regex->Pattern++;
+
+    FoldClass(Regex, Class);
+
+    if (Negate) {
+        for (DWORD i = 0; i < _countof(Class->Bits); i++) {
+            Class->Bits[i] = ~Class->Bits[i];
+        }
+    }
+
+    return Node;
+}
+
+static DWORD ParseAlternation(PREGEX Regex);
+
+static DWORD ParseAtom(PREGEX Regex)
+{
+    PREGEX_CLASS Class;
+    DWORD Node;
+    int Byte;
+
+    switch (*Regex->Pattern) {
+        case '(':
+            Regex->Pattern++;
+            Node = ParseAlternation(Regex);
+
+            if (Regex->Error)
+                return REGEX_NONE;
+
+            if (*Regex->Pattern != ')') {
+                Regex->Error = "The ( doesn't have a ).";
+                return REGEX_NONE;
+            }
+
+            Regex->Pattern++;
+            return Node;
+        case '[':
+            Regex->Pattern++;
+            return ParseClass(Regex);
+        case '*': case '+': case '?': case '{':
+            Regex->Error = "There's nothing to repeat.";
+            return REGEX_NONE;
+    }
+
+    if ((Class = NewClass(Regex, &Node)) == NULL)
+        return REGEX_NONE;
+
+    // Binary data doesn't have lines, so . is any byte.
+    if ((Byte = *Regex->Pattern++) == '.') {
+        AddRange(Class, 0, 255);
+    } else if (Byte != '\\' || (Byte = ParseEscape(Regex, Class)) >= 0) {
+        AddByte(Class, (BYTE) Byte);
+        FoldClass(Regex, Class);
+    }
+
+    return Regex->Error ? REGEX_NONE : Node;
+}
+
+static BOOL ParseCount(PREGEX Regex, DWORD *Count)
+{
+    if (!isdigit(*Regex->Pattern))
+        return FALSE;
+
+    *Count = strtoul((PCHAR) Regex->Pattern, (PCHAR *) &Regex->Pattern, 10);
+    return TRUE;
+}
+
+static DWORD ParseRepeat(PREGEX Regex)
+{
+    DWORD Node = ParseAtom(Regex);
+
+    while (Node != REGEX_NONE) {
+        DWORD Min;
+        DWORD Max;
+
+        switch (*Regex->Pattern) {
+            case '*':
+                Min = 0;
+                Max = REGEX_INFINITE;
+                break;
+            case '+':
+                Min = 1;
+                Max = REGEX_INFINITE;
+                break;
+            case '?':
+                Min = 0;
+                Max = 1;
+                break;
+            case '{':
+                Regex->Pattern++;
+
+                if (!ParseCount(Regex, &Min))
+                    goto error;
+
+                Max = Min;
+
+                if (*Regex->Pattern == ',') {
+                    Regex->Pattern++;
+                    Max = REGEX_INFINITE;
+
+                    if (*Regex->Pattern != '}' && !ParseCount(Regex, &Max))
+                        goto error;
+                }
+
+                if (*Regex->Pattern != '}')
+                    goto error;
+
+                if (Min > REGEX_MAX_REPEAT || (Max != REGEX_INFINITE && (Max > REGEX_MAX_REPEAT || Max < Min))) {
+                    Regex->Error = "A repeat count is too big, or backwards.";
+                    return REGEX_NONE;
+                }
+                break;
+            default:
+                return Node;
+        }
+
+        Regex->Pattern++;
+
+        if ((Node = NewNode(Regex, NODE_REPEAT, Node, 0)) != REGEX_NONE) {
+            Regex->Nodes[Node].Min = (WORD) Min;
+            Regex->Nodes[Node].Max = (WORD) Max;
+        }
+    }
+
+    return Node;
+
+error:
+    Regex->Error = "Use {n}, {n,} or {n,m} to repeat something.";
+    return REGEX_NONE;
+}
+
+static DWORD ParseConcatenation(PREGEX Regex)
+{
+    DWORD Node = REGEX_NONE;
+
+    while (*Regex->Pattern && *Regex->Pattern != '|' && *Regex->Pattern != ')') {
+        DWORD Next = ParseRepeat(Regex);
+
+        if (Next == REGEX_NONE)
+            return REGEX_NONE;
+
+        Node = Node == REGEX_NONE ? Next : NewNode(Regex, NODE_CONCAT, Node, Next);
+
+        if (Node == REGEX_NONE)
+            return REGEX_NONE;
+    }
+
+    return Node == REGEX_NONE ? NewNode(Regex, NODE_EMPTY, 0, 0) : Node;
+}
+
+static DWORD ParseAlternation(PREGEX Regex)
+{
+    DWORD Node = ParseConcatenation(Regex);
+
+    while (Node != REGEX_NONE && *Regex->Pattern == '|') {
+        DWORD Next;
+
+        Regex->Pattern++;
+
+        if ((Next = ParseConcatenation(Regex)) == REGEX_NONE)
+            return REGEX_NONE;
+
+        Node = NewNode(Regex, NODE_ALTERNATE, Node, Next);
+    }
+
+    return Node;
+}
+
+static DWORD NewState(PREGEX Regex, PREGEX_NFA Nfa, DWORD Type, DWORD Out, DWORD Out1)
+{
+    if (Nfa->Count == REGEX_MAX_STATES) {
+        Regex->Error = "The pattern is too big, try smaller repeat counts.";
+        return 0;
+    }
+
+    Nfa->States[Nfa->Count].Type = Type;
+    Nfa->States[Nfa->Count].Out = Out;
+    Nfa->States[Nfa->Count].Out1 = Out1;
+    return Nfa->Count++;
+}
+
+// Builds the states for Node that carry on to Next, and returns the first.
+static DWORD CompileNode(PREGEX Regex, PREGEX_NFA Nfa, DWORD Index, DWORD Next)
+{
+    PREGEX_NODE Node = &Regex->Nodes[Index];
+    DWORD Loop;
+
+    if (Regex->Error)
+        return 0;
+
+    switch (Node->Type) {
+        case NODE_EMPTY:
+            return Next;
+        case NODE_CLASS:
+            return NewState(Regex, Nfa, NFA_CLASS, Next, Node->Left);
+        case NODE_CONCAT:
+            return CompileNode(Regex, Nfa, Node->Left, CompileNode(Regex, Nfa, Node->Right, Next));
+        case NODE_ALTERNATE:
+            return NewState(Regex,
+                            Nfa,
+                            NFA_SPLIT,
+                            CompileNode(Regex, Nfa, Node->Left, Next),
+                            CompileNode(Regex, Nfa, Node->Right, Next));
+    }
+
+    // The optional part of a repeat, then the required copies in front.
+    if (Node->Max == REGEX_INFINITE) {
+        Loop = NewState(Regex, Nfa, NFA_SPLIT, 0, Next);
+
+        if (Regex->Error)
+            return 0;
+
+        Nfa->States[Loop].Out = CompileNode(Regex, Nfa, Node->Left, Loop);
+        Next = Loop;
+    } else {
+        for (DWORD i = Node->Min; i < Node->Max && !Regex->Error; i++) {
+            Next = NewState(Regex, Nfa, NFA_SPLIT, CompileNode(Regex, Nfa, Node->Left, Next), Next);
+        }
+    }
+
+    for (DWORD i = 0; i < Node->Min && !Regex->Error; i++) {
+        Next = CompileNode(Regex, Nfa, Node->Left, Next);
+    }
+
+    return Next;
+}
+
+// Adds the states reachable from State without reading anything to the set.
+static VOID AddClosure(PREGEX_DFA Dfa, DWORD State, DWORD *Length)
+{
+    DWORD Depth = 0;
+
+    Dfa->Stack[Depth++] = State;
+
+    while (Depth) {
+        PNFA_STATE Nfa;
+
+        State = Dfa->Stack[--Depth];
+
+        if (Dfa->Marks[State] == Dfa->Generation)
+            continue;
+
+        Dfa->Marks[State] = Dfa->Generation;
+        Nfa = &Dfa->Nfa->States[State];
+
+        if (Nfa->Type == NFA_SPLIT) {
+            Dfa->Stack[Depth++] = Nfa->Out1;
+            Dfa->Stack[Depth++] = Nfa->Out;
+        } else {
+            Dfa->Set[(*Length)++] = State;
+        }
+    }
+}
+
+static int __cdecl CompareStates(const void *a, const void *b)
+{
+    DWORD x = *(const DWORD *) a;
+    DWORD y = *(const DWORD *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static DWORD HashSet(const DWORD *Set, DWORD Length)
+{
+    DWORD Hash = 0x811C9DC5;
+
+    for (DWORD i = 0; i < Length; i++) {
+        Hash = (Hash ^ Set[i]) * 0x01000193;
+    }
+
+    return Hash;
+}
+
+static DWORD AddDfaState(PREGEX_DFA Dfa, const DWORD *Set, DWORD Length);
+
+// Throw the whole cache away, and put the start state back.
+static VOID FlushDfa(PREGEX_DFA Dfa)
+{
+    DWORD Length = 0;
+
+    Dfa->Count = 0;
+    Dfa->PoolUsed = 0;
+    Dfa->Flushes++;
+
+    FillMemory(Dfa->Buckets, sizeof Dfa->Buckets, 0xFF);
+
+    Dfa->Generation++;
+    AddClosure(Dfa, Dfa->Nfa->Start, &Length);
+    qsort(Dfa->Set, Length, sizeof(DWORD), CompareStates);
+
+    Dfa->Start = AddDfaState(Dfa, Dfa->Set, Length);
+}
+
+// Finds or makes the state for a sorted set, returning it with its flags.
+// This might flush the cache, which makes every other index invalid.
+static DWORD AddDfaState(PREGEX_DFA Dfa, const DWORD *Set, DWORD Length)
+{
+    DWORD Hash = HashSet(Set, Length);
+    DWORD Bucket = Hash % _countof(Dfa->Buckets);
+    PDFA_STATE State;
+    DWORD Index;
+
+    while ((Index = Dfa->Buckets[Bucket]) != REGEX_NONE) {
+        State = &Dfa->States[Index];
+
+        if (State->Hash == Hash
+         && State->Length == Length
+         && memcmp(Dfa->Pool + State->Set, Set, Length * sizeof(DWORD)) == 0) {
+            goto found;
+        }
+
+        Bucket = (Bucket + 1) % _countof(Dfa->Buckets);
+    }
+
+    if (Dfa->Count == REGEX_CACHE_STATES || Dfa->PoolUsed + Length > REGEX_CACHE_POOL) {
+        // Flushing reuses the scratch set, so save it first.
+        if (Set != Dfa->Copy)
+            CopyMemory(Dfa->Copy, Set, Length * sizeof(DWORD));
+
+        FlushDfa(Dfa);
+        return AddDfaState(Dfa, Dfa->Copy, Length);
+    }
+
+    Index = Dfa->Count++;
+    State = &Dfa->States[Index];
+    State->Set = Dfa->PoolUsed;
+    State->Length = Length;
+    State->Hash = Hash;
+    State->Match = FALSE;
+
+    for (DWORD i = 0; i < Length; i++) {
+        if (Dfa->Nfa->States[Set[i]].Type == NFA_MATCH)
+            State->Match = TRUE;
+    }
+
+    CopyMemory(Dfa->Pool + Dfa->PoolUsed, Set, Length * sizeof(DWORD));
+    Dfa->PoolUsed += Length;
+    Dfa->Buckets[Bucket] = Index;
+
+    FillMemory(Dfa->Table + Index * 256, 256 * sizeof(DWORD), 0xFF);
+
+found:
+    return Index
+         | (State->Match ? REGEX_MATCH : 0)
+         | (Length == 0 ? REGEX_DEAD : 0);
+}
+
+// Works out a transition that isn't in the table yet.
+static DWORD BuildTransition(PREGEX_DFA Dfa, DWORD Index, BYTE Byte)
+{
+    PDFA_STATE State = &Dfa->States[Index];
+    DWORD Flushes = Dfa->Flushes;
+    DWORD Length = 0;
+    DWORD Next;
+
+    Dfa->Generation++;
+
+    for (DWORD i = 0; i < State->Length; i++) {
+        PNFA_STATE Nfa = &Dfa->Nfa->States[Dfa->Pool[State->Set + i]];
+
+        if (Nfa->Type == NFA_CLASS && HasByte(&Dfa->Classes[Nfa->Out1], Byte))
+            AddClosure(Dfa, Nfa->Out, &Length);
+    }
+
+    if (Dfa->Unanchored)
+        AddClosure(Dfa, Dfa->Nfa->Start, &Length);
+
+    qsort(Dfa->Set, Length, sizeof(DWORD), CompareStates);
+
+    Next = AddDfaState(Dfa, Dfa->Set, Length);
+
+    // If the cache was flushed, Index isn't there anymore.
+    if (Flushes == Dfa->Flushes)
+        Dfa->Table[Index * 256 + Byte] = Next;
+
+    return Next;
+}
+
+static __forceinline DWORD Transition(PREGEX_DFA Dfa, DWORD Index, BYTE Byte)
+{
+    DWORD Next = Dfa->Table[Index * 256 + Byte];
+
+    return Next == REGEX_UNKNOWN ? BuildTransition(Dfa, Index, Byte) : Next;
+}
+
+static VOID InitializeDfa(PREGEX_DFA Dfa, PREGEX_NFA Nfa, const REGEX_CLASS *Classes, BOOL Unanchored)
+{
+    Dfa->Nfa = Nfa;
+    Dfa->Classes = Classes;
+    Dfa->Unanchored = Unanchored;
+    Dfa->Generation = 0;
+
+    ZeroMemory(Dfa->Marks, sizeof Dfa->Marks);
+    FlushDfa(Dfa);
+
+    Dfa->Flushes = 0;
+}
+
+// Returns NULL and sets Error if the pattern isn't valid.
+static PREGEX CompileRegex(LPCSTR Pattern, BOOL Caseless, LPCSTR *Error)
+{
+    PREGEX Regex;
+    PDFA_STATE Start;
+    DWORD Root;
+    DWORD Match;
+
+    if ((Regex = calloc(1, sizeof *Regex)) == NULL) {
+        *Error = "Not enough memory.";
+        return NULL;
+    }
+
+    Regex->Pattern = (const BYTE *) Pattern;
+    Regex->Caseless = Caseless;
+
+    Root = ParseAlternation(Regex);
+
+    if (Regex->Error == NULL && *Regex->Pattern == ')')
+        Regex->Error = "The ) doesn't have a (.";
+
+    if (Regex->Error)
+        goto error;
+
+    Match = NewState(Regex, &Regex->Nfa, NFA_MATCH, 0, 0);
+    Regex->Nfa.Start = CompileNode(Regex, &Regex->Nfa, Root, Match);
+
+    if (Regex->Error)
+        goto error;
+
+    InitializeDfa(&Regex->SearchDfa, &Regex->Nfa, Regex->Classes, TRUE);
+    InitializeDfa(&Regex->AnchoredDfa, &Regex->Nfa, Regex->Classes, FALSE);
+
+    Start = &Regex->SearchDfa.States[Regex->SearchDfa.Start];
+
+    // Every position would match.
+    if (Start->Match) {
+        Regex->Error = "That pattern matches nothing at all, so it matches everywhere.";
+        goto error;
+    }
+
+    // Which bytes get the search anywhere from the start.
+    for (DWORD Byte = 0; Byte < 256; Byte++) {
+        for (DWORD i = 0; i < Start->Length; i++) {
+            PNFA_STATE Nfa = &Regex->Nfa.States[Regex->SearchDfa.Pool[Start->Set + i]];
+
+            if (Nfa->Type == NFA_CLASS && HasByte(&Regex->Classes[Nfa->Out1], (BYTE) Byte)) {
+                if (Regex->FirstCount < REGEX_PREFILTER_BYTES)
+                    Regex->First[Regex->FirstCount] = (BYTE) Byte;
+
+                AddByte(&Regex->FirstSet, (BYTE) Byte);
+                Regex->FirstCount++;
+                break;
+            }
+        }
+    }
+
+    if (Regex->FirstCount == 0) {
+        Regex->Error = "That pattern can't match anything.";
+        goto error;
+    }
+
+    return Regex;
+
+error:
+    *Error = Regex->Error;
+    free(Regex);
+    return NULL;
+}
+
+// Skips to the next byte that could start a match.
+static DWORD FindFirstByte(PREGEX Regex, const BYTE *Data, DWORD Index, DWORD Length)
+{
+    __m128i Needles[REGEX_PREFILTER_BYTES];
+    unsigned long Bit;
+
+    if (Regex->FirstCount > REGEX_PREFILTER_BYTES) {
+        while (Index < Length && !HasByte(&Regex->FirstSet, Data[Index]))
+            Index++;
+        return Index;
+    }
+
+    for (DWORD i = 0; i < REGEX_PREFILTER_BYTES; i++) {
+        Needles[i] = _mm_set1_epi8(Regex->First[min(i, Regex->FirstCount - 1)]);
+    }
+
+    for (; Index < Length; Index += 16) {
+        __m128i Bytes = _mm_loadu_si128((const __m128i *)(Data + Index));
+        __m128i Match = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(Bytes, Needles[0]), _mm_cmpeq_epi8(Bytes, Needles[1])),
+                                     _mm_or_si128(_mm_cmpeq_epi8(Bytes, Needles[2]), _mm_cmpeq_epi8(Bytes, Needles[3])));
+
+        if (_BitScanForward(&Bit, _mm_movemask_epi8(Match)))
+            return min(Index + Bit, Length);
+    }
+
+    return Length;
+}
+
+static VOID AddMatch(PREGEX_SCAN Scan, HEM_QWORD Start, HEM_QWORD End)
+{
+    const BYTE *Data = Scan->Window + (Start - Scan->WindowOffset);
+    PREGEX_HIT Hit;
+
+    if (Scan->Hits->Count >= REGEX_MAX_HITS || (Hit = AppendVirtualList(Scan->Hits)) == NULL) {
+        Scan->Full = TRUE;
+        return;
+    }
+
+    Hit->Offset = Start;
+    Hit->Length = (DWORD)(End - Start);
+    Hit->PreviewLength = (BYTE) min(Hit->Length, REGEX_PREVIEW);
+
+    CopyMemory(Hit->Preview, Data, Hit->PreviewLength);
+}
+
+// The end of the longest match that starts at Start, or Start if none does.
+static HEM_QWORD LongestMatch(PREGEX_SCAN Scan, HEM_QWORD Start)
+{
+    PREGEX_DFA Dfa = &Scan->Regex->AnchoredDfa;
+    HEM_QWORD Limit = min(Start + REGEX_MAX_MATCH, Scan->WindowOffset + Scan->WindowLength);
+    HEM_QWORD End = Start;
+    DWORD State = Dfa->Start;
+
+    for (HEM_QWORD i = Start; i < Limit; i++) {
+        DWORD Next = Transition(Dfa, State, Scan->Window[i - Scan->WindowOffset]);
+
+        if (Next & REGEX_DEAD)
+            break;
+
+        if (Next & REGEX_MATCH)
+            End = i + 1;
+
+        State = Next & REGEX_INDEX;
+    }
+
+    return End;
+}
+
+// Something ended at MatchEnd, find the leftmost match and how long it is.
+// Returns the index to carry on searching from.
+static DWORD FinishMatch(PREGEX_SCAN Scan)
+{
+    HEM_QWORD End = Scan->MatchEnd;
+    HEM_QWORD Start = max(Scan->Idle, Scan->WindowOffset);
+
+    // Nothing that started further back is short enough.
+    if (End > REGEX_MAX_MATCH)
+        Start = max(Start, End - REGEX_MAX_MATCH);
+
+    // Whatever ended at MatchEnd started somewhere in here, so this will
+    // stop before it gets there unless that was too long to keep.
+    for (; Start < Scan->MatchEnd; Start++) {
+        if (!HasByte(&Scan->Regex->FirstSet, Scan->Window[Start - Scan->WindowOffset]))
+            continue;
+
+        if ((End = LongestMatch(Scan, Start)) != Start)
+            break;
+    }
+
+    // If it was too long, just carry on after it.
+    if (Start == Scan->MatchEnd) {
+        End = Start;
+    } else {
+        AddMatch(Scan, Start, End);
+    }
+
+    // Matches can't overlap, so the next one starts from here.
+    Scan->Idle = End;
+    Scan->Pending = FALSE;
+    Scan->State = Scan->Regex->SearchDfa.Start;
+
+    return (DWORD)(End - Scan->WindowOffset);
+}
+
+// Run the search DFA over the window from Index to the end.
+static VOID ScanWindow(PREGEX_SCAN Scan, DWORD Index, BOOL Last)
+{
+    PREGEX Regex = Scan->Regex;
+    PREGEX_DFA Dfa = &Regex->SearchDfa;
+    const BYTE *Data = Scan->Window;
+    DWORD Length = Scan->WindowLength;
+    DWORD State = Scan->State;
+
+    while (!Scan->Full) {
+        DWORD Next;
+
+        if (Scan->Pending) {
+            // The longest match might not have arrived yet.
+            if (!Last && Scan->WindowOffset + Length < Scan->MatchEnd + REGEX_MAX_MATCH)
+                break;
+
+            Index = FinishMatch(Scan);
+            State = Scan->State;
+        }
+
+        // Nothing is in progress, so skip to something that could start. If
+        // that skipped anything, everything before here is finished with.
+        if (State == Dfa->Start) {
+            DWORD Skip = FindFirstByte(Regex, Data, Index, Length);
+
+            if (Skip != Index)
+                Scan->Idle = Scan->WindowOffset + Skip;
+
+            Index = Skip;
+        }
+
+        // The usual case, where nothing interesting happens.
+        while (Index < Length && !((Next = Dfa->Table[State * 256 + Data[Index]]) & REGEX_SPECIAL)) {
+            State = Next;
+            Index++;
+
+            if (State == Dfa->Start)
+                break;
+        }
+
+        if (Index == Length)
+            break;
+
+        if (!(Next & REGEX_SPECIAL))
+            continue;
+
+        if (Next == REGEX_UNKNOWN)
+            Next = BuildTransition(Dfa, State, Data[Index]);
+
+        State = Next & REGEX_INDEX;
+        Index++;
+
+        if (Next & REGEX_MATCH) {
+            Scan->Pending = TRUE;
+            Scan->MatchEnd = Scan->WindowOffset + Index;
+        }
+    }
+
+    Scan->State = State;
+}
+
+static BOOL ScanChunk(PVOID Context, HEM_QWORD Offset, const BYTE *Data, DWORD Length)
+{
+    PREGEX_SCAN Scan = Context;
+    DWORD Keep = min(Scan->WindowLength, REGEX_KEEP);
+
+    if (Keep + Length + REGEX_PADDING > Scan->WindowCapacity) {
+        PBYTE Window = realloc(Scan->Window, Keep + Length + REGEX_PADDING);
+
+        if (Window == NULL)
+            return FALSE;
+
+        Scan->Window = Window;
+        Scan->WindowCapacity = Keep + Length + REGEX_PADDING;
+    }
+
+    memmove(Scan->Window, Scan->Window + Scan->WindowLength - Keep, Keep);
+    memcpy(Scan->Window + Keep, Data, Length);
+    ZeroMemory(Scan->Window + Keep + Length, REGEX_PADDING);
+
+    Scan->WindowOffset = Offset - Keep;
+    Scan->WindowLength = Keep + Length;
+
+    ScanWindow(Scan, Keep, Offset + Length == Scan->End);
+
+    return !Scan->Full;
+}
+
+static VOID FormatHit(PVOID Context, DWORD Index, const VOID *Record, PCHAR Buffer, SIZE_T Size)
+{
+    const REGEX_HIT *Hit = Record;
+    CHAR Preview[REGEX_PREVIEW + 1];
+
+    for (DWORD i = 0; i < Hit->PreviewLength; i++) {
+        Preview[i] = Hit->Preview[i] >= ' ' && Hit->Preview[i] < 0x7F ? Hit->Preview[i] : '.';
+    }
+
+    Preview[Hit->PreviewLength] = 0;
+
+    snprintf(Buffer,
+             Size,
+             "%0*llX  %5u  %s%s",
+             Matches.OffsetWidth,
+             Hit->Offset,
+             Hit->Length,
+             Preview,
+             Hit->Length > Hit->PreviewLength ? "..." : "");
+}
+
+// The first match at or after Offset.
+static DWORD FindMatchByOffset(HEM_QWORD Offset)
+{
+    DWORD Low = 0;
+    DWORD High = Matches.List.Count;
+
+    while (Low < High) {
+        DWORD Middle = Low + (High - Low) / 2;
+        PREGEX_HIT Hit = GetVirtualListRecord(&Matches.List, Middle);
+
+        if (Hit->Offset < Offset) {
+            Low = Middle + 1;
+        } else {
+            High = Middle;
+        }
+    }
+
+    return min(Low, Matches.List.Count - 1);
+}
+
+static int SelectRegexOptions(HEM_QWORD Offset, HEM_QWORD Length)
+{
+    CHAR Lines[4][REGEX_MAX_PATTERN + 64];
+    PCHAR Menu[4];
+    DWORD Count = 3;
+    DWORD Width = 0;
+    int Choice = 1;
+
+    while (TRUE) {
+        snprintf(Lines[0], sizeof Lines[0], "Find all in %#llx bytes from %#llx", Length, Offset);
+        snprintf(Lines[1], sizeof Lines[0], "Pattern %s", *RegexText ? RegexText : "(not set)");
+        snprintf(Lines[2], sizeof Lines[0], "[%c] Ignore case", RegexCaseless ? 'x' : ' ');
+
+        if (Matches.List.Count) {
+            snprintf(Lines[3], sizeof Lines[0], "Show the last %u matches", Matches.List.Count);
+            Count = 4;
+        }
+
+        for (DWORD i = 0; i < Count; i++) {
+            Menu[i] = Lines[i];
+            Width = max(Width, strlen(Lines[i]));
+        }
+
+        Choice = HiewGate_Menu("Regex", Menu, Count, Width, Choice, NULL, NULL, NULL, NULL);
+
+        switch (Choice) {
+            case 1:
+                if (*RegexText)
+                    return 1;
+                // Fallthrough, there's nothing to find yet.
+            case 2:
+                HiewGate_GetString("Pattern (e.g. MZ.{58}\\x50\\x45, [\\x20-\\x7e]{8,}, (http|ftp)s?://)",
+                                   RegexText,
+                                   sizeof RegexText);
+                break;
+            case 3:
+                RegexCaseless = !RegexCaseless;
+                break;
+            case 4:
+                return 2;
+            default:
+                return 0;
+        }
+    }
+}
+
+int RegexEntryPoint(HEMCALL_TAG *HemCall)
+{
+    REGEX_SCAN Scan = {0};
+    HIEWGATE_GETDATA HiewData;
+    STREAM_CONSUMER Consumer;
+    LPCSTR Error;
+    PREGEX Regex;
+    JOB Job;
+    HEM_QWORD Offset;
+    HEM_QWORD Length;
+    CHAR Message[REGEX_MAX_PATTERN + 128];
+    SIZE_T Used;
+    LONG Selected;
+    int Result;
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return HEM_ERROR;
+
+    GetMarkedRange(&HiewData, &Offset, &Length);
+
+    switch (SelectRegexOptions(Offset, Length)) {
+        case 1:
+            break;
+        case 2:
+            snprintf(Message, sizeof Message, "%u matches for %s", Matches.List.Count, Matches.Pattern);
+            goto show;
+        default:
+            return HEM_OK;
+    }
+
+    if ((Regex = CompileRegex(RegexText, RegexCaseless, &Error)) == NULL) {
+        HiewGate_Message("Regex", (PCHAR) Error);
+        return HEM_OK;
+    }
+
+    FreeVirtualList(&Matches.List);
+    InitVirtualList(&Matches.List, sizeof(REGEX_HIT), FormatHit, NULL);
+
+    strcpy_s(Matches.Pattern, sizeof Matches.Pattern, RegexText);
+    Matches.OffsetWidth = HiewData.filelength > 0xFFFFFFFF ? 16 : 8;
+
+    Scan.Regex = Regex;
+    Scan.End = Offset + Length;
+    Scan.Idle = Offset;
+    Scan.State = Regex->SearchDfa.Start;
+    Scan.Hits = &Matches.List;
+
+    Consumer.Routine = ScanChunk;
+    Consumer.Context = &Scan;
+
+    BeginJob(&Job, "Searching", Length);
+
+    Result = StreamFileRange(&Job, Offset, Length, &Consumer, 1);
+
+    EndJob(&Job);
+
+    free(Scan.Window);
+
+    // If there were too many, I can still show some.
+    if (Result == HEM_ERROR && Scan.Full)
+        Result = HEM_OK;
+
+    if (Result != HEM_OK) {
+        FreeVirtualList(&Matches.List);
+        HiewGate_Message("Regex", Result == HEM_KEYBREAK ? "Cancelled." : "Hiew failed to read the file.");
+        free(Regex);
+        return HEM_OK;
+    }
+
+    if (Matches.List.Count == 0) {
+        HiewGate_Message("Regex", "Nothing matched.");
+        free(Regex);
+        return HEM_OK;
+    }
+
+    Used = snprintf(Message,
+                    sizeof Message,
+                    "%u matches%s, %u DFA states, ",
+                    Matches.List.Count,
+                    Scan.Full ? " (some are missing)" : "",
+                    Regex->SearchDfa.Count + Regex->SearchDfa.Flushes * REGEX_CACHE_STATES);
+
+    FormatJobStats(&Job, Message + Used, sizeof Message - Used);
+
+    free(Regex);
+
+show:
+    // Matches are found in order, so start at the cursor.
+    Selected = ShowVirtualList(&Matches.List, Message, REGEX_MENU_WIDTH, FindMatchByOffset(HiewData.offsetCurrent));
+
+    if (Selected >= 0) {
+        PREGEX_HIT Hit = GetVirtualListRecord(&Matches.List, Selected);
+
+        HemCall->returnOffset = Hit->Offset;
+        HemCall->returnActionFlag |= HEM_RETURN_SETOFFSET;
+    }
+
+    return HEM_OK;
+}
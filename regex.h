@@ -0,0 +1,7 @@
+#ifndef __REGEX_H
+#define __REGEX_H
+
+// Finds every match of a byte regex in the marked block, or the whole file.
+int RegexEntryPoint(HEMCALL_TAG *HemCall);
+
+#endif
@@ -0,0 +1,353 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "elf.h"
+#include "secmap.h"
+
+// Hiew already knows where everything is loaded, but asking it through
+// HiewGate_Global2Local() is a gate call per offset, which is far too slow
+// for anything that scans. Instead I read the headers myself once, and keep
+// the map until a different file is opened or something is written.
+//
+// Only the parts that matter for translating addresses are parsed: PE
+// sections, ELF program headers and Mach-O segments.
+
+// Load commands bigger than this are probably garbage.
+#define SECMAP_MAX_COMMANDS (1024 * 1024)
+
+typedef struct _MACHO_HEADER {
+    DWORD Magic;
+    DWORD CpuType;
+    DWORD CpuSubtype;
+    DWORD FileType;
+    DWORD CommandCount;
+    DWORD CommandSize;
+    DWORD Flags;
+} MACHO_HEADER, *PMACHO_HEADER;
+
+typedef struct _MACHO_COMMAND {
+    DWORD Command;
+    DWORD Size;
+} MACHO_COMMAND, *PMACHO_COMMAND;
+
+typedef struct _MACHO_SEGMENT {
+    DWORD Command;
+    DWORD Size;
+    CHAR Name[16];
+    DWORD Address;
+    DWORD MemorySize;
+    DWORD Offset;
+    DWORD FileSize;
+    DWORD MaxProtection;
+    DWORD InitProtection;
+    DWORD SectionCount;
+    DWORD Flags;
+} MACHO_SEGMENT, *PMACHO_SEGMENT;
+
+typedef struct _MACHO_SEGMENT64 {
+    DWORD Command;
+    DWORD Size;
+    CHAR Name[16];
+    ULONGLONG Address;
+    ULONGLONG MemorySize;
+    ULONGLONG Offset;
+    ULONGLONG FileSize;
+    DWORD MaxProtection;
+    DWORD InitProtection;
+    DWORD SectionCount;
+    DWORD Flags;
+} MACHO_SEGMENT64, *PMACHO_SEGMENT64;
+
+#define MACHO_MAGIC         0xFEEDFACE
+#define MACHO_MAGIC64       0xFEEDFACF
+#define MACHO_LC_SEGMENT    0x01
+#define MACHO_LC_SEGMENT64  0x19
+#define MACHO_VM_EXECUTE    0x04
+
+// The map for the last file, and how to tell if it's still the same one.
+static SECTION_MAP Map;
+static BOOL MapValid;
+static DWORD MapFilenameHash;
+static DWORD MapFlags;
+static HEM_QWORD MapFileLength;
+
+static BOOL ReadHeader(HEM_QWORD Offset, DWORD Size, PVOID Buffer)
+{
+    if (Offset + Size < Offset || Offset + Size > MapFileLength)
+        return FALSE;
+
+    return HiewGate_FileRead(Offset, Size, Buffer) == (int) Size;
+}
+
+// Anything past the end of the file isn't there to scan.
+static VOID AddSection(HEM_QWORD Offset, HEM_QWORD Size, HEM_QWORD Address, BOOL Executable)
+{
+    PMAP_SECTION Section;
+
+    if (Offset >= MapFileLength || Map.Count == SECMAP_MAX_SECTIONS)
+        return;
+
+    Size = min(Size, MapFileLength - Offset);
+
+    if (Size == 0)
+        return;
+
+    Section = &Map.Sections[Map.Count++];
+    Section->Offset = Offset;
+    Section->Size = Size;
+    Section->Address = Address;
+    Section->Executable = Executable;
+}
+
+static BOOL ParsePe(VOID)
+{
+    IMAGE_DOS_HEADER Dos;
+    IMAGE_NT_HEADERS64 Headers;
+    IMAGE_SECTION_HEADER Section;
+    PIMAGE_NT_HEADERS32 Headers32 = (PVOID) &Headers;
+    HEM_QWORD SectionOffset;
+    ULONGLONG ImageBase;
+    DWORD HeaderSize;
+
+    if (!ReadHeader(0, sizeof Dos, &Dos) || Dos.e_magic != IMAGE_DOS_SIGNATURE)
+        return FALSE;
+
+    // The 32 bit headers are smaller, so this is enough for either.
+    if (!ReadHeader(Dos.e_lfanew, sizeof(IMAGE_NT_HEADERS32), &Headers) || Headers.Signature != IMAGE_NT_SIGNATURE)
+        return FALSE;
+
+    if (Headers.OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC) {
+        Map.Is64 = TRUE;
+        ImageBase = Headers.OptionalHeader.ImageBase;
+        HeaderSize = Headers.OptionalHeader.SizeOfHeaders;
+    } else if (Headers.OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC) {
+        ImageBase = Headers32->OptionalHeader.ImageBase;
+        HeaderSize = Headers32->OptionalHeader.SizeOfHeaders;
+    } else {
+        return FALSE;
+    }
+
+    SectionOffset = Dos.e_lfanew
+                  + FIELD_OFFSET(IMAGE_NT_HEADERS64, OptionalHeader)
+                  + Headers.FileHeader.SizeOfOptionalHeader;
+
+    AddSection(0, HeaderSize, ImageBase, FALSE);
+
+    for (DWORD i = 0; i < Headers.FileHeader.NumberOfSections; i++) {
+        DWORD Size;
+
+        if (!ReadHeader(SectionOffset + i * sizeof Section, sizeof Section, &Section))
+            break;
+
+        // Whatever is past the virtual size is just alignment.
+        Size = Section.SizeOfRawData;
+
+        if (Section.Misc.VirtualSize)
+            Size = min(Size, Section.Misc.VirtualSize);
+
+        AddSection(Section.PointerToRawData,
+                   Size,
+                   ImageBase + Section.VirtualAddress,
+                   !!(Section.Characteristics & (IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_CNT_CODE)));
+    }
+
+    Map.Format = "PE";
+    return TRUE;
+}
+
+static BOOL ParseElf(VOID)
+{
+    ELF64_HEADER Header;
+    PELF32_HEADER Header32 = (PVOID) &Header;
+    HEM_QWORD ProgramOffset;
+    DWORD EntrySize;
+    DWORD Count;
+
+    if (!ReadHeader(0, sizeof Header, &Header) || memcmp(Header.Ident, "\x7F" "ELF", 4) != 0)
+        return FALSE;
+
+    // Only little endian, the rest of this is for x86 anyway.
+    if (Header.Ident[5] != 1)
+        return FALSE;
+
+    Map.Is64 = Header.Ident[4] == 2;
+
+    if (Map.Is64) {
+        ProgramOffset = Header.ProgramOffset;
+        EntrySize = Header.ProgramEntrySize;
+        Count = Header.ProgramCount;
+    } else {
+        ProgramOffset = Header32->ProgramOffset;
+        EntrySize = Header32->ProgramEntrySize;
+        Count = Header32->ProgramCount;
+    }
+
+    if (EntrySize < (Map.Is64 ? sizeof(ELF64_PROGRAM) : sizeof(ELF32_PROGRAM)))
+        return FALSE;
+
+    for (DWORD i = 0; i < Count; i++) {
+        ELF64_PROGRAM Program;
+        PELF32_PROGRAM Program32 = (PVOID) &Program;
+
+        if (!ReadHeader(ProgramOffset + (HEM_QWORD) i * EntrySize, min(EntrySize, sizeof Program), &Program))
+            break;
+
+        if (Map.Is64 && Program.Type == ELF_PT_LOAD) {
+            AddSection(Program.Offset, Program.FileSize, Program.Address, Program.Flags & ELF_PF_X);
+        } else if (!Map.Is64 && Program32->Type == ELF_PT_LOAD) {
+            AddSection(Program32->Offset, Program32->FileSize, Program32->Address, Program32->Flags & ELF_PF_X);
+        }
+    }
+
+    Map.Format = "ELF";
+    return TRUE;
+}
+
+static BOOL ParseMacho(VOID)
+{
+    MACHO_HEADER Header;
+    PBYTE Commands;
+    DWORD Position = 0;
+
+    if (!ReadHeader(0, sizeof Header, &Header))
+        return FALSE;
+
+    if (Header.Magic != MACHO_MAGIC && Header.Magic != MACHO_MAGIC64)
+        return FALSE;
+
+    if (Header.CommandSize > SECMAP_MAX_COMMANDS || (Commands = malloc(max(Header.CommandSize, 1))) == NULL)
+        return FALSE;
+
+    Map.Is64 = Header.Magic == MACHO_MAGIC64;
+
+    // The 64 bit header has an extra reserved field.
+    if (!ReadHeader(sizeof Header + (Map.Is64 ? sizeof(DWORD) : 0), Header.CommandSize, Commands)) {
+        free(Commands);
+        return FALSE;
+    }
+
+    for (DWORD i = 0; i < Header.CommandCount; i++) {
+        PMACHO_COMMAND Command = (PVOID)(Commands + Position);
+
+        if (Position + sizeof *Command > Header.CommandSize || Command->Size < sizeof *Command)
+            break;
+        if (Command->Size > Header.CommandSize - Position)
+            break;
+
+        if (Command->Command == MACHO_LC_SEGMENT64 && Command->Size >= sizeof(MACHO_SEGMENT64)) {
+            PMACHO_SEGMENT64 Segment = (PVOID) Command;
+
+            AddSection(Segment->Offset,
+                       Segment->FileSize,
+                       Segment->Address,
+                       !!(Segment->InitProtection & MACHO_VM_EXECUTE));
+        } else if (Command->Command == MACHO_LC_SEGMENT && Command->Size >= sizeof(MACHO_SEGMENT)) {
+            PMACHO_SEGMENT Segment = (PVOID) Command;
+
+            AddSection(Segment->Offset,
+                       Segment->FileSize,
+                       Segment->Address,
+                       !!(Segment->InitProtection & MACHO_VM_EXECUTE));
+        }
+
+        Position += Command->Size;
+    }
+
+    free(Commands);
+
+    Map.Format = "Mach-O";
+    return TRUE;
+}
+
+static int __cdecl CompareSections(const void *a, const void *b)
+{
+    const MAP_SECTION *x = a;
+    const MAP_SECTION *y = b;
+
+    return x->Offset < y->Offset ? -1 : x->Offset > y->Offset;
+}
+
+PSECTION_MAP GetSectionMap(HEMCALL_TAG *HemCall)
+{
+    HIEWGATE_GETDATA HiewData;
+    DWORD Flags = HemCall->hemFlag & HEM_FLAG_FILEMASK;
+    BOOL Parsed = FALSE;
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return NULL;
+
+    if (MapValid
+     && MapFilenameHash == HemCall->filenameHash
+     && MapFlags == Flags
+     && MapFileLength == HiewData.filelength) {
+        return &Map;
+    }
+
+    ZeroMemory(&Map, sizeof Map);
+
+    MapFilenameHash = HemCall->filenameHash;
+    MapFlags = Flags;
+    MapFileLength = HiewData.filelength;
+
+    // Trust Hiew about the format, it's already checked.
+    if (Flags & (HEM_FLAG_PE | HEM_FLAG_PE64)) {
+        Parsed = ParsePe();
+    } else if (Flags & (HEM_FLAG_ELF | HEM_FLAG_ELF64)) {
+        Parsed = ParseElf();
+    } else if (Flags & (HEM_FLAG_MACHO | HEM_FLAG_MACHO64)) {
+        Parsed = ParseMacho();
+    }
+
+    // Just treat it as flat code.
+    if (!Parsed || Map.Count == 0) {
+        ZeroMemory(&Map, sizeof Map);
+
+        Map.Format = "raw";
+
+        AddSection(0, MapFileLength, 0, TRUE);
+    }
+
+    qsort(Map.Sections, Map.Count, sizeof(MAP_SECTION), CompareSections);
+
+    MapValid = TRUE;
+    return &Map;
+}
+
+BOOL OffsetToAddress(PSECTION_MAP Map, HEM_QWORD Offset, HEM_QWORD *Address)
+{
+    for (DWORD i = 0; i < Map->Count; i++) {
+        PMAP_SECTION Section = &Map->Sections[i];
+
+        if (Offset >= Section->Offset && Offset - Section->Offset < Section->Size) {
+            *Address = Section->Address + (Offset - Section->Offset);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+BOOL AddressToOffset(PSECTION_MAP Map, HEM_QWORD Address, HEM_QWORD *Offset)
+{
+    for (DWORD i = 0; i < Map->Count; i++) {
+        PMAP_SECTION Section = &Map->Sections[i];
+
+        if (Address >= Section->Address && Address - Section->Address < Section->Size) {
+            *Offset = Section->Offset + (Address - Section->Address);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+VOID InvalidateSectionMap(VOID)
+{
+    MapValid = FALSE;
+}
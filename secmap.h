@@ -0,0 +1,35 @@
+#ifndef __SECMAP_H
+#define __SECMAP_H
+
+#define SECMAP_MAX_SECTIONS 256
+
+// A part of the file that gets loaded somewhere.
+typedef struct _MAP_SECTION {
+    HEM_QWORD Offset;       // In the file
+    HEM_QWORD Size;         // Bytes in the file
+    HEM_QWORD Address;      // Where it's loaded
+    BOOL Executable;
+} MAP_SECTION, *PMAP_SECTION;
+
+typedef struct _SECTION_MAP {
+    LPCSTR Format;          // "PE", "ELF", "Mach-O" or "raw"
+    BOOL Is64;
+    DWORD Count;
+    MAP_SECTION Sections[SECMAP_MAX_SECTIONS];  // Sorted by Offset
+} SECTION_MAP, *PSECTION_MAP;
+
+// Gets the sections of the current file from its headers. The map is kept
+// until the file changes, so this is cheap to call. If the format isn't one
+// I understand, the whole file is one executable section at address zero.
+// Returns NULL if Hiew couldn't read the headers.
+PSECTION_MAP GetSectionMap(HEMCALL_TAG *HemCall);
+
+// Translate between file offsets and load addresses, these return FALSE if
+// the offset or address isn't in any section.
+BOOL OffsetToAddress(PSECTION_MAP Map, HEM_QWORD Offset, HEM_QWORD *Address);
+BOOL AddressToOffset(PSECTION_MAP Map, HEM_QWORD Address, HEM_QWORD *Offset);
+
+// Forget the map, the headers might have been written.
+VOID InvalidateSectionMap(VOID);
+
+#endif
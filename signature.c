@@ -0,0 +1,1253 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "stream.h"
+#include "vlist.h"
+#include "util.h"
+#include "background.h"
+#include "hash.h"
+#include "rcache.h"
+#include "signature.h"
+
+// This scans for thousands of byte signatures at once, e.g. crypto constants
+// or packer markers, with an Aho-Corasick automaton.
+//
+// Signatures can have wildcards, so the automaton only looks for the longest
+// fixed run of each one (the anchor), and the whole signature is checked
+// against the mask when the anchor is found.
+//
+// The signatures are read from a text file next to the hem, which looks like
+// this:
+//
+//  # Comments start with a hash.
+//  md5_init = 01 23 45 67 89 AB CD EF FE DC BA 98 76 54 32 10
+//  seh_frame = 68 ?? ?? ?? ?? 64 A1 00 00 00 00 50
+//  upx_marker = "UPX!"
+//
+// Compiling that is slow with a lot of signatures, so the automaton is saved
+// in a flat layout to a cache file, which I just map next time. It's only
+// rebuilt when the text file changes.
+
+#define SIGNATURE_MAGIC         'CGIS'
+#define SIGNATURE_VERSION       1
+#define SIGNATURE_EXTENSION     ".sig"
+#define SIGNATURE_CACHE         ".sgc"
+
+#define SIGNATURE_MAX_LENGTH    256
+#define SIGNATURE_MAX_NAME      64
+#define SIGNATURE_MAX_HITS      (1024 * 1024)
+
+// Chunks are split into slices this big to scan them in parallel.
+#define SIGNATURE_SLICE_SIZE    (256 * 1024)
+
+// ColorMarker, black on green.
+#define SIGNATURE_COLOR         0x20
+
+// The cache file is a header, followed by these arrays in order.
+typedef struct _SIGNATURE_HEADER {
+    DWORD Magic;
+    DWORD Version;
+    ULONGLONG SourceSize;
+    ULONGLONG SourceTime;
+    DWORD StateCount;
+    DWORD EdgeCount;
+    DWORD OutputCount;
+    DWORD SignatureCount;
+    DWORD PatternSize;
+    DWORD NameSize;
+    DWORD MaxLength;
+    DWORD MaxAnchor;
+    DWORD Root[256];
+} SIGNATURE_HEADER, *PSIGNATURE_HEADER;
+
+typedef struct _SIGNATURE_STATE {
+    DWORD FirstEdge;
+    DWORD EdgeCount;
+    DWORD Fail;
+    DWORD Dictionary;       // The next state on the fail chain with outputs.
+    DWORD FirstOutput;
+    DWORD OutputCount;
+} SIGNATURE_STATE, *PSIGNATURE_STATE;
+
+typedef struct _SIGNATURE {
+    DWORD Pattern;          // The bytes, followed by the mask.
+    DWORD Length;
+    DWORD Anchor;
+    DWORD AnchorLength;
+    DWORD Name;
+} SIGNATURE, *PSIGNATURE;
+
+// The mapped cache.
+typedef struct _SIGNATURE_SET {
+    PSIGNATURE_HEADER Header;
+    PSIGNATURE_STATE States;
+    PDWORD EdgeNext;
+    PDWORD Outputs;
+    PSIGNATURE Signatures;
+    PBYTE EdgeBytes;
+    PBYTE Patterns;
+    PCHAR Names;
+} SIGNATURE_SET, *PSIGNATURE_SET;
+
+typedef struct _SIGNATURE_HIT {
+    HEM_QWORD Offset;
+    DWORD Signature;
+} SIGNATURE_HIT, *PSIGNATURE_HIT;
+
+typedef struct _TRIE_EDGE {
+    BYTE Byte;
+    DWORD Next;
+} TRIE_EDGE, *PTRIE_EDGE;
+
+// The trie before it's flattened.
+typedef struct _TRIE_NODE {
+    DWORD Child;
+    DWORD Sibling;
+    DWORD Output;           // A list of signatures, linked through the Next array.
+    DWORD Fail;
+    BYTE Byte;
+} TRIE_NODE, *PTRIE_NODE;
+
+typedef struct _SIGNATURE_SLICE {
+    DWORD Start;
+    DWORD End;
+    PSIGNATURE_HIT Hits;
+    DWORD Count;
+    DWORD Capacity;
+    BOOL Failed;
+} SIGNATURE_SLICE, *PSIGNATURE_SLICE;
+
+typedef struct _SIGNATURE_SCAN {
+    PSIGNATURE_SET Set;
+
+    // The current chunk, with enough of the previous one in front of it to
+    // check signatures that cross.
+    PBYTE Window;
+    DWORD WindowLength;
+    DWORD WindowCapacity;
+    HEM_QWORD WindowOffset;
+    HEM_QWORD End;
+
+    // Anchors near the end of the window, the rest of the signature is in
+    // the next chunk.
+    PSIGNATURE_HIT Pending;
+    DWORD PendingCount;
+
+    PSIGNATURE_SLICE Slices;
+    DWORD SliceCount;
+    DWORD SliceCapacity;
+
+    VLIST *Hits;
+    BOOL Full;
+} SIGNATURE_SCAN, *PSIGNATURE_SCAN;
+
+static CHAR SourceFile[MAX_PATH];
+static CHAR CacheFile[MAX_PATH];
+
+static HANDLE CacheHandle = INVALID_HANDLE_VALUE;
+static HANDLE CacheMapping;
+static SIGNATURE_SET Set;
+
+// The last scan, so the list can be shown again and the markers removed.
+static struct {
+    VLIST List;
+    DWORD OffsetWidth;
+    HEM_QWORD FileLength;
+} Hits;
+
+// Background scans use the mapped signatures, so they can't be replaced until
+// these have finished.
+static DWORD BackgroundScans;
+
+// A scan running on another thread, the matches are moved into Hits when
+// they're collected.
+typedef struct _SIGNATURE_BACKGROUND {
+    SIGNATURE_SCAN Scan;
+    VLIST Hits;
+    RESULT_KEY Key;
+} SIGNATURE_BACKGROUND, *PSIGNATURE_BACKGROUND;
+
+static VOID ClearHits(VOID);
+
+BOOL OpenSignatures(LPCSTR HemFile)
+{
+    return ReplaceExtension(SourceFile, sizeof SourceFile, HemFile, SIGNATURE_EXTENSION)
+        && ReplaceExtension(CacheFile, sizeof CacheFile, HemFile, SIGNATURE_CACHE);
+}
+
+static VOID UnmapSignatures(VOID)
+{
+    if (Set.Header)
+        UnmapViewOfFile(Set.Header);
+    if (CacheMapping)
+        CloseHandle(CacheMapping);
+    if (CacheHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(CacheHandle);
+
+    ZeroMemory(&Set, sizeof Set);
+
+    CacheHandle = INVALID_HANDLE_VALUE;
+    CacheMapping = NULL;
+}
+
+VOID CloseSignatures(VOID)
+{
+    UnmapSignatures();
+    FreeVirtualList(&Hits.List);
+}
+
+// Parses "name = pattern" into Name, and the pattern bytes followed by the
+// mask into Pattern. Returns the length, 0 for a blank line, or -1.
+static int ParseSignature(PCHAR Line, PCHAR Name, PBYTE Pattern)
+{
+    PBYTE Mask = Pattern + SIGNATURE_MAX_LENGTH;
+    PCHAR Equals;
+    DWORD Length = 0;
+    DWORD NameLength = 0;
+
+    while (isspace((BYTE) *Line))
+        Line++;
+
+    if (*Line == '\0' || *Line == '#')
+        return 0;
+
+    if ((Equals = strchr(Line, '=')) == NULL)
+        return -1;
+
+    // Hiew names can't have spaces or punctuation.
+    for (PCHAR p = Line; p < Equals && NameLength < SIGNATURE_MAX_NAME - 1; p++) {
+        if (isspace((BYTE) *p))
+            continue;
+
+        Name[NameLength++] = isalnum((BYTE) *p) ? *p : '_';
+    }
+
+    Name[NameLength] = '\0';
+
+    if (NameLength == 0)
+        return -1;
+
+    for (PCHAR p = Equals + 1; *p; ) {
+        if (isspace((BYTE) *p)) {
+            p++;
+            continue;
+        }
+
+        if (Length == SIGNATURE_MAX_LENGTH)
+            return -1;
+
+        if (*p == '"') {
+            for (p++; *p && *p != '"' && Length < SIGNATURE_MAX_LENGTH; p++) {
+                Pattern[Length] = *p;
+                Mask[Length++] = 0xFF;
+            }
+
+            if (*p++ != '"')
+                return -1;
+
+            continue;
+        }
+
+        if (p[0] == '?' && p[1] == '?') {
+            Pattern[Length] = 0;
+            Mask[Length++] = 0;
+            p += 2;
+            continue;
+        }
+
+        if (HexDigit(p[0]) < 0 || HexDigit(p[1]) < 0)
+            return -1;
+
+        Pattern[Length] = HexDigit(p[0]) << 4 | HexDigit(p[1]);
+        Mask[Length++] = 0xFF;
+        p += 2;
+    }
+
+    return Length;
+}
+
+#define TRIE(Buffer) ((PTRIE_NODE)(Buffer).Data)
+
+static DWORD FindChild(PTRIE_NODE Trie, DWORD Node, BYTE Byte)
+{
+    for (DWORD Child = Trie[Node].Child; Child; Child = Trie[Child].Sibling) {
+        if (Trie[Child].Byte == Byte)
+            return Child;
+    }
+
+    return 0;
+}
+
+static int __cdecl CompareEdges(const void *a, const void *b)
+{
+    return ((const TRIE_EDGE *) a)->Byte - ((const TRIE_EDGE *) b)->Byte;
+}
+
+// Turn the trie into the flat layout, in breadth first order so the states
+// near the root are together. Returns FALSE if there's no memory.
+static BOOL FlattenTrie(PBUFFER Trie,
+                        PDWORD Next,
+                        PSIGNATURE_HEADER Header,
+                        PBUFFER States,
+                        PBUFFER EdgeBytes,
+                        PBUFFER EdgeNext,
+                        PBUFFER Outputs)
+{
+    DWORD Count = Trie->Size / sizeof(TRIE_NODE);
+    PDWORD Order = malloc(Count * sizeof(DWORD));
+    PDWORD Number = malloc(Count * sizeof(DWORD));
+    PTRIE_NODE Nodes = TRIE(*Trie);
+    DWORD Head = 0;
+    DWORD Tail = 0;
+    BOOL Result = FALSE;
+
+    if (Order == NULL || Number == NULL)
+        goto finished;
+
+    // Number the nodes breadth first, and work out the fail links on the way.
+    Order[Tail++] = 0;
+    Number[0] = 0;
+
+    while (Head < Tail) {
+        DWORD Node = Order[Head++];
+
+        for (DWORD Child = Nodes[Node].Child; Child; Child = Nodes[Child].Sibling) {
+            DWORD Fail = Nodes[Node].Fail;
+
+            if (Node == 0) {
+                Nodes[Child].Fail = 0;
+            } else {
+                while (Fail && FindChild(Nodes, Fail, Nodes[Child].Byte) == 0)
+                    Fail = Nodes[Fail].Fail;
+
+                Nodes[Child].Fail = FindChild(Nodes, Fail, Nodes[Child].Byte);
+            }
+
+            Number[Child] = Tail;
+            Order[Tail++] = Child;
+        }
+    }
+
+    for (DWORD i = 0; i < Count; i++) {
+        PTRIE_NODE Node = &Nodes[Order[i]];
+        SIGNATURE_STATE State = {0};
+        TRIE_EDGE Edges[256];
+        DWORD EdgeCount = 0;
+
+        State.FirstEdge = EdgeNext->Size / sizeof(DWORD);
+        State.Fail = Number[Node->Fail];
+        State.FirstOutput = Outputs->Size / sizeof(DWORD);
+
+        for (DWORD Child = Node->Child; Child; Child = Nodes[Child].Sibling) {
+            Edges[EdgeCount].Byte = Nodes[Child].Byte;
+            Edges[EdgeCount].Next = Number[Child];
+            EdgeCount++;
+        }
+
+        // Sorted, so a search can stop early.
+        qsort(Edges, EdgeCount, sizeof *Edges, CompareEdges);
+
+        for (DWORD e = 0; e < EdgeCount; e++) {
+            if (!AppendBuffer(EdgeBytes, &Edges[e].Byte, sizeof(BYTE))
+             || !AppendBuffer(EdgeNext, &Edges[e].Next, sizeof(DWORD))) {
+                goto finished;
+            }
+
+            if (i == 0)
+                Header->Root[Edges[e].Byte] = Edges[e].Next;
+        }
+
+        for (DWORD Output = Node->Output; Output; Output = Next[Output - 1]) {
+            DWORD Signature = Output - 1;
+
+            if (!AppendBuffer(Outputs, &Signature, sizeof Signature))
+                goto finished;
+
+            State.OutputCount++;
+        }
+
+        State.EdgeCount = EdgeCount;
+
+        if (!AppendBuffer(States, &State, sizeof State))
+            goto finished;
+    }
+
+    // Now every state is numbered, follow the fail links to the nearest state
+    // with outputs. The order is breadth first, so the fail state is done.
+    for (DWORD i = 1; i < Count; i++) {
+        PSIGNATURE_STATE State = (PSIGNATURE_STATE) States->Data + i;
+        PSIGNATURE_STATE Fail = (PSIGNATURE_STATE) States->Data + State->Fail;
+
+        State->Dictionary = Fail->OutputCount ? State->Fail : Fail->Dictionary;
+    }
+
+    Result = TRUE;
+
+finished:
+    free(Order);
+    free(Number);
+    return Result;
+}
+
+static BOOL WriteCache(PSIGNATURE_HEADER Header, PBUFFER *Sections, DWORD Count)
+{
+    HANDLE File;
+    DWORD Written;
+    BOOL Result = TRUE;
+
+    File = CreateFile(CacheFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (File == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    Result = WriteFile(File, Header, sizeof *Header, &Written, NULL) && Written == sizeof *Header;
+
+    for (DWORD i = 0; Result && i < Count; i++) {
+        Result = WriteFile(File, Sections[i]->Data, Sections[i]->Size, &Written, NULL)
+              && Written == Sections[i]->Size;
+    }
+
+    CloseHandle(File);
+
+    if (!Result)
+        DeleteFile(CacheFile);
+
+    return Result;
+}
+
+// Compile the text signatures into the cache file. Returns FALSE with a
+// reason in Message.
+static BOOL CompileSignatures(PWIN32_FILE_ATTRIBUTE_DATA Source, PCHAR Message, SIZE_T MaxLen)
+{
+    BUFFER Trie = {0}, Next = {0}, Signatures = {0}, Patterns = {0}, Names = {0};
+    BUFFER States = {0}, EdgeBytes = {0}, EdgeNext = {0}, Outputs = {0};
+    PBUFFER Sections[] = { &States, &EdgeNext, &Outputs, &Signatures, &EdgeBytes, &Patterns, &Names };
+    SIGNATURE_HEADER Header = {0};
+    BYTE Pattern[SIGNATURE_MAX_LENGTH * 2];
+    CHAR Name[SIGNATURE_MAX_NAME];
+    CHAR Line[1024];
+    DWORD LineNumber = 0;
+    BOOL Result = FALSE;
+    FILE *Text;
+
+    if ((Text = fopen(SourceFile, "r")) == NULL) {
+        snprintf(Message, MaxLen, "Put your signatures in %s.", SourceFile);
+        return FALSE;
+    }
+
+    // The root.
+    if (!AppendBuffer(&Trie, NULL, sizeof(TRIE_NODE)))
+        goto nomemory;
+
+    while (fgets(Line, sizeof Line, Text)) {
+        SIGNATURE Signature = {0};
+        DWORD Node = 0;
+        int Length;
+
+        LineNumber++;
+
+        if ((Length = ParseSignature(Line, Name, Pattern)) == 0)
+            continue;
+
+        if (Length < 0) {
+            snprintf(Message, MaxLen, "Line %u of %s isn't a valid signature.", LineNumber, SourceFile);
+            goto finished;
+        }
+
+        // Find the longest run without wildcards.
+        for (DWORD i = 0, Run = 0; i < (DWORD) Length; i++) {
+            Run = Pattern[SIGNATURE_MAX_LENGTH + i] ? Run + 1 : 0;
+
+            if (Run > Signature.AnchorLength) {
+                Signature.AnchorLength = Run;
+                Signature.Anchor = i + 1 - Run;
+            }
+        }
+
+        if (Signature.AnchorLength == 0) {
+            snprintf(Message, MaxLen, "Line %u of %s is only wildcards.", LineNumber, SourceFile);
+            goto finished;
+        }
+
+        Signature.Length = Length;
+        Signature.Pattern = Patterns.Size;
+        Signature.Name = Names.Size;
+
+        if (!AppendBuffer(&Patterns, Pattern, Length)
+         || !AppendBuffer(&Patterns, Pattern + SIGNATURE_MAX_LENGTH, Length)
+         || !AppendBuffer(&Names, Name, strlen(Name) + 1)
+         || !AppendBuffer(&Signatures, &Signature, sizeof Signature)) {
+            goto nomemory;
+        }
+
+        // Add the anchor to the trie.
+        for (DWORD i = 0; i < Signature.AnchorLength; i++) {
+            BYTE Byte = Pattern[Signature.Anchor + i];
+            DWORD Child = FindChild(TRIE(Trie), Node, Byte);
+
+            if (Child == 0) {
+                PTRIE_NODE New;
+
+                Child = Trie.Size / sizeof(TRIE_NODE);
+
+                if ((New = AppendBuffer(&Trie, NULL, sizeof(TRIE_NODE))) == NULL)
+                    goto nomemory;
+
+                New->Byte = Byte;
+                New->Sibling = TRIE(Trie)[Node].Child;
+                TRIE(Trie)[Node].Child = Child;
+            }
+
+            Node = Child;
+        }
+
+        // Several signatures can share an anchor.
+        if (!AppendBuffer(&Next, &TRIE(Trie)[Node].Output, sizeof(DWORD)))
+            goto nomemory;
+
+        TRIE(Trie)[Node].Output = Header.SignatureCount + 1;
+
+        Header.SignatureCount++;
+        Header.MaxLength = max(Header.MaxLength, Signature.Length);
+        Header.MaxAnchor = max(Header.MaxAnchor, Signature.AnchorLength);
+    }
+
+    if (Header.SignatureCount == 0) {
+        snprintf(Message, MaxLen, "There are no signatures in %s.", SourceFile);
+        goto finished;
+    }
+
+    if (!FlattenTrie(&Trie, (PDWORD) Next.Data, &Header, &States, &EdgeBytes, &EdgeNext, &Outputs))
+        goto nomemory;
+
+    Header.Magic = SIGNATURE_MAGIC;
+    Header.Version = SIGNATURE_VERSION;
+    Header.SourceSize = (ULONGLONG) Source->nFileSizeHigh << 32 | Source->nFileSizeLow;
+    Header.SourceTime = (ULONGLONG) Source->ftLastWriteTime.dwHighDateTime << 32 | Source->ftLastWriteTime.dwLowDateTime;
+    Header.StateCount = States.Size / sizeof(SIGNATURE_STATE);
+    Header.EdgeCount = EdgeBytes.Size;
+    Header.OutputCount = Outputs.Size / sizeof(DWORD);
+    Header.PatternSize = Patterns.Size;
+    Header.NameSize = Names.Size;
+
+    if (!WriteCache(&Header, Sections, _countof(Sections))) {
+        snprintf(Message, MaxLen, "Failed to write %s.", CacheFile);
+        goto finished;
+    }
+
+    Result = TRUE;
+    goto finished;
+
+nomemory:
+    snprintf(Message, MaxLen, "Not enough memory to compile the signatures.");
+
+finished:
+    fclose(Text);
+
+    free(Trie.Data);
+    free(Next.Data);
+
+    for (DWORD i = 0; i < _countof(Sections); i++) {
+        free(Sections[i]->Data);
+    }
+
+    return Result;
+}
+
+// Map the cache, checking that it matches the text file and isn't damaged.
+static BOOL MapSignatures(PWIN32_FILE_ATTRIBUTE_DATA Source)
+{
+    LARGE_INTEGER Size;
+    PSIGNATURE_HEADER Header;
+    ULONGLONG Expected;
+
+    CacheHandle = CreateFile(CacheFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (CacheHandle == INVALID_HANDLE_VALUE || !GetFileSizeEx(CacheHandle, &Size) || Size.QuadPart < sizeof *Header)
+        goto error;
+
+    if ((CacheMapping = CreateFileMapping(CacheHandle, NULL, PAGE_READONLY, 0, 0, NULL)) == NULL)
+        goto error;
+
+    if ((Header = MapViewOfFile(CacheMapping, FILE_MAP_READ, 0, 0, 0)) == NULL)
+        goto error;
+
+    Set.Header = Header;
+
+    if (Header->Magic != SIGNATURE_MAGIC
+     || Header->Version != SIGNATURE_VERSION
+     || Header->SourceSize != ((ULONGLONG) Source->nFileSizeHigh << 32 | Source->nFileSizeLow)
+     || Header->SourceTime != ((ULONGLONG) Source->ftLastWriteTime.dwHighDateTime << 32 | Source->ftLastWriteTime.dwLowDateTime)) {
+        goto error;
+    }
+
+    Expected = sizeof *Header
+             + (ULONGLONG) Header->StateCount * sizeof(SIGNATURE_STATE)
+             + (ULONGLONG) Header->EdgeCount * sizeof(DWORD)
+             + (ULONGLONG) Header->OutputCount * sizeof(DWORD)
+             + (ULONGLONG) Header->SignatureCount * sizeof(SIGNATURE)
+             + Header->EdgeCount
+             + Header->PatternSize
+             + Header->NameSize;
+
+    if (Expected != (ULONGLONG) Size.QuadPart)
+        goto error;
+
+    Set.States = (PSIGNATURE_STATE)(Header + 1);
+    Set.EdgeNext = (PDWORD)(Set.States + Header->StateCount);
+    Set.Outputs = Set.EdgeNext + Header->EdgeCount;
+    Set.Signatures = (PSIGNATURE)(Set.Outputs + Header->OutputCount);
+    Set.EdgeBytes = (PBYTE)(Set.Signatures + Header->SignatureCount);
+    Set.Patterns = Set.EdgeBytes + Header->EdgeCount;
+    Set.Names = (PCHAR)(Set.Patterns + Header->PatternSize);
+
+    return TRUE;
+
+error:
+    UnmapSignatures();
+    return FALSE;
+}
+
+static BOOL LoadSignatures(PCHAR Message, SIZE_T MaxLen)
+{
+    WIN32_FILE_ATTRIBUTE_DATA Source;
+
+    if (!GetFileAttributesEx(SourceFile, GetFileExInfoStandard, &Source)) {
+        snprintf(Message, MaxLen, "Put your signatures in %s.", SourceFile);
+        return FALSE;
+    }
+
+    // Already mapped, but maybe the text has changed.
+    if (Set.Header) {
+        if (Set.Header->SourceSize == ((ULONGLONG) Source.nFileSizeHigh << 32 | Source.nFileSizeLow)
+         && Set.Header->SourceTime == ((ULONGLONG) Source.ftLastWriteTime.dwHighDateTime << 32 | Source.ftLastWriteTime.dwLowDateTime)) {
+            return TRUE;
+        }
+
+        // Keep using the old ones until the background scans are done.
+        if (BackgroundScans)
+            return TRUE;
+
+        // The old matches refer to the old signatures.
+        ClearHits();
+        UnmapSignatures();
+    }
+
+    if (MapSignatures(&Source))
+        return TRUE;
+
+    HiewGate_MessageWaitOpen("Compiling signatures...");
+
+    if (!CompileSignatures(&Source, Message, MaxLen)) {
+        HiewGate_MessageWaitClose();
+        return FALSE;
+    }
+
+    HiewGate_MessageWaitClose();
+
+    if (!MapSignatures(&Source)) {
+        snprintf(Message, MaxLen, "Failed to read %s.", CacheFile);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static DWORD NextState(PSIGNATURE_SET Set, DWORD State, BYTE Byte)
+{
+    while (State) {
+        PSIGNATURE_STATE Current = &Set->States[State];
+        const BYTE *Bytes = Set->EdgeBytes + Current->FirstEdge;
+
+        for (DWORD i = 0; i < Current->EdgeCount && Bytes[i] <= Byte; i++) {
+            if (Bytes[i] == Byte)
+                return Set->EdgeNext[Current->FirstEdge + i];
+        }
+
+        State = Current->Fail;
+    }
+
+    return Set->Header->Root[Byte];
+}
+
+static BOOL AddHit(PSIGNATURE_SLICE Slice, HEM_QWORD Offset, DWORD Signature)
+{
+    if (Slice->Count == Slice->Capacity) {
+        DWORD Capacity = max(Slice->Capacity * 2, 256);
+        PSIGNATURE_HIT Grown = realloc(Slice->Hits, Capacity * sizeof *Grown);
+
+        if (Grown == NULL) {
+            Slice->Failed = TRUE;
+            return FALSE;
+        }
+
+        Slice->Hits = Grown;
+        Slice->Capacity = Capacity;
+    }
+
+    Slice->Hits[Slice->Count].Offset = Offset;
+    Slice->Hits[Slice->Count].Signature = Signature;
+    Slice->Count++;
+    return TRUE;
+}
+
+// Check the whole signature, not just the anchor. Start is relative to the
+// window, and might be negative at the start of the file.
+static BOOL MatchSignature(PSIGNATURE_SCAN Scan, PSIGNATURE Signature, LONGLONG Start)
+{
+    const BYTE *Pattern = Scan->Set->Patterns + Signature->Pattern;
+    const BYTE *Mask = Pattern + Signature->Length;
+    const BYTE *Data = Scan->Window + Start;
+
+    if (Start < 0)
+        return FALSE;
+
+    for (DWORD i = 0; i < Signature->Length; i++) {
+        if ((Data[i] ^ Pattern[i]) & Mask[i])
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static VOID ScanSlice(PVOID Context, DWORD Index)
+{
+    PSIGNATURE_SCAN Scan = Context;
+    PSIGNATURE_SET Set = Scan->Set;
+    PSIGNATURE_SLICE Slice = &Scan->Slices[Index];
+    BOOL Last = Scan->WindowOffset + Scan->WindowLength >= Scan->End;
+    DWORD Position = Slice->Start;
+    DWORD State = 0;
+
+    // Start a little early, so anchors that cross into this slice are found.
+    Position -= min(Position, Set->Header->MaxAnchor - 1);
+
+    for (; Position < Slice->End; Position++) {
+        DWORD Match;
+
+        State = NextState(Set, State, Scan->Window[Position]);
+
+        if (Position < Slice->Start)
+            continue;
+
+        Match = Set->States[State].OutputCount ? State : Set->States[State].Dictionary;
+
+        for (; Match; Match = Set->States[Match].Dictionary) {
+            PSIGNATURE_STATE Output = &Set->States[Match];
+
+            for (DWORD i = 0; i < Output->OutputCount; i++) {
+                DWORD Number = Set->Outputs[Output->FirstOutput + i];
+                PSIGNATURE Signature = &Set->Signatures[Number];
+                LONGLONG Start = (LONGLONG) Position + 1 - Signature->AnchorLength - Signature->Anchor;
+
+                // It continues into the next chunk, check it then.
+                if (Start + Signature->Length > Scan->WindowLength) {
+                    if (!Last)
+                        AddHit(Slice, Scan->WindowOffset + Start, Number | 0x80000000);
+                    continue;
+                }
+
+                if (MatchSignature(Scan, Signature, Start))
+                    AddHit(Slice, Scan->WindowOffset + Start, Number);
+            }
+        }
+    }
+}
+
+static BOOL AppendHit(PSIGNATURE_SCAN Scan, PSIGNATURE_HIT Hit)
+{
+    PSIGNATURE_HIT Record;
+
+    if (Scan->Hits->Count >= SIGNATURE_MAX_HITS || (Record = AppendVirtualList(Scan->Hits)) == NULL) {
+        Scan->Full = TRUE;
+        return FALSE;
+    }
+
+    *Record = *Hit;
+    return TRUE;
+}
+
+static BOOL ScanChunk(PVOID Context, HEM_QWORD Offset, const BYTE *Data, DWORD Length)
+{
+    PSIGNATURE_SCAN Scan = Context;
+    DWORD Keep = min(Scan->WindowLength, Scan->Set->Header->MaxLength);
+    PSIGNATURE_HIT Pending = NULL;
+    DWORD PendingCount = 0;
+
+    if (Keep + Length > Scan->WindowCapacity) {
+        PBYTE Window = realloc(Scan->Window, Keep + Length);
+
+        if (Window == NULL)
+            return FALSE;
+
+        Scan->Window = Window;
+        Scan->WindowCapacity = Keep + Length;
+    }
+
+    // Keep the end of the last chunk, signatures that cross it are checked
+    // here.
+    memmove(Scan->Window, Scan->Window + Scan->WindowLength - Keep, Keep);
+    memcpy(Scan->Window + Keep, Data, Length);
+
+    Scan->WindowOffset = Offset - Keep;
+    Scan->WindowLength = Keep + Length;
+
+    for (DWORD i = 0; i < Scan->PendingCount; i++) {
+        PSIGNATURE_HIT Hit = &Scan->Pending[i];
+        PSIGNATURE Signature = &Scan->Set->Signatures[Hit->Signature & 0x7FFFFFFF];
+        LONGLONG Start = Hit->Offset - Scan->WindowOffset;
+
+        if (Start + Signature->Length <= Scan->WindowLength && MatchSignature(Scan, Signature, Start)) {
+            Hit->Signature &= 0x7FFFFFFF;
+
+            if (!AppendHit(Scan, Hit))
+                return FALSE;
+        }
+    }
+
+    free(Scan->Pending);
+
+    Scan->Pending = NULL;
+    Scan->PendingCount = 0;
+
+    // Split the new data into slices.
+    Scan->SliceCount = (Length + SIGNATURE_SLICE_SIZE - 1) / SIGNATURE_SLICE_SIZE;
+
+    if (Scan->SliceCount > Scan->SliceCapacity) {
+        PSIGNATURE_SLICE Slices = realloc(Scan->Slices, Scan->SliceCount * sizeof *Slices);
+
+        if (Slices == NULL)
+            return FALSE;
+
+        ZeroMemory(Slices + Scan->SliceCapacity, (Scan->SliceCount - Scan->SliceCapacity) * sizeof *Slices);
+
+        Scan->Slices = Slices;
+        Scan->SliceCapacity = Scan->SliceCount;
+    }
+
+    for (DWORD i = 0; i < Scan->SliceCount; i++) {
+        PSIGNATURE_SLICE Slice = &Scan->Slices[i];
+
+        Slice->Start = Keep + i * SIGNATURE_SLICE_SIZE;
+        Slice->End = min(Slice->Start + SIGNATURE_SLICE_SIZE, Scan->WindowLength);
+        Slice->Count = 0;
+        Slice->Failed = FALSE;
+    }
+
+    ParallelFor(Scan->SliceCount, ScanSlice, Scan);
+
+    for (DWORD i = 0; i < Scan->SliceCount; i++) {
+        PSIGNATURE_SLICE Slice = &Scan->Slices[i];
+
+        if (Slice->Failed) {
+            Scan->Full = TRUE;
+            return FALSE;
+        }
+
+        for (DWORD j = 0; j < Slice->Count; j++) {
+            if (Slice->Hits[j].Signature & 0x80000000) {
+                PSIGNATURE_HIT Grown = realloc(Pending, (PendingCount + 1) * sizeof *Pending);
+
+                if (Grown == NULL)
+                    return FALSE;
+
+                Pending = Grown;
+                Pending[PendingCount++] = Slice->Hits[j];
+                continue;
+            }
+
+            if (!AppendHit(Scan, &Slice->Hits[j]))
+                return FALSE;
+        }
+    }
+
+    Scan->Pending = Pending;
+    Scan->PendingCount = PendingCount;
+    return TRUE;
+}
+
+static VOID FreeScan(PSIGNATURE_SCAN Scan)
+{
+    for (DWORD i = 0; i < Scan->SliceCapacity; i++) {
+        free(Scan->Slices[i].Hits);
+    }
+
+    free(Scan->Slices);
+    free(Scan->Window);
+    free(Scan->Pending);
+
+    Scan->Slices = NULL;
+    Scan->SliceCapacity = 0;
+    Scan->Window = NULL;
+    Scan->Pending = NULL;
+}
+
+// Saved matches are only good for the same signatures.
+static ULONGLONG SignatureParameter(VOID)
+{
+    return Xxh64(&Set.Header->SourceSize, 2 * sizeof(ULONGLONG), 0);
+}
+
+static int __cdecl CompareHits(const void *a, const void *b)
+{
+    const SIGNATURE_HIT *x = a;
+    const SIGNATURE_HIT *y = b;
+
+    if (x->Offset != y->Offset)
+        return x->Offset < y->Offset ? -1 : 1;
+
+    return x->Signature < y->Signature ? -1 : x->Signature > y->Signature;
+}
+
+static VOID MarkHits(VOID)
+{
+    for (DWORD i = 0; i < Hits.List.Count; i++) {
+        PSIGNATURE_HIT Hit = GetVirtualListRecord(&Hits.List, i);
+
+        HiewGate_ColorMarker(Hit->Offset, Set.Signatures[Hit->Signature].Length, SIGNATURE_COLOR);
+    }
+}
+
+// This doesn't need the signatures, so it works after they change.
+static VOID ClearHits(VOID)
+{
+    for (DWORD i = 0; i < Hits.List.Count; i++) {
+        PSIGNATURE_HIT Hit = GetVirtualListRecord(&Hits.List, i);
+
+        if (Hit->Offset < Hits.FileLength)
+            HiewGate_ColorMarker(Hit->Offset, 0, SIGNATURE_COLOR);
+    }
+
+    FreeVirtualList(&Hits.List);
+}
+
+// Names have to be unique, so later hits get a number.
+static VOID NameHits(VOID)
+{
+    PDWORD Counts = calloc(Set.Header->SignatureCount, sizeof(DWORD));
+    CHAR Name[SIGNATURE_MAX_NAME + 16];
+
+    if (Counts == NULL)
+        return;
+
+    for (DWORD i = 0; i < Hits.List.Count; i++) {
+        PSIGNATURE_HIT Hit = GetVirtualListRecord(&Hits.List, i);
+        PCHAR Base = Set.Names + Set.Signatures[Hit->Signature].Name;
+
+        if (Counts[Hit->Signature]++ == 0) {
+            snprintf(Name, sizeof Name, "%s", Base);
+        } else {
+            snprintf(Name, sizeof Name, "%s_%u", Base, Counts[Hit->Signature]);
+        }
+
+        HiewGate_Names_AddLocal(Hit->Offset, Name);
+    }
+
+    free(Counts);
+}
+
+// Get the matches from a previous scan of the same range with the same
+// signatures.
+static BOOL LoadHits(PRESULT_KEY Key)
+{
+    const SIGNATURE_HIT *Saved;
+    SIZE_T Size;
+
+    if ((Saved = FindCachedResult(Key, &Size)) == NULL || Size % sizeof(SIGNATURE_HIT))
+        return FALSE;
+
+    if (!ResizeVirtualList(&Hits.List, Size / sizeof(SIGNATURE_HIT)))
+        return FALSE;
+
+    CopyMemory(GetVirtualListRecord(&Hits.List, 0), Saved, Size);
+
+    for (DWORD i = 0; i < Hits.List.Count; i++) {
+        PSIGNATURE_HIT Hit = GetVirtualListRecord(&Hits.List, i);
+
+        if (Hit->Signature >= Set.Header->SignatureCount) {
+            FreeVirtualList(&Hits.List);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static VOID FormatHit(PVOID Context, DWORD Index, const VOID *Record, PCHAR Buffer, SIZE_T Size)
+{
+    const SIGNATURE_HIT *Hit = Record;
+    PSIGNATURE Signature = &Set.Signatures[Hit->Signature];
+
+    snprintf(Buffer,
+             Size,
+             "%0*llX  %-32s %3u bytes",
+             Hits.OffsetWidth,
+             Hit->Offset,
+             Set.Names + Signature->Name,
+             Signature->Length);
+}
+
+static VOID ShowHits(HEMCALL_TAG *HemCall, PCHAR Title)
+{
+    LONG Selected;
+
+    Selected = ShowVirtualList(&Hits.List, Title, Hits.OffsetWidth + 2 + 32 + 10, 0);
+
+    if (Selected >= 0) {
+        PSIGNATURE_HIT Hit = GetVirtualListRecord(&Hits.List, Selected);
+
+        HemCall->returnOffset = Hit->Offset;
+        HemCall->returnActionFlag |= HEM_RETURN_SETOFFSET;
+    }
+}
+
+// This runs on the job's thread, so it can't touch Hits.
+static LPCSTR FinishBackgroundScan(PVOID Context, BOOL Complete)
+{
+    PSIGNATURE_BACKGROUND Background = Context;
+
+    FreeScan(&Background->Scan);
+
+    // If there were too many, I can still show some.
+    if (!Complete && !Background->Scan.Full)
+        return "Not enough memory.";
+
+    if (Background->Hits.Count) {
+        qsort(GetVirtualListRecord(&Background->Hits, 0),
+              Background->Hits.Count,
+              sizeof(SIGNATURE_HIT),
+              CompareHits);
+    }
+
+    return NULL;
+}
+
+static LPCSTR CollectBackgroundScan(PVOID Context, HEMCALL_TAG *HemCall)
+{
+    PSIGNATURE_BACKGROUND Background = Context;
+    HIEWGATE_GETDATA HiewData;
+    RESULT_PART Part;
+
+    if (Background->Key.Parameter != SignatureParameter())
+        return "The signatures changed.";
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return "Hiew didn't say which file is open.";
+
+    ClearHits();
+
+    Hits.List = Background->Hits;
+    Hits.OffsetWidth = HiewData.filelength > 0xFFFFFFFF ? 16 : 8;
+    Hits.FileLength = HiewData.filelength;
+
+    InitVirtualList(&Background->Hits, sizeof(SIGNATURE_HIT), FormatHit, NULL);
+
+    NameHits();
+    MarkHits();
+
+    if (!Background->Scan.Full) {
+        Part.Data = GetVirtualListRecord(&Hits.List, 0);
+        Part.Size = (SIZE_T) Hits.List.Count * sizeof(SIGNATURE_HIT);
+
+        SaveCachedResult(&Background->Key, &Part, 1);
+    }
+
+    return NULL;
+}
+
+static VOID FreeBackgroundScan(PVOID Context)
+{
+    PSIGNATURE_BACKGROUND Background = Context;
+
+    FreeScan(&Background->Scan);
+    FreeVirtualList(&Background->Hits);
+    free(Background);
+
+    BackgroundScans--;
+}
+
+static VOID StartBackgroundScan(HEMCALL_TAG *HemCall, PRESULT_KEY Key)
+{
+    BACKGROUND_TASK Task = { "Signatures" };
+    PSIGNATURE_BACKGROUND Background;
+    CHAR Message[128];
+
+    if ((Background = calloc(1, sizeof *Background)) == NULL) {
+        HiewGate_Message("Signatures", "Not enough memory.");
+        return;
+    }
+
+    InitVirtualList(&Background->Hits, sizeof(SIGNATURE_HIT), FormatHit, NULL);
+
+    Background->Key = *Key;
+    Background->Scan.Set = &Set;
+    Background->Scan.End = Key->Offset + Key->Length;
+    Background->Scan.Hits = &Background->Hits;
+
+    Task.Consumers[0].Routine = ScanChunk;
+    Task.Consumers[0].Context = &Background->Scan;
+    Task.Count = 1;
+    Task.Finish = FinishBackgroundScan;
+    Task.Collect = CollectBackgroundScan;
+    Task.Free = FreeBackgroundScan;
+    Task.Context = Background;
+
+    BackgroundScans++;
+
+    if (StartBackgroundJob(&Task, HemCall, Key->Offset, Key->Length, Message, sizeof Message)) {
+        snprintf(Message,
+                 sizeof Message,
+                 "The scan is running in the background, the matches are applied the next time you use this plugin.");
+    }
+
+    HiewGate_Message("Signatures", Message);
+}
+
+int SignatureEntryPoint(HEMCALL_TAG *HemCall)
+{
+    static PCHAR Actions[] = {
+        "Scan now",
+        "Scan in the background",
+        "Show matches",
+        "Clear highlighting",
+    };
+    SIGNATURE_SCAN Scan = {0};
+    HIEWGATE_GETDATA HiewData;
+    STREAM_CONSUMER Consumer;
+    JOB Job;
+    RESULT_KEY Key = { RESULT_SIGNATURES };
+    RESULT_PART Part;
+    HEM_QWORD Offset;
+    HEM_QWORD Length;
+    CHAR Message[MAX_PATH + 128];
+    SIZE_T Size;
+    BOOL Loaded;
+    int Choice;
+    int Result;
+
+    // The list refers to the signatures, so they have to be loaded first.
+    if (!LoadSignatures(Message, sizeof Message)) {
+        ClearHits();
+        HiewGate_Message("Signatures", Message);
+        return HEM_OK;
+    }
+
+    // The last two only make sense if there's something to show.
+    Choice = HiewGate_Menu("Signatures", Actions, Hits.List.Count ? 4 : 2, 26, 1, NULL, NULL, NULL, NULL);
+
+    switch (Choice) {
+        case 1:
+        case 2:
+            break;
+        case 3:
+            snprintf(Message, sizeof Message, "%u signature matches", Hits.List.Count);
+            ShowHits(HemCall, Message);
+            return HEM_OK;
+        case 4:
+            ClearHits();
+            return HEM_OK;
+        default:
+            return HEM_OK;
+    }
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return HEM_ERROR;
+
+    GetMarkedRange(&HiewData, &Offset, &Length);
+
+    Key.Offset = Offset;
+    Key.Length = Length;
+    Key.Parameter = SignatureParameter();
+
+    // No point scanning in the background if it's been done before.
+    if (Choice == 2 && FindCachedResult(&Key, &Size) == NULL) {
+        StartBackgroundScan(HemCall, &Key);
+        return HEM_OK;
+    }
+
+    ClearHits();
+    InitVirtualList(&Hits.List, sizeof(SIGNATURE_HIT), FormatHit, NULL);
+
+    Hits.OffsetWidth = HiewData.filelength > 0xFFFFFFFF ? 16 : 8;
+    Hits.FileLength = HiewData.filelength;
+
+    Loaded = LoadHits(&Key);
+
+    if (Loaded) {
+        NameHits();
+        MarkHits();
+        goto finished;
+    }
+
+    Scan.Set = &Set;
+    Scan.End = Offset + Length;
+    Scan.Hits = &Hits.List;
+
+    Consumer.Routine = ScanChunk;
+    Consumer.Context = &Scan;
+
+    BeginJob(&Job, "Scanning for signatures", Length);
+
+    Result = StreamFileRange(&Job, Offset, Length, &Consumer, 1);
+
+    // If there were too many, I can still show some.
+    if (Result == HEM_ERROR && Scan.Full)
+        Result = HEM_OK;
+
+    if (Result == HEM_OK && Hits.List.Count) {
+        qsort(GetVirtualListRecord(&Hits.List, 0), Hits.List.Count, sizeof(SIGNATURE_HIT), CompareHits);
+
+        NameHits();
+        MarkHits();
+    }
+
+    // Only complete results are worth keeping, nothing matching is a result.
+    if (Result == HEM_OK && !Scan.Full) {
+        Part.Data = GetVirtualListRecord(&Hits.List, 0);
+        Part.Size = (SIZE_T) Hits.List.Count * sizeof(SIGNATURE_HIT);
+
+        SaveCachedResult(&Key, &Part, 1);
+    }
+
+    EndJob(&Job);
+    FreeScan(&Scan);
+
+    if (Result != HEM_OK) {
+        ClearHits();
+        HiewGate_Message("Signatures", Result == HEM_KEYBREAK ? "Cancelled." : "Hiew failed to read the file.");
+        return HEM_OK;
+    }
+
+finished:
+    if (Hits.List.Count == 0) {
+        HiewGate_Message("Signatures", "Nothing matched.");
+        return HEM_OK;
+    }
+
+    if (Loaded) {
+        snprintf(Message,
+                 sizeof Message,
+                 "%u matches of %u signatures, saved from last time",
+                 Hits.List.Count,
+                 Set.Header->SignatureCount);
+    } else {
+        snprintf(Message,
+                 sizeof Message,
+                 "%u matches of %u signatures%s (%llu ms)",
+                 Hits.List.Count,
+                 Set.Header->SignatureCount,
+                 Scan.Full ? ", some are missing" : "",
+                 Job.Elapsed);
+    }
+
+    ShowHits(HemCall, Message);
+    return HEM_OK;
+}
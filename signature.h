@@ -0,0 +1,15 @@
+#ifndef __SIGNATURE_H
+#define __SIGNATURE_H
+
+// Remembers where the signature file is, it lives next to the hem. Nothing
+// is loaded until the first scan.
+BOOL OpenSignatures(LPCSTR HemFile);
+
+// Unmaps the compiled signatures and forgets the last scan.
+VOID CloseSignatures(VOID);
+
+// Scans the marked block (or the whole file) for every signature, matches
+// are named, highlighted and listed.
+int SignatureEntryPoint(HEMCALL_TAG *HemCall);
+
+#endif
@@ -0,0 +1,209 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "stream.h"
+
+// Scanning large ranges is bound by how fast Hiew can read, so I read the
+// next chunk on the main thread (the HiewGate isn't thread safe) while the
+// consumers work on the current one. Each consumer has its own work object,
+// so independent consumers (e.g. different digests) use different cores.
+
+// How much to read with each gate call, there are two of these.
+#define STREAM_CHUNK_SIZE (2 * 1024 * 1024)
+
+typedef struct _STREAM STREAM, *PSTREAM;
+
+typedef struct _STREAM_WORKER {
+    PTP_WORK Work;
+    PSTREAM_CONSUMER Consumer;
+    PSTREAM Stream;
+    BOOL Result;
+} STREAM_WORKER, *PSTREAM_WORKER;
+
+typedef struct _PARALLEL_FOR {
+    PPARALLEL_ROUTINE Routine;
+    PVOID Context;
+    DWORD Count;
+    volatile LONG Next;
+} PARALLEL_FOR, *PPARALLEL_FOR;
+
+struct _STREAM {
+    HEM_QWORD Offset;
+    const BYTE *Data;
+    DWORD Length;
+};
+
+static VOID CALLBACK StreamWorkCallback(PTP_CALLBACK_INSTANCE Instance,
+                                        PVOID Context,
+                                        PTP_WORK Work)
+{
+    PSTREAM_WORKER Worker = Context;
+    PSTREAM Stream = Worker->Stream;
+
+    if (Worker->Result) {
+        Worker->Result = Worker->Consumer->Routine(Worker->Consumer->Context,
+                                                   Stream->Offset,
+                                                   Stream->Data,
+                                                   Stream->Length);
+    }
+}
+
+int StreamFileRange(PJOB Job,
+                    HEM_QWORD Offset,
+                    HEM_QWORD Length,
+                    PSTREAM_CONSUMER Consumers,
+                    DWORD Count)
+{
+    PSTREAM_WORKER Workers;
+    PBYTE Buffers[2] = {0};
+    STREAM Stream = {0};
+    ULONGLONG Done = 0;
+    DWORD Current = 0;
+    DWORD ReadSize;
+    int Result = HEM_ERROR;
+
+    if ((Workers = calloc(Count, sizeof *Workers)) == NULL)
+        return HEM_ERROR;
+
+    for (DWORD i = 0; i < _countof(Buffers); i++) {
+        Buffers[i] = VirtualAlloc(NULL, STREAM_CHUNK_SIZE, MEM_COMMIT, PAGE_READWRITE);
+
+        if (Buffers[i] == NULL)
+            goto finished;
+    }
+
+    for (DWORD i = 0; i < Count; i++) {
+        Workers[i].Consumer = &Consumers[i];
+        Workers[i].Stream = &Stream;
+        Workers[i].Result = TRUE;
+        Workers[i].Work = CreateThreadpoolWork(StreamWorkCallback, &Workers[i], NULL);
+
+        if (Workers[i].Work == NULL)
+            goto finished;
+    }
+
+    // Read the first chunk.
+    ReadSize = min(Length, STREAM_CHUNK_SIZE);
+
+    if (ReadSize && HiewGate_FileRead(Offset, ReadSize, Buffers[Current]) != (int) ReadSize)
+        goto finished;
+
+    while (ReadSize) {
+        BOOL ReadFailed = FALSE;
+        DWORD NextSize;
+
+        Stream.Offset = Offset;
+        Stream.Data = Buffers[Current];
+        Stream.Length = ReadSize;
+
+        for (DWORD i = 0; i < Count; i++) {
+            SubmitThreadpoolWork(Workers[i].Work);
+        }
+
+        Offset += ReadSize;
+        Length -= ReadSize;
+        Done += ReadSize;
+
+        // Read the next chunk while they work.
+        NextSize = min(Length, STREAM_CHUNK_SIZE);
+
+        if (NextSize && HiewGate_FileRead(Offset, NextSize, Buffers[!Current]) != (int) NextSize)
+            ReadFailed = TRUE;
+
+        for (DWORD i = 0; i < Count; i++) {
+            WaitForThreadpoolWorkCallbacks(Workers[i].Work, FALSE);
+        }
+
+        if (ReadFailed)
+            goto finished;
+
+        for (DWORD i = 0; i < Count; i++) {
+            if (Workers[i].Result == FALSE)
+                goto finished;
+        }
+
+        if (!UpdateJob(Job, Done)) {
+            Result = HEM_KEYBREAK;
+            goto finished;
+        }
+
+        ReadSize = NextSize;
+        Current = !Current;
+    }
+
+    Result = HEM_OK;
+
+finished:
+    for (DWORD i = 0; i < Count; i++) {
+        if (Workers[i].Work) {
+            WaitForThreadpoolWorkCallbacks(Workers[i].Work, TRUE);
+            CloseThreadpoolWork(Workers[i].Work);
+        }
+    }
+
+    for (DWORD i = 0; i < _countof(Buffers); i++) {
+        if (Buffers[i])
+            VirtualFree(Buffers[i], 0, MEM_RELEASE);
+    }
+
+    free(Workers);
+    return Result;
+}
+
+static VOID CALLBACK ParallelForCallback(PTP_CALLBACK_INSTANCE Instance,
+                                         PVOID Context,
+                                         PTP_WORK Work)
+{
+    PPARALLEL_FOR For = Context;
+    LONG Index;
+
+    while ((Index = InterlockedIncrement(&For->Next) - 1) < (LONG) For->Count) {
+        For->Routine(For->Context, Index);
+    }
+}
+
+VOID ParallelFor(DWORD Count, PPARALLEL_ROUTINE Routine, PVOID Context)
+{
+    PARALLEL_FOR For = { Routine, Context, Count, 0 };
+    SYSTEM_INFO SystemInfo;
+    PTP_WORK Work;
+    DWORD Threads;
+
+    GetSystemInfo(&SystemInfo);
+
+    Threads = min(SystemInfo.dwNumberOfProcessors, Count);
+
+    // Not worth it, or not possible, just do it here.
+    if (Threads <= 1 || (Work = CreateThreadpoolWork(ParallelForCallback, &For, NULL)) == NULL) {
+        ParallelForCallback(NULL, &For, NULL);
+        return;
+    }
+
+    for (DWORD i = 1; i < Threads; i++) {
+        SubmitThreadpoolWork(Work);
+    }
+
+    // This thread helps too, so it finishes even if the pool is busy.
+    ParallelForCallback(NULL, &For, NULL);
+
+    WaitForThreadpoolWorkCallbacks(Work, FALSE);
+    CloseThreadpoolWork(Work);
+}
+
+VOID GetMarkedRange(HIEWGATE_GETDATA *HiewData, HEM_QWORD *Offset, HEM_QWORD *Length)
+{
+    if (HiewData->sizeMark && HiewData->offsetMark1 < HiewData->filelength) {
+        *Offset = HiewData->offsetMark1;
+        *Length = min(HiewData->sizeMark, HiewData->filelength - *Offset);
+    } else {
+        *Offset = 0;
+        *Length = HiewData->filelength;
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef __STREAM_H
+#define __STREAM_H
+
+// Called for each chunk of the file in order. Return FALSE to stop.
+typedef BOOL (*PSTREAM_ROUTINE)(PVOID Context, HEM_QWORD Offset, const BYTE *Data, DWORD Length);
+
+typedef struct _STREAM_CONSUMER {
+    PSTREAM_ROUTINE Routine;
+    PVOID Context;
+} STREAM_CONSUMER, *PSTREAM_CONSUMER;
+
+// Reads Length bytes from Offset through the HiewGate, and hands each chunk to
+// every consumer. The consumers run in parallel on the threadpool while the
+// next chunk is read. Progress is reported to Job, which should have been
+// started with Length as the total. Returns HEM_OK, HEM_KEYBREAK if the user
+// pressed Esc, or HEM_ERROR if a read failed or a consumer returned FALSE.
+int StreamFileRange(PJOB Job,
+                    HEM_QWORD Offset,
+                    HEM_QWORD Length,
+                    PSTREAM_CONSUMER Consumers,
+                    DWORD Count);
+
+typedef VOID (*PPARALLEL_ROUTINE)(PVOID Context, DWORD Index);
+
+// Calls Routine for every Index below Count, spread across the threadpool
+// and the calling thread. Returns when they have all finished.
+VOID ParallelFor(DWORD Count, PPARALLEL_ROUTINE Routine, PVOID Context);
+
+// Gets the marked block, or the whole file if nothing is marked.
+VOID GetMarkedRange(HIEWGATE_GETDATA *HiewData, HEM_QWORD *Offset, HEM_QWORD *Length);
+
+#endif
@@ -0,0 +1,1122 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "vlist.h"
+#include "util.h"
+#include "secmap.h"
+#include "template.h"
+
+// This decodes records at the cursor using C-like structure definitions from
+// a text file next to the hem, which looks like this:
+//
+//  # Comments start with a hash, or //.
+//  struct point {
+//      i32 x;
+//      i32 y;
+//  };
+//
+//  be struct header {
+//      char magic[4];
+//      u16 version;
+//      le u32 flags;
+//      struct point corners[4];
+//      ptr64 struct header *next;
+//  };
+//
+// A be or le in front of a struct is the default for its fields, and a field
+// can override it. Pointers are 32 bits unless they're marked ptr64, the value
+// is an address if the file has sections, or an offset if it doesn't.
+// There's no padding, fields are wherever the previous one ended.
+//
+// Each struct is compiled into a flat list of fields with their offsets, so
+// nested structs are already expanded and decoding is just an indexed read
+// from the records. An array is one field with a count, however big it is.
+// The list is kept until the text changes.
+
+#define TEMPLATE_EXTENSION      ".tpl"
+
+#define TEMPLATE_MAX_NAME       64
+#define TEMPLATE_MAX_PATH       128
+#define TEMPLATE_MAX_FIELDS     4096
+#define TEMPLATE_MAX_SIZE       (16 * 1024 * 1024)
+#define TEMPLATE_MAX_SOURCE     (4 * 1024 * 1024)
+
+// Everything is read at once, so don't let that get silly.
+#define TEMPLATE_MAX_READ       (256 * 1024 * 1024)
+
+// Byte arrays longer than this are shown with dots.
+#define TEMPLATE_MAX_BYTES      16
+
+#define TEMPLATE_NONE           ((DWORD) -1)
+
+#define TEMPLATE_MENU_WIDTH     80
+
+typedef enum _FIELD_KIND {
+    FIELD_UNSIGNED,
+    FIELD_SIGNED,
+    FIELD_FLOAT,
+    FIELD_CHARS,            // A char array, shown as a string.
+    FIELD_BYTES,            // A u8 or i8 array, shown as hex.
+    FIELD_POINTER,
+    FIELD_STRUCT,           // An array of structs, shown as records.
+} FIELD_KIND;
+
+typedef struct _TEMPLATE_FIELD {
+    DWORD Offset;           // From the start of the record
+    DWORD Count;            // How many elements, 1 unless it's an array.
+    DWORD Name;             // The whole path, e.g. header.corners
+    DWORD Target;           // The struct a pointer points to or an array holds, or TEMPLATE_NONE
+    BYTE Kind;
+    BYTE Size;
+    BYTE BigEndian;
+} TEMPLATE_FIELD, *PTEMPLATE_FIELD;
+
+typedef struct _TEMPLATE {
+    DWORD Name;
+    DWORD Size;
+    DWORD FirstField;
+    DWORD FieldCount;
+} TEMPLATE, *PTEMPLATE;
+
+typedef struct _TEMPLATE_TYPE {
+    LPCSTR Name;
+    FIELD_KIND Kind;
+    BYTE Size;
+} TEMPLATE_TYPE, *PTEMPLATE_TYPE;
+
+static const TEMPLATE_TYPE TemplateTypes[] = {
+    { "u8",         FIELD_UNSIGNED, 1 },
+    { "uint8_t",    FIELD_UNSIGNED, 1 },
+    { "BYTE",       FIELD_UNSIGNED, 1 },
+    { "UCHAR",      FIELD_UNSIGNED, 1 },
+    { "i8",         FIELD_SIGNED,   1 },
+    { "int8_t",     FIELD_SIGNED,   1 },
+    { "char",       FIELD_SIGNED,   1 },
+    { "CHAR",       FIELD_SIGNED,   1 },
+    { "u16",        FIELD_UNSIGNED, 2 },
+    { "uint16_t",   FIELD_UNSIGNED, 2 },
+    { "WORD",       FIELD_UNSIGNED, 2 },
+    { "USHORT",     FIELD_UNSIGNED, 2 },
+    { "i16",        FIELD_SIGNED,   2 },
+    { "int16_t",    FIELD_SIGNED,   2 },
+    { "short",      FIELD_SIGNED,   2 },
+    { "SHORT",      FIELD_SIGNED,   2 },
+    { "u32",        FIELD_UNSIGNED, 4 },
+    { "uint32_t",   FIELD_UNSIGNED, 4 },
+    { "DWORD",      FIELD_UNSIGNED, 4 },
+    { "ULONG",      FIELD_UNSIGNED, 4 },
+    { "UINT",       FIELD_UNSIGNED, 4 },
+    { "i32",        FIELD_SIGNED,   4 },
+    { "int32_t",    FIELD_SIGNED,   4 },
+    { "int",        FIELD_SIGNED,   4 },
+    { "LONG",       FIELD_SIGNED,   4 },
+    { "INT",        FIELD_SIGNED,   4 },
+    { "u64",        FIELD_UNSIGNED, 8 },
+    { "uint64_t",   FIELD_UNSIGNED, 8 },
+    { "QWORD",      FIELD_UNSIGNED, 8 },
+    { "ULONGLONG",  FIELD_UNSIGNED, 8 },
+    { "i64",        FIELD_SIGNED,   8 },
+    { "int64_t",    FIELD_SIGNED,   8 },
+    { "LONGLONG",   FIELD_SIGNED,   8 },
+    { "f32",        FIELD_FLOAT,    4 },
+    { "float",      FIELD_FLOAT,    4 },
+    { "FLOAT",      FIELD_FLOAT,    4 },
+    { "f64",        FIELD_FLOAT,    8 },
+    { "double",     FIELD_FLOAT,    8 },
+    { "DOUBLE",     FIELD_FLOAT,    8 },
+};
+
+typedef enum _TOKEN {
+    TOKEN_END,
+    TOKEN_NAME,
+    TOKEN_NUMBER,
+    TOKEN_PUNCT,
+    TOKEN_INVALID,
+} TOKEN;
+
+typedef struct _PARSER {
+    PCHAR Position;
+    DWORD Line;
+    TOKEN Token;
+    CHAR Text[TEMPLATE_MAX_NAME];
+    ULONGLONG Number;
+} PARSER, *PPARSER;
+
+// Some records read from the file, and the lists that show them.
+typedef struct _APPLIED {
+    PTEMPLATE Template;
+    HEM_QWORD Offset;
+    DWORD Count;
+    PBYTE Data;
+    DWORD Record;           // The one the fields list is showing.
+    VLIST Records;
+    VLIST Fields;
+} APPLIED, *PAPPLIED;
+
+static CHAR SourceFile[MAX_PATH];
+
+// The compiled templates, and the text they came from.
+static struct {
+    BUFFER Templates;
+    BUFFER Fields;
+    BUFFER Names;
+    ULONGLONG SourceSize;
+    ULONGLONG SourceTime;
+    BOOL Loaded;
+} Set;
+
+static DWORD TemplateChoice;
+static DWORD TemplateRecords = 1;
+static BOOL TemplateComments;
+
+#define TEMPLATES() ((PTEMPLATE) Set.Templates.Data)
+#define FIELDS() ((PTEMPLATE_FIELD) Set.Fields.Data)
+#define NAMES() ((PCHAR) Set.Names.Data)
+#define TEMPLATE_COUNT() (Set.Templates.Size / sizeof(TEMPLATE))
+
+BOOL OpenTemplates(LPCSTR HemFile)
+{
+    return ReplaceExtension(SourceFile, sizeof SourceFile, HemFile, TEMPLATE_EXTENSION);
+}
+
+static VOID FreeTemplates(VOID)
+{
+    free(Set.Templates.Data);
+    free(Set.Fields.Data);
+    free(Set.Names.Data);
+
+    ZeroMemory(&Set, sizeof Set);
+}
+
+VOID CloseTemplates(VOID)
+{
+    FreeTemplates();
+}
+
+static DWORD AppendName(LPCSTR Name)
+{
+    DWORD Offset = Set.Names.Size;
+
+    if (!AppendBuffer(&Set.Names, Name, strlen(Name) + 1))
+        return TEMPLATE_NONE;
+
+    return Offset;
+}
+
+static TOKEN NextToken(PPARSER Parser)
+{
+    PCHAR p = Parser->Position;
+    DWORD Length = 0;
+
+    // Whitespace and comments.
+    while (TRUE) {
+        if (*p == '\n')
+            Parser->Line++;
+
+        if (isspace((BYTE) *p)) {
+            p++;
+        } else if (*p == '#' || (p[0] == '/' && p[1] == '/')) {
+            while (*p && *p != '\n')
+                p++;
+        } else if (p[0] == '/' && p[1] == '*') {
+            for (p += 2; *p && !(p[0] == '*' && p[1] == '/'); p++) {
+                if (*p == '\n')
+                    Parser->Line++;
+            }
+
+            if (*p)
+                p += 2;
+        } else {
+            break;
+        }
+    }
+
+    Parser->Text[0] = '\0';
+
+    if (*p == '\0') {
+        Parser->Token = TOKEN_END;
+    } else if (isalpha((BYTE) *p) || *p == '_') {
+        while (isalnum((BYTE) *p) || *p == '_') {
+            if (Length < sizeof Parser->Text - 1)
+                Parser->Text[Length++] = *p;
+            p++;
+        }
+
+        Parser->Text[Length] = '\0';
+        Parser->Token = TOKEN_NAME;
+    } else if (isdigit((BYTE) *p)) {
+        Parser->Number = _strtoui64(p, &p, 0);
+        Parser->Token = TOKEN_NUMBER;
+    } else if (strchr("{}[];*", *p)) {
+        Parser->Text[0] = *p++;
+        Parser->Text[1] = '\0';
+        Parser->Token = TOKEN_PUNCT;
+    } else {
+        Parser->Token = TOKEN_INVALID;
+    }
+
+    Parser->Position = p;
+    return Parser->Token;
+}
+
+static BOOL IsPunct(PPARSER Parser, CHAR c)
+{
+    return Parser->Token == TOKEN_PUNCT && Parser->Text[0] == c;
+}
+
+static DWORD FindTemplate(LPCSTR Name)
+{
+    for (DWORD i = 0; i < TEMPLATE_COUNT(); i++) {
+        if (strcmp(NAMES() + TEMPLATES()[i].Name, Name) == 0)
+            return i;
+    }
+
+    return TEMPLATE_NONE;
+}
+
+static const TEMPLATE_TYPE *FindType(LPCSTR Name)
+{
+    for (DWORD i = 0; i < _countof(TemplateTypes); i++) {
+        if (strcmp(TemplateTypes[i].Name, Name) == 0)
+            return &TemplateTypes[i];
+    }
+
+    return NULL;
+}
+
+// Add a field to the struct being compiled.
+static BOOL AppendField(PTEMPLATE Template, PTEMPLATE_FIELD Field, LPCSTR Path)
+{
+    if (Template->FieldCount == TEMPLATE_MAX_FIELDS)
+        return FALSE;
+
+    if ((Field->Name = AppendName(Path)) == TEMPLATE_NONE)
+        return FALSE;
+
+    if (!AppendBuffer(&Set.Fields, Field, sizeof *Field))
+        return FALSE;
+
+    Template->FieldCount++;
+    return TRUE;
+}
+
+// Copy the fields of an earlier struct into this one, at Offset.
+static BOOL EmbedTemplate(PTEMPLATE Template, DWORD Inner, DWORD Offset, LPCSTR Prefix)
+{
+    CHAR Path[TEMPLATE_MAX_PATH];
+
+    for (DWORD i = 0; i < TEMPLATES()[Inner].FieldCount; i++) {
+        // Appending can move the arrays, so look this up again every time.
+        TEMPLATE_FIELD Field = FIELDS()[TEMPLATES()[Inner].FirstField + i];
+
+        snprintf(Path, sizeof Path, "%s.%s", Prefix, NAMES() + Field.Name);
+
+        Field.Offset += Offset;
+
+        if (!AppendField(Template, &Field, Path))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+// Parse one field, like "le struct point *origin[4];", the current token is
+// the first word.
+static BOOL ParseField(PPARSER Parser, PTEMPLATE Template, BOOL BigEndian, BYTE PointerSize, PCHAR Message, SIZE_T MaxLen)
+{
+    const TEMPLATE_TYPE *Type = NULL;
+    TEMPLATE_FIELD Field = {0};
+    CHAR Target[TEMPLATE_MAX_NAME];
+    CHAR Name[TEMPLATE_MAX_NAME];
+    DWORD Inner = TEMPLATE_NONE;
+    DWORD Size;
+    ULONGLONG Count = 1;
+    BOOL Array = FALSE;
+    BOOL Pointer = FALSE;
+    BOOL Result;
+
+    while (Parser->Token == TOKEN_NAME) {
+        if (strcmp(Parser->Text, "le") == 0) {
+            BigEndian = FALSE;
+        } else if (strcmp(Parser->Text, "be") == 0) {
+            BigEndian = TRUE;
+        } else if (strcmp(Parser->Text, "ptr32") == 0) {
+            PointerSize = sizeof(DWORD);
+        } else if (strcmp(Parser->Text, "ptr64") == 0) {
+            PointerSize = sizeof(ULONGLONG);
+        } else {
+            break;
+        }
+
+        NextToken(Parser);
+    }
+
+    if (Parser->Token != TOKEN_NAME) {
+        snprintf(Message, MaxLen, "Line %u of %s should start with a type.", Parser->Line, SourceFile);
+        return FALSE;
+    }
+
+    if (strcmp(Parser->Text, "struct") == 0) {
+        if (NextToken(Parser) != TOKEN_NAME) {
+            snprintf(Message, MaxLen, "Line %u of %s needs a struct name.", Parser->Line, SourceFile);
+            return FALSE;
+        }
+
+        strcpy_s(Target, sizeof Target, Parser->Text);
+    } else if ((Type = FindType(Parser->Text)) == NULL) {
+        snprintf(Message, MaxLen, "Line %u of %s uses %s, which isn't a type I know.", Parser->Line, SourceFile, Parser->Text);
+        return FALSE;
+    }
+
+    if (NextToken(Parser) == TOKEN_PUNCT && IsPunct(Parser, '*')) {
+        Pointer = TRUE;
+        NextToken(Parser);
+    }
+
+    if (Parser->Token != TOKEN_NAME) {
+        snprintf(Message, MaxLen, "Line %u of %s needs a field name.", Parser->Line, SourceFile);
+        return FALSE;
+    }
+
+    strcpy_s(Name, sizeof Name, Parser->Text);
+
+    if (NextToken(Parser) == TOKEN_PUNCT && IsPunct(Parser, '[')) {
+        if (NextToken(Parser) != TOKEN_NUMBER || Parser->Number == 0 || Parser->Number > TEMPLATE_MAX_SIZE) {
+            snprintf(Message, MaxLen, "Line %u of %s has a bad array size.", Parser->Line, SourceFile);
+            return FALSE;
+        }
+
+        Count = Parser->Number;
+        Array = TRUE;
+
+        if (NextToken(Parser) != TOKEN_PUNCT || !IsPunct(Parser, ']')) {
+            snprintf(Message, MaxLen, "Line %u of %s is missing a ].", Parser->Line, SourceFile);
+            return FALSE;
+        }
+
+        NextToken(Parser);
+    }
+
+    if (!IsPunct(Parser, ';')) {
+        snprintf(Message, MaxLen, "Line %u of %s is missing a semicolon.", Parser->Line, SourceFile);
+        return FALSE;
+    }
+
+    // Pointers can refer to anything, it's resolved when the file is done.
+    if (Pointer) {
+        Field.Kind = FIELD_POINTER;
+        Field.Size = PointerSize;
+        Field.Target = Type ? TEMPLATE_NONE : AppendName(Target);
+        Size = PointerSize;
+    } else if (Type) {
+        Field.Kind = Type->Kind;
+        Field.Size = Type->Size;
+        Field.Target = TEMPLATE_NONE;
+        Size = Type->Size;
+
+        if (Array && Type->Size == 1) {
+            Field.Kind = strcmp(Type->Name, "char") == 0 || strcmp(Type->Name, "CHAR") == 0 ? FIELD_CHARS : FIELD_BYTES;
+        }
+    } else {
+        // Otherwise it has to be complete already.
+        if ((Inner = FindTemplate(Target)) == TEMPLATE_NONE) {
+            snprintf(Message, MaxLen, "Line %u of %s uses struct %s before it's defined.", Parser->Line, SourceFile, Target);
+            return FALSE;
+        }
+
+        Size = TEMPLATES()[Inner].Size;
+
+        // A single struct is expanded in place, but an array of them is
+        // kept as one field.
+        if (Array) {
+            Field.Kind = FIELD_STRUCT;
+            Field.Target = Inner;
+        }
+    }
+
+    if (Template->Size + Count * Size > TEMPLATE_MAX_SIZE) {
+        snprintf(Message, MaxLen, "Line %u of %s makes the struct too big.", Parser->Line, SourceFile);
+        return FALSE;
+    }
+
+    Field.BigEndian = (BYTE) BigEndian;
+    Field.Offset = Template->Size;
+    Field.Count = (DWORD) Count;
+
+    if (Inner != TEMPLATE_NONE && !Array) {
+        Result = EmbedTemplate(Template, Inner, Field.Offset, Name);
+    } else {
+        Result = AppendField(Template, &Field, Name);
+    }
+
+    if (!Result) {
+        snprintf(Message, MaxLen, "Line %u of %s has too many fields, or I ran out of memory.", Parser->Line, SourceFile);
+        return FALSE;
+    }
+
+    Template->Size += (DWORD) Count * Size;
+
+    NextToken(Parser);
+    return TRUE;
+}
+
+static BOOL ParseStruct(PPARSER Parser, PCHAR Message, SIZE_T MaxLen)
+{
+    TEMPLATE Template = {0};
+    BOOL BigEndian = FALSE;
+    BYTE PointerSize = sizeof(DWORD);
+
+    while (Parser->Token == TOKEN_NAME && strcmp(Parser->Text, "struct") != 0) {
+        if (strcmp(Parser->Text, "le") == 0) {
+            BigEndian = FALSE;
+        } else if (strcmp(Parser->Text, "be") == 0) {
+            BigEndian = TRUE;
+        } else if (strcmp(Parser->Text, "ptr32") == 0) {
+            PointerSize = sizeof(DWORD);
+        } else if (strcmp(Parser->Text, "ptr64") == 0) {
+            PointerSize = sizeof(ULONGLONG);
+        } else {
+            break;
+        }
+
+        NextToken(Parser);
+    }
+
+    if (Parser->Token != TOKEN_NAME || strcmp(Parser->Text, "struct") != 0) {
+        snprintf(Message, MaxLen, "Line %u of %s should start a struct.", Parser->Line, SourceFile);
+        return FALSE;
+    }
+
+    if (NextToken(Parser) != TOKEN_NAME) {
+        snprintf(Message, MaxLen, "Line %u of %s needs a struct name.", Parser->Line, SourceFile);
+        return FALSE;
+    }
+
+    if (FindTemplate(Parser->Text) != TEMPLATE_NONE) {
+        snprintf(Message, MaxLen, "Line %u of %s defines struct %s again.", Parser->Line, SourceFile, Parser->Text);
+        return FALSE;
+    }
+
+    Template.Name = AppendName(Parser->Text);
+    Template.FirstField = Set.Fields.Size / sizeof(TEMPLATE_FIELD);
+
+    if (NextToken(Parser) != TOKEN_PUNCT || !IsPunct(Parser, '{')) {
+        snprintf(Message, MaxLen, "Line %u of %s is missing a {.", Parser->Line, SourceFile);
+        return FALSE;
+    }
+
+    NextToken(Parser);
+
+    while (!IsPunct(Parser, '}')) {
+        if (Parser->Token == TOKEN_END) {
+            snprintf(Message, MaxLen, "The last struct in %s is missing a }.", SourceFile);
+            return FALSE;
+        }
+
+        if (!ParseField(Parser, &Template, BigEndian, PointerSize, Message, MaxLen))
+            return FALSE;
+    }
+
+    if (Template.FieldCount == 0) {
+        snprintf(Message, MaxLen, "Line %u of %s ends an empty struct.", Parser->Line, SourceFile);
+        return FALSE;
+    }
+
+    // The semicolon is optional.
+    if (NextToken(Parser) == TOKEN_PUNCT && IsPunct(Parser, ';'))
+        NextToken(Parser);
+
+    if (Template.Name == TEMPLATE_NONE || !AppendBuffer(&Set.Templates, &Template, sizeof Template)) {
+        snprintf(Message, MaxLen, "Not enough memory to compile the templates.");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static BOOL CompileTemplates(PCHAR Text, PCHAR Message, SIZE_T MaxLen)
+{
+    PARSER Parser = { Text, 1 };
+
+    NextToken(&Parser);
+
+    while (Parser.Token != TOKEN_END) {
+        if (!ParseStruct(&Parser, Message, MaxLen))
+            return FALSE;
+    }
+
+    if (TEMPLATE_COUNT() == 0) {
+        snprintf(Message, MaxLen, "There are no structs in %s.", SourceFile);
+        return FALSE;
+    }
+
+    // Now everything is defined, find what the pointers point to.
+    for (DWORD i = 0; i < Set.Fields.Size / sizeof(TEMPLATE_FIELD); i++) {
+        PTEMPLATE_FIELD Field = &FIELDS()[i];
+        LPCSTR Target;
+
+        if (Field->Kind != FIELD_POINTER || Field->Target == TEMPLATE_NONE)
+            continue;
+
+        Target = NAMES() + Field->Target;
+
+        if ((Field->Target = FindTemplate(Target)) == TEMPLATE_NONE) {
+            snprintf(Message, MaxLen, "Something in %s points to struct %s, which isn't defined.", SourceFile, Target);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static BOOL LoadTemplates(PCHAR Message, SIZE_T MaxLen)
+{
+    WIN32_FILE_ATTRIBUTE_DATA Source;
+    ULONGLONG SourceSize;
+    ULONGLONG SourceTime;
+    PCHAR Text;
+    FILE *File;
+    SIZE_T Length;
+    BOOL Result;
+
+    if (!GetFileAttributesEx(SourceFile, GetFileExInfoStandard, &Source)) {
+        snprintf(Message, MaxLen, "Put your structs in %s.", SourceFile);
+        return FALSE;
+    }
+
+    SourceSize = (ULONGLONG) Source.nFileSizeHigh << 32 | Source.nFileSizeLow;
+    SourceTime = (ULONGLONG) Source.ftLastWriteTime.dwHighDateTime << 32 | Source.ftLastWriteTime.dwLowDateTime;
+
+    if (Set.Loaded && Set.SourceSize == SourceSize && Set.SourceTime == SourceTime)
+        return TRUE;
+
+    FreeTemplates();
+
+    if (SourceSize > TEMPLATE_MAX_SOURCE) {
+        snprintf(Message, MaxLen, "%s is too big.", SourceFile);
+        return FALSE;
+    }
+
+    if ((File = fopen(SourceFile, "rb")) == NULL) {
+        snprintf(Message, MaxLen, "Failed to read %s.", SourceFile);
+        return FALSE;
+    }
+
+    if ((Text = malloc(SourceSize + 1)) == NULL) {
+        snprintf(Message, MaxLen, "Not enough memory to compile the templates.");
+        fclose(File);
+        return FALSE;
+    }
+
+    Length = fread(Text, 1, SourceSize, File);
+    Text[Length] = '\0';
+
+    fclose(File);
+
+    Result = CompileTemplates(Text, Message, MaxLen);
+
+    free(Text);
+
+    if (!Result) {
+        FreeTemplates();
+        return FALSE;
+    }
+
+    Set.SourceSize = SourceSize;
+    Set.SourceTime = SourceTime;
+    Set.Loaded = TRUE;
+    return TRUE;
+}
+
+static ULONGLONG ReadValue(const BYTE *Data, DWORD Size, BOOL BigEndian)
+{
+    ULONGLONG Value = 0;
+
+    switch (Size) {
+        case 1:
+            return *Data;
+        case 2:
+            Value = *(UNALIGNED WORD *) Data;
+            return BigEndian ? _byteswap_ushort((WORD) Value) : Value;
+        case 4:
+            Value = *(UNALIGNED DWORD *) Data;
+            return BigEndian ? _byteswap_ulong((DWORD) Value) : Value;
+        case 8:
+            Value = *(UNALIGNED ULONGLONG *) Data;
+            return BigEndian ? _byteswap_uint64(Value) : Value;
+    }
+
+    return Value;
+}
+
+// Pointers are addresses if I know where things are loaded.
+static BOOL FollowPointer(HEMCALL_TAG *HemCall, ULONGLONG Value, HEM_QWORD *Offset)
+{
+    PSECTION_MAP Map = GetSectionMap(HemCall);
+
+    if (Map && strcmp(Map->Format, "raw") != 0)
+        return AddressToOffset(Map, Value, Offset);
+
+    *Offset = Value;
+    return TRUE;
+}
+
+// Format one element of a number or pointer field.
+static VOID FormatScalar(PTEMPLATE_FIELD Field, const BYTE *Data, PCHAR Buffer, SIZE_T Size)
+{
+    ULONGLONG Value = ReadValue(Data, Field->Size, Field->BigEndian);
+
+    switch (Field->Kind) {
+        case FIELD_UNSIGNED:
+            snprintf(Buffer, Size, "%llu (%#llx)", Value, Value);
+            break;
+        case FIELD_SIGNED:
+            // Sign extend it from the field size.
+            if (Field->Size < sizeof Value && (Value >> (Field->Size * 8 - 1)) & 1)
+                Value |= ~0ULL << (Field->Size * 8);
+
+            snprintf(Buffer, Size, "%lld (%#llx)", (LONGLONG) Value, Value & (~0ULL >> (64 - Field->Size * 8)));
+            break;
+        case FIELD_FLOAT:
+            if (Field->Size == sizeof(FLOAT)) {
+                DWORD Bits = (DWORD) Value;
+                snprintf(Buffer, Size, "%g", *(PFLOAT) &Bits);
+            } else {
+                snprintf(Buffer, Size, "%g", *(DOUBLE *) &Value);
+            }
+            break;
+        case FIELD_POINTER:
+            if (Field->Target != TEMPLATE_NONE) {
+                snprintf(Buffer, Size, "%#llx -> struct %s", Value, NAMES() + TEMPLATES()[Field->Target].Name);
+            } else {
+                snprintf(Buffer, Size, "%#llx", Value);
+            }
+            break;
+        default:
+            Buffer[0] = '\0';
+            break;
+    }
+}
+
+static VOID FormatValue(PTEMPLATE_FIELD Field, const BYTE *Data, PCHAR Buffer, SIZE_T Size)
+{
+    CHAR Value[VLIST_LINE_SIZE];
+    SIZE_T Used = 0;
+    DWORD i;
+
+    switch (Field->Kind) {
+        case FIELD_CHARS:
+            Used = snprintf(Buffer, Size, "\"");
+
+            for (DWORD i = 0; i < Field->Count && Data[i] && Used + 5 < Size; i++) {
+                Buffer[Used++] = isprint(Data[i]) ? Data[i] : '.';
+            }
+
+            snprintf(Buffer + Used, Size - Used, "\"");
+            break;
+        case FIELD_BYTES:
+            Buffer[0] = '\0';
+
+            for (DWORD i = 0; i < min(Field->Count, TEMPLATE_MAX_BYTES) && Used < Size; i++) {
+                Used += snprintf(Buffer + Used, Size - Used, "%02X ", Data[i]);
+            }
+
+            if (Field->Count > TEMPLATE_MAX_BYTES && Used < Size)
+                snprintf(Buffer + Used, Size - Used, "...");
+            break;
+        case FIELD_STRUCT:
+            snprintf(Buffer, Size, "%u x struct %s", Field->Count, NAMES() + TEMPLATES()[Field->Target].Name);
+            break;
+        default:
+            if (Field->Count == 1) {
+                FormatScalar(Field, Data, Buffer, Size);
+                break;
+            }
+
+            // Other arrays show as many elements as fit on a line.
+            Used = snprintf(Buffer, Size, "{");
+
+            for (i = 0; i < Field->Count && Used < TEMPLATE_MENU_WIDTH; i++) {
+                FormatScalar(Field, Data + (SIZE_T) i * Field->Size, Value, sizeof Value);
+
+                Used += snprintf(Buffer + Used, Size - Used, i ? ", %s" : "%s", Value);
+                Used = min(Used, Size - 1);
+            }
+
+            snprintf(Buffer + Used, Size - Used, i < Field->Count ? ", ...}" : "}");
+            break;
+    }
+}
+
+// The elements of an array field, so one can be chosen.
+typedef struct _ELEMENTS {
+    PTEMPLATE_FIELD Field;
+    const BYTE *Data;
+    HEM_QWORD Offset;
+} ELEMENTS, *PELEMENTS;
+
+static VOID FormatElement(PVOID Context, DWORD Index, const VOID *Record, PCHAR Buffer, SIZE_T Size)
+{
+    PELEMENTS Elements = Context;
+    CHAR Name[TEMPLATE_MAX_PATH + 16];
+    CHAR Value[VLIST_LINE_SIZE];
+
+    snprintf(Name, sizeof Name, "%s[%u]", NAMES() + Elements->Field->Name, Index);
+
+    FormatScalar(Elements->Field, Elements->Data + (SIZE_T) Index * Elements->Field->Size, Value, sizeof Value);
+
+    snprintf(Buffer,
+             Size,
+             "%08llX  %-24s %s",
+             Elements->Offset + (HEM_QWORD) Index * Elements->Field->Size,
+             Name,
+             Value);
+}
+
+// Let the user choose one element of an array, returns TEMPLATE_NONE if
+// cancelled.
+static DWORD SelectElement(PTEMPLATE_FIELD Field, const BYTE *Data, HEM_QWORD Offset)
+{
+    ELEMENTS Elements = { Field, Data, Offset };
+    CHAR Title[TEMPLATE_MAX_PATH + 64];
+    VLIST List;
+    LONG Selected = -1;
+
+    InitVirtualList(&List, sizeof(DWORD), FormatElement, &Elements);
+
+    snprintf(Title, sizeof Title, "%s[%u] at %llX", NAMES() + Field->Name, Field->Count, Offset);
+
+    if (ResizeVirtualList(&List, Field->Count))
+        Selected = ShowVirtualList(&List, Title, TEMPLATE_MENU_WIDTH, 0);
+
+    FreeVirtualList(&List);
+
+    return Selected < 0 ? TEMPLATE_NONE : (DWORD) Selected;
+}
+
+static VOID FormatField(PVOID Context, DWORD Index, const VOID *Record, PCHAR Buffer, SIZE_T Size)
+{
+    PAPPLIED Applied = Context;
+    PTEMPLATE_FIELD Field = &FIELDS()[Applied->Template->FirstField + *(const DWORD *) Record];
+    const BYTE *Data = Applied->Data + (SIZE_T) Applied->Record * Applied->Template->Size + Field->Offset;
+    CHAR Value[VLIST_LINE_SIZE];
+
+    FormatValue(Field, Data, Value, sizeof Value);
+
+    snprintf(Buffer,
+             Size,
+             "%08llX  %-24s %s",
+             Applied->Offset + (HEM_QWORD) Applied->Record * Applied->Template->Size + Field->Offset,
+             NAMES() + Field->Name,
+             Value);
+}
+
+// One line per record, with as many fields as fit.
+static VOID FormatRecord(PVOID Context, DWORD Index, const VOID *Record, PCHAR Buffer, SIZE_T Size)
+{
+    PAPPLIED Applied = Context;
+    PTEMPLATE_FIELD Fields = &FIELDS()[Applied->Template->FirstField];
+    const BYTE *Data = Applied->Data + (SIZE_T) Index * Applied->Template->Size;
+    CHAR Value[VLIST_LINE_SIZE];
+    SIZE_T Used;
+
+    Used = snprintf(Buffer, Size, "%08llX  %-6u", *(const HEM_QWORD *) Record, Index);
+
+    for (DWORD i = 0; i < Applied->Template->FieldCount && Used < TEMPLATE_MENU_WIDTH; i++) {
+        FormatValue(&Fields[i], Data + Fields[i].Offset, Value, sizeof Value);
+
+        Used += snprintf(Buffer + Used, Size - Used, " %s=%s", NAMES() + Fields[i].Name, Value);
+        Used = min(Used, Size - 1);
+    }
+}
+
+static BOOL AddComments(PAPPLIED Applied)
+{
+    LPCSTR Name = NAMES() + Applied->Template->Name;
+    CHAR Comment[TEMPLATE_MAX_PATH + TEMPLATE_MAX_NAME + 16];
+    JOB Job;
+
+    BeginJob(&Job, "Adding comments", Applied->Count);
+
+    for (DWORD r = 0; r < Applied->Count; r++) {
+        HEM_QWORD Base = Applied->Offset + (HEM_QWORD) r * Applied->Template->Size;
+
+        if (!UpdateJob(&Job, r))
+            break;
+
+        for (DWORD i = 0; i < Applied->Template->FieldCount; i++) {
+            PTEMPLATE_FIELD Field = &FIELDS()[Applied->Template->FirstField + i];
+
+            if (Applied->Count > 1) {
+                snprintf(Comment, sizeof Comment, "%s[%u].%s", Name, r, NAMES() + Field->Name);
+            } else {
+                snprintf(Comment, sizeof Comment, "%s.%s", Name, NAMES() + Field->Name);
+            }
+
+            HiewGate_Names_AddLocalComment(Base + Field->Offset, Comment);
+        }
+    }
+
+    EndJob(&Job);
+
+    return !Job.Cancelled;
+}
+
+static VOID FreeApplied(PAPPLIED Applied)
+{
+    FreeVirtualList(&Applied->Records);
+    FreeVirtualList(&Applied->Fields);
+    free(Applied->Data);
+}
+
+// Read Count records at Offset in one go, Count is reduced if the file isn't
+// long enough.
+static BOOL ApplyTemplate(PAPPLIED Applied, DWORD Index, HEM_QWORD Offset, DWORD Count, HEM_QWORD FileLength)
+{
+    PTEMPLATE Template = &TEMPLATES()[Index];
+    SIZE_T Length;
+
+    ZeroMemory(Applied, sizeof *Applied);
+
+    InitVirtualList(&Applied->Records, sizeof(HEM_QWORD), FormatRecord, Applied);
+    InitVirtualList(&Applied->Fields, sizeof(DWORD), FormatField, Applied);
+
+    if (Offset >= FileLength)
+        return FALSE;
+
+    Count = (DWORD) min(Count, (FileLength - Offset) / Template->Size);
+    Count = min(Count, TEMPLATE_MAX_READ / Template->Size);
+
+    if (Count == 0)
+        return FALSE;
+
+    Length = (SIZE_T) Count * Template->Size;
+
+    Applied->Template = Template;
+    Applied->Offset = Offset;
+    Applied->Count = Count;
+
+    if ((Applied->Data = malloc(Length)) == NULL)
+        return FALSE;
+
+    if (HiewGate_FileRead(Offset, (HEM_UINT) Length, Applied->Data) != (int) Length)
+        goto error;
+
+    if (!ResizeVirtualList(&Applied->Records, Count) || !ResizeVirtualList(&Applied->Fields, Template->FieldCount))
+        goto error;
+
+    for (DWORD i = 0; i < Count; i++) {
+        *(HEM_QWORD *) GetVirtualListRecord(&Applied->Records, i) = Offset + (HEM_QWORD) i * Template->Size;
+    }
+
+    for (DWORD i = 0; i < Template->FieldCount; i++) {
+        *(PDWORD) GetVirtualListRecord(&Applied->Fields, i) = i;
+    }
+
+    return TRUE;
+
+error:
+    FreeApplied(Applied);
+    return FALSE;
+}
+
+// Show the records, and the fields of the one chosen. Choosing a pointer shows
+// what it points to, an array shows its elements, anything else is where to
+// go. Returns FALSE if nothing was chosen.
+static BOOL ShowApplied(HEMCALL_TAG *HemCall, PAPPLIED Applied, HEM_QWORD FileLength, HEM_QWORD *Result)
+{
+    LPCSTR Name = NAMES() + Applied->Template->Name;
+    CHAR Title[128];
+    LONG Record = 0;
+    LONG Selected;
+
+    while (TRUE) {
+        if (Applied->Count > 1) {
+            snprintf(Title, sizeof Title, "%u x struct %s (%u bytes) at %llX", Applied->Count, Name, Applied->Template->Size, Applied->Offset);
+
+            if ((Record = ShowVirtualList(&Applied->Records, Title, TEMPLATE_MENU_WIDTH, Record)) < 0)
+                return FALSE;
+        }
+
+        Applied->Record = Record;
+
+        snprintf(Title,
+                 sizeof Title,
+                 "struct %s at %llX",
+                 Name,
+                 Applied->Offset + (HEM_QWORD) Record * Applied->Template->Size);
+
+        for (Selected = 0; (Selected = ShowVirtualList(&Applied->Fields, Title, TEMPLATE_MENU_WIDTH, Selected)) >= 0; ) {
+            PTEMPLATE_FIELD Field = &FIELDS()[Applied->Template->FirstField + Selected];
+            const BYTE *Data = Applied->Data + (SIZE_T) Record * Applied->Template->Size + Field->Offset;
+            HEM_QWORD Offset = Applied->Offset + (HEM_QWORD) Record * Applied->Template->Size + Field->Offset;
+            HEM_QWORD Target;
+            APPLIED Pointee;
+            DWORD Element;
+            BOOL Chosen;
+
+            // An array of structs is just more records.
+            if (Field->Kind == FIELD_STRUCT) {
+                if (!ApplyTemplate(&Pointee, Field->Target, Offset, Field->Count, FileLength)) {
+                    HiewGate_Message("Templates", "Failed to read the array, or not enough memory.");
+                    continue;
+                }
+
+                Chosen = ShowApplied(HemCall, &Pointee, FileLength, Result);
+
+                FreeApplied(&Pointee);
+
+                if (Chosen)
+                    return TRUE;
+
+                continue;
+            }
+
+            if (Field->Count > 1 && Field->Kind != FIELD_CHARS && Field->Kind != FIELD_BYTES) {
+                if ((Element = SelectElement(Field, Data, Offset)) == TEMPLATE_NONE)
+                    continue;
+
+                Data += (SIZE_T) Element * Field->Size;
+                Offset += (HEM_QWORD) Element * Field->Size;
+            }
+
+            if (Field->Kind != FIELD_POINTER) {
+                *Result = Offset;
+                return TRUE;
+            }
+
+            if (!FollowPointer(HemCall, ReadValue(Data, Field->Size, Field->BigEndian), &Target) || Target >= FileLength) {
+                HiewGate_Message("Templates", "That doesn't point anywhere in the file.");
+                continue;
+            }
+
+            if (Field->Target == TEMPLATE_NONE) {
+                *Result = Target;
+                return TRUE;
+            }
+
+            if (!ApplyTemplate(&Pointee, Field->Target, Target, 1, FileLength)) {
+                HiewGate_Message("Templates", "Failed to read what that points to.");
+                continue;
+            }
+
+            Chosen = ShowApplied(HemCall, &Pointee, FileLength, Result);
+
+            FreeApplied(&Pointee);
+
+            if (Chosen)
+                return TRUE;
+        }
+
+        if (Applied->Count == 1)
+            return FALSE;
+    }
+}
+
+static VOID FormatTemplate(PVOID Context, DWORD Index, const VOID *Record, PCHAR Buffer, SIZE_T Size)
+{
+    PTEMPLATE Template = &TEMPLATES()[Index];
+
+    snprintf(Buffer, Size, "%-32s %8u bytes %6u fields", NAMES() + Template->Name, Template->Size, Template->FieldCount);
+}
+
+// Let the user choose a struct and how to apply it. Returns FALSE if
+// cancelled.
+static BOOL SelectTemplateOptions(HEM_QWORD Offset)
+{
+    CHAR Lines[4][TEMPLATE_MAX_NAME + 64];
+    CHAR Count[32];
+    PCHAR Menu[4];
+    DWORD Width = 0;
+    VLIST List;
+    LONG Selected;
+    int Choice = 1;
+
+    TemplateChoice = min(TemplateChoice, TEMPLATE_COUNT() - 1);
+
+    while (TRUE) {
+        PTEMPLATE Template = &TEMPLATES()[TemplateChoice];
+
+        snprintf(Lines[0], sizeof Lines[0], "Decode at %#llx", Offset);
+        snprintf(Lines[1], sizeof Lines[0], "struct %s (%u bytes)", NAMES() + Template->Name, Template->Size);
+        snprintf(Lines[2], sizeof Lines[0], "Records %u", TemplateRecords);
+        snprintf(Lines[3], sizeof Lines[0], "[%c] Add field names as comments", TemplateComments ? 'x' : ' ');
+
+        for (DWORD i = 0; i < _countof(Menu); i++) {
+            Menu[i] = Lines[i];
+            Width = max(Width, strlen(Lines[i]));
+        }
+
+        Choice = HiewGate_Menu("Templates", Menu, _countof(Menu), Width, Choice, NULL, NULL, NULL, NULL);
+
+        switch (Choice) {
+            case 1:
+                return TRUE;
+            case 2:
+                InitVirtualList(&List, sizeof(DWORD), FormatTemplate, NULL);
+
+                if (!ResizeVirtualList(&List, TEMPLATE_COUNT()))
+                    break;
+
+                if ((Selected = ShowVirtualList(&List, "Structs", TEMPLATE_MENU_WIDTH, TemplateChoice)) >= 0)
+                    TemplateChoice = Selected;
+
+                FreeVirtualList(&List);
+                break;
+            case 3:
+                snprintf(Count, sizeof Count, "%u", TemplateRecords);
+
+                if (HiewGate_GetString("Records", Count, sizeof Count) == HEM_INPUT_CR)
+                    TemplateRecords = max(1, strtoul(Count, NULL, 0));
+                break;
+            case 4:
+                TemplateComments = !TemplateComments;
+                break;
+            default:
+                return FALSE;
+        }
+    }
+}
+
+int TemplateEntryPoint(HEMCALL_TAG *HemCall)
+{
+    HIEWGATE_GETDATA HiewData;
+    APPLIED Applied;
+    HEM_QWORD Target;
+    CHAR Message[MAX_PATH + 128];
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return HEM_ERROR;
+
+    if (!LoadTemplates(Message, sizeof Message)) {
+        HiewGate_Message("Templates", Message);
+        return HEM_OK;
+    }
+
+    if (!SelectTemplateOptions(HiewData.offsetCurrent))
+        return HEM_OK;
+
+    if (!ApplyTemplate(&Applied, TemplateChoice, HiewData.offsetCurrent, TemplateRecords, HiewData.filelength)) {
+        HiewGate_Message("Templates", "There isn't a whole record at the cursor, or not enough memory.");
+        return HEM_OK;
+    }
+
+    if (TemplateComments)
+        AddComments(&Applied);
+
+    if (ShowApplied(HemCall, &Applied, HiewData.filelength, &Target)) {
+        HemCall->returnOffset = Target;
+        HemCall->returnActionFlag |= HEM_RETURN_SETOFFSET;
+    }
+
+    FreeApplied(&Applied);
+    return HEM_OK;
+}
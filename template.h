@@ -0,0 +1,15 @@
+#ifndef __TEMPLATE_H
+#define __TEMPLATE_H
+
+// Remember where the struct definitions are, they're in a .tpl file next to
+// the hem.
+BOOL OpenTemplates(LPCSTR HemFile);
+
+// Release the compiled templates.
+VOID CloseTemplates(VOID);
+
+// Decodes one or more records at the cursor with a struct from the .tpl file,
+// choosing a field jumps to it and choosing a pointer shows what it points to.
+int TemplateEntryPoint(HEMCALL_TAG *HemCall);
+
+#endif
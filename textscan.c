@@ -0,0 +1,776 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <intrin.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "stream.h"
+#include "vlist.h"
+#include "background.h"
+#include "rcache.h"
+#include "textscan.h"
+
+// This finds runs of printable characters, like strings(1). Every encoding
+// is a separate stream consumer, so they're found in parallel, and each
+// chunk is classified 16 bytes at a time with SSE2. UTF-16 is split into low
+// and high bytes first, so the same test works for every encoding.
+//
+// The text is kept in one big pool, and the results are sorted by offset so
+// I can start the list wherever the cursor is.
+
+// Only this much of each string is kept.
+#define STRINGS_MAX_TEXT 128
+
+// Comments are truncated to this.
+#define STRINGS_MAX_COMMENT 64
+
+#define STRINGS_MENU_WIDTH 100
+
+enum {
+    STRING_ASCII,
+    STRING_UTF16LE,
+    STRING_UTF16BE,
+    STRING_ENCODINGS,
+};
+
+typedef struct _STRING_RECORD {
+    HEM_QWORD Offset;
+    DWORD Length;           // Characters
+    DWORD Text;             // Offset into the pool
+    BYTE TextLength;
+    BYTE Encoding;
+} STRING_RECORD, *PSTRING_RECORD;
+
+typedef struct _STRING_RUN {
+    HEM_QWORD Start;
+    DWORD Length;
+    DWORD TextLength;
+    CHAR Text[STRINGS_MAX_TEXT];
+} STRING_RUN, *PSTRING_RUN;
+
+typedef struct _STRING_SCAN {
+    DWORD Encoding;
+    DWORD MinLength;
+
+    // UTF-16 can start at either alignment, so there are two runs.
+    STRING_RUN Runs[2];
+
+    // The last byte of a chunk, which might be half of a character.
+    BYTE Carry;
+    BOOL HasCarry;
+
+    VLIST Results;
+    PCHAR Pool;
+    DWORD PoolSize;
+    DWORD PoolCapacity;
+    BOOL Full;
+} STRING_SCAN, *PSTRING_SCAN;
+
+static PCHAR EncodingNames[STRING_ENCODINGS] = {
+    "ascii",
+    "utf16le",
+    "utf16be",
+};
+
+// Remember the settings from last time.
+static BOOL StringEncodings[STRING_ENCODINGS] = { TRUE, TRUE, FALSE };
+static DWORD StringMinLength = 4;
+static BOOL StringComments;
+
+// The last results, so they can be shown again.
+static struct {
+    VLIST List;
+    PCHAR Pool;
+    DWORD PoolSize;
+    DWORD OffsetWidth;
+} Strings;
+
+// A search running on another thread, merged into Strings when it's
+// collected.
+typedef struct _STRINGS_BACKGROUND {
+    STRING_SCAN Scans[STRING_ENCODINGS];
+    DWORD Count;
+    RESULT_KEY Key;
+    BOOL Comments;
+} STRINGS_BACKGROUND, *PSTRINGS_BACKGROUND;
+
+// Printable ascii (0x20 to 0x7E) or a tab. Adding 0x60 moves the printable
+// range to the bottom of the signed bytes, so one compare does it.
+static __m128i PrintableBytes(__m128i Bytes)
+{
+    __m128i Shifted = _mm_add_epi8(Bytes, _mm_set1_epi8(0x60));
+
+    return _mm_or_si128(_mm_cmpgt_epi8(_mm_set1_epi8(-33), Shifted),
+                        _mm_cmpeq_epi8(Bytes, _mm_set1_epi8('\t')));
+}
+
+static BOOL IsPrintable(BYTE Byte)
+{
+    return (Byte >= 0x20 && Byte <= 0x7E) || Byte == '\t';
+}
+
+static VOID EndRun(PSTRING_SCAN Scan, PSTRING_RUN Run)
+{
+    PSTRING_RECORD Record;
+
+    if (Run->Length >= Scan->MinLength && !Scan->Full) {
+        if (Scan->PoolSize + Run->TextLength > Scan->PoolCapacity) {
+            DWORD Capacity = max(Scan->PoolCapacity * 2, 64 * 1024);
+            PCHAR Pool = realloc(Scan->Pool, Capacity);
+
+            if (Pool == NULL) {
+                Scan->Full = TRUE;
+                goto finished;
+            }
+
+            Scan->Pool = Pool;
+            Scan->PoolCapacity = Capacity;
+        }
+
+        if ((Record = AppendVirtualList(&Scan->Results)) == NULL) {
+            Scan->Full = TRUE;
+            goto finished;
+        }
+
+        memcpy(Scan->Pool + Scan->PoolSize, Run->Text, Run->TextLength);
+
+        Record->Offset = Run->Start;
+        Record->Length = Run->Length;
+        Record->Text = Scan->PoolSize;
+        Record->TextLength = Run->TextLength;
+        Record->Encoding = Scan->Encoding;
+
+        Scan->PoolSize += Run->TextLength;
+    }
+
+finished:
+    Run->Length = 0;
+    Run->TextLength = 0;
+}
+
+// Bit i of Mask says if character i is printable, Text has one byte for each
+// character.
+static VOID AddCharacters(PSTRING_SCAN Scan,
+                          PSTRING_RUN Run,
+                          DWORD Mask,
+                          DWORD Count,
+                          HEM_QWORD Offset,
+                          const BYTE *Text,
+                          DWORD CharSize)
+{
+    unsigned long Next;
+
+    // Nothing here, and nothing to finish.
+    if (Mask == 0 && Run->Length == 0)
+        return;
+
+    for (DWORD i = 0; i < Count; i += Next) {
+        DWORD Bits = Mask >> i;
+
+        if (Bits & 1) {
+            DWORD Copy;
+
+            if (!_BitScanForward(&Next, ~Bits) || Next > Count - i)
+                Next = Count - i;
+
+            if (Run->Length == 0)
+                Run->Start = Offset + i * CharSize;
+
+            Copy = min(Next, STRINGS_MAX_TEXT - Run->TextLength);
+
+            memcpy(Run->Text + Run->TextLength, Text + i, Copy);
+
+            Run->TextLength += Copy;
+            Run->Length += Next;
+        } else {
+            if (Run->Length)
+                EndRun(Scan, Run);
+
+            if (!_BitScanForward(&Next, Bits) || Next > Count - i)
+                Next = Count - i;
+        }
+    }
+}
+
+static VOID ScanAscii(PSTRING_SCAN Scan, HEM_QWORD Offset, const BYTE *Data, DWORD Length)
+{
+    DWORD i = 0;
+
+    for (; i + 16 <= Length; i += 16) {
+        DWORD Mask = _mm_movemask_epi8(PrintableBytes(_mm_loadu_si128((const __m128i *)(Data + i))));
+
+        AddCharacters(Scan, &Scan->Runs[0], Mask, 16, Offset + i, Data + i, 1);
+    }
+
+    for (; i < Length; i++) {
+        AddCharacters(Scan, &Scan->Runs[0], IsPrintable(Data[i]), 1, Offset + i, Data + i, 1);
+    }
+}
+
+// Scan Count characters of UTF-16, the low and high bytes are separated so
+// I can use the same test as ascii.
+static VOID ScanWide(PSTRING_SCAN Scan, PSTRING_RUN Run, HEM_QWORD Offset, const BYTE *Data, DWORD Count)
+{
+    BOOL BigEndian = Scan->Encoding == STRING_UTF16BE;
+    __m128i LowMask = _mm_set1_epi16(0x00FF);
+    __m128i Zero = _mm_setzero_si128();
+    BYTE Text[16];
+    DWORD i = 0;
+
+    for (; i + 16 <= Count; i += 16) {
+        __m128i First = _mm_loadu_si128((const __m128i *)(Data + i * 2));
+        __m128i Second = _mm_loadu_si128((const __m128i *)(Data + i * 2 + 16));
+        __m128i Low = _mm_packus_epi16(_mm_and_si128(First, LowMask), _mm_and_si128(Second, LowMask));
+        __m128i High = _mm_packus_epi16(_mm_srli_epi16(First, 8), _mm_srli_epi16(Second, 8));
+        __m128i Char = BigEndian ? High : Low;
+        __m128i Upper = BigEndian ? Low : High;
+        DWORD Mask = _mm_movemask_epi8(_mm_and_si128(PrintableBytes(Char), _mm_cmpeq_epi8(Upper, Zero)));
+
+        _mm_storeu_si128((__m128i *) Text, Char);
+
+        AddCharacters(Scan, Run, Mask, 16, Offset + i * 2, Text, 2);
+    }
+
+    for (; i < Count; i++) {
+        BYTE Char = Data[i * 2 + BigEndian];
+        BYTE Upper = Data[i * 2 + !BigEndian];
+
+        AddCharacters(Scan, Run, IsPrintable(Char) && Upper == 0, 1, Offset + i * 2, &Char, 2);
+    }
+}
+
+static BOOL ScanChunk(PVOID Context, HEM_QWORD Offset, const BYTE *Data, DWORD Length)
+{
+    PSTRING_SCAN Scan = Context;
+
+    if (Scan->Encoding == STRING_ASCII) {
+        ScanAscii(Scan, Offset, Data, Length);
+        return !Scan->Full;
+    }
+
+    // Chunks are always an even size until the last one, so characters at
+    // odd alignment straddle them.
+    if (Scan->HasCarry) {
+        BYTE Pair[2] = { Scan->Carry, Data[0] };
+
+        ScanWide(Scan, &Scan->Runs[1], Offset - 1, Pair, 1);
+    }
+
+    ScanWide(Scan, &Scan->Runs[0], Offset, Data, Length / 2);
+    ScanWide(Scan, &Scan->Runs[1], Offset + 1, Data + 1, (Length - 1) / 2);
+
+    Scan->HasCarry = Length % 2 == 0;
+    Scan->Carry = Data[Length - 1];
+
+    return !Scan->Full;
+}
+
+static int __cdecl CompareStrings(const void *a, const void *b)
+{
+    const STRING_RECORD *x = a;
+    const STRING_RECORD *y = b;
+
+    if (x->Offset != y->Offset)
+        return x->Offset < y->Offset ? -1 : 1;
+
+    return x->Encoding - y->Encoding;
+}
+
+// UTF-16 text also looks like the other byte order a byte later (or
+// earlier), e.g. "A\0B\0C\0" is "\0B\0C" in big endian. I prefer little
+// endian, so drop the big endian copy.
+static BOOL IsShiftedCopy(PSTRING_RECORD Record, PSTRING_RECORD Other)
+{
+    if (Record->Encoding != STRING_UTF16BE || Other->Encoding != STRING_UTF16LE)
+        return FALSE;
+
+    return Record->Offset + 1 == Other->Offset || Record->Offset == Other->Offset + 1;
+}
+
+// Combine the results of every encoding, sorted by offset.
+static BOOL MergeResults(PSTRING_SCAN Scans, DWORD Count)
+{
+    PSTRING_RECORD Records;
+    DWORD PoolSize = 0;
+    DWORD Total = 0;
+    DWORD Kept = 0;
+
+    for (DWORD i = 0; i < Count; i++) {
+        Total += Scans[i].Results.Count;
+        PoolSize += Scans[i].PoolSize;
+    }
+
+    InitVirtualList(&Strings.List, sizeof(STRING_RECORD), NULL, NULL);
+
+    if (!ResizeVirtualList(&Strings.List, Total) || (Strings.Pool = malloc(max(PoolSize, 1))) == NULL)
+        return FALSE;
+
+    Records = GetVirtualListRecord(&Strings.List, 0);
+    PoolSize = 0;
+    Total = 0;
+
+    for (DWORD i = 0; i < Count; i++) {
+        PSTRING_RECORD Scanned = GetVirtualListRecord(&Scans[i].Results, 0);
+
+        memcpy(Strings.Pool + PoolSize, Scans[i].Pool, Scans[i].PoolSize);
+
+        for (DWORD j = 0; j < Scans[i].Results.Count; j++) {
+            Records[Total] = Scanned[j];
+            Records[Total++].Text += PoolSize;
+        }
+
+        PoolSize += Scans[i].PoolSize;
+    }
+
+    Strings.PoolSize = PoolSize;
+
+    qsort(Records, Total, sizeof *Records, CompareStrings);
+
+    for (DWORD i = 0; i < Total; i++) {
+        if (i > 0 && IsShiftedCopy(&Records[i], &Records[i - 1]))
+            continue;
+        if (i + 1 < Total && IsShiftedCopy(&Records[i], &Records[i + 1]))
+            continue;
+
+        Records[Kept++] = Records[i];
+    }
+
+    return ResizeVirtualList(&Strings.List, Kept);
+}
+
+static VOID FreeStrings(VOID)
+{
+    FreeVirtualList(&Strings.List);
+    free(Strings.Pool);
+
+    Strings.Pool = NULL;
+    Strings.PoolSize = 0;
+}
+
+// The saved results are the count and pool size, then the records and the
+// pool.
+static VOID SaveStrings(PRESULT_KEY Key)
+{
+    DWORD Sizes[2] = { Strings.List.Count, Strings.PoolSize };
+    RESULT_PART Parts[] = {
+        { Sizes, sizeof Sizes },
+        { GetVirtualListRecord(&Strings.List, 0), (SIZE_T) Strings.List.Count * sizeof(STRING_RECORD) },
+        { Strings.Pool, Strings.PoolSize },
+    };
+
+    SaveCachedResult(Key, Parts, _countof(Parts));
+}
+
+static BOOL LoadStrings(PRESULT_KEY Key)
+{
+    const DWORD *Sizes;
+    SIZE_T Records;
+    SIZE_T Size;
+
+    if ((Sizes = FindCachedResult(Key, &Size)) == NULL || Size < 2 * sizeof(DWORD))
+        return FALSE;
+
+    Records = (SIZE_T) Sizes[0] * sizeof(STRING_RECORD);
+
+    if (Size != 2 * sizeof(DWORD) + Records + Sizes[1])
+        return FALSE;
+
+    InitVirtualList(&Strings.List, sizeof(STRING_RECORD), NULL, NULL);
+
+    if (!ResizeVirtualList(&Strings.List, Sizes[0]) || (Strings.Pool = malloc(max(Sizes[1], 1))) == NULL) {
+        FreeStrings();
+        return FALSE;
+    }
+
+    CopyMemory(GetVirtualListRecord(&Strings.List, 0), Sizes + 2, Records);
+    CopyMemory(Strings.Pool, (PBYTE)(Sizes + 2) + Records, Sizes[1]);
+
+    Strings.PoolSize = Sizes[1];
+    return TRUE;
+}
+
+static VOID FormatStringText(PVOID Context, DWORD Index, const VOID *Record, PCHAR Buffer, SIZE_T Size)
+{
+    const STRING_RECORD *String = Record;
+
+    snprintf(Buffer, Size, "%.*s", String->TextLength, Strings.Pool + String->Text);
+}
+
+static VOID FormatString(PVOID Context, DWORD Index, const VOID *Record, PCHAR Buffer, SIZE_T Size)
+{
+    const STRING_RECORD *String = Record;
+
+    snprintf(Buffer,
+             Size,
+             "%0*llX %-7s %5u  %.*s%s",
+             Strings.OffsetWidth,
+             String->Offset,
+             EncodingNames[String->Encoding],
+             String->Length,
+             String->TextLength,
+             Strings.Pool + String->Text,
+             String->Length > String->TextLength ? "..." : "");
+
+    // Tabs would mess up the menu.
+    for (PCHAR Tab = strchr(Buffer, '\t'); Tab; Tab = strchr(Tab, '\t')) {
+        *Tab = ' ';
+    }
+}
+
+// The first string at or after Offset.
+static DWORD FindStringByOffset(HEM_QWORD Offset)
+{
+    DWORD Low = 0;
+    DWORD High = Strings.List.Count;
+
+    while (Low < High) {
+        DWORD Middle = Low + (High - Low) / 2;
+        PSTRING_RECORD Record = GetVirtualListRecord(&Strings.List, Middle);
+
+        if (Record->Offset < Offset) {
+            Low = Middle + 1;
+        } else {
+            High = Middle;
+        }
+    }
+
+    return Low;
+}
+
+static BOOL AddComments(VOID)
+{
+    CHAR Comment[STRINGS_MAX_COMMENT + 4];
+    JOB Job;
+
+    BeginJob(&Job, "Adding comments", Strings.List.Count);
+
+    for (DWORD i = 0; i < Strings.List.Count; i++) {
+        PSTRING_RECORD Record = GetVirtualListRecord(&Strings.List, i);
+
+        if (!UpdateJob(&Job, i))
+            break;
+
+        snprintf(Comment,
+                 sizeof Comment,
+                 "%.*s%s",
+                 min(Record->TextLength, STRINGS_MAX_COMMENT),
+                 Strings.Pool + Record->Text,
+                 Record->Length > STRINGS_MAX_COMMENT ? "..." : "");
+
+        HiewGate_Names_AddLocalComment(Record->Offset, Comment);
+    }
+
+    EndJob(&Job);
+
+    return !Job.Cancelled;
+}
+
+// Let the user change the settings until they choose to start. Returns 1 to
+// search, 2 to show the last results, 3 to search in the background, or 0 if
+// cancelled.
+static int SelectStringOptions(HEM_QWORD Offset, HEM_QWORD Length)
+{
+    static DWORD MinLengths[] = { 3, 4, 5, 6, 8, 10, 16, 32 };
+    CHAR Lines[STRING_ENCODINGS + 5][64];
+    PCHAR Menu[STRING_ENCODINGS + 5];
+    DWORD Count = STRING_ENCODINGS + 4;
+    DWORD Width = 0;
+    int Choice = 1;
+
+    while (TRUE) {
+        snprintf(Lines[0], sizeof Lines[0], "Find strings in %#llx bytes from %#llx", Length, Offset);
+
+        for (DWORD i = 0; i < STRING_ENCODINGS; i++) {
+            snprintf(Lines[i + 1],
+                     sizeof Lines[i + 1],
+                     "[%c] %s",
+                     StringEncodings[i] ? 'x' : ' ',
+                     EncodingNames[i]);
+        }
+
+        snprintf(Lines[STRING_ENCODINGS + 1], sizeof Lines[0], "Minimum length %u", StringMinLength);
+        snprintf(Lines[STRING_ENCODINGS + 2], sizeof Lines[0], "[%c] Add comments", StringComments ? 'x' : ' ');
+        snprintf(Lines[STRING_ENCODINGS + 3], sizeof Lines[0], "Search in the background");
+
+        if (Strings.List.Count) {
+            snprintf(Lines[STRING_ENCODINGS + 4], sizeof Lines[0], "Show the last %u strings", Strings.List.Count);
+            Count = STRING_ENCODINGS + 5;
+        }
+
+        for (DWORD i = 0; i < Count; i++) {
+            Menu[i] = Lines[i];
+            Width = max(Width, strlen(Lines[i]));
+        }
+
+        Choice = HiewGate_Menu("Strings", Menu, Count, Width, Choice, NULL, NULL, NULL, NULL);
+
+        if (Choice <= 0)
+            return 0;
+
+        if (Choice == 1 || Choice == STRING_ENCODINGS + 4)
+            break;
+
+        if (Choice <= STRING_ENCODINGS + 1) {
+            StringEncodings[Choice - 2] = !StringEncodings[Choice - 2];
+        } else if (Choice == STRING_ENCODINGS + 2) {
+            DWORD i = 0;
+
+            // Go to the next length, wrapping around.
+            while (i < _countof(MinLengths) && MinLengths[i] <= StringMinLength)
+                i++;
+
+            StringMinLength = MinLengths[i % _countof(MinLengths)];
+        } else if (Choice == STRING_ENCODINGS + 3) {
+            StringComments = !StringComments;
+        } else {
+            return 2;
+        }
+    }
+
+    for (DWORD i = 0; i < STRING_ENCODINGS; i++) {
+        if (StringEncodings[i])
+            return Choice == 1 ? 1 : 3;
+    }
+
+    HiewGate_Message("Strings", "No encodings were selected.");
+    return 0;
+}
+
+// Set up a scan for each selected encoding, returns how many there are.
+static DWORD PrepareScans(PSTRING_SCAN Scans, PSTREAM_CONSUMER Consumers)
+{
+    DWORD Count = 0;
+
+    for (DWORD i = 0; i < STRING_ENCODINGS; i++) {
+        if (StringEncodings[i] == FALSE)
+            continue;
+
+        Scans[Count].Encoding = i;
+        Scans[Count].MinLength = StringMinLength;
+
+        InitVirtualList(&Scans[Count].Results, sizeof(STRING_RECORD), NULL, NULL);
+
+        Consumers[Count].Routine = ScanChunk;
+        Consumers[Count].Context = &Scans[Count];
+        Count++;
+    }
+
+    return Count;
+}
+
+static VOID FreeScans(PSTRING_SCAN Scans, DWORD Count)
+{
+    for (DWORD i = 0; i < Count; i++) {
+        FreeVirtualList(&Scans[i].Results);
+        free(Scans[i].Pool);
+    }
+}
+
+// This runs on the job's thread. The scans only stop early when they're
+// full, and what was found is still worth showing.
+static LPCSTR FinishBackgroundSearch(PVOID Context, BOOL Complete)
+{
+    PSTRINGS_BACKGROUND Background = Context;
+
+    for (DWORD i = 0; i < Background->Count; i++) {
+        EndRun(&Background->Scans[i], &Background->Scans[i].Runs[0]);
+        EndRun(&Background->Scans[i], &Background->Scans[i].Runs[1]);
+    }
+
+    return NULL;
+}
+
+static LPCSTR CollectBackgroundSearch(PVOID Context, HEMCALL_TAG *HemCall)
+{
+    PSTRINGS_BACKGROUND Background = Context;
+    BOOL Full = FALSE;
+
+    for (DWORD i = 0; i < Background->Count; i++) {
+        Full |= Background->Scans[i].Full;
+    }
+
+    FreeStrings();
+
+    if (!MergeResults(Background->Scans, Background->Count)) {
+        FreeStrings();
+        return "Not enough memory.";
+    }
+
+    if (!Full)
+        SaveStrings(&Background->Key);
+
+    if (Background->Comments && Strings.List.Count)
+        AddComments();
+
+    return NULL;
+}
+
+static VOID FreeBackgroundSearch(PVOID Context)
+{
+    PSTRINGS_BACKGROUND Background = Context;
+
+    FreeScans(Background->Scans, Background->Count);
+    free(Background);
+}
+
+static VOID StartBackgroundSearch(HEMCALL_TAG *HemCall, PRESULT_KEY Key)
+{
+    BACKGROUND_TASK Task = { "Strings" };
+    PSTRINGS_BACKGROUND Background;
+    CHAR Message[128];
+
+    if ((Background = calloc(1, sizeof *Background)) == NULL) {
+        HiewGate_Message("Strings", "Not enough memory.");
+        return;
+    }
+
+    Background->Key = *Key;
+    Background->Comments = StringComments;
+    Background->Count = PrepareScans(Background->Scans, Task.Consumers);
+
+    Task.Count = Background->Count;
+    Task.Finish = FinishBackgroundSearch;
+    Task.Collect = CollectBackgroundSearch;
+    Task.Free = FreeBackgroundSearch;
+    Task.Context = Background;
+
+    if (StartBackgroundJob(&Task, HemCall, Key->Offset, Key->Length, Message, sizeof Message)) {
+        snprintf(Message,
+                 sizeof Message,
+                 "The search is running in the background, the strings are ready the next time you use this plugin.");
+    }
+
+    HiewGate_Message("Strings", Message);
+}
+
+int StringsEntryPoint(HEMCALL_TAG *HemCall)
+{
+    STRING_SCAN Scans[STRING_ENCODINGS] = {0};
+    STREAM_CONSUMER Consumers[STRING_ENCODINGS];
+    HIEWGATE_GETDATA HiewData;
+    JOB Job;
+    RESULT_KEY Key = { RESULT_STRINGS };
+    HEM_QWORD Offset;
+    HEM_QWORD Length;
+    CHAR Title[128];
+    SIZE_T Used;
+    SIZE_T Size;
+    BOOL Full = FALSE;
+    DWORD Count;
+    LONG Selected;
+    int Choice;
+    int Result;
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return HEM_ERROR;
+
+    GetMarkedRange(&HiewData, &Offset, &Length);
+
+    switch (Choice = SelectStringOptions(Offset, Length)) {
+        case 1:
+        case 3:
+            break;
+        case 2:
+            snprintf(Title, sizeof Title, "%u strings", Strings.List.Count);
+            goto show;
+        default:
+            return HEM_OK;
+    }
+
+    Key.Offset = Offset;
+    Key.Length = Length;
+    Key.Parameter = StringMinLength << STRING_ENCODINGS;
+
+    for (DWORD i = 0; i < STRING_ENCODINGS; i++) {
+        if (StringEncodings[i])
+            Key.Parameter |= 1 << i;
+    }
+
+    // No point searching in the background if it's been done before.
+    if (Choice == 3 && FindCachedResult(&Key, &Size) == NULL) {
+        StartBackgroundSearch(HemCall, &Key);
+        return HEM_OK;
+    }
+
+    FreeStrings();
+
+    // The same search might have been done before.
+    if (LoadStrings(&Key)) {
+        if (StringComments && Strings.List.Count)
+            AddComments();
+
+        snprintf(Title, sizeof Title, "%u strings, saved from last time", Strings.List.Count);
+        goto show;
+    }
+
+    Count = PrepareScans(Scans, Consumers);
+
+    BeginJob(&Job, "Finding strings", Length);
+
+    Result = StreamFileRange(&Job, Offset, Length, Consumers, Count);
+
+    EndJob(&Job);
+
+    for (DWORD i = 0; i < Count; i++) {
+        EndRun(&Scans[i], &Scans[i].Runs[0]);
+        EndRun(&Scans[i], &Scans[i].Runs[1]);
+
+        Full |= Scans[i].Full;
+    }
+
+    // If memory ran out, I can still show what was found.
+    if (Result == HEM_ERROR && Full)
+        Result = HEM_OK;
+
+    if (Result == HEM_OK && !MergeResults(Scans, Count)) {
+        FreeStrings();
+        Full = TRUE;
+    }
+
+    // Only complete results are worth keeping.
+    if (Result == HEM_OK && !Full)
+        SaveStrings(&Key);
+
+    if (Result == HEM_OK && StringComments && Strings.List.Count) {
+        if (!AddComments())
+            Result = HEM_KEYBREAK;
+    }
+
+    FreeScans(Scans, Count);
+
+    if (Result != HEM_OK) {
+        HiewGate_Message("Strings", Result == HEM_KEYBREAK ? "Cancelled." : "Hiew failed to read the file.");
+        return HEM_OK;
+    }
+
+    if (Full)
+        HiewGate_Message("Strings", "There wasn't enough memory for all of the strings, some are missing.");
+
+    Used = snprintf(Title, sizeof Title, "%u strings, ", Strings.List.Count);
+
+    FormatJobStats(&Job, Title + Used, sizeof Title - Used);
+
+show:
+    Strings.OffsetWidth = HiewData.filelength > 0xFFFFFFFF ? 16 : 8;
+    Strings.List.Format = FormatString;
+    Strings.List.SearchText = FormatStringText;
+
+    Selected = ShowVirtualList(&Strings.List,
+                               Title,
+                               STRINGS_MENU_WIDTH,
+                               FindStringByOffset(HiewData.offsetCurrent));
+
+    if (Selected >= 0) {
+        PSTRING_RECORD Record = GetVirtualListRecord(&Strings.List, Selected);
+
+        HemCall->returnOffset = Record->Offset;
+        HemCall->returnActionFlag |= HEM_RETURN_SETOFFSET;
+    }
+
+    return HEM_OK;
+}
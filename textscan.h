@@ -0,0 +1,8 @@
+#ifndef __TEXTSCAN_H
+#define __TEXTSCAN_H
+
+// Finds ascii and UTF-16 strings in the marked block (or the whole file),
+// choosing one jumps to it.
+int StringsEntryPoint(HEMCALL_TAG *HemCall);
+
+#endif
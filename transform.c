@@ -0,0 +1,602 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <intrin.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "stream.h"
+#include "journal.h"
+#include "wcache.h"
+#include "transform.h"
+
+// Decrypting a blob with a crypt script in Hiew goes a byte at a time through
+// the interpreter, which takes minutes for a few megabytes. This reads the
+// marked block in big chunks, transforms them with SSE2 (or AVX2 if the CPU
+// has it) and writes them back, all in one undo transaction if the journal
+// has room for it.
+//
+// Keys repeat from the start of the block. They're expanded once to a length
+// that's a multiple of the vector size, so every vector lines up with the
+// same part of the expanded key each time round and there's no shuffling in
+// the loop.
+
+#define TRANSFORM_CHUNK_SIZE    (2 * 1024 * 1024)
+#define TRANSFORM_MAX_KEY       256
+#define TRANSFORM_MAX_TEXT      256
+#define TRANSFORM_VECTOR        32
+
+typedef enum _TRANSFORM_OPERATION {
+    TRANSFORM_XOR,
+    TRANSFORM_ADD,
+    TRANSFORM_SUB,
+    TRANSFORM_ROL,
+    TRANSFORM_ROR,
+    TRANSFORM_SWAP,
+    TRANSFORM_FILL,
+    TRANSFORM_OPERATIONS,
+} TRANSFORM_OPERATION;
+
+static LPCSTR OperationNames[] = { "XOR", "ADD", "SUB", "ROL", "ROR", "Byte swap", "Fill" };
+
+typedef struct _TRANSFORM {
+    TRANSFORM_OPERATION Operation;
+    DWORD Width;            // Element size, 1, 2 or 4 (2, 4 or 8 for swaps).
+    DWORD Count;            // Bits to rotate.
+    BYTE Key[TRANSFORM_MAX_KEY];
+    DWORD KeyLength;
+
+    // The key repeated to a multiple of TRANSFORM_VECTOR.
+    PBYTE Expanded;
+    DWORD ExpandedLength;
+} TRANSFORM, *PTRANSFORM;
+
+// Remember the settings from last time.
+static TRANSFORM_OPERATION TransformOperation;
+static DWORD TransformWidth = 1;
+static CHAR TransformText[TRANSFORM_MAX_TEXT];
+
+static BOOL HasAvx2(VOID)
+{
+    int CpuInfo[4];
+
+    __cpuid(CpuInfo, 0);
+
+    if (CpuInfo[0] < 7)
+        return FALSE;
+
+    __cpuid(CpuInfo, 1);
+
+    // The OS has to save the upper halves of the registers too.
+    if (!(CpuInfo[2] & (1 << 27)) || !(CpuInfo[2] & (1 << 28)) || (_xgetbv(0) & 6) != 6)
+        return FALSE;
+
+    __cpuidex(CpuInfo, 7, 0);
+
+    return !!(CpuInfo[1] & (1 << 5));
+}
+
+// Swaps can be words, dwords or qwords, everything else bytes, words or
+// dwords.
+static DWORD NextWidth(TRANSFORM_OPERATION Operation, DWORD Width)
+{
+    if (Operation == TRANSFORM_SWAP)
+        return Width >= 8 ? 2 : Width * 2;
+
+    return Width >= 4 ? 1 : Width * 2;
+}
+
+static DWORD ValidWidth(TRANSFORM_OPERATION Operation, DWORD Width)
+{
+    if (Operation == TRANSFORM_SWAP)
+        return max(Width, 2);
+
+    return min(Width, 4);
+}
+
+static LPCSTR WidthName(DWORD Width)
+{
+    switch (Width) {
+        case 1: return "byte";
+        case 2: return "word";
+        case 4: return "dword";
+        case 8: return "qword";
+    }
+
+    return "?";
+}
+
+// Parse the key, a list of numbers the size of an element (stored little
+// endian) or quoted strings. Rotates only want the count.
+static BOOL ParseKey(PTRANSFORM Transform, LPCSTR Text)
+{
+    LPCSTR p = Text;
+
+    Transform->KeyLength = 0;
+
+    while (*p) {
+        ULONGLONG Value;
+        PCHAR End;
+
+        if (*p == ' ' || *p == ',' || *p == '\t') {
+            p++;
+            continue;
+        }
+
+        if (*p == '"') {
+            for (p++; *p && *p != '"'; p++) {
+                if (Transform->KeyLength == TRANSFORM_MAX_KEY)
+                    return FALSE;
+
+                Transform->Key[Transform->KeyLength++] = *p;
+            }
+
+            if (*p++ != '"')
+                return FALSE;
+
+            continue;
+        }
+
+        Value = _strtoui64(p, &End, 0);
+
+        if (End == p)
+            return FALSE;
+
+        // Allow -1 and so on.
+        if (*p == '-')
+            Value = (ULONGLONG) _strtoi64(p, &End, 0);
+
+        p = End;
+
+        if (Transform->Operation == TRANSFORM_ROL || Transform->Operation == TRANSFORM_ROR) {
+            Transform->Count = (DWORD) (Value % (Transform->Width * 8));
+            return *p == '\0';
+        }
+
+        if (Transform->Width < 8 && (LONGLONG) Value >= 0 && Value >> (Transform->Width * 8))
+            return FALSE;
+
+        if (Transform->KeyLength + Transform->Width > TRANSFORM_MAX_KEY)
+            return FALSE;
+
+        CopyMemory(Transform->Key + Transform->KeyLength, &Value, Transform->Width);
+        Transform->KeyLength += Transform->Width;
+    }
+
+    if (Transform->Operation == TRANSFORM_ROL || Transform->Operation == TRANSFORM_ROR)
+        return FALSE;
+
+    return Transform->KeyLength && Transform->KeyLength % Transform->Width == 0;
+}
+
+static BOOL ExpandKey(PTRANSFORM Transform)
+{
+    DWORD a = Transform->KeyLength;
+    DWORD b = TRANSFORM_VECTOR;
+
+    // Swaps don't need a key, but this is simpler if there's one.
+    if (Transform->KeyLength == 0) {
+        Transform->Key[0] = 0;
+        Transform->KeyLength = a = 1;
+    }
+
+    // The least common multiple of the key and vector lengths.
+    while (b) {
+        DWORD t = a % b;
+        a = b;
+        b = t;
+    }
+
+    Transform->ExpandedLength = Transform->KeyLength / a * TRANSFORM_VECTOR;
+
+    if ((Transform->Expanded = malloc(Transform->ExpandedLength)) == NULL)
+        return FALSE;
+
+    for (DWORD i = 0; i < Transform->ExpandedLength; i++) {
+        Transform->Expanded[i] = Transform->Key[i % Transform->KeyLength];
+    }
+
+    return TRUE;
+}
+
+// One element at a time, for whatever doesn't fill a vector. Position is
+// where Data is in the block.
+static VOID TransformScalar(PTRANSFORM Transform, PBYTE Data, DWORD Length, ULONGLONG Position)
+{
+    DWORD Width = Transform->Width;
+    DWORD Bits = Width * 8;
+    ULONGLONG Mask = Width == 8 ? ~0ULL : (1ULL << Bits) - 1;
+
+    for (DWORD i = 0; i + Width <= Length; i += Width) {
+        const BYTE *Key = Transform->Expanded + (Position + i) % Transform->ExpandedLength;
+        ULONGLONG Value = 0;
+        ULONGLONG KeyValue = 0;
+
+        CopyMemory(&Value, Data + i, Width);
+        CopyMemory(&KeyValue, Key, Width);
+
+        switch (Transform->Operation) {
+            case TRANSFORM_XOR:
+                Value ^= KeyValue;
+                break;
+            case TRANSFORM_ADD:
+                Value += KeyValue;
+                break;
+            case TRANSFORM_SUB:
+                Value -= KeyValue;
+                break;
+            case TRANSFORM_ROL:
+                Value = Transform->Count ? Value << Transform->Count | Value >> (Bits - Transform->Count) : Value;
+                break;
+            case TRANSFORM_ROR:
+                Value = Transform->Count ? Value >> Transform->Count | Value << (Bits - Transform->Count) : Value;
+                break;
+            case TRANSFORM_SWAP:
+                Value = _byteswap_uint64(Value) >> (64 - Bits);
+                break;
+            case TRANSFORM_FILL:
+                Value = KeyValue;
+                break;
+        }
+
+        Value &= Mask;
+
+        CopyMemory(Data + i, &Value, Width);
+    }
+}
+
+static __m128i RotateLeft128(__m128i Value, DWORD Width, DWORD Count)
+{
+    switch (Width) {
+        case 1:
+            // There are no byte shifts, so shift words and throw away what
+            // crossed over.
+            return _mm_or_si128(_mm_and_si128(_mm_slli_epi16(Value, Count), _mm_set1_epi8((CHAR) (0xFF << Count))),
+                                _mm_and_si128(_mm_srli_epi16(Value, 8 - Count), _mm_set1_epi8((CHAR) (0xFF >> (8 - Count)))));
+        case 2:
+            return _mm_or_si128(_mm_slli_epi16(Value, Count), _mm_srli_epi16(Value, 16 - Count));
+    }
+
+    return _mm_or_si128(_mm_slli_epi32(Value, Count), _mm_srli_epi32(Value, 32 - Count));
+}
+
+static __m128i SwapVector128(__m128i Value, DWORD Width)
+{
+    Value = _mm_or_si128(_mm_slli_epi16(Value, 8), _mm_srli_epi16(Value, 8));
+
+    if (Width == 4) {
+        Value = _mm_shufflelo_epi16(Value, _MM_SHUFFLE(2, 3, 0, 1));
+        Value = _mm_shufflehi_epi16(Value, _MM_SHUFFLE(2, 3, 0, 1));
+    } else if (Width == 8) {
+        Value = _mm_shufflelo_epi16(Value, _MM_SHUFFLE(0, 1, 2, 3));
+        Value = _mm_shufflehi_epi16(Value, _MM_SHUFFLE(0, 1, 2, 3));
+    }
+
+    return Value;
+}
+
+// Returns how much was done, Position has to be a multiple of the vector
+// size.
+static DWORD TransformSse2(PTRANSFORM Transform, PBYTE Data, DWORD Length, ULONGLONG Position)
+{
+    DWORD Width = Transform->Width;
+    DWORD Rotate = Transform->Operation == TRANSFORM_ROR ? Width * 8 - Transform->Count : Transform->Count;
+    DWORD KeyIndex = (DWORD) (Position % Transform->ExpandedLength);
+    DWORD i;
+
+    for (i = 0; i + sizeof(__m128i) <= Length; i += sizeof(__m128i)) {
+        __m128i Value = _mm_loadu_si128((__m128i *) (Data + i));
+        __m128i Key = _mm_loadu_si128((__m128i *) (Transform->Expanded + KeyIndex));
+
+        switch (Transform->Operation) {
+            case TRANSFORM_XOR:
+                Value = _mm_xor_si128(Value, Key);
+                break;
+            case TRANSFORM_ADD:
+                Value = Width == 1 ? _mm_add_epi8(Value, Key) : Width == 2 ? _mm_add_epi16(Value, Key) : _mm_add_epi32(Value, Key);
+                break;
+            case TRANSFORM_SUB:
+                Value = Width == 1 ? _mm_sub_epi8(Value, Key) : Width == 2 ? _mm_sub_epi16(Value, Key) : _mm_sub_epi32(Value, Key);
+                break;
+            case TRANSFORM_ROL:
+            case TRANSFORM_ROR:
+                if (Rotate % (Width * 8))
+                    Value = RotateLeft128(Value, Width, Rotate % (Width * 8));
+                break;
+            case TRANSFORM_SWAP:
+                Value = SwapVector128(Value, Width);
+                break;
+            case TRANSFORM_FILL:
+                Value = Key;
+                break;
+        }
+
+        _mm_storeu_si128((__m128i *) (Data + i), Value);
+
+        KeyIndex += sizeof(__m128i);
+
+        if (KeyIndex == Transform->ExpandedLength)
+            KeyIndex = 0;
+    }
+
+    return i;
+}
+
+static __m256i RotateLeft256(__m256i Value, DWORD Width, DWORD Count)
+{
+    switch (Width) {
+        case 1:
+            return _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi16(Value, Count), _mm256_set1_epi8((CHAR) (0xFF << Count))),
+                                   _mm256_and_si256(_mm256_srli_epi16(Value, 8 - Count), _mm256_set1_epi8((CHAR) (0xFF >> (8 - Count)))));
+        case 2:
+            return _mm256_or_si256(_mm256_slli_epi16(Value, Count), _mm256_srli_epi16(Value, 16 - Count));
+    }
+
+    return _mm256_or_si256(_mm256_slli_epi32(Value, Count), _mm256_srli_epi32(Value, 32 - Count));
+}
+
+static DWORD TransformAvx2(PTRANSFORM Transform, PBYTE Data, DWORD Length, ULONGLONG Position)
+{
+    DWORD Width = Transform->Width;
+    DWORD Rotate = Transform->Operation == TRANSFORM_ROR ? Width * 8 - Transform->Count : Transform->Count;
+    DWORD KeyIndex = (DWORD) (Position % Transform->ExpandedLength);
+    __m256i Shuffle;
+    DWORD i;
+
+    // Reverse each element, the shuffle works within each 128 bit lane.
+    switch (Width) {
+        case 2:
+            Shuffle = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                       1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+            break;
+        case 4:
+            Shuffle = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                       3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+            break;
+        default:
+            Shuffle = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                       7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+            break;
+    }
+
+    for (i = 0; i + sizeof(__m256i) <= Length; i += sizeof(__m256i)) {
+        __m256i Value = _mm256_loadu_si256((__m256i *) (Data + i));
+        __m256i Key = _mm256_loadu_si256((__m256i *) (Transform->Expanded + KeyIndex));
+
+        switch (Transform->Operation) {
+            case TRANSFORM_XOR:
+                Value = _mm256_xor_si256(Value, Key);
+                break;
+            case TRANSFORM_ADD:
+                Value = Width == 1 ? _mm256_add_epi8(Value, Key) : Width == 2 ? _mm256_add_epi16(Value, Key) : _mm256_add_epi32(Value, Key);
+                break;
+            case TRANSFORM_SUB:
+                Value = Width == 1 ? _mm256_sub_epi8(Value, Key) : Width == 2 ? _mm256_sub_epi16(Value, Key) : _mm256_sub_epi32(Value, Key);
+                break;
+            case TRANSFORM_ROL:
+            case TRANSFORM_ROR:
+                if (Rotate % (Width * 8))
+                    Value = RotateLeft256(Value, Width, Rotate % (Width * 8));
+                break;
+            case TRANSFORM_SWAP:
+                Value = _mm256_shuffle_epi8(Value, Shuffle);
+                break;
+            case TRANSFORM_FILL:
+                Value = Key;
+                break;
+        }
+
+        _mm256_storeu_si256((__m256i *) (Data + i), Value);
+
+        KeyIndex += sizeof(__m256i);
+
+        if (KeyIndex == Transform->ExpandedLength)
+            KeyIndex = 0;
+    }
+
+    _mm256_zeroupper();
+
+    return i;
+}
+
+// Transform Length bytes at Position in the block, Position has to be a
+// multiple of the vector size.
+static VOID TransformBuffer(PTRANSFORM Transform, BOOL Avx2, PBYTE Data, DWORD Length, ULONGLONG Position)
+{
+    DWORD Done;
+
+    if (Avx2) {
+        Done = TransformAvx2(Transform, Data, Length, Position);
+    } else {
+        Done = TransformSse2(Transform, Data, Length, Position);
+    }
+
+    TransformScalar(Transform, Data + Done, Length - Done, Position + Done);
+
+    // These work on bytes, so a partial element at the end still counts.
+    if (Transform->Operation == TRANSFORM_XOR || Transform->Operation == TRANSFORM_FILL) {
+        DWORD Tail = Length % Transform->Width;
+        DWORD Start = Length - Tail;
+
+        for (DWORD i = Start; i < Length; i++) {
+            BYTE Key = Transform->Expanded[(Position + i) % Transform->ExpandedLength];
+
+            Data[i] = Transform->Operation == TRANSFORM_XOR ? Data[i] ^ Key : Key;
+        }
+    }
+}
+
+// Let the user change the settings until they choose to start. Returns FALSE
+// if cancelled.
+static BOOL SelectTransformOptions(HEM_QWORD Offset, HEM_QWORD Length)
+{
+    CHAR Lines[4][TRANSFORM_MAX_TEXT + 32];
+    PCHAR Menu[4];
+    DWORD Count;
+    DWORD Width;
+    int Choice = 1;
+
+    while (TRUE) {
+        BOOL Rotate = TransformOperation == TRANSFORM_ROL || TransformOperation == TRANSFORM_ROR;
+
+        snprintf(Lines[0], sizeof Lines[0], "Apply to %#llx bytes from %#llx", Length, Offset);
+        snprintf(Lines[1], sizeof Lines[0], "Operation %s", OperationNames[TransformOperation]);
+        snprintf(Lines[2], sizeof Lines[0], "Width %s", WidthName(TransformWidth));
+        snprintf(Lines[3], sizeof Lines[0], "%s %s", Rotate ? "Bits" : "Key", *TransformText ? TransformText : "(not set)");
+
+        Count = TransformOperation == TRANSFORM_SWAP ? 3 : 4;
+        Width = 0;
+
+        for (DWORD i = 0; i < Count; i++) {
+            Menu[i] = Lines[i];
+            Width = max(Width, strlen(Lines[i]));
+        }
+
+        Choice = HiewGate_Menu("Transform", Menu, Count, Width, Choice, NULL, NULL, NULL, NULL);
+
+        switch (Choice) {
+            case 1:
+                if (*TransformText || TransformOperation == TRANSFORM_SWAP)
+                    return TRUE;
+                // Fallthrough, there's no key yet.
+            case 4:
+                HiewGate_GetString(Rotate ? "Bits to rotate"
+                                          : "Key, numbers the size of the width or \"text\" (e.g. 0x41 0x42, \"secret\")",
+                                   TransformText,
+                                   sizeof TransformText);
+                break;
+            case 2:
+                TransformOperation = (TransformOperation + 1) % TRANSFORM_OPERATIONS;
+                TransformWidth = ValidWidth(TransformOperation, TransformWidth);
+                break;
+            case 3:
+                TransformWidth = NextWidth(TransformOperation, TransformWidth);
+                break;
+            default:
+                return FALSE;
+        }
+    }
+}
+
+int TransformEntryPoint(HEMCALL_TAG *HemCall)
+{
+    TRANSFORM Transform = {0};
+    HIEWGATE_GETDATA HiewData;
+    JOB Job;
+    HEM_QWORD Offset;
+    HEM_QWORD Length;
+    HEM_QWORD Done;
+    CHAR Message[256];
+    LPCSTR Error = NULL;
+    PBYTE Buffer;
+    SIZE_T Used;
+    BOOL Recorded;
+    BOOL Avx2;
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return HEM_ERROR;
+
+    // Doing the whole file by accident would be a shame.
+    if (HiewData.sizeMark == 0 || HiewData.offsetMark1 >= HiewData.filelength) {
+        HiewGate_Message("Transform", "Mark the block to transform first.");
+        return HEM_OK;
+    }
+
+    GetMarkedRange(&HiewData, &Offset, &Length);
+
+    if (!SelectTransformOptions(Offset, Length))
+        return HEM_OK;
+
+    Transform.Operation = TransformOperation;
+    Transform.Width = TransformWidth;
+
+    if (Transform.Operation != TRANSFORM_SWAP && !ParseKey(&Transform, TransformText)) {
+        if (Transform.Operation == TRANSFORM_ROL || Transform.Operation == TRANSFORM_ROR) {
+            snprintf(Message, sizeof Message, "Enter how many bits to rotate by.");
+        } else {
+            snprintf(Message, sizeof Message, "The key should be %s values or quoted text, up to %u bytes.", WidthName(Transform.Width), TRANSFORM_MAX_KEY);
+        }
+
+        HiewGate_Message("Transform", Message);
+        return HEM_OK;
+    }
+
+    // The journal keeps the old and new bytes, so a big block would throw
+    // away all the undo history and still not be undoable.
+    if (!CanJournalWrite(Length) && !ConfirmWithoutUndo("Transform it"))
+        return HEM_OK;
+
+    if (HiewGate_FileOpenForWrite() != HEM_OK) {
+        HiewGate_Message("Transform", "The file is read only.");
+        return HEM_OK;
+    }
+
+    if (!ExpandKey(&Transform) || (Buffer = malloc(TRANSFORM_CHUNK_SIZE)) == NULL) {
+        free(Transform.Expanded);
+        HiewGate_Message("Transform", "Not enough memory.");
+        return HEM_OK;
+    }
+
+    Avx2 = HasAvx2();
+
+    BeginJob(&Job, "Transforming", Length);
+    BeginJournalTransaction("Transform");
+
+    // The chunk size is a multiple of every width and the vector size, so
+    // each chunk starts at the beginning of an element and a vector.
+    for (Done = 0; Done < Length; Done += TRANSFORM_CHUNK_SIZE) {
+        DWORD Size = (DWORD) min(TRANSFORM_CHUNK_SIZE, Length - Done);
+
+        if (!UpdateJob(&Job, Done))
+            break;
+
+        // A fill doesn't care what was there.
+        if (Transform.Operation != TRANSFORM_FILL && HiewGate_FileRead(Offset + Done, Size, Buffer) != (int) Size) {
+            Error = "Hiew failed to read the file.";
+            break;
+        }
+
+        TransformBuffer(&Transform, Avx2, Buffer, Size, Done);
+
+        if (CachedFileWrite(Offset + Done, Size, Buffer) != HEM_OK) {
+            Error = "Hiew failed to write to the file.";
+            break;
+        }
+    }
+
+    if (!FlushFileWrites() && Error == NULL)
+        Error = "Hiew failed to write to the file.";
+
+    Recorded = EndJournalTransaction();
+    EndJob(&Job);
+
+    free(Buffer);
+    free(Transform.Expanded);
+
+    if (Error || Job.Cancelled) {
+        snprintf(Message,
+                 sizeof Message,
+                 "%s %#llx bytes were changed, %s.",
+                 Error ? Error : "Cancelled.",
+                 min(Done, Length),
+                 Recorded ? "undo puts them back" : "and they can't be undone");
+        HiewGate_Message("Transform", Message);
+        return HEM_OK;
+    }
+
+    Used = snprintf(Message,
+                    sizeof Message,
+                    "%s %s, %s, ",
+                    OperationNames[Transform.Operation],
+                    WidthName(Transform.Width),
+                    Avx2 ? "AVX2" : "SSE2");
+
+    FormatJobStats(&Job, Message + Used, sizeof Message - Used);
+
+    HiewGate_Message("Transform", Message);
+    return HEM_OK;
+}
@@ -0,0 +1,8 @@
+#ifndef __TRANSFORM_H
+#define __TRANSFORM_H
+
+// XORs, adds, subtracts, rotates, byte swaps or fills the marked block with a
+// repeating key, in one undo transaction.
+int TransformEntryPoint(HEMCALL_TAG *HemCall);
+
+#endif
@@ -0,0 +1,51 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "util.h"
+
+// Small helpers shared by the features that compile things from text.
+
+PVOID AppendBuffer(PBUFFER Buffer, const VOID *Data, DWORD Size)
+{
+    PVOID Result;
+
+    if (Buffer->Size + Size > Buffer->Capacity) {
+        DWORD Capacity = max(Buffer->Capacity * 2, Buffer->Size + Size + 4096);
+        PBYTE Grown = realloc(Buffer->Data, Capacity);
+
+        if (Grown == NULL)
+            return NULL;
+
+        Buffer->Data = Grown;
+        Buffer->Capacity = Capacity;
+    }
+
+    Result = Buffer->Data + Buffer->Size;
+
+    if (Data) {
+        memcpy(Result, Data, Size);
+    } else {
+        ZeroMemory(Result, Size);
+    }
+
+    Buffer->Size += Size;
+    return Result;
+}
+
+BOOL ReplaceExtension(PCHAR FileName, SIZE_T Size, LPCSTR HemFile, LPCSTR NewExtension)
+{
+    PCHAR Extension;
+
+    if (strcpy_s(FileName, Size, HemFile) != 0)
+        return FALSE;
+
+    if ((Extension = strrchr(FileName, '.')) != NULL)
+        *Extension = '\0';
+
+    return strncat_s(FileName, Size, NewExtension, _TRUNCATE) == 0;
+}
@@ -0,0 +1,32 @@
+#ifndef __UTIL_H
+#define __UTIL_H
+
+// A growable byte array, e.g. for building tables while compiling.
+typedef struct _BUFFER {
+    PBYTE Data;
+    DWORD Size;
+    DWORD Capacity;
+} BUFFER, *PBUFFER;
+
+// Adds Size bytes to the end of Buffer, copied from Data or zeroed if it's
+// NULL. Returns where they went, or NULL if there isn't enough memory. The
+// data might move, so earlier pointers into it aren't valid after this.
+PVOID AppendBuffer(PBUFFER Buffer, const VOID *Data, DWORD Size);
+
+// Makes a filename next to the hem with a different extension, e.g.
+// keyhelp.hem to keyhelp.sig.
+BOOL ReplaceExtension(PCHAR FileName, SIZE_T Size, LPCSTR HemFile, LPCSTR NewExtension);
+
+// The value of a hex digit, or -1 if it isn't one.
+static __forceinline int HexDigit(BYTE c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,739 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <intrin.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "stream.h"
+#include "vlist.h"
+#include "secmap.h"
+#include "valscan.h"
+
+// Hiew can search for bytes, but not for "any dword between 0x1000 and
+// 0x2000", and a value could be at any alignment.
+//
+// Every 16 bytes is loaded once per alignment of the type, so together the
+// lanes cover every position exactly once. Big endian lanes are swapped in
+// the register. An integer x is in the range [Low, High] when x - Low <=
+// High - Low as unsigned, which works for signed ranges too because it's
+// only asking if x is on the arc from Low to High, so every integer type is
+// one subtract and one compare.
+
+#define VALUE_SLICE_SIZE (256 * 1024)
+#define VALUE_MAX_HITS (1024 * 1024)
+#define VALUE_MAX_TEXT 64
+
+// Enough of the last chunk for a value that crosses into this one.
+#define VALUE_KEEP 8
+
+// The vector loop reads a little past the end of the window.
+#define VALUE_PADDING 32
+
+#define VALUE_MENU_WIDTH 80
+
+// ColorMarker, black on cyan.
+#define VALUE_COLOR 0x30
+
+enum {
+    VALUE_INT8,
+    VALUE_INT16,
+    VALUE_INT32,
+    VALUE_INT64,
+    VALUE_FLOAT,
+    VALUE_DOUBLE,
+    VALUE_TYPES,
+};
+
+static PCHAR TypeNames[VALUE_TYPES] = {
+    "int8",
+    "int16",
+    "int32",
+    "int64",
+    "float",
+    "double",
+};
+
+static DWORD TypeSizes[VALUE_TYPES] = { 1, 2, 4, 8, 4, 8 };
+
+typedef struct _VALUE_HIT {
+    HEM_QWORD Offset;
+    BYTE Data[8];           // As it is in the file
+} VALUE_HIT, *PVALUE_HIT;
+
+// What to look for, the bounds are the bits of the type.
+typedef struct _VALUE_QUERY {
+    DWORD Type;
+    BOOL BigEndian;
+    ULONGLONG Low;
+    ULONGLONG High;
+    double LowFloat;
+    double HighFloat;
+} VALUE_QUERY, *PVALUE_QUERY;
+
+typedef struct _VALUE_SLICE {
+    DWORD Start;
+    DWORD End;
+    PVALUE_HIT Hits;
+    DWORD Count;
+    DWORD Capacity;
+    BOOL Failed;
+} VALUE_SLICE, *PVALUE_SLICE;
+
+typedef struct _VALUE_SCAN {
+    PVALUE_QUERY Query;
+    HEM_QWORD End;
+    HEM_QWORD Next;         // The first offset that hasn't been checked
+
+    PBYTE Window;
+    DWORD WindowLength;
+    DWORD WindowCapacity;
+    HEM_QWORD WindowOffset;
+
+    PVALUE_SLICE Slices;
+    DWORD SliceCount;
+    DWORD SliceCapacity;
+
+    PVLIST Hits;
+    BOOL Full;
+} VALUE_SCAN, *PVALUE_SCAN;
+
+// Remember the settings from last time.
+static VALUE_QUERY ValueQuery = { VALUE_INT32 };
+static CHAR ValueText[VALUE_MAX_TEXT];
+static BOOL ValueHighlight;
+
+// The last results, so they can be shown again and the markers removed.
+static struct {
+    VLIST List;
+    VALUE_QUERY Query;
+    DWORD OffsetWidth;
+    HEM_QWORD FileLength;
+    BOOL Marked;
+} Values;
+
+static __m128i SwapVector(__m128i Value, DWORD Size)
+{
+    if (Size == 1)
+        return Value;
+
+    Value = _mm_or_si128(_mm_slli_epi16(Value, 8), _mm_srli_epi16(Value, 8));
+
+    if (Size == 4) {
+        Value = _mm_shufflelo_epi16(Value, _MM_SHUFFLE(2, 3, 0, 1));
+        Value = _mm_shufflehi_epi16(Value, _MM_SHUFFLE(2, 3, 0, 1));
+    } else if (Size == 8) {
+        Value = _mm_shufflelo_epi16(Value, _MM_SHUFFLE(0, 1, 2, 3));
+        Value = _mm_shufflehi_epi16(Value, _MM_SHUFFLE(0, 1, 2, 3));
+    }
+
+    return Value;
+}
+
+// SSE2 has no unsigned compares, but flipping the sign bits makes a signed
+// compare do the same thing. There's no 64 bit compare at all, so that's
+// built from the 32 bit halves, which both need flipping.
+static __m128i SignBits(DWORD Size)
+{
+    switch (Size) {
+        case 1: return _mm_set1_epi8((CHAR) 0x80);
+        case 2: return _mm_set1_epi16((SHORT) 0x8000);
+    }
+
+    return _mm_set1_epi32(0x80000000);
+}
+
+// Limit must already have its sign bits flipped.
+static __m128i CompareAbove(__m128i Value, __m128i Limit, DWORD Size)
+{
+    __m128i Above;
+    __m128i Equal;
+
+    Value = _mm_xor_si128(Value, SignBits(Size));
+
+    switch (Size) {
+        case 1: return _mm_cmpgt_epi8(Value, Limit);
+        case 2: return _mm_cmpgt_epi16(Value, Limit);
+        case 4: return _mm_cmpgt_epi32(Value, Limit);
+    }
+
+    Above = _mm_cmpgt_epi32(Value, Limit);
+    Equal = _mm_cmpeq_epi32(Value, Limit);
+
+    return _mm_or_si128(_mm_shuffle_epi32(Above, _MM_SHUFFLE(3, 3, 1, 1)),
+                        _mm_and_si128(_mm_shuffle_epi32(Equal, _MM_SHUFFLE(3, 3, 1, 1)),
+                                      _mm_shuffle_epi32(Above, _MM_SHUFFLE(2, 2, 0, 0))));
+}
+
+static __m128i SubtractVector(__m128i Value, __m128i Low, DWORD Size)
+{
+    switch (Size) {
+        case 1: return _mm_sub_epi8(Value, Low);
+        case 2: return _mm_sub_epi16(Value, Low);
+        case 4: return _mm_sub_epi32(Value, Low);
+    }
+
+    return _mm_sub_epi64(Value, Low);
+}
+
+static __m128i BroadcastVector(ULONGLONG Value, DWORD Size)
+{
+    switch (Size) {
+        case 1: return _mm_set1_epi8((CHAR) Value);
+        case 2: return _mm_set1_epi16((SHORT) Value);
+        case 4: return _mm_set1_epi32((LONG) Value);
+    }
+
+    return _mm_set1_epi64x(Value);
+}
+
+static BOOL AddHit(PVALUE_SCAN Scan, PVALUE_SLICE Slice, DWORD Position, DWORD Size)
+{
+    if (Slice->Count == Slice->Capacity) {
+        DWORD Capacity = max(Slice->Capacity * 2, 256);
+        PVALUE_HIT Hits = realloc(Slice->Hits, Capacity * sizeof *Hits);
+
+        if (Hits == NULL)
+            return FALSE;
+
+        Slice->Hits = Hits;
+        Slice->Capacity = Capacity;
+    }
+
+    Slice->Hits[Slice->Count].Offset = Scan->WindowOffset + Position;
+
+    ZeroMemory(Slice->Hits[Slice->Count].Data, sizeof Slice->Hits[0].Data);
+    CopyMemory(Slice->Hits[Slice->Count].Data, Scan->Window + Position, Size);
+
+    Slice->Count++;
+    return TRUE;
+}
+
+static VOID ScanSlice(PVOID Context, DWORD Index)
+{
+    PVALUE_SCAN Scan = Context;
+    PVALUE_SLICE Slice = &Scan->Slices[Index];
+    PVALUE_QUERY Query = Scan->Query;
+    DWORD Size = TypeSizes[Query->Type];
+    DWORD LaneMask = (1 << Size) - 1;
+    __m128i Low = BroadcastVector(Query->Low, Size);
+    __m128i Span = _mm_xor_si128(BroadcastVector(Query->High - Query->Low, Size), SignBits(Size));
+    __m128 LowFloat = _mm_set1_ps((float) Query->LowFloat);
+    __m128 HighFloat = _mm_set1_ps((float) Query->HighFloat);
+    __m128d LowDouble = _mm_set1_pd(Query->LowFloat);
+    __m128d HighDouble = _mm_set1_pd(Query->HighFloat);
+    unsigned long Bit;
+
+    for (DWORD Position = Slice->Start; Position < Slice->End; Position += 16) {
+        for (DWORD Align = 0; Align < Size; Align++) {
+            __m128i Value = _mm_loadu_si128((const __m128i *)(Scan->Window + Position + Align));
+            __m128i Match;
+            DWORD Mask;
+
+            if (Query->BigEndian)
+                Value = SwapVector(Value, Size);
+
+            if (Query->Type == VALUE_FLOAT) {
+                __m128 Float = _mm_castsi128_ps(Value);
+
+                Match = _mm_castps_si128(_mm_and_ps(_mm_cmpge_ps(Float, LowFloat), _mm_cmple_ps(Float, HighFloat)));
+            } else if (Query->Type == VALUE_DOUBLE) {
+                __m128d Double = _mm_castsi128_pd(Value);
+
+                Match = _mm_castpd_si128(_mm_and_pd(_mm_cmpge_pd(Double, LowDouble), _mm_cmple_pd(Double, HighDouble)));
+            } else {
+                Match = _mm_xor_si128(CompareAbove(SubtractVector(Value, Low, Size), Span, Size),
+                                      _mm_set1_epi32(-1));
+            }
+
+            Mask = _mm_movemask_epi8(Match);
+
+            // Every byte of a lane is the same, so the lowest bit is where
+            // it starts.
+            while (_BitScanForward(&Bit, Mask)) {
+                DWORD Start = Position + Align + Bit;
+
+                Mask &= ~(LaneMask << Bit);
+
+                if (Start >= Slice->End || Start + Size > Scan->WindowLength)
+                    continue;
+
+                if (!AddHit(Scan, Slice, Start, Size)) {
+                    Slice->Failed = TRUE;
+                    return;
+                }
+            }
+        }
+    }
+}
+
+static BOOL ScanChunk(PVOID Context, HEM_QWORD Offset, const BYTE *Data, DWORD Length)
+{
+    PVALUE_SCAN Scan = Context;
+    DWORD Keep = min(Scan->WindowLength, VALUE_KEEP);
+    DWORD Size = TypeSizes[Scan->Query->Type];
+    DWORD First;
+    DWORD Limit;
+
+    if (Keep + Length + VALUE_PADDING > Scan->WindowCapacity) {
+        PBYTE Window = realloc(Scan->Window, Keep + Length + VALUE_PADDING);
+
+        if (Window == NULL)
+            return FALSE;
+
+        Scan->Window = Window;
+        Scan->WindowCapacity = Keep + Length + VALUE_PADDING;
+    }
+
+    memmove(Scan->Window, Scan->Window + Scan->WindowLength - Keep, Keep);
+    memcpy(Scan->Window + Keep, Data, Length);
+    ZeroMemory(Scan->Window + Keep + Length, VALUE_PADDING);
+
+    Scan->WindowOffset = Offset - Keep;
+    Scan->WindowLength = Keep + Length;
+
+    // Values that cross the end are checked with the next chunk.
+    First = (DWORD)(Scan->Next - Scan->WindowOffset);
+    Limit = Scan->WindowLength;
+
+    if (Offset + Length != Scan->End)
+        Limit -= min(Length, Size - 1);
+
+    Scan->Next = Scan->WindowOffset + Limit;
+
+    if (First >= Limit)
+        return TRUE;
+
+    Scan->SliceCount = (Limit - First + VALUE_SLICE_SIZE - 1) / VALUE_SLICE_SIZE;
+
+    if (Scan->SliceCount > Scan->SliceCapacity) {
+        PVALUE_SLICE Slices = realloc(Scan->Slices, Scan->SliceCount * sizeof *Slices);
+
+        if (Slices == NULL)
+            return FALSE;
+
+        ZeroMemory(Slices + Scan->SliceCapacity, (Scan->SliceCount - Scan->SliceCapacity) * sizeof *Slices);
+
+        Scan->Slices = Slices;
+        Scan->SliceCapacity = Scan->SliceCount;
+    }
+
+    for (DWORD i = 0; i < Scan->SliceCount; i++) {
+        PVALUE_SLICE Slice = &Scan->Slices[i];
+
+        Slice->Start = First + i * VALUE_SLICE_SIZE;
+        Slice->End = min(Slice->Start + VALUE_SLICE_SIZE, Limit);
+        Slice->Count = 0;
+        Slice->Failed = FALSE;
+    }
+
+    ParallelFor(Scan->SliceCount, ScanSlice, Scan);
+
+    for (DWORD i = 0; i < Scan->SliceCount; i++) {
+        PVALUE_SLICE Slice = &Scan->Slices[i];
+
+        for (DWORD j = 0; j < Slice->Count; j++) {
+            PVALUE_HIT Hit;
+
+            if (Scan->Hits->Count >= VALUE_MAX_HITS || (Hit = AppendVirtualList(Scan->Hits)) == NULL) {
+                Scan->Full = TRUE;
+                return FALSE;
+            }
+
+            *Hit = Slice->Hits[j];
+        }
+
+        if (Slice->Failed) {
+            Scan->Full = TRUE;
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static int __cdecl CompareHits(const void *a, const void *b)
+{
+    const VALUE_HIT *x = a;
+    const VALUE_HIT *y = b;
+
+    return x->Offset < y->Offset ? -1 : x->Offset > y->Offset;
+}
+
+// The value of a hit in the byte order of the machine.
+static ULONGLONG ReadHit(PVALUE_QUERY Query, const VALUE_HIT *Hit)
+{
+    DWORD Size = TypeSizes[Query->Type];
+    ULONGLONG Value = 0;
+
+    for (DWORD i = 0; i < Size; i++) {
+        DWORD Shift = Query->BigEndian ? (Size - i - 1) * 8 : i * 8;
+
+        Value |= (ULONGLONG) Hit->Data[i] << Shift;
+    }
+
+    return Value;
+}
+
+static VOID FormatValue(PVALUE_QUERY Query, ULONGLONG Value, PCHAR Buffer, SIZE_T Size)
+{
+    DWORD Bits = TypeSizes[Query->Type] * 8;
+    LONGLONG Signed;
+    DOUBLE Double;
+    FLOAT Float;
+    DWORD Single;
+
+    switch (Query->Type) {
+        case VALUE_FLOAT:
+            Single = (DWORD) Value;
+            CopyMemory(&Float, &Single, sizeof Float);
+            snprintf(Buffer, Size, "%g", Float);
+            return;
+        case VALUE_DOUBLE:
+            CopyMemory(&Double, &Value, sizeof Double);
+            snprintf(Buffer, Size, "%g", Double);
+            return;
+    }
+
+    // Sign extend, so negative numbers look negative.
+    Signed = Bits == 64 ? (LONGLONG) Value : (LONGLONG)(Value << (64 - Bits)) >> (64 - Bits);
+
+    snprintf(Buffer, Size, "%#0*llx  %lld", Bits / 4 + 2, Value, Signed);
+}
+
+static VOID FormatHit(PVOID Context, DWORD Index, const VOID *Record, PCHAR Buffer, SIZE_T Size)
+{
+    const VALUE_HIT *Hit = Record;
+    CHAR Value[64];
+
+    FormatValue(&Values.Query, ReadHit(&Values.Query, Hit), Value, sizeof Value);
+
+    snprintf(Buffer, Size, "%0*llX  %s", Values.OffsetWidth, Hit->Offset, Value);
+}
+
+static VOID MarkValues(VOID)
+{
+    for (DWORD i = 0; i < Values.List.Count; i++) {
+        PVALUE_HIT Hit = GetVirtualListRecord(&Values.List, i);
+
+        HiewGate_ColorMarker(Hit->Offset, TypeSizes[Values.Query.Type], VALUE_COLOR);
+    }
+
+    Values.Marked = TRUE;
+}
+
+static VOID ClearValues(VOID)
+{
+    if (Values.Marked) {
+        for (DWORD i = 0; i < Values.List.Count; i++) {
+            PVALUE_HIT Hit = GetVirtualListRecord(&Values.List, i);
+
+            if (Hit->Offset < Values.FileLength)
+                HiewGate_ColorMarker(Hit->Offset, 0, VALUE_COLOR);
+        }
+    }
+
+    FreeVirtualList(&Values.List);
+
+    Values.Marked = FALSE;
+}
+
+// Numbers can be written in decimal or hex, negative numbers are allowed if
+// they fit when sign extended.
+static BOOL ParseInteger(PCHAR Text, DWORD Size, ULONGLONG *Value, BOOL *Negative)
+{
+    DWORD Bits = Size * 8;
+    PCHAR End;
+
+    while (*Text == ' ')
+        Text++;
+
+    *Negative = *Text == '-';
+
+    if (*Negative) {
+        *Value = (ULONGLONG) _strtoi64(Text, &End, 0);
+
+        if (Bits < 64 && (LONGLONG) *Value < -(1LL << (Bits - 1)))
+            return FALSE;
+    } else {
+        *Value = _strtoui64(Text, &End, 0);
+
+        if (Bits < 64 && *Value >> Bits)
+            return FALSE;
+    }
+
+    while (*End == ' ')
+        End++;
+
+    return End != Text && *End == '\0';
+}
+
+static BOOL ParseFloat(PCHAR Text, double *Value)
+{
+    PCHAR End;
+
+    *Value = strtod(Text, &End);
+
+    while (*End == ' ')
+        End++;
+
+    return End != Text && *End == '\0';
+}
+
+// Either a single value, or "low..high".
+static BOOL ParseQuery(PVALUE_QUERY Query, LPCSTR QueryText, PCHAR Message, SIZE_T MaxLen)
+{
+    CHAR Text[VALUE_MAX_TEXT];
+    DWORD Size = TypeSizes[Query->Type];
+    PCHAR High;
+    BOOL LowNegative;
+    BOOL HighNegative;
+
+    strncpy_s(Text, sizeof Text, QueryText, _TRUNCATE);
+
+    if ((High = strstr(Text, "..")) != NULL) {
+        *High = '\0';
+        High += 2;
+    } else {
+        High = Text;
+    }
+
+    if (Query->Type == VALUE_FLOAT || Query->Type == VALUE_DOUBLE) {
+        if (!ParseFloat(Text, &Query->LowFloat) || !ParseFloat(High, &Query->HighFloat)) {
+            snprintf(Message, MaxLen, "I don't understand \"%s\", try 1.5 or 0.5..2.", QueryText);
+            return FALSE;
+        }
+
+        if (Query->LowFloat > Query->HighFloat) {
+            snprintf(Message, MaxLen, "The start of the range is bigger than the end.");
+            return FALSE;
+        }
+
+        return TRUE;
+    }
+
+    if (!ParseInteger(Text, Size, &Query->Low, &LowNegative)
+     || !ParseInteger(High, Size, &Query->High, &HighNegative)) {
+        snprintf(Message, MaxLen, "I don't understand \"%s\", or it doesn't fit in an %s.", QueryText, TypeNames[Query->Type]);
+        return FALSE;
+    }
+
+    // A negative start means a signed range.
+    if (LowNegative || HighNegative ? (LONGLONG) Query->Low > (LONGLONG) Query->High : Query->Low > Query->High) {
+        snprintf(Message, MaxLen, "The start of the range is bigger than the end.");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// The lowest and highest address of anything loaded.
+static BOOL GetImageRange(HEMCALL_TAG *HemCall, PVALUE_QUERY Query, PCHAR Message, SIZE_T MaxLen)
+{
+    PSECTION_MAP Map = GetSectionMap(HemCall);
+
+    if (Map == NULL || strcmp(Map->Format, "raw") == 0) {
+        snprintf(Message, MaxLen, "This isn't a PE, ELF or Mach-O file, so I don't know where it's loaded.");
+        return FALSE;
+    }
+
+    Query->Type = Map->Is64 ? VALUE_INT64 : VALUE_INT32;
+    Query->BigEndian = FALSE;
+    Query->Low = MAXULONGLONG;
+    Query->High = 0;
+
+    for (DWORD i = 0; i < Map->Count; i++) {
+        Query->Low = min(Query->Low, Map->Sections[i].Address);
+        Query->High = max(Query->High, Map->Sections[i].Address + Map->Sections[i].Size - 1);
+    }
+
+    return TRUE;
+}
+
+// Let the user change the settings until they choose to start. Returns 1 to
+// search, 2 to show the last results, 3 to find pointers, or 0 if cancelled.
+static int SelectValueOptions(HEM_QWORD Offset, HEM_QWORD Length)
+{
+    CHAR Lines[7][VALUE_MAX_TEXT + 32];
+    PCHAR Menu[7];
+    DWORD Count = 6;
+    DWORD Width = 0;
+    int Choice = 1;
+
+    while (TRUE) {
+        snprintf(Lines[0],
+                 sizeof Lines[0],
+                 "Find %s in %#llx bytes from %#llx",
+                 *ValueText ? ValueText : "a value",
+                 Length,
+                 Offset);
+        snprintf(Lines[1], sizeof Lines[0], "Type %s", TypeNames[ValueQuery.Type]);
+        snprintf(Lines[2], sizeof Lines[0], "%s endian", ValueQuery.BigEndian ? "Big" : "Little");
+        snprintf(Lines[3], sizeof Lines[0], "Value %s", *ValueText ? ValueText : "(not set)");
+        snprintf(Lines[4], sizeof Lines[0], "[%c] Highlight matches", ValueHighlight ? 'x' : ' ');
+        snprintf(Lines[5], sizeof Lines[0], "Find pointers into this image");
+
+        if (Values.List.Count) {
+            snprintf(Lines[6], sizeof Lines[0], "Show the last %u matches", Values.List.Count);
+            Count = 7;
+        }
+
+        for (DWORD i = 0; i < Count; i++) {
+            Menu[i] = Lines[i];
+            Width = max(Width, strlen(Lines[i]));
+        }
+
+        Choice = HiewGate_Menu("Values", Menu, Count, Width, Choice, NULL, NULL, NULL, NULL);
+
+        switch (Choice) {
+            case 1:
+                if (*ValueText)
+                    return 1;
+                // Fallthrough, there's nothing to find yet.
+            case 4:
+                HiewGate_GetString("Value, or low..high (e.g. 0x1000..0x2000, -1, 3.14)", ValueText, sizeof ValueText);
+                break;
+            case 2:
+                ValueQuery.Type = (ValueQuery.Type + 1) % VALUE_TYPES;
+                break;
+            case 3:
+                ValueQuery.BigEndian = !ValueQuery.BigEndian;
+                break;
+            case 5:
+                ValueHighlight = !ValueHighlight;
+                break;
+            case 6:
+                return 3;
+            case 7:
+                return 2;
+            default:
+                return 0;
+        }
+    }
+}
+
+int ValuesEntryPoint(HEMCALL_TAG *HemCall)
+{
+    VALUE_SCAN Scan = {0};
+    VALUE_QUERY Search = ValueQuery;
+    HIEWGATE_GETDATA HiewData;
+    STREAM_CONSUMER Consumer;
+    JOB Job;
+    HEM_QWORD Offset;
+    HEM_QWORD Length;
+    CHAR Message[VALUE_MAX_TEXT + 128];
+    CHAR Low[64];
+    CHAR High[64];
+    SIZE_T Used;
+    LONG Selected;
+    int Result;
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return HEM_ERROR;
+
+    GetMarkedRange(&HiewData, &Offset, &Length);
+
+    switch (SelectValueOptions(Offset, Length)) {
+        case 1:
+            if (!ParseQuery(&Search, ValueText, Message, sizeof Message)) {
+                HiewGate_Message("Values", Message);
+                return HEM_OK;
+            }
+            break;
+        case 2:
+            snprintf(Message, sizeof Message, "%u matches", Values.List.Count);
+            goto show;
+        case 3:
+            if (!GetImageRange(HemCall, &Search, Message, sizeof Message)) {
+                HiewGate_Message("Values", Message);
+                return HEM_OK;
+            }
+            break;
+        default:
+            return HEM_OK;
+    }
+
+    ClearValues();
+    InitVirtualList(&Values.List, sizeof(VALUE_HIT), FormatHit, NULL);
+
+    Values.Query = Search;
+    Values.OffsetWidth = HiewData.filelength > 0xFFFFFFFF ? 16 : 8;
+    Values.FileLength = HiewData.filelength;
+
+    Scan.Query = &Values.Query;
+    Scan.End = Offset + Length;
+    Scan.Next = Offset;
+    Scan.Hits = &Values.List;
+
+    Consumer.Routine = ScanChunk;
+    Consumer.Context = &Scan;
+
+    BeginJob(&Job, "Finding values", Length);
+
+    Result = StreamFileRange(&Job, Offset, Length, &Consumer, 1);
+
+    EndJob(&Job);
+
+    for (DWORD i = 0; i < Scan.SliceCapacity; i++) {
+        free(Scan.Slices[i].Hits);
+    }
+
+    free(Scan.Slices);
+    free(Scan.Window);
+
+    // If there were too many, I can still show some.
+    if (Result == HEM_ERROR && Scan.Full)
+        Result = HEM_OK;
+
+    if (Result != HEM_OK) {
+        ClearValues();
+        HiewGate_Message("Values", Result == HEM_KEYBREAK ? "Cancelled." : "Hiew failed to read the file.");
+        return HEM_OK;
+    }
+
+    if (Values.List.Count == 0) {
+        HiewGate_Message("Values", "Nothing matched.");
+        return HEM_OK;
+    }
+
+    qsort(GetVirtualListRecord(&Values.List, 0), Values.List.Count, sizeof(VALUE_HIT), CompareHits);
+
+    if (ValueHighlight)
+        MarkValues();
+
+    // A float range is kept as doubles, not bits.
+    if (Values.Query.Type == VALUE_FLOAT || Values.Query.Type == VALUE_DOUBLE) {
+        snprintf(Low, sizeof Low, "%g", Values.Query.LowFloat);
+        snprintf(High, sizeof High, "%g", Values.Query.HighFloat);
+    } else {
+        FormatValue(&Values.Query, Values.Query.Low, Low, sizeof Low);
+        FormatValue(&Values.Query, Values.Query.High, High, sizeof High);
+    }
+
+    Used = snprintf(Message,
+                    sizeof Message,
+                    "%u %s from %s to %s%s, ",
+                    Values.List.Count,
+                    TypeNames[Values.Query.Type],
+                    Low,
+                    High,
+                    Scan.Full ? " (some are missing)" : "");
+
+    FormatJobStats(&Job, Message + Used, sizeof Message - Used);
+
+show:
+    Selected = ShowVirtualList(&Values.List, Message, VALUE_MENU_WIDTH, 0);
+
+    if (Selected >= 0) {
+        PVALUE_HIT Hit = GetVirtualListRecord(&Values.List, Selected);
+
+        HemCall->returnOffset = Hit->Offset;
+        HemCall->returnActionFlag |= HEM_RETURN_SETOFFSET;
+    }
+
+    return HEM_OK;
+}
@@ -0,0 +1,9 @@
+#ifndef __VALSCAN_H
+#define __VALSCAN_H
+
+// Finds integers, floats or pointers into the image that equal a value or
+// fall in a range, at any alignment in the marked block (or the whole file).
+// Choosing one jumps to it.
+int ValuesEntryPoint(HEMCALL_TAG *HemCall);
+
+#endif
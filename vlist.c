@@ -0,0 +1,227 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "vlist.h"
+
+// Allocating a string for every menu line is fine for a few keys, but not for
+// a million search results. Instead, results are kept as fixed size records
+// in one flat array, and HiewGate_Menu() asks for lines through CallbackLine
+// as they scroll into view. Hiew only needs each line until it's drawn, so
+// they're formatted into a small ring of buffers.
+
+// Hiew gets confused by enormous menus, so they're shown a page at a time.
+#define VLIST_PAGE_SIZE (256 * 1024)
+
+// Active keys, then 6 characters of caption for each of F1-F12.
+#define VLIST_KEYS_PAGES    "011000110000|      <Page Page>                   SearchAgain                         "
+#define VLIST_KEYS          "000000110000|                                    SearchAgain                         "
+
+VOID InitVirtualList(PVLIST List, DWORD RecordSize, PVLIST_FORMAT Format, PVOID Context)
+{
+    ZeroMemory(List, sizeof *List);
+
+    List->RecordSize = RecordSize;
+    List->Format = Format;
+    List->Context = Context;
+}
+
+VOID FreeVirtualList(PVLIST List)
+{
+    free(List->Records);
+
+    List->Records = NULL;
+    List->Count = 0;
+    List->Capacity = 0;
+}
+
+BOOL ResizeVirtualList(PVLIST List, DWORD Count)
+{
+    if (Count > List->Capacity) {
+        PVOID Records = realloc(List->Records, (SIZE_T) Count * List->RecordSize);
+
+        if (Records == NULL)
+            return FALSE;
+
+        List->Records = Records;
+        List->Capacity = Count;
+    }
+
+    if (Count > List->Count) {
+        ZeroMemory(List->Records + (SIZE_T) List->Count * List->RecordSize,
+                   (SIZE_T)(Count - List->Count) * List->RecordSize);
+    }
+
+    List->Count = Count;
+    return TRUE;
+}
+
+PVOID AppendVirtualList(PVLIST List)
+{
+    if (List->Count == List->Capacity) {
+        DWORD Capacity = max(List->Capacity * 2, 1024);
+        PVOID Records = realloc(List->Records, (SIZE_T) Capacity * List->RecordSize);
+
+        if (Records == NULL)
+            return NULL;
+
+        List->Records = Records;
+        List->Capacity = Capacity;
+    }
+
+    if (!ResizeVirtualList(List, List->Count + 1))
+        return NULL;
+
+    return GetVirtualListRecord(List, List->Count - 1);
+}
+
+PVOID GetVirtualListRecord(PVLIST List, DWORD Index)
+{
+    return List->Records + (SIZE_T) Index * List->RecordSize;
+}
+
+static HEM_BYTE *VirtualListCallback(int Line, PVOID Context)
+{
+    PVLIST List = Context;
+    PCHAR Buffer = List->Lines[List->NextLine++ % VLIST_RING_SIZE];
+    DWORD Index = List->First + Line;
+
+    if (Line < 0 || Index >= List->Count)
+        return "";
+
+    List->Format(List->Context, Index, GetVirtualListRecord(List, Index), Buffer, VLIST_LINE_SIZE);
+
+    return Buffer;
+}
+
+// Case insensitive, a leading ^ means the line must start with the pattern.
+static BOOL MatchLine(LPCSTR Line, LPCSTR Pattern)
+{
+    SIZE_T Length;
+
+    if (*Pattern == '^')
+        return _strnicmp(Line, Pattern + 1, strlen(Pattern + 1)) == 0;
+
+    Length = strlen(Pattern);
+
+    for (; *Line; Line++) {
+        if (_strnicmp(Line, Pattern, Length) == 0)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+// Find the next line after Start that matches, wrapping around.
+static LONG SearchVirtualList(PVLIST List, DWORD Start)
+{
+    CHAR Line[VLIST_LINE_SIZE];
+    LONG Result = -1;
+    JOB Job;
+
+    BeginJob(&Job, "Searching", List->Count);
+
+    for (DWORD i = 1; i <= List->Count; i++) {
+        DWORD Index = (Start + i) % List->Count;
+
+        if (!UpdateJob(&Job, i))
+            break;
+
+        if (List->SearchText) {
+            List->SearchText(List->Context, Index, GetVirtualListRecord(List, Index), Line, sizeof Line);
+        } else {
+            List->Format(List->Context, Index, GetVirtualListRecord(List, Index), Line, sizeof Line);
+        }
+
+        if (MatchLine(Line, List->Pattern)) {
+            Result = Index;
+            break;
+        }
+    }
+
+    EndJob(&Job);
+
+    return Result;
+}
+
+LONG ShowVirtualList(PVLIST List, PCHAR Title, DWORD Width, DWORD Start)
+{
+    DWORD Pages = (List->Count + VLIST_PAGE_SIZE - 1) / VLIST_PAGE_SIZE;
+    DWORD Current = min(Start, List->Count - 1);
+    CHAR PageTitle[128];
+
+    if (List->Count == 0) {
+        HiewGate_Message(Title, "There's nothing to show.");
+        return -1;
+    }
+
+    while (TRUE) {
+        HEM_FNKEYS FnKeys = { Pages > 1 ? VLIST_KEYS_PAGES : VLIST_KEYS, "", "", "" };
+        DWORD Page = Current / VLIST_PAGE_SIZE;
+        HEM_UINT FnKey = 0;
+        LONG Found;
+        int Choice;
+
+        List->First = Page * VLIST_PAGE_SIZE;
+
+        if (Pages > 1) {
+            snprintf(PageTitle, sizeof PageTitle, "%s (page %u of %u)", Title, Page + 1, Pages);
+        } else {
+            snprintf(PageTitle, sizeof PageTitle, "%s", Title);
+        }
+
+        Choice = HiewGate_Menu(PageTitle,
+                               NULL,
+                               min(List->Count - List->First, VLIST_PAGE_SIZE),
+                               Width,
+                               Current - List->First + 1,
+                               &FnKeys,
+                               &FnKey,
+                               VirtualListCallback,
+                               List);
+
+        // Hiew tells me where the cursor was when a key was pressed.
+        if (Choice > 0)
+            Current = List->First + Choice - 1;
+
+        switch (FnKey) {
+            case HEM_FNKEY_F2:
+                if (Page > 0)
+                    Current = List->First - VLIST_PAGE_SIZE;
+                continue;
+            case HEM_FNKEY_F3:
+                if (Page + 1 < Pages)
+                    Current = List->First + VLIST_PAGE_SIZE;
+                continue;
+            case HEM_FNKEY_F7:
+                if (HiewGate_GetString("Search (^ to match the start)",
+                                       List->Pattern,
+                                       sizeof List->Pattern) != HEM_INPUT_CR) {
+                    continue;
+                }
+                // fallthrough
+            case HEM_FNKEY_F8:
+                if (*List->Pattern == '\0')
+                    continue;
+
+                if ((Found = SearchVirtualList(List, Current)) < 0) {
+                    HiewGate_Message(Title, "Not found.");
+                    continue;
+                }
+
+                Current = Found;
+                continue;
+        }
+
+        if (Choice <= 0)
+            return -1;
+
+        return Current;
+    }
+}
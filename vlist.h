@@ -0,0 +1,50 @@
+#ifndef __VLIST_H
+#define __VLIST_H
+
+#define VLIST_RING_SIZE 8
+#define VLIST_LINE_SIZE 256
+
+// Formats the record at Index into a menu line.
+typedef VOID (*PVLIST_FORMAT)(PVOID Context, DWORD Index, const VOID *Record, PCHAR Buffer, SIZE_T Size);
+
+// A list of fixed size records shown with HiewGate_Menu(), lines are only
+// formatted when Hiew draws them.
+typedef struct _VLIST {
+    DWORD RecordSize;
+    DWORD Count;
+    DWORD Capacity;
+    PBYTE Records;
+    PVLIST_FORMAT Format;
+    PVOID Context;
+
+    // Optional, formats the text F7 searches if it isn't the whole line.
+    PVLIST_FORMAT SearchText;
+
+    // The rest is used while the list is shown.
+    DWORD First;
+    DWORD NextLine;
+    CHAR Pattern[64];
+    CHAR Lines[VLIST_RING_SIZE][VLIST_LINE_SIZE];
+} VLIST, *PVLIST;
+
+// Prepares an empty list.
+VOID InitVirtualList(PVLIST List, DWORD RecordSize, PVLIST_FORMAT Format, PVOID Context);
+
+// Releases the records, the list can be used again.
+VOID FreeVirtualList(PVLIST List);
+
+// Adds a zeroed record to the end of the list, returns NULL if there's no
+// memory. The pointer is only valid until the next append.
+PVOID AppendVirtualList(PVLIST List);
+
+// Makes the list Count records long, any new records are zeroed.
+BOOL ResizeVirtualList(PVLIST List, DWORD Count);
+
+// Gets the record at Index.
+PVOID GetVirtualListRecord(PVLIST List, DWORD Index);
+
+// Shows the list with the cursor on Start. F7 searches the lines, and long
+// lists are split into pages. Returns the chosen index, or -1.
+LONG ShowVirtualList(PVLIST List, PCHAR Title, DWORD Width, DWORD Start);
+
+#endif
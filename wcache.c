@@ -0,0 +1,263 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "journal.h"
+#include "wcache.h"
+
+// Every HiewGate_FileWrite() is a round trip through Hiew, so features that
+// edit a byte at a time are slow. Instead, writes are kept here as a sorted
+// list of dirty ranges, overlapping or adjacent writes are merged into the
+// same range, and each range is written with one call when flushed.
+//
+// Ranges never overlap or touch, so a write can only merge with a contiguous
+// run of them, which I can find with a binary search.
+
+// Flush when this much is pending.
+#define WCACHE_FLUSH_SIZE (4 * 1024 * 1024)
+
+// Writes this large that don't touch anything pending aren't worth copying.
+#define WCACHE_PASSTHROUGH_SIZE (64 * 1024)
+
+typedef struct _WCACHE_RANGE {
+    HEM_QWORD Offset;
+    DWORD Length;
+    DWORD Capacity;
+    PBYTE Data;
+} WCACHE_RANGE, *PWCACHE_RANGE;
+
+static PWCACHE_RANGE Ranges;
+static DWORD NumRanges;
+static DWORD MaxRanges;
+static SIZE_T PendingBytes;
+static WCACHE_STATS Stats;
+
+// Find the first range that ends at or after Offset.
+static DWORD FindRange(HEM_QWORD Offset)
+{
+    DWORD Low = 0;
+    DWORD High = NumRanges;
+
+    while (Low < High) {
+        DWORD Middle = Low + (High - Low) / 2;
+
+        if (Ranges[Middle].Offset + Ranges[Middle].Length < Offset) {
+            Low = Middle + 1;
+        } else {
+            High = Middle;
+        }
+    }
+
+    return Low;
+}
+
+static int WriteRange(HEM_QWORD Offset, HEM_UINT Bytes, HEM_BYTE *Buffer)
+{
+    int Result;
+
+    Stats.GateCalls++;
+
+    if ((Result = JournalFileWrite(Offset, Bytes, Buffer)) == HEM_OK)
+        Stats.Bytes += Bytes;
+
+    return Result;
+}
+
+static BOOL InsertRange(DWORD Index, HEM_QWORD Offset, HEM_UINT Bytes, HEM_BYTE *Buffer)
+{
+    PWCACHE_RANGE Range;
+
+    if (NumRanges == MaxRanges) {
+        DWORD Count = max(MaxRanges * 2, 64);
+        PVOID NewRanges = realloc(Ranges, Count * sizeof *Ranges);
+
+        if (NewRanges == NULL)
+            return FALSE;
+
+        Ranges = NewRanges;
+        MaxRanges = Count;
+    }
+
+    MoveMemory(&Ranges[Index + 1], &Ranges[Index], (NumRanges - Index) * sizeof *Ranges);
+
+    Range = &Ranges[Index];
+    Range->Offset = Offset;
+    Range->Length = Bytes;
+    Range->Capacity = Bytes;
+
+    if ((Range->Data = malloc(Bytes)) == NULL) {
+        MoveMemory(&Ranges[Index], &Ranges[Index + 1], (NumRanges - Index) * sizeof *Ranges);
+        return FALSE;
+    }
+
+    CopyMemory(Range->Data, Buffer, Bytes);
+
+    NumRanges++;
+    PendingBytes += Bytes;
+    return TRUE;
+}
+
+// Merge a write into the ranges First...Last, which all overlap or touch it.
+static BOOL MergeRanges(DWORD First, DWORD Last, HEM_QWORD Offset, HEM_UINT Bytes, HEM_BYTE *Buffer)
+{
+    PWCACHE_RANGE Range = &Ranges[First];
+    HEM_QWORD Start = min(Range->Offset, Offset);
+    HEM_QWORD End = max(Ranges[Last].Offset + Ranges[Last].Length, Offset + Bytes);
+    DWORD Length = End - Start;
+    PBYTE Data;
+
+    // Extending a range at the end is common (sequential writes), so grow the
+    // buffer geometrically to make that cheap.
+    if (Range->Offset == Start) {
+        if (Length > Range->Capacity) {
+            DWORD Capacity = max(Length, Range->Capacity * 2);
+
+            if ((Data = realloc(Range->Data, Capacity)) == NULL)
+                return FALSE;
+
+            Range->Data = Data;
+            Range->Capacity = Capacity;
+        }
+    } else {
+        if ((Data = malloc(Length)) == NULL)
+            return FALSE;
+
+        CopyMemory(Data + (Range->Offset - Start), Range->Data, Range->Length);
+        free(Range->Data);
+
+        Range->Data = Data;
+        Range->Capacity = Length;
+    }
+
+    PendingBytes -= Range->Length;
+
+    // Copy in the other ranges, then the new data on top.
+    for (DWORD i = First + 1; i <= Last; i++) {
+        CopyMemory(Range->Data + (Ranges[i].Offset - Start), Ranges[i].Data, Ranges[i].Length);
+        PendingBytes -= Ranges[i].Length;
+        free(Ranges[i].Data);
+    }
+
+    CopyMemory(Range->Data + (Offset - Start), Buffer, Bytes);
+
+    Range->Offset = Start;
+    Range->Length = Length;
+
+    PendingBytes += Length;
+
+    MoveMemory(&Ranges[First + 1], &Ranges[Last + 1], (NumRanges - Last - 1) * sizeof *Ranges);
+
+    NumRanges -= Last - First;
+    return TRUE;
+}
+
+int CachedFileWrite(HEM_QWORD Offset, HEM_UINT Bytes, HEM_BYTE *Buffer)
+{
+    DWORD First;
+    DWORD Last;
+
+    if (Buffer == NULL)
+        return HEM_ERR_POINTER_IS_NULL;
+
+    if (Bytes == 0)
+        return HEM_OK;
+
+    Stats.Writes++;
+
+    // Find everything this write overlaps or touches.
+    First = FindRange(Offset);
+
+    for (Last = First; Last < NumRanges && Ranges[Last].Offset <= Offset + Bytes; Last++)
+        ;
+
+    if (First == Last) {
+        if (Bytes >= WCACHE_PASSTHROUGH_SIZE)
+            return WriteRange(Offset, Bytes, Buffer);
+
+        if (!InsertRange(First, Offset, Bytes, Buffer))
+            return WriteRange(Offset, Bytes, Buffer);
+    } else if (!MergeRanges(First, Last - 1, Offset, Bytes, Buffer)) {
+        // Out of memory, write it the slow way so nothing is lost.
+        if (!FlushFileWrites())
+            return HEM_ERROR;
+
+        return WriteRange(Offset, Bytes, Buffer);
+    }
+
+    if (PendingBytes >= WCACHE_FLUSH_SIZE) {
+        return FlushFileWrites() ? HEM_OK : HEM_ERROR;
+    }
+
+    return HEM_OK;
+}
+
+int CachedFileRead(HEM_QWORD Offset, HEM_UINT Bytes, HEM_BYTE *Buffer)
+{
+    int Result = HiewGate_FileRead(Offset, Bytes, Buffer);
+    HEM_QWORD End;
+
+    if (Result <= 0)
+        return Result;
+
+    End = Offset + Result;
+
+    // Copy whatever hasn't been written yet on top.
+    for (DWORD i = FindRange(Offset); i < NumRanges && Ranges[i].Offset < End; i++) {
+        HEM_QWORD Start = max(Ranges[i].Offset, Offset);
+        HEM_QWORD Stop = min(Ranges[i].Offset + Ranges[i].Length, End);
+
+        if (Start >= Stop)
+            continue;
+
+        CopyMemory(Buffer + (Start - Offset),
+                   Ranges[i].Data + (Start - Ranges[i].Offset),
+                   Stop - Start);
+    }
+
+    return Result;
+}
+
+BOOL FlushFileWrites(VOID)
+{
+    BOOL Result = TRUE;
+
+    if (NumRanges == 0)
+        return TRUE;
+
+    // If there was no transaction, this flush is one.
+    BeginJournalTransaction("Write");
+
+    for (DWORD i = 0; i < NumRanges; i++) {
+        if (WriteRange(Ranges[i].Offset, Ranges[i].Length, Ranges[i].Data) != HEM_OK)
+            Result = FALSE;
+    }
+
+    EndJournalTransaction();
+
+    DiscardFileWrites();
+    return Result;
+}
+
+VOID DiscardFileWrites(VOID)
+{
+    for (DWORD i = 0; i < NumRanges; i++) {
+        free(Ranges[i].Data);
+    }
+
+    free(Ranges);
+
+    Ranges = NULL;
+    NumRanges = 0;
+    MaxRanges = 0;
+    PendingBytes = 0;
+}
+
+VOID GetWriteCacheStats(PWCACHE_STATS Result)
+{
+    *Result = Stats;
+}
@@ -0,0 +1,27 @@
+#ifndef __WCACHE_H
+#define __WCACHE_H
+
+typedef struct _WCACHE_STATS {
+    DWORD Writes;           // Calls to CachedFileWrite()
+    DWORD GateCalls;        // Calls to HiewGate_FileWrite() made for them
+    ULONGLONG Bytes;        // Bytes that reached the file
+} WCACHE_STATS, *PWCACHE_STATS;
+
+// Just like HiewGate_FileWrite(), but the write is held and merged with
+// others until FlushFileWrites() is called or enough is pending.
+int CachedFileWrite(HEM_QWORD Offset, HEM_UINT Bytes, HEM_BYTE *Buffer);
+
+// Just like HiewGate_FileRead(), but includes any pending writes.
+int CachedFileRead(HEM_QWORD Offset, HEM_UINT Bytes, HEM_BYTE *Buffer);
+
+// Write everything pending to the file, this is done whenever the entry point
+// returns. Returns FALSE if any write failed.
+BOOL FlushFileWrites(VOID);
+
+// Throw away anything pending without writing it.
+VOID DiscardFileWrites(VOID);
+
+// How many gate calls were saved, since the hem was loaded.
+VOID GetWriteCacheStats(PWCACHE_STATS Stats);
+
+#endif
@@ -0,0 +1,428 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <winternl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <intrin.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include "hem.h"
+#include "job.h"
+#include "stream.h"
+#include "vlist.h"
+#include "secmap.h"
+#include "xref.h"
+
+// Finding callers without a disassembly is mostly arithmetic. A rel32 at
+// address A refers to the target T when the dword there is T - (A + 4), so as
+// A increases by one the value I'm looking for decreases by one. That means
+// every position can be checked with a vector compare against a sliding
+// expected value, and a pointer is just a compare against T itself. Only the
+// rare positions that match are looked at properly, to see if the bytes in
+// front are really a call, jmp or jcc.
+//
+// Short jumps can only reach 128 bytes either side of the target, so they're
+// checked one at a time near it.
+
+// Enough of the previous chunk to see the opcode in front of a displacement
+// that crosses into this one.
+#define XREF_KEEP 16
+
+// The vector loop reads a little past the end of the window.
+#define XREF_PADDING 32
+
+// A pointer at the end of a chunk isn't checked until the next one.
+#define XREF_DEFER 7
+
+#define XREF_MAX_HITS (1024 * 1024)
+
+#define XREF_MENU_WIDTH 72
+
+enum {
+    XREF_CALL,
+    XREF_JMP,
+    XREF_JCC,
+    XREF_JMP_SHORT,
+    XREF_JCC_SHORT,
+    XREF_LOOP,
+    XREF_RIP,
+    XREF_POINTER,
+    XREF_NONE,
+};
+
+static PCHAR TypeNames[] = {
+    "call",
+    "jmp",
+    "jcc",
+    "jmp short",
+    "jcc short",
+    "loop",
+    "rip",
+    "pointer",
+};
+
+typedef struct _XREF {
+    HEM_QWORD Offset;       // Where the instruction or pointer starts
+    HEM_QWORD Address;
+    DWORD Type;
+} XREF, *PXREF;
+
+typedef struct _XREF_SCAN {
+    PSECTION_MAP Map;
+    HEM_QWORD Target;       // An address, not an offset
+    HEM_QWORD End;
+    HEM_QWORD Next;         // The first offset that hasn't been checked
+
+    // The current chunk, with the end of the last one in front of it.
+    PBYTE Window;
+    DWORD WindowLength;
+    DWORD WindowCapacity;
+    HEM_QWORD WindowOffset;
+
+    PVLIST Hits;
+    BOOL Full;
+} XREF_SCAN, *PXREF_SCAN;
+
+// The last search, so the list can be shown again.
+static struct {
+    VLIST List;
+    DWORD OffsetWidth;
+    DWORD AddressWidth;
+} Xrefs;
+
+static BYTE WindowByte(PXREF_SCAN Scan, LONGLONG Index)
+{
+    return Index < 0 ? 0 : Scan->Window[Index];
+}
+
+static VOID AddXref(PXREF_SCAN Scan, LONGLONG Index, HEM_QWORD Address, DWORD Type)
+{
+    PXREF Xref;
+
+    if (Scan->Hits->Count >= XREF_MAX_HITS || (Xref = AppendVirtualList(Scan->Hits)) == NULL) {
+        Scan->Full = TRUE;
+        return;
+    }
+
+    Xref->Offset = Scan->WindowOffset + Index;
+    Xref->Address = Address;
+    Xref->Type = Type;
+}
+
+// The displacement at Index refers to the target, see if the bytes in front
+// make it an instruction I know. A rip operand could have any opcode, so I
+// guess where it starts from the usual encodings.
+static DWORD ClassifyBranch(PXREF_SCAN Scan, LONGLONG Index, LONGLONG *Start)
+{
+    BYTE Opcode = WindowByte(Scan, Index - 1);
+
+    if (Opcode == 0xE8 || Opcode == 0xE9) {
+        *Start = Index - 1;
+        return Opcode == 0xE8 ? XREF_CALL : XREF_JMP;
+    }
+
+    if (WindowByte(Scan, Index - 2) == 0x0F && (Opcode & 0xF0) == 0x80) {
+        *Start = Index - 2;
+        return XREF_JCC;
+    }
+
+    // A ModRM with mod 00 and rm 101, which is only rip relative in 64 bit
+    // code. In 32 bit code it's absolute, and found as a pointer.
+    if (Scan->Map->Is64 && (Opcode & 0xC7) == 0x05) {
+        *Start = Index - 2;
+
+        if (WindowByte(Scan, *Start - 1) == 0x0F)
+            *Start -= 1;
+        if ((WindowByte(Scan, *Start - 1) & 0xF0) == 0x40)
+            *Start -= 1;
+
+        return XREF_RIP;
+    }
+
+    return XREF_NONE;
+}
+
+static VOID CheckCandidate(PXREF_SCAN Scan, BOOL Executable, DWORD Index, HEM_QWORD Address)
+{
+    DWORD Value = *(const DWORD UNALIGNED *)(Scan->Window + Index);
+    LONGLONG Start;
+    DWORD Type;
+
+    if (Executable && Index + sizeof(DWORD) <= Scan->WindowLength) {
+        HEM_QWORD Destination = Address + sizeof(DWORD) + (LONGLONG)(LONG) Value;
+
+        // 32 bit code wraps around.
+        if (!Scan->Map->Is64)
+            Destination = (DWORD) Destination;
+
+        if (Destination == Scan->Target && (Type = ClassifyBranch(Scan, Index, &Start)) != XREF_NONE)
+            AddXref(Scan, Start, Address - (Index - Start), Type);
+    }
+
+    if (Scan->Map->Is64) {
+        if (Index + sizeof(ULONGLONG) <= Scan->WindowLength
+         && *(const ULONGLONG UNALIGNED *)(Scan->Window + Index) == Scan->Target) {
+            AddXref(Scan, Index, Address, XREF_POINTER);
+        }
+    } else if (Value == Scan->Target) {
+        AddXref(Scan, Index, Address, XREF_POINTER);
+    }
+}
+
+// Only the 256 positions that a rel8 could reach the target from.
+static VOID ScanShortBranches(PXREF_SCAN Scan, DWORD Start, DWORD End, HEM_QWORD Address)
+{
+    LONGLONG First = (LONGLONG)(Scan->Target - Address) - 128;
+    LONGLONG Last = First + 256;
+
+    First = max(First, 0);
+    Last = min(Last, (LONGLONG)(End - Start));
+
+    for (LONGLONG i = First; i < Last; i++) {
+        LONGLONG Index = Start + i;
+        BYTE Opcode = WindowByte(Scan, Index - 1);
+        DWORD Type;
+
+        if (Address + i + 1 + (INT8) Scan->Window[Index] != Scan->Target)
+            continue;
+
+        if (Opcode == 0xEB) {
+            Type = XREF_JMP_SHORT;
+        } else if ((Opcode & 0xF0) == 0x70) {
+            Type = XREF_JCC_SHORT;
+        } else if (Opcode >= 0xE0 && Opcode <= 0xE3) {
+            Type = XREF_LOOP;
+        } else {
+            continue;
+        }
+
+        AddXref(Scan, Index - 1, Address + i - 1, Type);
+    }
+}
+
+// Check every position from Start to End in the window, which are all in one
+// section. Address is where Start is loaded.
+static VOID ScanRange(PXREF_SCAN Scan, BOOL Executable, DWORD Start, DWORD End, HEM_QWORD Address)
+{
+    DWORD Relative = (DWORD)(Scan->Target - Address - sizeof(DWORD));
+    __m128i Pointer = _mm_set1_epi32((DWORD) Scan->Target);
+    __m128i Lanes[4];
+    unsigned long Bit;
+
+    // Each load checks four dwords, and four loads cover every alignment.
+    for (DWORD k = 0; k < 4; k++) {
+        Lanes[k] = _mm_setr_epi32(k, k + 4, k + 8, k + 12);
+    }
+
+    for (DWORD i = Start; i < End; i += 16) {
+        __m128i Expected = _mm_set1_epi32(Relative - (i - Start));
+
+        for (DWORD k = 0; k < 4; k++) {
+            __m128i Value = _mm_loadu_si128((const __m128i *)(Scan->Window + i + k));
+            __m128i Match = _mm_or_si128(_mm_cmpeq_epi32(Value, _mm_sub_epi32(Expected, Lanes[k])),
+                                         _mm_cmpeq_epi32(Value, Pointer));
+            DWORD Mask = _mm_movemask_ps(_mm_castsi128_ps(Match));
+
+            while (_BitScanForward(&Bit, Mask)) {
+                DWORD Index = i + k + Bit * 4;
+
+                Mask &= Mask - 1;
+
+                if (Index < End)
+                    CheckCandidate(Scan, Executable, Index, Address + (Index - Start));
+            }
+        }
+    }
+
+    if (Executable)
+        ScanShortBranches(Scan, Start, End, Address);
+}
+
+static BOOL ScanChunk(PVOID Context, HEM_QWORD Offset, const BYTE *Data, DWORD Length)
+{
+    PXREF_SCAN Scan = Context;
+    DWORD Keep = min(Scan->WindowLength, XREF_KEEP);
+    HEM_QWORD Limit;
+
+    if (Keep + Length + XREF_PADDING > Scan->WindowCapacity) {
+        PBYTE Window = realloc(Scan->Window, Keep + Length + XREF_PADDING);
+
+        if (Window == NULL)
+            return FALSE;
+
+        Scan->Window = Window;
+        Scan->WindowCapacity = Keep + Length + XREF_PADDING;
+    }
+
+    memmove(Scan->Window, Scan->Window + Scan->WindowLength - Keep, Keep);
+    memcpy(Scan->Window + Keep, Data, Length);
+    ZeroMemory(Scan->Window + Keep + Length, XREF_PADDING);
+
+    Scan->WindowOffset = Offset - Keep;
+    Scan->WindowLength = Keep + Length;
+
+    // Leave the end for next time so pointers that cross are seen whole,
+    // unless this is the last chunk.
+    Limit = Offset + Length;
+
+    if (Limit != Scan->End)
+        Limit -= min(Length, XREF_DEFER);
+
+    for (DWORD i = 0; i < Scan->Map->Count && !Scan->Full; i++) {
+        PMAP_SECTION Section = &Scan->Map->Sections[i];
+        HEM_QWORD First = max(Scan->Next, Section->Offset);
+        HEM_QWORD Last = min(Limit, Section->Offset + Section->Size);
+
+        if (First >= Last)
+            continue;
+
+        ScanRange(Scan,
+                  Section->Executable,
+                  (DWORD)(First - Scan->WindowOffset),
+                  (DWORD)(Last - Scan->WindowOffset),
+                  Section->Address + (First - Section->Offset));
+    }
+
+    Scan->Next = max(Scan->Next, Limit);
+
+    return !Scan->Full;
+}
+
+static int __cdecl CompareXrefs(const void *a, const void *b)
+{
+    const XREF *x = a;
+    const XREF *y = b;
+
+    if (x->Offset != y->Offset)
+        return x->Offset < y->Offset ? -1 : 1;
+
+    return x->Type < y->Type ? -1 : x->Type > y->Type;
+}
+
+// Sections can overlap, so the same reference might be found twice.
+static VOID SortXrefs(VOID)
+{
+    PXREF Records = GetVirtualListRecord(&Xrefs.List, 0);
+    DWORD Kept = 0;
+
+    qsort(Records, Xrefs.List.Count, sizeof(XREF), CompareXrefs);
+
+    for (DWORD i = 0; i < Xrefs.List.Count; i++) {
+        if (Kept && CompareXrefs(&Records[Kept - 1], &Records[i]) == 0)
+            continue;
+
+        Records[Kept++] = Records[i];
+    }
+
+    ResizeVirtualList(&Xrefs.List, Kept);
+}
+
+static VOID FormatXref(PVOID Context, DWORD Index, const VOID *Record, PCHAR Buffer, SIZE_T Size)
+{
+    const XREF *Xref = Record;
+
+    snprintf(Buffer,
+             Size,
+             "%0*llX  %0*llX  %s",
+             Xrefs.OffsetWidth,
+             Xref->Offset,
+             Xrefs.AddressWidth,
+             Xref->Address,
+             TypeNames[Xref->Type]);
+}
+
+int XrefEntryPoint(HEMCALL_TAG *HemCall)
+{
+    XREF_SCAN Scan = {0};
+    HIEWGATE_GETDATA HiewData;
+    STREAM_CONSUMER Consumer;
+    PSECTION_MAP Map;
+    JOB Job;
+    HEM_QWORD Start;
+    HEM_QWORD End = 0;
+    CHAR Title[128];
+    SIZE_T Used;
+    LONG Selected;
+    int Result;
+
+    if (HiewGate_GetData(&HiewData) != HEM_OK)
+        return HEM_ERROR;
+
+    if ((Map = GetSectionMap(HemCall)) == NULL) {
+        HiewGate_Message("Cross References", "Hiew failed to read the headers.");
+        return HEM_OK;
+    }
+
+    if (!OffsetToAddress(Map, HiewData.offsetCurrent, &Scan.Target)) {
+        HiewGate_Message("Cross References", "The cursor isn't in a part of the file that gets loaded.");
+        return HEM_OK;
+    }
+
+    // Read everything that's in a section in one pass.
+    Start = Map->Sections[0].Offset;
+
+    for (DWORD i = 0; i < Map->Count; i++) {
+        End = max(End, Map->Sections[i].Offset + Map->Sections[i].Size);
+    }
+
+    FreeVirtualList(&Xrefs.List);
+    InitVirtualList(&Xrefs.List, sizeof(XREF), FormatXref, NULL);
+
+    Xrefs.OffsetWidth = HiewData.filelength > 0xFFFFFFFF ? 16 : 8;
+    Xrefs.AddressWidth = Map->Is64 ? 16 : 8;
+
+    Scan.Map = Map;
+    Scan.End = End;
+    Scan.Next = Start;
+    Scan.Hits = &Xrefs.List;
+
+    Consumer.Routine = ScanChunk;
+    Consumer.Context = &Scan;
+
+    BeginJob(&Job, "Finding references", End - Start);
+
+    Result = StreamFileRange(&Job, Start, End - Start, &Consumer, 1);
+
+    EndJob(&Job);
+
+    free(Scan.Window);
+
+    // If there were too many, I can still show some.
+    if (Result == HEM_ERROR && Scan.Full)
+        Result = HEM_OK;
+
+    if (Result != HEM_OK) {
+        FreeVirtualList(&Xrefs.List);
+        HiewGate_Message("Cross References", Result == HEM_KEYBREAK ? "Cancelled." : "Hiew failed to read the file.");
+        return HEM_OK;
+    }
+
+    SortXrefs();
+
+    if (Xrefs.List.Count == 0) {
+        snprintf(Title, sizeof Title, "Nothing in this %s file refers to %llX.", Map->Format, Scan.Target);
+        HiewGate_Message("Cross References", Title);
+        return HEM_OK;
+    }
+
+    Used = snprintf(Title,
+                    sizeof Title,
+                    "%u references to %llX%s, ",
+                    Xrefs.List.Count,
+                    Scan.Target,
+                    Scan.Full ? " (some are missing)" : "");
+
+    FormatJobStats(&Job, Title + Used, sizeof Title - Used);
+
+    Selected = ShowVirtualList(&Xrefs.List, Title, XREF_MENU_WIDTH, 0);
+
+    if (Selected >= 0) {
+        PXREF Xref = GetVirtualListRecord(&Xrefs.List, Selected);
+
+        HemCall->returnOffset = Xref->Offset;
+        HemCall->returnActionFlag |= HEM_RETURN_SETOFFSET;
+    }
+
+    return HEM_OK;
+}
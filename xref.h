@@ -0,0 +1,8 @@
+#ifndef __XREF_H
+#define __XREF_H
+
+// Finds calls, jumps, rip relative operands and pointers that refer to the
+// cursor, choosing one jumps to it.
+int XrefEntryPoint(HEMCALL_TAG *HemCall);
+
+#endif